@@ -0,0 +1,918 @@
+/**
+ * bench.c
+ *
+ * PURPOSE: Generates a synthetic FAT32 image of a configurable shape and times the fat32 reader against it with every image backend.
+ **/
+
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
+#define BENCH_BYTES_PER_SECTOR 512
+#define BENCH_RESERVED_SECTORS 32
+#define BENCH_NUM_FATS 2
+#define BENCH_MIN_CLUSTERS 65525 // fewest clusters a real FAT32 volume can have
+#define BENCH_MAX_GAP 16		 // largest run of clusters skipped when a file fragments
+#define BENCH_MAX_RUNS 64
+#define LONG_NAME_CHARS 13 // UCS-2 characters in one long name record
+#include <stdint.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <math.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "fat32.h" // .h file that has all the structs
+
+// what the generated image looks like
+struct BenchShape
+{
+	int fanOut;				   // subdirectories in every directory above the deepest level
+	int depth;				   // levels of directories below the root
+	int filesPerDirectory;	   // files in every directory, the root included
+	uint64_t minFileSize;	   // smallest file, sizes are spread evenly on a log scale
+	uint64_t maxFileSize;	   // largest file
+	int fragmentation;		   // percent chance that a file's next cluster is not right after its last one
+	uint32_t clusterSize;	   // bytes per cluster, a power of 2 from 512 to 32768
+	unsigned long long seed;   // makes the same image every time for the same shape
+};
+
+// a directory entry being built, with the long name records that go in front of it
+struct BenchEntry
+{
+	struct LongNameDirInfo longName[2]; // records last part first, like on disk
+	int longNameEntries;
+	struct DirInfo entry;
+};
+
+// totals over the generated image, used to work out rates
+struct BenchTotals
+{
+	uint64_t files;
+	uint64_t directories;
+	uint64_t fileBytes;
+	char largestPath[256]; // path of the largest file, for get
+	uint64_t largestSize;
+};
+
+// one timed run of the reader
+struct BenchResult
+{
+	double seconds;
+	uint64_t readCalls;	 // read_calls from the reader's --stats, /proc misses reads submitted through io_uring
+	uint64_t writeCalls; // syscw from /proc/<pid>/io
+	uint64_t bytesRead;	 // bytes_read plus bytes_mapped from --stats, /proc misses bytes served from a map
+	bool failed;
+};
+
+// an image backend and thread count to compare
+struct BenchEngine
+{
+	const char *name;
+	const char *options[3];
+};
+
+// function forward declarations
+int parseBenchOptions(int argc, char *argv[]);
+bool generateImage(const char *path);
+uint32_t countDirectoryClusters(int entryCount);
+uint32_t allocateChain(uint32_t clusterCount);
+void writeDirectory(int level, uint32_t firstCluster, uint32_t parentCluster, const char *path);
+void addFile(struct BenchEntry *entries, int *entryCount, int fileNum, const char *path);
+void fillEntry(struct DirInfo *entry, const char *shortName, uint8_t attr, uint32_t firstCluster, uint32_t size);
+void fillLongName(struct BenchEntry *benchEntry, const char *longName);
+void writeChain(uint32_t firstCluster, const void *data, uint64_t length);
+uint64_t pickFileSize(void);
+uint64_t nextRandom(void);
+unsigned char ChkSum(unsigned char *pFcbName);
+bool writeManifest(int level, const char *prefix, FILE *manifest);
+bool runReader(const char *const *arguments, const char *statsPath, struct BenchResult *result);
+void readReaderStats(const char *statsPath, struct BenchResult *result);
+void readProcessIo(pid_t pid, struct BenchResult *result);
+int compareResults(const void *a, const void *b);
+void printResult(const char *engine, const char *command, const struct BenchResult *result, uint64_t entries, uint64_t bytes);
+
+// variables
+struct BenchShape shape = {4, 3, 16, 512, 4 * 1024 * 1024, 10, 4096, 1};
+const char *readerPath = "./fat32";
+const char *imagePath = "bench.img";
+int runs = 3;
+int threads = 4;
+bool keepImage;
+
+// image being generated
+int imageFd;
+uint32_t *fat;			   // the whole FAT in memory, written out once at the end
+uint32_t clusterCount;	   // data clusters in the image
+uint32_t nextCluster = 3;  // next unused cluster, 2 is the root
+off_t dataStart;		   // byte offset of cluster 2
+struct BenchTotals totals;
+
+/**
+ * main
+ *
+ * Generates the image, then times info, list, get and get-batch with every engine and prints a table
+ * @param int argc - number of parameters
+ * @param char* argv - command line arguments
+ * @returns int - Error or success code
+ */
+int main(int argc, char *argv[])
+{
+	char manifestPath[PATH_MAX];
+	char largestPath[PATH_MAX];
+	char threadOption[32];
+	char statsPath[PATH_MAX];
+	char statsOption[PATH_MAX + 8];
+	FILE *manifest;
+	const struct BenchEngine engines[] = {
+		{"pread, small FAT cache", {"--io=pread", "--fat-cache=1", NULL}},
+		{"pread", {"--io=pread", NULL, NULL}},
+		{"mmap", {"--io=mmap", NULL, NULL}},
+		{"io_uring", {"--io=uring", NULL, NULL}},
+		{"mmap, parallel", {"--io=mmap", threadOption, NULL}},
+	};
+
+	if (parseBenchOptions(argc, argv) != 1)
+	{
+		printf("Usage: fat32-bench [--fanout=N] [--depth=N] [--files=N] [--min-size=BYTES] [--max-size=BYTES] [--fragmentation=PERCENT] [--cluster-size=BYTES] [--seed=N] [--runs=N] [--threads=N] [--image=PATH] [--fat32=PATH] [--keep]\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (!generateImage(imagePath))
+	{
+		printf("Error, could not generate %s. Exiting.", imagePath);
+		exit(EXIT_FAILURE);
+	}
+
+	printf("Image %s: %" PRIu64 " files in %" PRIu64 " directories, %.1f MB of data, %u byte clusters, %d%% fragmentation\n\n",
+		   imagePath, totals.files, totals.directories, totals.fileBytes / 1048576.0, shape.clusterSize, shape.fragmentation);
+
+	// get-batch copies every file, driven by a manifest of every path
+	snprintf(manifestPath, sizeof(manifestPath), "%s.manifest", imagePath);
+	manifest = fopen(manifestPath, "w");
+	if (manifest == NULL || !writeManifest(0, "", manifest))
+	{
+		printf("Error, could not write %s. Exiting.", manifestPath);
+		exit(EXIT_FAILURE);
+	}
+	fclose(manifest);
+
+	// get and get-batch write into output/ like they do for a user
+	if (mkdir("output", 0777) != 0 && errno != EEXIST)
+	{
+		printf("Error, could not create the output folder. Exiting.");
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(threadOption, sizeof(threadOption), "--threads=%d", threads);
+	snprintf(statsPath, sizeof(statsPath), "%s.stats", imagePath);
+	snprintf(statsOption, sizeof(statsOption), "--stats=%s", statsPath);
+	snprintf(largestPath, sizeof(largestPath), "%s", totals.largestPath);
+
+	printf("%-24s %-10s %10s %10s %10s %10s %12s\n", "engine", "command", "ms", "syscalls", "read MB", "MB/s", "entries/s");
+
+	for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+	{
+		const char *commands[][3] = {{"info", NULL, NULL}, {"list", NULL, NULL}, {"get", largestPath, NULL}, {"get-batch", manifestPath, NULL}};
+
+		for (size_t j = 0; j < sizeof(commands) / sizeof(commands[0]); j++)
+		{
+			struct BenchResult results[BENCH_MAX_RUNS];
+			const char *arguments[16];
+			int argumentCount = 0;
+			uint64_t entries = 0;
+			uint64_t bytes = 0;
+
+			arguments[argumentCount++] = readerPath;
+			arguments[argumentCount++] = imagePath;
+			for (int k = 0; k < 3 && commands[j][k] != NULL; k++)
+			{
+				arguments[argumentCount++] = commands[j][k];
+			}
+			for (int k = 0; k < 3 && engines[i].options[k] != NULL; k++)
+			{
+				arguments[argumentCount++] = engines[i].options[k];
+			}
+			arguments[argumentCount++] = "--index=none";
+			arguments[argumentCount++] = statsOption;
+			arguments[argumentCount] = NULL;
+
+			for (int run = 0; run < runs; run++)
+			{
+				runReader(arguments, statsPath, &results[run]);
+			}
+
+			// the median run is reported so one slow run does not skew the table
+			qsort(results, runs, sizeof(struct BenchResult), compareResults);
+
+			if (strcmp(commands[j][0], "list") == 0)
+			{
+				entries = totals.files + totals.directories;
+			}
+			else if (strcmp(commands[j][0], "get") == 0)
+			{
+				entries = 1;
+				bytes = totals.largestSize;
+			}
+			else if (strcmp(commands[j][0], "get-batch") == 0)
+			{
+				entries = totals.files;
+				bytes = totals.fileBytes;
+			}
+
+			printResult(engines[i].name, commands[j][0], &results[runs / 2], entries, bytes);
+		}
+	}
+
+	if (!keepImage)
+	{
+		unlink(imagePath);
+		unlink(manifestPath);
+	}
+	unlink(statsPath);
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * parseBenchOptions
+ *
+ * Pulls every argument starting with -- out of argv, leaving the positional arguments in order
+ * @param int argc - number of parameters
+ * @param char* argv - command line arguments, compacted in place
+ * @returns int - number of positional arguments left in argv, 0 if an option was not understood
+ */
+int parseBenchOptions(int argc, char *argv[])
+{
+	int positional = 0;
+
+	for (int i = 0; i < argc; i++)
+	{
+		if (i == 0 || strncmp(argv[i], "--", 2) != 0)
+		{
+			argv[positional++] = argv[i];
+		}
+		else if (strncmp(argv[i], "--fanout=", 9) == 0)
+		{
+			shape.fanOut = atoi(argv[i] + 9);
+		}
+		else if (strncmp(argv[i], "--depth=", 8) == 0)
+		{
+			shape.depth = atoi(argv[i] + 8);
+		}
+		else if (strncmp(argv[i], "--files=", 8) == 0)
+		{
+			shape.filesPerDirectory = atoi(argv[i] + 8);
+		}
+		else if (strncmp(argv[i], "--min-size=", 11) == 0)
+		{
+			shape.minFileSize = strtoull(argv[i] + 11, NULL, 10);
+		}
+		else if (strncmp(argv[i], "--max-size=", 11) == 0)
+		{
+			shape.maxFileSize = strtoull(argv[i] + 11, NULL, 10);
+		}
+		else if (strncmp(argv[i], "--fragmentation=", 16) == 0)
+		{
+			shape.fragmentation = atoi(argv[i] + 16);
+		}
+		else if (strncmp(argv[i], "--cluster-size=", 15) == 0)
+		{
+			shape.clusterSize = strtoul(argv[i] + 15, NULL, 10);
+		}
+		else if (strncmp(argv[i], "--seed=", 7) == 0)
+		{
+			shape.seed = strtoull(argv[i] + 7, NULL, 10);
+		}
+		else if (strncmp(argv[i], "--runs=", 7) == 0)
+		{
+			runs = atoi(argv[i] + 7);
+		}
+		else if (strncmp(argv[i], "--threads=", 10) == 0)
+		{
+			threads = atoi(argv[i] + 10);
+		}
+		else if (strncmp(argv[i], "--image=", 8) == 0)
+		{
+			imagePath = argv[i] + 8;
+		}
+		else if (strncmp(argv[i], "--fat32=", 8) == 0)
+		{
+			readerPath = argv[i] + 8;
+		}
+		else if (strcmp(argv[i], "--keep") == 0)
+		{
+			keepImage = true;
+		}
+		else
+		{
+			return 0;
+		}
+	}
+
+	// anything silly is treated as a bad command line rather than generating something strange
+	if (shape.fanOut < 0 || shape.depth < 0 || shape.filesPerDirectory < 0 || shape.fragmentation < 0 || shape.fragmentation > 100 ||
+		shape.minFileSize > shape.maxFileSize || shape.maxFileSize > UINT32_MAX || shape.clusterSize < BENCH_BYTES_PER_SECTOR ||
+		shape.clusterSize > 32768 || (shape.clusterSize & (shape.clusterSize - 1)) != 0 || runs < 1 || runs > BENCH_MAX_RUNS || threads < 1 || shape.seed == 0)
+	{
+		return 0;
+	}
+
+	return positional;
+}
+
+/**
+ * generateImage
+ *
+ * Writes a FAT32 image with the configured shape. The tree is laid out depth first, and every file gets a long name so the reader decodes LFN records too. The image is sparse, only clusters that are used are written.
+ * @param const char* path - where to write the image
+ * @returns bool - true if the image was written
+ */
+bool generateImage(const char *path)
+{
+	fat32BS bootSector;
+	fat32FSInfo infoSector;
+	uint64_t directories = 1;
+	uint64_t level = 1;
+	uint64_t clustersNeeded;
+	uint32_t sectorsPerCluster = shape.clusterSize / BENCH_BYTES_PER_SECTOR;
+	uint32_t fatSectors;
+	uint64_t totalSectors;
+	uint32_t freeClusters = 0;
+
+	// work out how many directories there are and a generous bound on the clusters everything needs
+	for (int i = 0; i < shape.depth; i++)
+	{
+		level *= shape.fanOut;
+		directories += level;
+	}
+	clustersNeeded = directories * (countDirectoryClusters(2 + shape.fanOut + (shape.filesPerDirectory * 3)) + ((shape.maxFileSize + shape.clusterSize - 1) / shape.clusterSize) * shape.filesPerDirectory);
+	clustersNeeded += clustersNeeded * shape.fragmentation * BENCH_MAX_GAP / 100;
+	clusterCount = (clustersNeeded < BENCH_MIN_CLUSTERS) ? BENCH_MIN_CLUSTERS : clustersNeeded;
+	if (clustersNeeded >= 0x0FFFFFF0)
+	{
+		return false;
+	}
+
+	fatSectors = ((uint64_t)(clusterCount + 2) * sizeof(uint32_t) + BENCH_BYTES_PER_SECTOR - 1) / BENCH_BYTES_PER_SECTOR;
+	totalSectors = BENCH_RESERVED_SECTORS + ((uint64_t)fatSectors * BENCH_NUM_FATS) + ((uint64_t)clusterCount * sectorsPerCluster);
+	if (totalSectors > UINT32_MAX)
+	{
+		return false;
+	}
+	dataStart = (off_t)(BENCH_RESERVED_SECTORS + (fatSectors * BENCH_NUM_FATS)) * BENCH_BYTES_PER_SECTOR;
+
+	imageFd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+	if (imageFd < 0 || ftruncate(imageFd, (off_t)totalSectors * BENCH_BYTES_PER_SECTOR) != 0)
+	{
+		return false;
+	}
+
+	fat = calloc((size_t)fatSectors * BENCH_BYTES_PER_SECTOR / sizeof(uint32_t), sizeof(uint32_t));
+	fat[0] = 0x0FFFFFF8;
+	fat[1] = EOC;
+	memset(&totals, 0, sizeof(totals));
+	nextCluster = 3;
+
+	// the root is always cluster 2, and it holds no dot entries
+	fat[2] = EOC;
+	if (countDirectoryClusters(shape.fanOut + (shape.filesPerDirectory * 3)) > 1)
+	{
+		fat[2] = allocateChain(countDirectoryClusters(shape.fanOut + (shape.filesPerDirectory * 3)) - 1);
+	}
+	writeDirectory(0, 2, 0, "");
+
+	for (uint32_t i = 2; i < clusterCount + 2; i++)
+	{
+		freeClusters += fat[i] == 0;
+	}
+
+	memset(&bootSector, 0, sizeof(bootSector));
+	memcpy(bootSector.BS_jmpBoot, "\xEB\x58\x90", 3);
+	memcpy(bootSector.BS_OEMName, "F32BENCH", BS_OEMName_LENGTH);
+	bootSector.BPB_BytesPerSec = BENCH_BYTES_PER_SECTOR;
+	bootSector.BPB_SecPerClus = sectorsPerCluster;
+	bootSector.BPB_RsvdSecCnt = BENCH_RESERVED_SECTORS;
+	bootSector.BPB_NumFATs = BENCH_NUM_FATS;
+	bootSector.BPB_Media = 0xF8;
+	bootSector.BPB_TotSec32 = totalSectors;
+	bootSector.BPB_FATSz32 = fatSectors;
+	bootSector.BPB_RootClus = 2;
+	bootSector.BPB_FSInfo = 1;
+	bootSector.BPB_BkBootSec = 6;
+	bootSector.BS_DrvNum = 0x80;
+	bootSector.BS_BootSig = 0x29;
+	bootSector.BS_VolID = (uint32_t)shape.seed;
+	memcpy(bootSector.BS_VolLab, "BENCH      ", BS_VolLab_LENGTH);
+	memcpy(bootSector.BS_FilSysType, "FAT32   ", BS_FilSysType_LENGTH);
+	bootSector.BS_SigA = 0x55;
+	bootSector.BS_SigB = 0xAA;
+
+	memset(&infoSector, 0, sizeof(infoSector));
+	infoSector.lead_sig = 0x41615252;
+	infoSector.signature = 0x61417272;
+	infoSector.free_count = freeClusters;
+	infoSector.next_free = nextCluster;
+	infoSector.trail_signature = 0xAA550000;
+
+	pwrite(imageFd, &bootSector, sizeof(bootSector), 0);
+	pwrite(imageFd, &infoSector, sizeof(infoSector), BENCH_BYTES_PER_SECTOR);
+	for (int i = 0; i < BENCH_NUM_FATS; i++)
+	{
+		pwrite(imageFd, fat, (size_t)fatSectors * BENCH_BYTES_PER_SECTOR, (off_t)(BENCH_RESERVED_SECTORS + (i * fatSectors)) * BENCH_BYTES_PER_SECTOR);
+	}
+
+	free(fat);
+	return close(imageFd) == 0;
+}
+
+/**
+ * countDirectoryClusters
+ *
+ * Works out how many clusters a directory needs
+ * @param int entryCount - number of 32 byte entries, long name records included
+ * @returns uint32_t - number of clusters, at least 1
+ */
+uint32_t countDirectoryClusters(int entryCount)
+{
+	uint32_t entriesPerCluster = shape.clusterSize / sizeof(struct DirInfo);
+
+	return (entryCount + entriesPerCluster) / entriesPerCluster; // always room for the end marker
+}
+
+/**
+ * allocateChain
+ *
+ * Allocates a chain of clusters, leaving a random gap before a cluster as often as the fragmentation level says
+ * @param uint32_t count - number of clusters, at least 1
+ * @returns uint32_t - first cluster of the chain
+ */
+uint32_t allocateChain(uint32_t count)
+{
+	uint32_t first = 0;
+	uint32_t previous = 0;
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint32_t clusterNum;
+
+		if (i > 0 && (int)(nextRandom() % 100) < shape.fragmentation)
+		{
+			nextCluster += 1 + (nextRandom() % BENCH_MAX_GAP);
+		}
+		clusterNum = nextCluster++;
+
+		if (previous == 0)
+		{
+			first = clusterNum;
+		}
+		else
+		{
+			fat[previous] = clusterNum;
+		}
+		fat[clusterNum] = EOC;
+		previous = clusterNum;
+	}
+
+	return first;
+}
+
+/**
+ * writeDirectory
+ *
+ * Builds one directory and everything below it, then writes its entries into its chain
+ * @param int level - 0 for the root
+ * @param uint32_t firstCluster - directory's chain, already allocated
+ * @param uint32_t parentCluster - first cluster of the parent, 0 for the root and its children
+ * @param const char* path - short name path of the directory ending in /, empty for the root
+ * @returns void - NA
+ */
+void writeDirectory(int level, uint32_t firstCluster, uint32_t parentCluster, const char *path)
+{
+	int subdirectories = (level < shape.depth) ? shape.fanOut : 0;
+	struct BenchEntry *entries = calloc(2 + subdirectories + shape.filesPerDirectory, sizeof(struct BenchEntry));
+	int entryCount = 0;
+	uint8_t *raw;
+	size_t rawLength = 0;
+	char name[16];
+	char childPath[256];
+
+	totals.directories++;
+
+	if (level > 0)
+	{
+		fillEntry(&entries[entryCount++].entry, ".          ", ATTR_DIRECTORY, firstCluster, 0);
+		fillEntry(&entries[entryCount++].entry, "..         ", ATTR_DIRECTORY, parentCluster, 0);
+	}
+
+	for (int i = 0; i < shape.filesPerDirectory; i++)
+	{
+		addFile(entries, &entryCount, i, path);
+	}
+
+	for (int i = 0; i < subdirectories; i++)
+	{
+		uint32_t childCluster = allocateChain(countDirectoryClusters(2 + ((level + 1 < shape.depth) ? shape.fanOut : 0) + (shape.filesPerDirectory * 3)));
+
+		snprintf(name, sizeof(name), "D%07d   ", i);
+		fillEntry(&entries[entryCount++].entry, name, ATTR_DIRECTORY, childCluster, 0);
+
+		snprintf(childPath, sizeof(childPath), "%sD%07d/", path, i);
+		writeDirectory(level + 1, childCluster, (level == 0) ? 0 : firstCluster, childPath);
+	}
+
+	// flatten the entries with their long name records in front of them
+	raw = calloc((size_t)countDirectoryClusters(entryCount * 3) * shape.clusterSize, 1);
+	for (int i = 0; i < entryCount; i++)
+	{
+		memcpy(raw + rawLength, entries[i].longName, entries[i].longNameEntries * sizeof(struct LongNameDirInfo));
+		rawLength += entries[i].longNameEntries * sizeof(struct LongNameDirInfo);
+		memcpy(raw + rawLength, &entries[i].entry, sizeof(struct DirInfo));
+		rawLength += sizeof(struct DirInfo);
+	}
+
+	writeChain(firstCluster, raw, rawLength + sizeof(struct DirInfo)); // the zeroed entry after the last one ends the directory
+
+	free(raw);
+	free(entries);
+}
+
+/**
+ * addFile
+ *
+ * Allocates and writes one file, then adds its entry and long name to its directory
+ * @param struct BenchEntry* entries - directory being built
+ * @param int* entryCount - number of entries, moved on by one
+ * @param int fileNum - number of the file in its directory
+ * @param const char* path - short name path of the directory ending in /, empty for the root
+ * @returns void - NA
+ */
+void addFile(struct BenchEntry *entries, int *entryCount, int fileNum, const char *path)
+{
+	struct BenchEntry *benchEntry = &entries[(*entryCount)++];
+	uint64_t size = pickFileSize();
+	uint32_t firstCluster = 0;
+	char name[16];
+	char longName[32];
+	uint8_t *data;
+
+	if (size > 0)
+	{
+		firstCluster = allocateChain((size + shape.clusterSize - 1) / shape.clusterSize);
+
+		// every byte of the file says where it is, which makes extraction bugs easy to spot
+		data = malloc(size);
+		for (uint64_t i = 0; i < size; i++)
+		{
+			data[i] = (uint8_t)(i ^ (i >> 8) ^ fileNum);
+		}
+		writeChain(firstCluster, data, size);
+		free(data);
+	}
+
+	snprintf(name, sizeof(name), "F%07dDAT", fileNum);
+	fillEntry(&benchEntry->entry, name, ATTR_ARCHIVE, firstCluster, size);
+	snprintf(longName, sizeof(longName), "Benchmark file %d.dat", fileNum);
+	fillLongName(benchEntry, longName);
+
+	totals.files++;
+	totals.fileBytes += size;
+	if (size >= totals.largestSize)
+	{
+		totals.largestSize = size;
+		snprintf(totals.largestPath, sizeof(totals.largestPath), "%sF%07d.DAT", path, fileNum);
+	}
+}
+
+/**
+ * fillEntry
+ *
+ * Fills in a short directory entry with a fixed timestamp
+ * @param struct DirInfo* entry - entry to fill in
+ * @param const char* shortName - 11 character name, padded with blanks
+ * @param uint8_t attr - attributes
+ * @param uint32_t firstCluster - first cluster, 0 for empty files
+ * @param uint32_t size - file size, 0 for directories
+ * @returns void - NA
+ */
+void fillEntry(struct DirInfo *entry, const char *shortName, uint8_t attr, uint32_t firstCluster, uint32_t size)
+{
+	memset(entry, 0, sizeof(struct DirInfo));
+	memcpy(entry->dir_name, shortName, 11);
+	entry->dir_attr = attr;
+	entry->dir_crt_time = entry->dir_wrt_time = (12 << 11);
+	entry->dir_crt_date = entry->dir_wrt_date = entry->dir_last_access_time = ((2024 - 1980) << 9) | (1 << 5) | 1;
+	entry->dir_first_cluster_hi = firstCluster >> 16;
+	entry->dir_first_cluster_lo = firstCluster & 0xFFFF;
+	entry->dir_file_size = size;
+}
+
+/**
+ * fillLongName
+ *
+ * Adds the long name records for an entry whose short entry is already filled in
+ * @param struct BenchEntry* benchEntry - entry to add a long name to
+ * @param const char* longName - ASCII long name, at most 25 characters
+ * @returns void - NA
+ */
+void fillLongName(struct BenchEntry *benchEntry, const char *longName)
+{
+	uint16_t chars[26];
+	size_t length = strlen(longName);
+	unsigned char checkSum = ChkSum((unsigned char *)benchEntry->entry.dir_name);
+
+	// the name is terminated by a 0 and padded with 0xFFFF
+	for (size_t i = 0; i < 26; i++)
+	{
+		chars[i] = (i < length) ? (uint16_t)longName[i] : (i == length) ? 0x0000 : 0xFFFF;
+	}
+
+	benchEntry->longNameEntries = (length + 1 + LONG_NAME_CHARS - 1) / LONG_NAME_CHARS;
+	for (int i = 0; i < benchEntry->longNameEntries; i++)
+	{
+		int order = benchEntry->longNameEntries - i; // records are stored last part first
+		struct LongNameDirInfo *record = &benchEntry->longName[i];
+		const uint16_t *part = chars + ((order - 1) * LONG_NAME_CHARS);
+
+		memset(record, 0, sizeof(struct LongNameDirInfo));
+		record->LDIR_Ord = order | ((i == 0) ? LAST_LONG_ENTRY : 0);
+		record->LDIR_Attr = ATTR_LONG_NAME;
+		record->LDIR_Chksum = checkSum;
+		memcpy(record->LDIR_Name1, part, 10);
+		memcpy(record->LDIR_Name2, part + 5, 12);
+		memcpy(record->LDIR_Name3, part + 11, 4);
+	}
+}
+
+/**
+ * writeChain
+ *
+ * Writes bytes into the clusters of a chain, zero filling the end of the last cluster
+ * @param uint32_t firstCluster - first cluster of the chain
+ * @param const void* data - bytes to write
+ * @param uint64_t length - number of bytes, no more than the chain holds
+ * @returns void - NA
+ */
+void writeChain(uint32_t firstCluster, const void *data, uint64_t length)
+{
+	uint8_t *cluster = calloc(1, shape.clusterSize);
+	uint64_t written = 0;
+
+	for (uint32_t clusterNum = firstCluster; clusterNum >= 2 && clusterNum < EOC && written < length; clusterNum = fat[clusterNum])
+	{
+		uint64_t piece = (length - written < shape.clusterSize) ? length - written : shape.clusterSize;
+
+		memset(cluster, 0, shape.clusterSize);
+		memcpy(cluster, (const uint8_t *)data + written, piece);
+		pwrite(imageFd, cluster, shape.clusterSize, dataStart + ((off_t)(clusterNum - 2) * shape.clusterSize));
+		written += piece;
+	}
+
+	free(cluster);
+}
+
+/**
+ * pickFileSize
+ *
+ * Picks a file size spread evenly on a log scale between the smallest and largest size, so there are many small files and a few large ones
+ * @returns uint64_t - size in bytes
+ */
+uint64_t pickFileSize(void)
+{
+	double low = log((double)shape.minFileSize + 1);
+	double high = log((double)shape.maxFileSize + 1);
+	double pick = low + ((high - low) * (double)(nextRandom() % 1000001) / 1000000.0);
+	uint64_t size = (uint64_t)exp(pick) - 1;
+
+	return (size < shape.minFileSize) ? shape.minFileSize : (size > shape.maxFileSize) ? shape.maxFileSize : size;
+}
+
+/**
+ * nextRandom
+ *
+ * xorshift64 random numbers, seeded from --seed so the same shape always makes the same image
+ * @returns uint64_t - next random number
+ */
+uint64_t nextRandom(void)
+{
+	shape.seed ^= shape.seed << 13;
+	shape.seed ^= shape.seed >> 7;
+	shape.seed ^= shape.seed << 17;
+	return shape.seed;
+}
+
+/**
+ * writeManifest
+ *
+ * Writes the path of every file to a get-batch manifest by replaying the shape the image was generated from
+ * @param int level - level of the directory, 0 for the root
+ * @param const char* prefix - short name path of the directory ending in /, empty for the root
+ * @param FILE* manifest - where to write
+ * @returns bool - true if everything was written
+ */
+bool writeManifest(int level, const char *prefix, FILE *manifest)
+{
+	char childPrefix[256];
+	bool success = true;
+
+	for (int i = 0; i < shape.filesPerDirectory; i++)
+	{
+		success = fprintf(manifest, "%sF%07d.DAT\n", prefix, i) > 0 && success;
+	}
+
+	for (int i = 0; level < shape.depth && i < shape.fanOut; i++)
+	{
+		snprintf(childPrefix, sizeof(childPrefix), "%sD%07d/", prefix, i);
+		success = writeManifest(level + 1, childPrefix, manifest) && success;
+	}
+
+	return success;
+}
+
+/**
+ * runReader
+ *
+ * Runs the reader once with its output thrown away, timing it and collecting its write count from /proc before it is reaped and its read counters from its --stats file
+ * @param const char* const* arguments - argv for the reader, NULL terminated, ending in --stats=statsPath
+ * @param const char* statsPath - where the reader writes its counters
+ * @param struct BenchResult* result - filled in
+ * @returns bool - true if the reader exited successfully
+ */
+bool runReader(const char *const *arguments, const char *statsPath, struct BenchResult *result)
+{
+	struct timespec start;
+	struct timespec end;
+	siginfo_t info;
+	pid_t pid;
+	int status;
+	int devNull;
+
+	memset(result, 0, sizeof(struct BenchResult));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pid = fork();
+	if (pid == 0)
+	{
+		devNull = open("/dev/null", O_WRONLY);
+		dup2(devNull, STDOUT_FILENO);
+		dup2(devNull, STDERR_FILENO);
+		execv(arguments[0], (char *const *)arguments);
+		_exit(127);
+	}
+	if (pid < 0)
+	{
+		result->failed = true;
+		return false;
+	}
+
+	// wait without reaping so the counters in /proc are still there
+	memset(&info, 0, sizeof(info));
+	waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	readProcessIo(pid, result);
+	waitpid(pid, &status, 0);
+	readReaderStats(statsPath, result);
+
+	result->seconds = (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1e9);
+	result->failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+
+	return !result->failed;
+}
+
+/**
+ * readProcessIo
+ *
+ * Reads the write syscall counter of a finished process that has not been reaped yet
+ * @param pid_t pid - process to look at
+ * @param struct BenchResult* result - writeCalls is filled in, left at 0 if /proc does not have it
+ * @returns void - NA
+ */
+void readProcessIo(pid_t pid, struct BenchResult *result)
+{
+	char path[64];
+	char line[128];
+	unsigned long long value;
+	FILE *io;
+
+	snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+	io = fopen(path, "r");
+	if (io == NULL)
+	{
+		return;
+	}
+
+	while (fgets(line, sizeof(line), io) != NULL)
+	{
+		// reads through a map or io_uring never show up here, so only the writes are taken from /proc
+		if (sscanf(line, "syscw: %llu", &value) == 1)
+		{
+			result->writeCalls = value;
+		}
+	}
+
+	fclose(io);
+}
+
+/**
+ * readReaderStats
+ *
+ * Reads the read counters the reader counted itself from the JSON it writes for --stats=<path>, then removes the file so the next run starts clean
+ * @param const char* statsPath - file the reader wrote
+ * @param struct BenchResult* result - readCalls and bytesRead are filled in, left at 0 if the file is missing
+ * @returns void - NA
+ */
+void readReaderStats(const char *statsPath, struct BenchResult *result)
+{
+	char line[1024];
+	unsigned long long readCalls;
+	unsigned long long bytesRead;
+	unsigned long long bytesMapped;
+	FILE *stats;
+
+	stats = fopen(statsPath, "r");
+	if (stats == NULL)
+	{
+		return;
+	}
+
+	// the counters lead the object in a fixed order
+	if (fgets(line, sizeof(line), stats) != NULL &&
+		sscanf(line, "{\"read_calls\":%llu,\"seek_calls\":%*u,\"bytes_read\":%llu,\"bytes_mapped\":%llu", &readCalls, &bytesRead, &bytesMapped) == 3)
+	{
+		result->readCalls = readCalls;
+		result->bytesRead = bytesRead + bytesMapped;
+	}
+
+	fclose(stats);
+	unlink(statsPath);
+}
+
+/**
+ * compareResults
+ *
+ * qsort comparator ordering runs by time
+ * @param const void* a - first struct BenchResult
+ * @param const void* b - second struct BenchResult
+ * @returns int - negative, 0 or positive like strcmp
+ */
+int compareResults(const void *a, const void *b)
+{
+	double first = ((const struct BenchResult *)a)->seconds;
+	double second = ((const struct BenchResult *)b)->seconds;
+
+	return (first > second) - (first < second);
+}
+
+/**
+ * printResult
+ *
+ * Prints one row of the table
+ * @param const char* engine - name of the engine
+ * @param const char* command - reader command that was run
+ * @param const struct BenchResult* result - the median run
+ * @param uint64_t entries - entries the command handles, 0 if it does not make sense
+ * @param uint64_t bytes - file bytes the command extracts, 0 to rate the bytes read from the image instead
+ * @returns void - NA
+ */
+void printResult(const char *engine, const char *command, const struct BenchResult *result, uint64_t entries, uint64_t bytes)
+{
+	double megabytes = ((bytes > 0) ? bytes : result->bytesRead) / 1048576.0;
+
+	if (result->failed)
+	{
+		printf("%-24s %-10s %10s\n", engine, command, "failed");
+		return;
+	}
+
+	printf("%-24s %-10s %10.2f %10" PRIu64 " %10.1f %10.1f %12.0f\n", engine, command, result->seconds * 1000, result->readCalls + result->writeCalls,
+		   result->bytesRead / 1048576.0, megabytes / result->seconds, entries / result->seconds);
+}
+
+//-----------------------------------------------------------------------------
+// ChkSum()
+// Returns an unsigned byte checksum computed on an unsigned byte
+// array. The array must be 11 bytes long and is assumed to contain
+// a name stored in the format of a MS-DOS directory entry.
+// Passed: pFcbName Pointer to an unsigned byte array assumed to be
+// 11 bytes long.
+// Returns: Sum An 8-bit unsigned checksum of the array pointed
+// to by pFcbName.
+// (comment copied directly from documentation)
+//------------------------------------------------------------------------------
+unsigned char ChkSum(unsigned char *pFcbName)
+{
+	short FcbNameLen;
+	unsigned char Sum;
+	Sum = 0;
+	for (FcbNameLen = 11; FcbNameLen != 0; FcbNameLen--)
+	{
+		// NOTE: The operation is an unsigned char rotate right
+		Sum = ((Sum & 1) ? 0x80 : 0) + (Sum >> 1) + *pFcbName++;
+	}
+	return (Sum);
+}
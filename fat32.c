@@ -9,7 +9,40 @@
 #define BYTES_PER_KB 1024
 #define END_OF_CLUSTER_CHAIN 0x0ffffff8
 #define MASK_FIRST_HEX 0x0fffffff
+#define FAT_CACHE_PAGE_SECTORS 64
+#define FAT_CACHE_DEFAULT_LIMIT_KB (64 * 1024)
+#define COPY_BUFFER_SIZE (1024 * 1024)
+#define DIRECT_ALIGN 4096				 // O_DIRECT offsets, lengths and buffers are multiples of this, it covers 512 and 4K sectors
+#define PREFETCH_WINDOW (8 * 1024 * 1024) // file bytes asked for ahead of the extent being copied
+#define PREFETCH_GAP (64 * 1024)			 // extents closer than this are asked for as one range, gap and all
+#define TEXT_FLUSH_SIZE (1024 * 1024)
+#define BATCH_FLUSH_SIZE (64 * 1024) // batch output of one image kept back before its whole lines go to stdout
+#define HASH_BLOCK_SIZE 64 // largest block a hash kernel takes, SHA-256 blocks are 64 bytes and xxHash64 stripes 32
+#define HASH_HEX_SIZE 65   // longest digest in hex, SHA-256, plus the terminator
+#define XXH64_PRIME_1 0x9E3779B185EBCA87ULL
+#define XXH64_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define XXH64_PRIME_3 0x165667B19E3779F9ULL
+#define XXH64_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define XXH64_PRIME_5 0x27D4EB2F165667C5ULL
+#define URING_QUEUE_DEPTH 64
+#define LIST_BINARY_MAGIC "F32LIST1"
+#define INDEX_MAGIC "F32IDX2"
+#define SERVE_BACKLOG 64
+#define SERVE_MAX_READ (16 * 1024 * 1024) // most file bytes one read reply carries
+#define SERVE_REQUEST_SIZE 16			  // op, flags, path length, length, offset
+#define SERVE_REPLY_SIZE 12				  // status, payload length
+#define SERVE_INFO_SIZE 47
+#define MOUNT_REQUEST_SIZE (64 * 1024) // comfortably above FUSE_MIN_READ_BUFFER and max_write
+#define MOUNT_MAX_READ (1024 * 1024)	  // largest read the kernel sends us
+#define MOUNT_PAGE_SIZE 4096
+#define MOUNT_MAX_WRITE 4096 // nothing is ever written, but the kernel wants a size
+#define MOUNT_MAX_BACKGROUND 64
+#define MOUNT_MAX_IOVECS 64
+#define MOUNT_CACHE_SECONDS 3600 // how long the kernel may keep names and attributes
+#define MOUNT_NAME_MAX 255
+#define MOUNT_UNKNOWN_INO 0xFFFFFFFF // inode number for .., the kernel fills in the real one
 #define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -19,34 +52,946 @@
 #include <sys/types.h>
 #include <pthread.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mount.h>
+#include <sys/uio.h>
+#include <linux/fuse.h>
+#include <signal.h>
+#include <strings.h>
+#include <dirent.h>
+#include <linux/io_uring.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <sched.h>
 #include <ctype.h>
-#include <wchar.h> /* wint_t */
 #include <locale.h>
+#include <limits.h>
+#include <glob.h>
+#include <fnmatch.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#include <cpuid.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 #include "fat32.h" // .h file that has all the structs
+#include "libfat32.h"
+
+// one directory cluster worth of entries, decoded straight out of the image map or out of buffer
+struct DirCluster
+{
+	uint32_t clusterNum;	  // cluster currently loaded
+	const uint8_t *entries;	  // first byte of the cluster, in the map or in buffer
+	uint8_t *buffer;		  // holds the cluster when the image is not mapped, allocated once and reused
+};
+
+// a run of consecutive clusters, stored as a byte range in the image
+struct Extent
+{
+	off_t offset;	 // byte offset of the run in the image
+	uint64_t length; // number of bytes of the file stored in the run
+};
+
+// every extent of a file in file order
+struct ExtentList
+{
+	struct Extent *extents;
+	size_t count;
+	size_t capacity;
+	uint64_t *ends; // file offset where each extent ends, built on the first findExtent and NULL until then
+};
+
+// growable text output, written to sink whenever it gets large or kept in memory when sink is NULL
+struct TextBuffer
+{
+	char *data;
+	size_t length;
+	size_t capacity;
+	FILE *sink;
+};
+
+// where a subdirectory's listing is spliced into its parent's output
+struct ListChild
+{
+	size_t position;		// length of the parent's output when the subdirectory was found
+	struct ListTask *task;	// listing of the subdirectory
+};
+
+// listing of one directory and everything below it, in parallel mode each subdirectory becomes its own task
+struct ListTask
+{
+	uint32_t clusterNum;	   // first cluster of the directory
+	int depth;				   // depth of the directory's entries
+	struct ListTask *parent;   // task of the directory holding this one, NULL for the root, outlives this task
+	char *path;				   // path of the directory ending in /, NULL for the root
+	struct TextBuffer out;	   // lines printed for this directory's entries
+	struct ListChild *children; // subdirectory tasks in the order they were found
+	size_t childCount;
+	size_t childCapacity;
+	bool done;				   // set by the worker once out and children are final
+};
+
+// one worker's deque of tasks, the owner works from the bottom and thieves take from the top
+struct ListDeque
+{
+	pthread_mutex_t lock;
+	struct ListTask **tasks;
+	size_t top;
+	size_t bottom;
+	size_t capacity;
+};
+
+// pool of workers used for parallel listing
+struct ListPool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t workReady; // signalled when a task is queued or the last task finishes
+	pthread_cond_t taskDone;  // signalled whenever a task finishes
+	struct ListDeque *deques; // one per worker
+	int workerCount;
+	size_t queued;			  // tasks sitting in deques, counted just before they are pushed
+	size_t pending;			  // tasks queued or running
+};
+
+// serve requests, the first byte of every request
+#define SERVE_OP_INFO 1
+#define SERVE_OP_STAT 2
+#define SERVE_OP_READDIR 3
+#define SERVE_OP_READ 4
+
+// serve reply statuses
+#define SERVE_OK 0
+#define SERVE_NOT_FOUND 1
+#define SERVE_BAD_REQUEST 2
+
+// one thread answering the kernel for a mount
+struct MountWorker
+{
+	uint8_t *request; // request being answered, MOUNT_REQUEST_SIZE bytes
+	uint8_t *buffer;  // file bytes for reads that can not point into the map, allocated on first use
+};
+
+// kinds of slot in the dentry cache
+#define DENTRY_EMPTY 0
+#define DENTRY_FILE 1
+#define DENTRY_DIRECTORY 2
+#define DENTRY_SCANNED 3 // marks a directory whose entries are all in the cache
+
+// cached directory entry, keyed by the directory it is in and the name get matches against
+struct Dentry
+{
+	uint32_t parentCluster; // first cluster of the directory holding the entry
+	uint8_t kind;			// one of the DENTRY_ kinds
+	char name[13];			// short name as get matches it, NAME for directories and NAME.EXT for files
+	struct DirInfo entry;	// copy of the directory entry
+};
+
+// open addressing hash map from (parent cluster, name, kind) to Dentry
+struct DentryCache
+{
+	struct Dentry *slots;
+	size_t capacity; // always a power of 2
+	size_t count;
+};
+
+// one file to extract in a batch
+struct BatchFile
+{
+	char *path;				  // path as written in the manifest
+	uint32_t startingCluster; // first cluster of the file, batches are copied in this order
+	struct DirInfo entry;	  // copy of the file's directory entry
+	size_t order;			  // position in the manifest
+};
+
+// hashes --hash and the hash command can compute
+enum HashAlgorithm
+{
+	HASH_NONE,
+	HASH_SHA256,
+	HASH_XXH64
+};
+
+// a digest being computed over bytes fed to it in order, whole blocks go straight to the kernel and only a partial block is copied
+struct Hasher
+{
+	enum HashAlgorithm algorithm;
+	uint64_t length;					// bytes fed in so far
+	uint32_t sha256[8];					// SHA-256 chaining state
+	uint64_t xxh64[4];					// xxHash64 lane accumulators
+	uint8_t pending[HASH_BLOCK_SIZE];	// start of a block that is not complete yet
+	size_t pendingLength;
+};
+
+// one output file in the copy pipeline
+struct CopyJob
+{
+	char destination[64];	// path of the output file
+	const struct BatchFile *file; // the file being copied
+	struct ExtentList list; // where the file lives in the image
+	size_t chunksLeft;		// chunks not yet written, the writer of the last one closes the file
+	int outFd;				// output descriptor, opened by the reader that starts the job
+	bool opened;			// the reader has opened the output file, it is closed once outFd goes back to -1
+	bool skip;				// another job writes the same destination later, so this one is dropped
+	bool failed;			// a read, write or open went wrong
+	struct Hasher hasher;	// digest of the bytes written so far, with --hash
+	uint64_t hashedBytes;	// bytes of the file fed to hasher, chunks after this wait in hashQueue
+	struct CopyChunk *hashQueue; // written chunks that are not next in the file yet, in file order
+	bool hashing;			// a writer is feeding chunks to hasher, so others only queue theirs
+};
+
+// a buffer moving through the pipeline, free -> read by a reader -> written by a writer -> free
+struct CopyChunk
+{
+	struct CopyJob *job;
+	off_t imageOffset; // where the bytes come from
+	off_t fileOffset;  // where they go in the output file
+	size_t length;
+	char *buffer;	   // buffer from allocCopyBuffer owned by the chunk
+	const char *data;  // where the chunk's bytes start in buffer, past the alignment of a --direct read
+	struct CopyChunk *next;
+};
+
+// shared state of the reader and writer pools
+struct CopyPipeline
+{
+	pthread_mutex_t lock;
+	pthread_cond_t chunkFree;  // a chunk went back on the free list
+	pthread_cond_t chunkReady; // a chunk was read, or the last reader finished
+	struct CopyChunk *freeChunks;
+	struct CopyChunk *readyHead;
+	struct CopyChunk *readyTail;
+	struct CopyJob *jobs;
+	size_t jobCount;
+	size_t nextJob;		   // dispatch cursor, job being split into chunks
+	size_t nextExtent;	   // extent within that job
+	uint64_t extentDone;   // bytes of that extent already handed out
+	uint64_t fileDone;	   // bytes of that job already handed out
+	int readersRunning;
+};
+
+// a file the hash command reads, with the digest of its bytes
+struct HashFile
+{
+	struct BatchFile file;
+	struct Hasher hasher;
+	bool truncated; // the chain ended before the file did, so the file has no digest
+};
+
+// files shared by the hash workers
+struct HashRun
+{
+	struct HashFile *files;
+	struct HashFile **byCluster; // files ordered by starting cluster, the order the workers take them in
+	size_t fileCount;
+	size_t nextFile; // next position in byCluster to take, advanced atomically
+};
+
+#define ANALYZE_GAP_BUCKETS 32 // forward gaps of 1, 2-3, 4-7 and so on clusters, the last bucket takes anything longer
+
+// one file analyze followed, filled in by the worker that took it
+struct AnalyzeFile
+{
+	struct BatchFile file;
+	uint64_t clusters; // clusters the chain covers, short of the size when the chain ends early
+	uint64_t extents;  // runs of consecutive clusters
+	off_t firstOffset; // where the first extent starts in the image
+	off_t endOffset;   // where the cluster holding the last byte ends
+};
+
+// fragmentation counts over a set of files, every worker adds up its own and they are merged once it finishes
+struct AnalyzeTotals
+{
+	uint64_t files;
+	uint64_t fragmentedFiles; // files of more than one extent
+	uint64_t clusters;
+	uint64_t extents;
+	uint64_t gaps[ANALYZE_GAP_BUCKETS]; // jumps forward between the extents of a file, by log2 of the clusters skipped
+	uint64_t backwardJumps;				// extents that start before the end of the one before them
+};
+
+// files shared by the analyze workers
+struct AnalyzeRun
+{
+	struct AnalyzeFile *files;
+	size_t fileCount;
+	size_t nextFile; // next file to take, advanced atomically
+	pthread_mutex_t lock;
+	struct AnalyzeTotals totals; // merged totals, guarded by lock
+};
+
+// one read in a batch handed to readImageBatch
+struct ImageRead
+{
+	void *buffer;
+	size_t length;
+	off_t offset;
+	ssize_t bytesRead; // filled in with how many bytes came from the image
+};
+
+// a thread's io_uring instance, the rings are shared with the kernel through mmap
+struct UringRing
+{
+	int ringFd;
+	unsigned entries;
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	struct io_uring_sqe *sqes;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_cqe *cqes;
+	void *sqRing;
+	size_t sqRingSize;
+	void *cqRing;
+	size_t cqRingSize;
+	size_t sqesSize;
+};
+
+// what decodeEntry found
+#define ENTRY_NONE 0	  // long name record, hidden entry or anything else that is not listed
+#define ENTRY_DIRECTORY 1 // visible directory
+#define ENTRY_FILE 2	  // visible file
+
+#define LONG_NAME_CHARS_PER_ENTRY 13
+#define LONG_NAME_MAX_ENTRIES 20 // 20 records of 13 characters covers the 255 character limit
+
+// long name being assembled from the records in front of a short entry, records are stored last part first just like on disk
+struct LongName
+{
+	bool started;			 // whether a valid long name is in progress
+	unsigned char checkSum;	 // checksum every record and the short entry have to match
+	uint8_t previousOrder;	 // verify ordering
+	int entries;			 // number of long name records read in so far
+	uint16_t chars[LONG_NAME_MAX_ENTRIES * LONG_NAME_CHARS_PER_ENTRY];
+};
+
+// a visible directory entry decoded into fixed size buffers, nothing in here is heap allocated
+struct DecodedEntry
+{
+	const struct DirInfo *info;	 // raw entry, points into the directory cluster
+	unsigned char entryName[12]; // raw 11 character short name
+	char givenName[9];			 // short name without extension or trailing blanks
+	char nameExtension[4];		 // extension without trailing blanks, empty if there is none
+	uint32_t firstCluster;		 // first cluster of the file or directory
+	const uint16_t *longName;	 // matching long name, NULL if there is none, points into the struct LongName
+	int longNameEntries;		 // number of 13 character records in longName
+};
+
+#define ENTRY_END 3 // nextDirEntry ran out of entries
+
+// follows one cluster chain through the FAT, stopping on loops and on entries that can not be part of a chain
+struct ChainWalk
+{
+	uint32_t firstCluster;	 // where the chain starts, for diagnostics
+	uint32_t clusterNum;	 // current cluster, END_OF_CLUSTER_CHAIN once the chain is done
+	uint32_t checkpoint;	 // cluster saved by the cycle check, meeting it again means a loop
+	uint64_t steps;			 // clusters moved past so far
+	uint64_t nextCheckpoint; // steps at which the checkpoint moves to the current cluster, doubles each time
+	bool broken;			 // the walk stopped on a loop or a bad entry instead of the end of the chain
+};
+
+// what find looks for, every part left at its default matches everything
+struct FindFilter
+{
+	const char *name;		 // glob matched against the short and the long name, NULL for any name
+	char **pathParts;		 // glob for the whole path split at /, each part matched against one level
+	int pathPartCount;		 // 0 when there is no path glob
+	uint32_t minSize;
+	uint32_t maxSize;
+	uint16_t modifiedAfter;	 // first dir_wrt_date that matches
+	uint16_t modifiedBefore; // first dir_wrt_date past the ones that match
+	uint8_t attributesSet;	 // ATTR_ bits an entry has to have
+	uint8_t attributesClear; // ATTR_ bits an entry must not have
+	int type;				 // ENTRY_FILE or ENTRY_DIRECTORY, ENTRY_NONE for both
+};
+
+// walks the visible entries of one directory, following its cluster chain without recursing
+struct DirIterator
+{
+	struct DirCluster dir;	  // cluster being read, its buffer is reused for the whole chain
+	struct LongName longName; // long name in progress, carries over from one cluster to the next
+	struct ChainWalk chain;	  // cluster being read, END_OF_CLUSTER_CHAIN once the directory is done
+	int entryNum;			  // next entry to look at in the cluster
+	size_t pathLength;		  // length of the walk's path while this directory is being read
+	bool loaded;			  // dir holds the chain's current cluster
+	bool skipDots;			  // the first two entries are dot and dotdot
+	const struct FindFilter *filter; // files it rules out are skipped before they are decoded, NULL to keep everything
+};
+
+// explicit stack of directories being walked, one iterator per level so memory grows with depth and not with directory length
+struct DirWalk
+{
+	struct DirIterator *frames;
+	int depth;	  // iterators in use, the top one is the directory being read
+	int capacity; // iterators allocated, unused ones keep their buffers for the next push
+	struct TextBuffer path; // path of the directory on top, ending in / unless it is the root
+	const struct FindFilter *filter; // handed to every iterator pushed, NULL outside find
+};
+
+// a directory diff still has to read, a side is 0 when only the other image has the directory
+struct DiffDirectory
+{
+	uint32_t cluster;		  // first cluster in the image
+	uint32_t baselineCluster; // first cluster in the baseline
+	int depth;
+	char *path; // ending in / unless it is the root
+};
+
+// a visible entry of a directory that is compared entry by entry
+struct DiffEntry
+{
+	struct DirInfo info;
+	uint32_t firstCluster;
+};
+
+// one of the two images a diff reads
+struct DiffSide
+{
+	struct Volume *volume;
+	struct DirIterator iterator; // reused for every directory so its cluster buffer is allocated once
+	struct DirCluster dir;		 // cluster compared byte for byte against the other side
+	struct DiffEntry *entries;	 // visible entries of the directory being compared, sorted by short name
+	size_t entryCount;
+	size_t entryCapacity;
+	uint32_t *lineage; // first cluster of the directory at each depth down to the one being read
+};
+
+// everything one diff needs, the baseline is what the image is compared against
+struct DiffState
+{
+	struct DiffSide image;
+	struct DiffSide baseline;
+	bool *changedBlocks; // one per FAT cache page, true when the page differs between the two FATs
+	uint32_t blockCount;
+	uint32_t changedBlockCount;
+	struct DiffDirectory *pending; // directories still to read, the last one pushed is read first
+	size_t pendingCount;
+	size_t pendingCapacity;
+	int lineageCapacity;
+	struct TextBuffer out;
+	size_t added;
+	size_t removed;
+	size_t modified;
+	size_t directories;			// directories read on either side
+	size_t directoriesCompared; // directories whose entries had to be compared, the rest matched cluster for cluster
+};
+
+// start of a metadata index sidecar, every section offset is from the start of the file and 8 byte aligned
+struct IndexHeader
+{
+	char magic[8];			  // INDEX_MAGIC
+	uint32_t volumeId;		  // BS_VolID of the image the index was built from
+	uint32_t bytesPerCluster; // cluster size the extents were built with
+	uint64_t fatChecksum;	  // checksumFat of the image the index was built from
+	uint64_t entryCount;
+	uint64_t extentCount;
+	uint64_t slotCount; // size of the path hash table, always a power of 2
+	uint64_t poolSize;	// bytes of paths, lookup keys and long names
+	uint64_t entriesOffset;
+	uint64_t extentsOffset;
+	uint64_t slotsOffset;
+	uint64_t poolOffset;
+	uint64_t bodyChecksum; // checksumIndexBody of the entries, extents, slots and pool
+};
+
+// one visible file or directory in the index, entries are stored in the order list prints them
+struct IndexEntry
+{
+	struct DirInfo entry;	   // copy of the directory entry
+	uint32_t firstCluster;	   // first cluster of the file or directory
+	uint32_t depth;			   // depth list prints the entry at
+	uint64_t dirPath;		   // pool offset of the path of the directory holding the entry, ending in / unless it is the root
+	uint64_t key;			   // pool offset of the path get matches against, NAME for directories and NAME.EXT with the padded extension for files
+	uint64_t longName;		   // pool offset of the UTF-16 long name records, last part first like on disk
+	uint64_t firstExtent;	   // index of the entry's first extent
+	uint32_t dirPathLength;
+	uint32_t keyLength;
+	uint32_t longNameEntries;  // number of 13 character records, 0 if there is no long name
+	uint32_t extentCount;	   // number of extents of a file, 0 for directories
+};
+
+// an index sidecar mapped read only, header is NULL when there is no usable index
+struct VolumeIndex
+{
+	const uint8_t *map;
+	size_t size;
+	const struct IndexHeader *header;
+	const struct IndexEntry *entries;
+	const struct Extent *extents;
+	const uint32_t *slots; // entry number + 1 for each used slot, 0 for empty ones
+	const char *pool;
+};
+
+// one thread's share of a free cluster count
+struct FatScan
+{
+	uint32_t firstEntry; // first FAT entry to look at
+	uint32_t endEntry;	 // one past the last FAT entry to look at
+	uint64_t freeCount;	 // zero entries found
+	uint64_t orphanClusters; // in use clusters no file or directory owns
+	uint64_t orphanChains;	 // orphaned clusters nothing points at, each starts an orphaned chain
+	uint64_t freeRuns;		 // runs of free entries, counting one cut by the end of the range
+	uint32_t longestFreeRun; // longest run of free entries in the range
+	uint32_t leadingFree;	 // free entries at the start of the range, the whole range when it is all free
+	uint32_t trailingFree;	 // free entries at the end of the range
+};
+
+// what check found wrong with a chain
+#define CHECK_OK 0
+#define CHECK_CROSS_LINKED 1	// runs into a cluster another chain owns
+#define CHECK_LOOP 2			// runs back into itself
+#define CHECK_BAD_CLUSTER 3		// points at BAD_CLUSTER
+#define CHECK_FREE_CLUSTER 4	// points at a free cluster
+#define CHECK_INVALID_CLUSTER 5 // points outside the data region
+#define CHECK_SIZE_MISMATCH 6	// dir_file_size does not match the chain length
+
+// one file or directory found by check
+struct CheckFile
+{
+	char *path;				 // short name path, directories end in /
+	uint32_t firstCluster;
+	uint32_t size;			 // dir_file_size
+	uint32_t problemCluster; // cluster the problem was found at
+	uint64_t chainClusters;	 // clusters claimed before the walk stopped
+	uint8_t problem;		 // one of the CHECK_ kinds
+	bool isDirectory;
+};
+
+// clusters of one directory's chain
+struct CheckClusters
+{
+	uint32_t *clusters;
+	size_t count;
+	size_t capacity;
+};
+
+// files shared by the check workers
+struct CheckRun
+{
+	struct CheckFile *files;
+	size_t fileCount;
+	size_t nextFile; // next file to take, advanced atomically
+};
+
+// parts of a run that --stats times, measured on the main thread
+enum StatsPhase
+{
+	PHASE_VALIDATE, // opening the image and checking the boot sector, FSInfo and FAT
+	PHASE_TRAVERSE, // walking directories and following cluster chains
+	PHASE_COPY,		// moving file bytes out of the image
+	PHASE_COUNT
+};
+
+// hot path counters, every thread counts into its own copy and adds it to totalStats when it finishes
+struct Stats
+{
+	uint64_t readCalls;		  // pread, io_uring_enter, copy_file_range and sendfile calls against the image
+	uint64_t seekCalls;		  // lseek calls against the image
+	uint64_t bytesRead;		  // bytes those calls pulled out of the image
+	uint64_t mappedBytes;	  // bytes read straight out of the image map without a syscall
+	uint64_t fatLookups;	  // calls to getNextFatValue
+	uint64_t fatCacheHits;	  // lookups whose FAT page was already in memory
+	uint64_t dirClusters;	  // directory clusters loaded
+	uint64_t longNameEntries; // long name records decoded
+	uint64_t prefetchHints;	  // posix_fadvise and madvise calls telling the kernel what is read next
+};
+
+// everything known about one open image, each thread works on the volume its volume pointer names
+struct Volume
+{
+	int fd;		 // error code
+	const char *imageName;
+	off_t fatSectorStart;
+	off_t dataSectorLocationInSectors;
+	off_t entriesPerCluster;
+	off_t bytesPerCluster;
+	fat32BS bootSector;
+	fat32FSInfo infoSector;
+	int threads; // workers commands on this volume may use, a batch runs each image on one
+	FILE *out;	 // where commands print, stdout unless a batch collects the output in memory
+	const char *batchName; // image name written on every NDJSON line of a batch, NULL outside one
+
+	// image backend, when the image is mapped every read is served straight out of imageMap
+	const uint8_t *imageMap; // whole image mapped read only, NULL when using pread
+	off_t imageSize;		 // size of the image in bytes, 0 if unknown
+	bool uringEnabled;		 // --io=uring was asked for and the kernel has not refused it yet
+	int directFd;			 // the image opened with O_DIRECT for --direct, -1 when file bytes go through the page cache
+
+	// FAT cache, holds the FAT region in memory split into pages of FAT_CACHE_PAGE_SECTORS sectors
+	uint32_t **fatCachePages;		 // one slot per page, NULL until the page is loaded
+	uint32_t fatCachePageCount;		 // number of pages covering the whole FAT
+	uint32_t fatCacheEntriesPerPage; // number of FAT entries in one page
+	uint32_t fatCacheEntryCount;	 // number of FAT entries in the whole FAT
+	uint32_t fatCacheMaxPages;		 // maximum number of pages held in memory at once
+	uint32_t fatCacheLoadedPages;	 // number of pages currently held in memory
+	uint32_t fatCacheClockHand;		 // next page slot considered for eviction
+	bool fatCacheMapped;			 // pages point into imageMap instead of being allocated
+	pthread_mutex_t fatCacheLock;	 // guards demand paging when only part of the FAT fits
+
+	// directory entries seen so far while resolving paths
+	struct DentryCache dentryCache;
+	pthread_mutex_t dentryLock; // serve resolves paths from several threads
+
+	// consistency check, one bit per cluster
+	uint64_t *checkOwned;	  // clusters some file or directory's chain has claimed
+	uint64_t *checkPointedTo; // clusters some FAT entry points at
+	uint32_t checkEndCluster; // one past the last cluster the check looks at
+
+	// metadata index sidecar, only mapped when it matches the image
+	struct VolumeIndex volumeIndex;
+};
+
+// images shared out between the workers of a batch
+struct BatchRun
+{
+	char **images;
+	size_t imageCount;
+	size_t nextImage; // next image to take, advanced atomically
+	const char *command;
+	int failures;	  // images that could not be opened or had check problems, added atomically
+};
+
+// a volume opened through libfat32.h, nothing can be read until fat32Validate passes
+struct fat32Volume
+{
+	struct Volume volume;
+	char *path; // copy of the path the volume's imageName points at
+	bool validated;
+};
+
+// a directory being read through libfat32.h
+struct fat32Dir
+{
+	struct fat32Volume *handle;
+	struct DirIterator iterator;
+};
+
+// a file opened through libfat32.h, the extents are never changed after it is opened so readers can share it
+struct fat32File
+{
+	struct fat32Volume *handle;
+	struct ExtentList list;
+};
 
 // function forward declarations
 void printInfo(void);
-void readCluster(uint32_t clusterNum, int depth);
+uint32_t countFreeClusters(void);
+struct FatScan *splitFatScan(int *threadCount);
+void runFatScan(struct FatScan *scans, int threadCount, void *(*body)(void *));
+void *scanFatRange(void *arg);
+uint32_t dataClusterCount(void);
+size_t checkVolume(void);
+void *checkWorker(void *arg);
+void walkCheckChain(struct CheckFile *file, struct CheckClusters *clusters);
+bool claimCluster(uint32_t clusterNum);
+bool chainVisits(uint32_t firstCluster, uint64_t length, uint32_t clusterNum);
+void *markPointedTo(void *arg);
+void *countOrphans(void *arg);
+void printCheckProblem(const struct CheckFile *file);
+size_t countZeroEntries(const uint32_t *entries, size_t count);
+size_t countZeroEntriesScalar(const uint32_t *entries, size_t count);
+#if defined(__x86_64__) || defined(__i386__)
+size_t countZeroEntriesAvx2(const uint32_t *entries, size_t count);
+#elif defined(__aarch64__)
+size_t countZeroEntriesNeon(const uint32_t *entries, size_t count);
+#endif
+void listDirectory(struct ListTask *task, struct DirWalk *walk);
+void openDirIterator(struct DirIterator *iterator, uint32_t clusterNum, bool skipDots);
+void openChainWalk(struct ChainWalk *chain, uint32_t firstCluster);
+uint32_t advanceChainWalk(struct ChainWalk *chain);
+void breakChainWalk(struct ChainWalk *chain, const char *reason, uint32_t clusterNum);
+bool isAncestorDirectory(const struct ListTask *task, const struct DirWalk *walk, uint32_t clusterNum);
+bool loopsDirWalk(const struct ListTask *task, const struct DirWalk *walk, const struct DecodedEntry *decoded);
+bool descendDirWalk(struct DirWalk *walk, const struct DecodedEntry *decoded);
+int nextDirEntry(struct DirIterator *iterator, struct DecodedEntry *decoded);
+struct DirIterator *pushDirWalk(struct DirWalk *walk, uint32_t clusterNum, bool skipDots);
+void freeDirWalk(struct DirWalk *walk);
+int decodeEntry(const struct DirInfo *currentDir, struct LongName *longName, struct DecodedEntry *decoded);
+void decodeShortName(const struct DirInfo *currentDir, struct DecodedEntry *decoded);
+void appendLongNameEntry(struct LongName *longName, const struct LongNameDirInfo *currentLongDir);
+void appendDashes(struct TextBuffer *buffer, int depth);
+void appendLongName(struct TextBuffer *buffer, const struct DecodedEntry *decoded);
+size_t decodeLongName(const struct DecodedEntry *decoded, char *out);
+void appendListEntry(struct TextBuffer *buffer, const struct TextBuffer *path, const struct DecodedEntry *decoded, int kind, int depth);
+void appendTextEntry(struct TextBuffer *buffer, const struct DecodedEntry *decoded, int kind, int depth);
+void appendShortName(struct TextBuffer *buffer, const struct DecodedEntry *decoded);
+void appendJsonEntry(struct TextBuffer *buffer, const struct TextBuffer *path, const struct DecodedEntry *decoded);
+void appendJsonString(struct TextBuffer *buffer, const char *data, size_t length);
+void formatFatTimestamp(char *out, size_t size, uint16_t date, uint16_t time, uint8_t tenths);
+void appendBinaryEntry(struct TextBuffer *buffer, const struct TextBuffer *path, const struct DecodedEntry *decoded);
+void putLittleEndian(uint8_t *out, uint64_t value, int bytes);
 char *removeTrailingSpace(char *string);
 uint32_t getNextFatValue(uint32_t currentCluster);
-void copyFile(struct DirInfo *targetDir, uint32_t startingCluster, char *givenName, char *nameExtension);
-void fetchFile(uint32_t clusterNum, char *target, int numLeft);
+bool copyFile(const struct ExtentList *list, char *givenName, char *nameExtension, struct Hasher *hasher);
+void initHasher(struct Hasher *hasher, enum HashAlgorithm algorithm);
+void updateHasher(struct Hasher *hasher, const void *data, size_t length);
+void hashBlocks(struct Hasher *hasher, const uint8_t *data, size_t blockCount);
+void finishHasher(const struct Hasher *hasher, char *hex);
+void pickHashKernels(void);
+void sha256BlocksScalar(uint32_t *state, const uint8_t *data, size_t blockCount);
+#if defined(__x86_64__) || defined(__i386__)
+void sha256BlocksShaNi(uint32_t *state, const uint8_t *data, size_t blockCount);
+#endif
+void xxh64Stripes(uint64_t *lanes, const uint8_t *data, size_t stripeCount);
+uint64_t xxh64Round(uint64_t accumulator, uint64_t input);
+uint64_t rotateLeft64(uint64_t value, int bits);
+uint32_t rotateRight32(uint32_t value, int bits);
+void appendHashLine(struct TextBuffer *buffer, const char *path, const struct Hasher *hasher);
+bool fetchFile(const char *path);
+bool locateFile(const char *path, struct DirInfo *entry, struct ExtentList *list);
+void limitToRange(struct ExtentList *list);
+bool fetchBatch(const char *manifestPath);
+bool readBatchManifest(const char *manifestPath, struct BatchFile **files, size_t *fileCount, size_t *missing);
+bool streamFile(const char *path, int outFd);
+bool serveVolume(const char *socketPath);
+void stopServing(int signalNum);
+void *serveClient(void *arg);
+void appendServeInfo(struct TextBuffer *reply);
+uint32_t appendServeDirectory(struct TextBuffer *reply, const char *path);
+bool serveRead(int clientFd, const char *path, uint64_t offset, uint64_t length);
+bool locateDirectory(const char *path, struct DirInfo *entry);
+bool sendReplyHeader(int clientFd, uint32_t status, uint64_t payloadLength);
+bool sendAll(int clientFd, const void *data, size_t length);
+bool receiveAll(int clientFd, void *data, size_t length);
+uint64_t getLittleEndian(const uint8_t *in, int bytes);
+bool mountVolume(const char *path);
+void stopMount(int signalNum);
+void *mountWorker(void *arg);
+bool handleMountRequest(struct MountWorker *worker);
+bool loadMountNode(uint64_t nodeId, struct DirInfo *entry);
+uint64_t lookupMountNode(uint64_t parentId, const char *name, struct DirInfo *entry);
+void fillFuseAttr(uint64_t nodeId, const struct DirInfo *entry, struct fuse_attr *attr);
+uint64_t fatTimeToEpoch(uint16_t date, uint16_t time);
+struct TextBuffer *readMountDirectory(uint64_t nodeId, uint32_t clusterNum);
+void appendMountDirent(struct TextBuffer *listing, uint64_t nodeId, const char *name, size_t nameLength, uint32_t type);
+void replyMountRead(struct MountWorker *worker, uint64_t unique, struct ExtentList *list, uint64_t offset, uint32_t size);
+bool replyFuse(uint64_t unique, int error, const void *data, size_t length);
+int compareBatchFiles(const void *a, const void *b);
+bool copyPipelined(const struct BatchFile *files, size_t fileCount, size_t *copied);
+int compareCopyJobDestinations(const void *a, const void *b);
+void *copyReader(void *arg);
+void *copyWriter(void *arg);
+void hashCopyChunk(struct CopyPipeline *pipeline, struct CopyChunk *chunk);
+bool hashVolume(const char *manifestPath);
+size_t collectFiles(uint32_t rootCluster, struct BatchFile **files);
+int compareHashFiles(const void *a, const void *b);
+void *hashWorker(void *arg);
+void analyzeVolume(void);
+void *analyzeWorker(void *arg);
+void analyzeFile(struct AnalyzeFile *file, struct ExtentList *list, struct AnalyzeTotals *totals);
+uint64_t countBatchSeeks(const struct AnalyzeFile *files, size_t fileCount);
+void *scanFreeRuns(void *arg);
+void appendAnalyzeFile(struct TextBuffer *buffer, const struct AnalyzeFile *file);
+void appendAnalyzeSummary(struct TextBuffer *buffer, const struct AnalyzeTotals *totals, const struct FatScan *freeSpace, uint64_t batchSeeks);
+const struct Dentry *resolvePath(const char *path, bool isDirectory);
+const struct Dentry *lookupDentry(uint32_t parentCluster, const char *name, bool isDirectory);
+void scanDirectoryIntoCache(uint32_t parentCluster);
+uint64_t hashDentryKey(uint32_t parentCluster, const char *name, uint8_t kind);
+struct Dentry *findDentry(uint32_t parentCluster, const char *name, uint8_t kind);
+void insertDentry(uint32_t parentCluster, const char *name, uint8_t kind, const struct DirInfo *entry);
+void freeDentryCache(void);
+bool writeIndex(const char *path);
+bool openIndex(const char *path);
+bool mapIndex(const char *path, struct VolumeIndex *index);
+void locateIndexSections(struct VolumeIndex *index);
+bool checkIndex(const struct VolumeIndex *index);
+bool indexLayoutFits(const struct VolumeIndex *index);
+bool indexExtentsFit(const struct VolumeIndex *index);
+uint64_t checksumIndexBody(const struct IndexHeader *header, const struct IndexEntry *entries, const struct Extent *extents, const uint32_t *slots, const char *pool);
+uint64_t checksumIndexBytes(uint64_t hash, const void *data, size_t length);
+bool indexSectionFits(uint64_t offset, uint64_t count, size_t itemSize, size_t fileSize);
+void closeIndex(void);
+void listIndex(void);
+int decodeIndexEntry(const struct IndexEntry *indexed, struct DecodedEntry *decoded);
+const struct IndexEntry *findIndexEntry(const char *path);
+uint64_t checksumFat(void);
+uint64_t hashBytes(const char *data, size_t length);
 unsigned char ChkSum(unsigned char *pFcbName);
+int parseOptions(int argc, char *argv[]);
+const char *openVolume(const char *path);
+void readVolumeHeaders(void);
+const char *validateVolume(void);
+void closeVolume(void);
+bool runBatch(int argc, char *argv[]);
+void *batchWorker(void *arg);
+bool runBatchImage(const char *command, const char *path);
+ssize_t writeBatchOutput(void *cookie, const char *data, size_t length);
+int closeBatchOutput(void *cookie);
+void openFat32Dir(struct fat32Dir *dir, uint32_t clusterNum);
+void startPhase(enum StatsPhase phase);
+void mergeThreadStats(void);
+void reportStats(void);
+uint64_t nowNanoseconds(void);
+void initFatCache(void);
+uint32_t *loadFatCachePage(uint32_t pageNum);
+const uint32_t *peekFatPage(uint32_t pageNum, uint32_t **scratch);
+void freeFatCache(void);
+bool openImage(const char *path);
+void closeImage(void);
+void createUringKey(void);
+ssize_t readImage(void *buffer, size_t length, off_t offset);
+ssize_t readImagePread(void *buffer, size_t length, off_t offset);
+void readImageBatch(struct ImageRead *reads, size_t count);
+struct UringRing *getUringRing(void);
+struct UringRing *setupUringRing(void);
+void freeUringRing(void *ring);
+const void *mapImage(off_t offset, size_t length);
+void prefetchImage(off_t offset, uint64_t length);
+void prefetchNextCluster(uint32_t clusterNum);
+size_t prefetchExtents(const struct ExtentList *list, size_t first);
+char *allocCopyBuffer(void);
+const char *readFileBytes(char *buffer, size_t length, off_t offset);
+const char *readImageDirect(char *buffer, size_t length, off_t offset);
+bool loadDirCluster(struct DirCluster *dir, uint32_t clusterNum);
+void freeDirCluster(struct DirCluster *dir);
+off_t clusterOffset(uint32_t clusterNum);
+uint64_t buildExtents(uint32_t startingCluster, uint64_t fileSize, struct ExtentList *list);
+bool chainCoversFile(const char *path, uint64_t covered, uint64_t fileSize);
+void freeExtents(struct ExtentList *list);
+size_t findExtent(struct ExtentList *list, uint64_t fileOffset);
+void sliceExtents(struct ExtentList *list, uint64_t offset, uint64_t length, struct ExtentList *slice);
+bool copyExtents(const struct ExtentList *list, int outFd, struct Hasher *hasher);
+bool copyExtentsBatched(const struct ExtentList *list, int outFd, struct Hasher *hasher);
+void appendText(struct TextBuffer *buffer, const char *format, ...);
+char *reserveText(struct TextBuffer *buffer, size_t length);
+void appendBytes(struct TextBuffer *buffer, const char *data, size_t length);
+void appendString(struct TextBuffer *buffer, const char *string);
+size_t encodeUtf8(uint32_t codePoint, char *out);
+void flushText(struct TextBuffer *buffer);
+void listVolume(uint32_t rootCluster);
+void listSubdirectory(struct ListTask *task, struct DirWalk *walk, const struct DecodedEntry *decoded, int depth);
+struct ListTask *newListTask(uint32_t clusterNum, int depth, char *path);
+void pushListTask(int workerNum, struct ListTask *task);
+struct ListTask *takeListTask(int workerNum);
+void *listWorker(void *arg);
+void emitListTask(struct ListTask *task, FILE *sink);
+size_t findVolume(uint32_t rootCluster);
+void appendFindEntry(struct TextBuffer *buffer, const struct TextBuffer *path, const struct DecodedEntry *decoded, int kind);
+bool entryMatches(const struct FindFilter *filter, const struct DirInfo *info);
+bool filterSkipsFile(const struct FindFilter *filter, const struct DirInfo *info);
+bool nameMatches(const struct DecodedEntry *decoded, const char *pattern);
+bool parseFatDate(const char *text, uint16_t *date);
+bool parseAttributes(const char *letters, uint8_t *attributes);
+const char *diffVolume(const char *baselinePath, size_t *changes);
+size_t diffImages(struct Volume *baseline);
+size_t diffIndex(struct Volume *baseline);
+void hashFatBlocks(struct DiffState *state);
+uint64_t hashFatBlock(uint32_t pageNum, uint32_t **scratch);
+bool directoryClustersMatch(struct DiffState *state, const struct DiffDirectory *pending);
+void collectDiffEntries(struct DiffSide *side, uint32_t clusterNum, bool skipDots, const struct FindFilter *filter);
+int compareDiffEntries(const void *a, const void *b);
+void compareDiffDirectory(struct DiffState *state, const struct DiffDirectory *pending);
+void pushDiffDirectory(struct DiffState *state, const struct DiffDirectory *parent, const struct DiffEntry *entry, const struct DiffEntry *baselineEntry);
+bool diffEntriesDiffer(const struct DiffEntry *entry, const struct DiffEntry *baselineEntry);
+void appendDiffChange(struct DiffState *state, const char *path, size_t pathLength, const struct DiffEntry *entry, const struct DiffEntry *baselineEntry);
+void appendDiffDetails(struct TextBuffer *buffer, const struct DiffEntry *entry, const struct DiffEntry *baselineEntry);
+void appendDiffFields(struct TextBuffer *buffer, const struct DiffEntry *entry);
+void appendDiffSummary(struct DiffState *state);
+void freeDiffState(struct DiffState *state);
+
+// ways of reading the image
+enum ImageBackend
+{
+	BACKEND_AUTO,  // mmap regular files, pread everything else
+	BACKEND_PREAD, // always pread
+	BACKEND_MMAP,  // mmap whenever the kernel lets us, pread otherwise
+	BACKEND_URING  // batched reads through io_uring, pread if the kernel does not have it
+};
+
+// ways list can print entries
+enum ListFormat
+{
+	LIST_FORMAT_TEXT,	// indented lines for people to read
+	LIST_FORMAT_NDJSON, // one JSON object per line
+	LIST_FORMAT_BINARY	// length prefixed records, see the README for the layout
+};
+
+// command line options that can appear anywhere after the image name
+struct Options
+{
+	long fatCacheLimitKB;	   // upper bound on memory used to hold the FAT, 0 means no limit
+	enum ImageBackend backend; // how the image is read
+	int threads;			   // worker threads for parallel work, 1 keeps everything on the main thread
+	int readers;			   // reader threads in the copy pipeline
+	int writers;			   // writer threads in the copy pipeline
+	int ioDepth;			   // buffers in flight in the copy pipeline
+	enum ListFormat listFormat; // how list prints each entry
+	const char *indexPath;	   // metadata index sidecar, NULL for <image>.idx
+	bool useIndex;			   // list and get read from the sidecar when it is up to date
+	bool scanFat;			   // info counts free clusters from the FAT instead of trusting FSInfo
+	bool stats;				   // print the hot path counters to stderr when the run ends
+	const char *statsPath;	   // write the counters to this file as JSON instead, NULL for none
+	uint64_t rangeOffset;	   // first byte get and cat copy
+	uint64_t rangeLength;	   // number of bytes get and cat copy, UINT64_MAX for the rest of the file
+	bool direct;			   // get, get-batch and cat read file bytes with O_DIRECT so they stay out of the page cache
+	bool prefetch;			   // tell the kernel which parts of the image are about to be read
+	enum HashAlgorithm hash;   // digest get, get-batch and cat compute while copying, and the one hash computes
+} options = {FAT_CACHE_DEFAULT_LIMIT_KB, BACKEND_AUTO, 1, 2, 2, 8, LIST_FORMAT_TEXT, NULL, true, false, false, NULL, 0, UINT64_MAX, false, true, HASH_NONE};
+
+// io_uring backend, every thread gets its own ring the first time it reads
+pthread_key_t uringRingKey; // per thread struct UringRing, torn down when the thread exits
+pthread_once_t uringKeyOnce = PTHREAD_ONCE_INIT; // rings are shared by every volume a thread reads, so the key is made once
+bool uringKeyCreated;
+
+// the image named on the command line, threads that never pick a volume of their own work on this one
+struct Volume mainVolume = {.fd = -1, .threads = 1, .fatCacheLock = PTHREAD_MUTEX_INITIALIZER, .dentryLock = PTHREAD_MUTEX_INITIALIZER};
+_Thread_local struct Volume *volume = &mainVolume;
+
+// batch runs, guards stdout so every image's lines come out together
+pthread_mutex_t batchLock = PTHREAD_MUTEX_INITIALIZER;
+
+// parallel listing, listPool is NULL when listing on the main thread
+struct ListPool *listPool;
+_Thread_local int listWorkerNum; // which deque the current thread owns
+
+// find, filled in from the command line
+struct FindFilter findFilter = {NULL, NULL, 0, 0, UINT32_MAX, 0, UINT16_MAX, 0, 0, ENTRY_NONE};
 
-// variables
-int fd; // error code
-char *imageName;
-bool foundFile;
-off_t fatSectorStart;
-off_t dataSectorLocationInSectors;
-off_t entriesPerCluster;
-off_t bytesPerCluster;
-fat32BS bootSector;
-fat32FSInfo infoSector;
+// serve, set from the signal handler to stop accepting clients
+volatile sig_atomic_t serveStopping;
 
+// mount, the /dev/fuse connection and where it is mounted
+int fuseFd = -1;
+const char *mountPoint;
+
+// hot path counters for --stats
+_Thread_local struct Stats threadStats; // what the current thread has counted since it last merged
+struct Stats totalStats;				// counts from threads that have merged
+pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t phaseNanoseconds[PHASE_COUNT]; // time spent in each phase
+enum StatsPhase currentPhase;			// phase the main thread is in
+uint64_t currentPhaseStart;				// when it started
+
+// hashing, the SHA-256 kernel is picked for this CPU the first time a hasher is set up
+void (*sha256Blocks)(uint32_t *state, const uint8_t *data, size_t blockCount);
+pthread_once_t hashKernelsOnce = PTHREAD_ONCE_INIT;
+// SHA-256 round constants, the first 32 bits of the fractional parts of the cube roots of the first 64 primes
+const uint32_t sha256Constants[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+
+// kernel copy support, switched off the first time the kernel says it can not do it for us
+bool copyFileRangeWorks = true;
+bool sendfileWorks = true;
+
+// the library build leaves the command line out
+#ifndef FAT32_LIBRARY
 /**
  * main
  *
@@ -58,7 +1003,21 @@ fat32FSInfo infoSector;
 int main(int argc, char *argv[])
 {
 
-	uint32_t fatValidation;
+	const char *error;
+	char defaultIndexPath[PATH_MAX];
+
+	// set up the locale once for the whole run, nothing after this touches it again so threads can not race on it
+	setlocale(LC_ALL, "");
+
+	// pull out any options so only the positional arguments are left
+	argc = parseOptions(argc, argv);
+
+	// the counters are reported however the run ends, every exit goes through here
+	startPhase(PHASE_VALIDATE);
+	if (options.stats || options.statsPath != NULL)
+	{
+		atexit(reportStats);
+	}
 
 	// read in parameters and decide which function we will be performing
 	if (argc < 3)
@@ -67,766 +1026,9173 @@ int main(int argc, char *argv[])
 		exit(EXIT_FAILURE);
 	}
 
-	// get arguments
-	imageName = argv[1];
-
-	fd = open(argv[1], O_RDONLY);
-
-	// read in the Boot sector
-	read(fd, &bootSector, sizeof(fat32BS));
-
-	// read in FS info
-	lseek(fd, bootSector.BPB_BytesPerSec * bootSector.BPB_FSInfo, SEEK_SET);
-	read(fd, &infoSector, sizeof(infoSector));
-
-	// calculate the starting point of the data sector
-	dataSectorLocationInSectors = bootSector.BPB_RsvdSecCnt + (bootSector.BPB_FATSz32 * bootSector.BPB_NumFATs);
-
-	// calculate FAT starting location
-	fatSectorStart = bootSector.BPB_RsvdSecCnt * bootSector.BPB_BytesPerSec;
-
-	// calculate number of directory entries per cluster
-	entriesPerCluster = (bootSector.BPB_SecPerClus * bootSector.BPB_BytesPerSec) / sizeof(struct DirInfo);
-
-	// calculate the number of bytes per cluster
-	bytesPerCluster = bootSector.BPB_SecPerClus * bootSector.BPB_BytesPerSec;
+	// every command so far prints to stdout and may use all the threads it was given
+	mainVolume.out = stdout;
+	mainVolume.threads = options.threads;
 
-	// check to see if info sector the signatures match
-	if (infoSector.lead_sig != 0x41615252)
+	// a batch runs one command over many images, each on its own volume
+	if (strcmp(argv[1], "batch") == 0)
 	{
-		printf("Info sector does not exist, exiting program.");
-		close(fd);
-		exit(EXIT_FAILURE);
+		exit(runBatch(argc - 2, argv + 2) ? EXIT_SUCCESS : EXIT_FAILURE);
 	}
 
-	// check to see if jmpboot signatures match
-	if ((uint8_t)bootSector.BS_jmpBoot[0] != 0xEB && (uint8_t)bootSector.BS_jmpBoot[0] != 0xE9)
+	// get arguments
+	volume->imageName = argv[1];
+
+	// the sidecar sits next to the image unless told otherwise
+	if (options.indexPath == NULL)
 	{
-		printf("Jump validation failed, exiting program.");
-		close(fd);
-		exit(EXIT_FAILURE);
+		snprintf(defaultIndexPath, sizeof(defaultIndexPath), "%s.idx", volume->imageName);
+		options.indexPath = defaultIndexPath;
 	}
 
-	// check to see if root clus >=2
-	if (bootSector.BPB_RootClus < 2)
+	error = openVolume(argv[1]);
+	if (error != NULL)
 	{
-		printf("BPB_RootClus validation failed, exiting program.");
-		close(fd);
+		printf("%s, exiting program.", error);
 		exit(EXIT_FAILURE);
 	}
 
-	// check to see if FATz32 is non 0
-	if (bootSector.BPB_FATSz32 == 0)
+	// list and get can skip walking the directories when an up to date index is there
+	if (options.useIndex && strcmp(argv[2], "info") != 0 && strcmp(argv[2], "index") != 0 && strcmp(argv[2], "check") != 0 && strcmp(argv[2], "find") != 0 &&
+		strcmp(argv[2], "diff") != 0)
 	{
-		printf("BPB_FATSz32 validation failed, exiting program.");
-		close(fd);
-		exit(EXIT_FAILURE);
+		openIndex(options.indexPath);
 	}
 
-	// check to see if total sectors less than min clusters
-	if (bootSector.BPB_TotSec32 < 65525)
+	startPhase(PHASE_TRAVERSE);
+
+	// check command line arguments
+	if (strcmp(argv[2], "info") == 0)
 	{
-		printf("BPB_TotSec32 validation failed, exiting program.");
-		close(fd);
-		exit(EXIT_FAILURE);
+		printInfo();
 	}
-
-	// check to see if total sectors less than min clusters
-	for (int i = 0; i < 12; i++)
+	else if (strcmp(argv[2], "list") == 0)
 	{
-		if ((int)bootSector.BPB_reserved[i] != 0)
+		// skip straight to reading the root cluster, treating it as another directory as Franklin's video said to do
+		listVolume(volume->bootSector.BPB_RootClus & MASK_FIRST_HEX);
+
+		// machine readable listings are consumed by other programs, so they end without the Done
+		if (options.listFormat != LIST_FORMAT_TEXT)
 		{
-			printf("BPB_reserved validation failed, exiting program.");
-			close(fd);
-			exit(EXIT_FAILURE);
+			fflush(stdout);
+			freeFatCache();
+			closeImage();
+			exit(EXIT_SUCCESS);
 		}
 	}
-
-	// check to see if low byte of FAT[0] = BPB_Media
-	lseek(fd, fatSectorStart + ((SIZE_OF_FAT_ENTRY / BITS_PER_BYTE) * 0), SEEK_SET);
-	read(fd, &fatValidation, SIZE_OF_FAT_ENTRY / BITS_PER_BYTE);
-
-	if ((fatValidation & MASK_FIRST_HEX) != (bootSector.BPB_Media + 0x0FFFFF00))
+	else if (strcmp(argv[2], "find") == 0)
 	{
-		printf("FAT validation 0 failed, exiting program.");
-		close(fd);
-		exit(EXIT_FAILURE);
+		// the output is only the matches, and like grep finding nothing is a failure
+		size_t matches = findVolume(volume->bootSector.BPB_RootClus & MASK_FIRST_HEX);
+
+		fflush(stdout);
+		closeVolume();
+		exit((matches > 0) ? EXIT_SUCCESS : EXIT_FAILURE);
 	}
+	else if (strcmp(argv[2], "diff") == 0)
+	{
+		size_t changes = 0;
 
-	// check to see if FAT[1] is all Fs
-	lseek(fd, fatSectorStart + ((SIZE_OF_FAT_ENTRY / BITS_PER_BYTE) * 1), SEEK_SET);
-	read(fd, &fatValidation, SIZE_OF_FAT_ENTRY / BITS_PER_BYTE);
+		if (argc != 4)
+		{
+			printf("Incorrect parameters, exiting program. num parameters: %i", argc);
+			closeVolume();
+			exit(EXIT_FAILURE);
+		}
 
-	if ((fatValidation & MASK_FIRST_HEX) != 0x0FFFFFFF)
-	{
-		printf("FAT validation 1 failed, exiting program.");
-		close(fd);
-		exit(EXIT_FAILURE);
-	}
+		error = diffVolume(argv[3], &changes);
+		if (error != NULL)
+		{
+			printf("%s: %s, exiting program.", argv[3], error);
+			closeVolume();
+			exit(EXIT_FAILURE);
+		}
 
-	// check command line arguments
-	if (strcmp(argv[2], "info") == 0)
+		// like diff, finding differences is a failure
+		fflush(stdout);
+		closeVolume();
+		exit((changes > 0) ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+	else if (strcmp(argv[2], "check") == 0)
 	{
-		printInfo();
+		if (checkVolume() > 0)
+		{
+			fflush(stdout);
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
 	}
-	else if (strcmp(argv[2], "list") == 0)
+	else if (strcmp(argv[2], "index") == 0)
 	{
-		// skip straight to reading the root cluster, treating it as another directory as Franklin's video said to do
-		readCluster(bootSector.BPB_RootClus & MASK_FIRST_HEX, 0);
+		if (!writeIndex(options.indexPath))
+		{
+			printf("Error, could not write index %s. Exiting.", options.indexPath);
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
+
+		printf("Index written to %s.\n", options.indexPath);
 	}
 	else if (strcmp(argv[2], "get") == 0)
 	{
 		if (argc != 4)
 		{
 			printf("Incorrect parameters, exiting program. num parameters: %i", argc);
-			close(fd);
+			freeFatCache();
+			closeImage();
 			exit(EXIT_FAILURE);
 		}
 
-		char *path = argv[3];
-		char *token;
-		int i, count;
-
-		// count number of tokens
-		for (i = 0, count = 0; path[i]; i++)
-			count += (path[i] == '/');
-
-		token = strtok(path, "/");
-
-		foundFile = false;
-
-		fetchFile(bootSector.BPB_RootClus & MASK_FIRST_HEX, token, count);
-
-		if (foundFile == true)
+		if (fetchFile(argv[3]))
 		{
 			printf("File copied into output folder.\n");
 		}
 		else
 		{
-			printf("Error, file could not be found. Exiting.");
+			printf("Error, file could not be copied. Exiting.");
 			fflush(stdout);
-			close(fd);
+			freeDentryCache();
+			freeFatCache();
+			closeImage();
 			exit(EXIT_FAILURE);
 		}
 	}
-	else
+	else if (strcmp(argv[2], "get-batch") == 0)
 	{
-		printf("Incorrect parameters, exiting program.");
-		close(fd);
-		exit(EXIT_FAILURE);
+		if (argc != 4)
+		{
+			printf("Incorrect parameters, exiting program. num parameters: %i", argc);
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
+
+		if (!fetchBatch(argv[3]))
+		{
+			printf("Error, not every file could be copied. Exiting.");
+			fflush(stdout);
+			freeDentryCache();
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
 	}
+	else if (strcmp(argv[2], "analyze") == 0)
+	{
+		// like find, the report is the whole output
+		analyzeVolume();
 
-	close(fd);
-	printf("Done");
-}
+		fflush(stdout);
+		closeVolume();
+		exit(EXIT_SUCCESS);
+	}
+	else if (strcmp(argv[2], "hash") == 0)
+	{
+		if (argc > 4)
+		{
+			printf("Incorrect parameters, exiting program. num parameters: %i", argc);
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
 
-/**
- * printInfo
- *
- * Prints information regarding the FAT32 volume found in boot and info sector
- * @returns void - NA
- */
-void printInfo(void)
-{
-	long freeSpace;
-	long totalSpace;
-	long totalUsableSpace;
-	long clusterSizeBytes;
-	char *driveName;
-	char *OEMName;
+		// the output is only the digests, so it ends without the Done
+		if (!hashVolume((argc == 4) ? argv[3] : NULL))
+		{
+			fflush(stdout);
+			closeVolume();
+			exit(EXIT_FAILURE);
+		}
 
-	// drive name
-	driveName = malloc((BS_VolLab_LENGTH + 1) * sizeof(char));
-	memcpy(driveName, bootSector.BS_VolLab, 11);
-	driveName[BS_VolLab_LENGTH] = '\0';
+		fflush(stdout);
+		closeVolume();
+		exit(EXIT_SUCCESS);
+	}
+	else if (strcmp(argv[2], "serve") == 0)
+	{
+		if (argc != 4)
+		{
+			printf("Incorrect parameters, exiting program. num parameters: %i", argc);
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
 
-	// OEM name
+		if (!serveVolume(argv[3]))
+		{
+			printf("Error, could not listen on %s. Exiting.", argv[3]);
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
+
+		// client threads can still be reading, so the image stays open until the process is gone
+		exit(EXIT_SUCCESS);
+	}
+	else if (strcmp(argv[2], "mount") == 0)
+	{
+		if (argc != 4)
+		{
+			printf("Incorrect parameters, exiting program. num parameters: %i", argc);
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
+
+		if (!mountVolume(argv[3]))
+		{
+			printf("Error, could not mount on %s: %s. Exiting.", argv[3], strerror(errno));
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	else if (strcmp(argv[2], "cat") == 0)
+	{
+		// stdout carries the file, so messages go to stderr and there is no Done at the end
+		if (argc != 4 && argc != 5)
+		{
+			fprintf(stderr, "Incorrect parameters, exiting program. num parameters: %i", argc);
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
+
+		if (!streamFile(argv[3], (argc == 5) ? atoi(argv[4]) : STDOUT_FILENO))
+		{
+			fprintf(stderr, "Error, file could not be streamed. Exiting.");
+			freeDentryCache();
+			freeFatCache();
+			closeImage();
+			exit(EXIT_FAILURE);
+		}
+
+		freeDentryCache();
+		freeFatCache();
+		closeImage();
+		exit(EXIT_SUCCESS);
+	}
+	else
+	{
+		printf("Incorrect parameters, exiting program.");
+		freeFatCache();
+		closeImage();
+		exit(EXIT_FAILURE);
+	}
+
+	freeDentryCache();
+	freeFatCache();
+	closeImage();
+	printf("Done");
+}
+#endif
+
+/**
+ * openVolume
+ *
+ * Opens an image as the calling thread's volume and validates its boot sector, FSInfo and the first two FAT entries
+ * @param const char* path - path to the image file
+ * @returns const char* - NULL once the volume is ready, otherwise what failed, the image is closed again by then
+ */
+const char *openVolume(const char *path)
+{
+	const char *error;
+
+	volume->imageName = path;
+
+	if (!openImage(path))
+	{
+		return "Could not open image";
+	}
+
+	readVolumeHeaders();
+
+	error = validateVolume();
+	if (error != NULL)
+	{
+		closeImage();
+	}
+
+	return error;
+}
+
+/**
+ * readVolumeHeaders
+ *
+ * Reads the boot sector and FSInfo of the calling thread's volume and works out where everything else is
+ * @returns void - NA
+ */
+void readVolumeHeaders(void)
+{
+	// read in the Boot sector
+	readImage(&volume->bootSector, sizeof(fat32BS), 0);
+
+	// read in FS info
+	readImage(&volume->infoSector, sizeof(volume->infoSector), (off_t)volume->bootSector.BPB_BytesPerSec * volume->bootSector.BPB_FSInfo);
+
+	// calculate the starting point of the data sector
+	volume->dataSectorLocationInSectors = volume->bootSector.BPB_RsvdSecCnt + (volume->bootSector.BPB_FATSz32 * volume->bootSector.BPB_NumFATs);
+
+	// calculate FAT starting location
+	volume->fatSectorStart = volume->bootSector.BPB_RsvdSecCnt * volume->bootSector.BPB_BytesPerSec;
+
+	// calculate number of directory entries per cluster
+	volume->entriesPerCluster = (volume->bootSector.BPB_SecPerClus * volume->bootSector.BPB_BytesPerSec) / sizeof(struct DirInfo);
+
+	// calculate the number of bytes per cluster
+	volume->bytesPerCluster = volume->bootSector.BPB_SecPerClus * volume->bootSector.BPB_BytesPerSec;
+}
+
+/**
+ * validateVolume
+ *
+ * Checks the boot sector and FSInfo of the calling thread's volume, then sets up its FAT cache and checks the first two FAT entries
+ * @returns const char* - NULL once the volume is ready, otherwise what failed, the FAT cache is freed again by then
+ */
+const char *validateVolume(void)
+{
+	uint32_t fatValidation;
+
+	// check to see if sector size is one FAT allows, every offset into the image is worked out from it
+	if (volume->bootSector.BPB_BytesPerSec != 512 && volume->bootSector.BPB_BytesPerSec != 1024 && volume->bootSector.BPB_BytesPerSec != 2048 &&
+		volume->bootSector.BPB_BytesPerSec != 4096)
+	{
+		return "BPB_BytesPerSec validation failed";
+	}
+
+	// check to see if sectors per cluster is a non 0 power of 2, cluster sizes are divided by
+	if (volume->bootSector.BPB_SecPerClus == 0 || (volume->bootSector.BPB_SecPerClus & (volume->bootSector.BPB_SecPerClus - 1)) != 0)
+	{
+		return "BPB_SecPerClus validation failed";
+	}
+
+	// check to see if info sector the signatures match
+	if (volume->infoSector.lead_sig != 0x41615252)
+	{
+		return "Info sector does not exist";
+	}
+
+	// check to see if jmpboot signatures match
+	if ((uint8_t)volume->bootSector.BS_jmpBoot[0] != 0xEB && (uint8_t)volume->bootSector.BS_jmpBoot[0] != 0xE9)
+	{
+		return "Jump validation failed";
+	}
+
+	// check to see if root clus >=2
+	if (volume->bootSector.BPB_RootClus < 2)
+	{
+		return "BPB_RootClus validation failed";
+	}
+
+	// check to see if FATz32 is non 0
+	if (volume->bootSector.BPB_FATSz32 == 0)
+	{
+		return "BPB_FATSz32 validation failed";
+	}
+
+	// check to see if total sectors less than min clusters
+	if (volume->bootSector.BPB_TotSec32 < 65525)
+	{
+		return "BPB_TotSec32 validation failed";
+	}
+
+	// check to see if total sectors less than min clusters
+	for (int i = 0; i < 12; i++)
+	{
+		if ((int)volume->bootSector.BPB_reserved[i] != 0)
+		{
+				return "BPB_reserved validation failed";
+		}
+	}
+
+	// set up the FAT cache now that we know the FAT size is valid, all FAT reads after this come from memory
+	initFatCache();
+
+	// check to see if low byte of FAT[0] = BPB_Media
+	fatValidation = getNextFatValue(0);
+
+	if ((fatValidation & MASK_FIRST_HEX) != (uint32_t)(volume->bootSector.BPB_Media + 0x0FFFFF00))
+	{
+		freeFatCache();
+		return "FAT validation 0 failed";
+	}
+
+	// check to see if FAT[1] is all Fs
+	fatValidation = getNextFatValue(1);
+
+	if ((fatValidation & MASK_FIRST_HEX) != 0x0FFFFFFF)
+	{
+		freeFatCache();
+		return "FAT validation 1 failed";
+	}
+
+	return NULL;
+}
+
+/**
+ * closeVolume
+ *
+ * Frees everything the calling thread's volume holds and closes its image
+ * @returns void - NA
+ */
+void closeVolume(void)
+{
+	freeDentryCache();
+	freeFatCache();
+	closeImage();
+}
+
+/**
+ * runBatch
+ *
+ * Runs info, list or check over many images on a shared pool of --threads workers, printing NDJSON where every line names its image. Arguments that match no file are tried as globs, so fleets too big for the command line can be passed quoted.
+ * @param int argc - number of arguments after batch
+ * @param char* argv - the command followed by image paths or glob patterns
+ * @returns bool - true if every image opened and check found no problems
+ */
+bool runBatch(int argc, char *argv[])
+{
+	struct BatchRun run = {0};
+	glob_t found = {0};
+	pthread_t *threads;
+	int threadCount;
+	int flags = GLOB_NOCHECK;
+
+	if (argc < 2 || (strcmp(argv[0], "info") != 0 && strcmp(argv[0], "list") != 0 && strcmp(argv[0], "check") != 0))
+	{
+		printf("Incorrect parameters, exiting program.");
+		return false;
+	}
+
+	// patterns that match nothing are kept as they are, so the image shows up in the output as one that could not be opened
+	for (int i = 1; i < argc; i++)
+	{
+		glob(argv[i], flags, NULL, &found);
+		flags |= GLOB_APPEND;
+	}
+
+	run.images = found.gl_pathv;
+	run.imageCount = found.gl_pathc;
+	run.command = argv[0];
+
+	// batch output is always NDJSON, text and binary listings have no room for the image name
+	options.listFormat = LIST_FORMAT_NDJSON;
+
+	threadCount = (options.threads < (int)run.imageCount) ? options.threads : (int)run.imageCount;
+	threads = malloc(threadCount * sizeof(pthread_t));
+	for (int i = 0; i < threadCount; i++)
+	{
+		pthread_create(&threads[i], NULL, batchWorker, &run);
+	}
+	for (int i = 0; i < threadCount; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	fflush(stdout);
+	free(threads);
+	globfree(&found);
+
+	return run.failures == 0;
+}
+
+/**
+ * batchWorker
+ *
+ * Thread body for runBatch, takes images off the shared cursor until there are none left
+ * @param void* arg - the struct BatchRun
+ * @returns void* - NULL
+ */
+void *batchWorker(void *arg)
+{
+	struct BatchRun *run = arg;
+	size_t next;
+
+	while ((next = __atomic_fetch_add(&run->nextImage, 1, __ATOMIC_RELAXED)) < run->imageCount)
+	{
+		if (!runBatchImage(run->command, run->images[next]))
+		{
+			__atomic_fetch_add(&run->failures, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * runBatchImage
+ *
+ * Runs one batch command on one image, on a volume of its own on the calling thread. The output goes to stdout in runs of whole lines, so a line of one image is never broken up by lines of another.
+ * @param const char* command - info, list or check
+ * @param const char* path - path to the image file
+ * @returns bool - true if the image opened and check found no problems
+ */
+bool runBatchImage(const char *command, const char *path)
+{
+	struct Volume image = {.fd = -1, .threads = 1, .fatCacheLock = PTHREAD_MUTEX_INITIALIZER, .dentryLock = PTHREAD_MUTEX_INITIALIZER};
+	struct TextBuffer name = {0};
+	struct TextBuffer text = {0};
+	char indexPath[PATH_MAX];
+	const char *error;
+	bool succeeded = true;
+
+	// the name goes on every line, so it is escaped once up front
+	appendJsonString(&name, path, strlen(path));
+	appendBytes(&name, "", 1);
+	image.batchName = name.data;
+	image.out = fopencookie(&text, "w", (cookie_io_functions_t){.write = writeBatchOutput, .close = closeBatchOutput});
+	volume = &image;
+
+	error = openVolume(path);
+	if (error != NULL)
+	{
+		fprintf(image.out, "{\"image\":\"%s\",\"error\":\"%s\"}\n", image.batchName, error);
+		succeeded = false;
+	}
+	else
+	{
+		if (strcmp(command, "info") == 0)
+		{
+			printInfo();
+		}
+		else if (strcmp(command, "list") == 0)
+		{
+			// the sidecar always sits next to its image, one --index path can not name the sidecar of every image
+			if (options.useIndex)
+			{
+				snprintf(indexPath, sizeof(indexPath), "%s.idx", path);
+				openIndex(indexPath);
+			}
+			listVolume(volume->bootSector.BPB_RootClus & MASK_FIRST_HEX);
+		}
+		else if (checkVolume() > 0)
+		{
+			succeeded = false;
+		}
+
+		closeVolume();
+	}
+
+	fclose(image.out);
+
+	free(text.data);
+	free(name.data);
+	pthread_mutex_destroy(&image.fatCacheLock);
+	pthread_mutex_destroy(&image.dentryLock);
+	volume = &mainVolume;
+
+	return succeeded;
+}
+
+/**
+ * writeBatchOutput
+ *
+ * Write function of a batch image's output stream. Bytes are kept in the image's text buffer, and once it holds BATCH_FLUSH_SIZE every whole line in it is written to stdout under batchLock, so one image never holds its entire listing in memory.
+ * @param void* cookie - the image's struct TextBuffer
+ * @param const char* data - bytes written to the stream
+ * @param size_t length - number of bytes
+ * @returns ssize_t - length, the bytes are always taken
+ */
+ssize_t writeBatchOutput(void *cookie, const char *data, size_t length)
+{
+	struct TextBuffer *text = cookie;
+	const char *lineEnd;
+	size_t lines;
+
+	appendBytes(text, data, length);
+	if (text->length < BATCH_FLUSH_SIZE)
+	{
+		return length;
+	}
+
+	// a partial line at the end waits for the rest of it
+	lineEnd = memrchr(text->data, '\n', text->length);
+	if (lineEnd == NULL)
+	{
+		return length;
+	}
+	lines = lineEnd + 1 - text->data;
+
+	pthread_mutex_lock(&batchLock);
+	fwrite(text->data, 1, lines, stdout);
+	pthread_mutex_unlock(&batchLock);
+
+	memmove(text->data, text->data + lines, text->length - lines);
+	text->length -= lines;
+
+	return length;
+}
+
+/**
+ * closeBatchOutput
+ *
+ * Close function of a batch image's output stream, writes whatever is left in the image's text buffer to stdout under batchLock
+ * @param void* cookie - the image's struct TextBuffer
+ * @returns int - 0
+ */
+int closeBatchOutput(void *cookie)
+{
+	struct TextBuffer *text = cookie;
+
+	if (text->length > 0)
+	{
+		pthread_mutex_lock(&batchLock);
+		fwrite(text->data, 1, text->length, stdout);
+		pthread_mutex_unlock(&batchLock);
+		text->length = 0;
+	}
+
+	return 0;
+}
+
+/**
+ * fat32Open
+ *
+ * Opens an image as a volume of its own and reads its boot sector and FSInfo, see libfat32.h
+ * @param const char* path - path to the image file or block device
+ * @returns fat32Volume* - the volume, NULL if the image could not be opened
+ */
+fat32Volume *fat32Open(const char *path)
+{
+	struct fat32Volume *handle = calloc(1, sizeof(struct fat32Volume));
+	struct Volume *previous = volume;
+
+	handle->volume.fd = -1;
+	handle->volume.threads = 1;
+	handle->volume.out = stderr;
+	pthread_mutex_init(&handle->volume.fatCacheLock, NULL);
+	pthread_mutex_init(&handle->volume.dentryLock, NULL);
+	handle->path = strdup(path);
+	handle->volume.imageName = handle->path;
+
+	volume = &handle->volume;
+	if (!openImage(path))
+	{
+		volume = previous;
+		pthread_mutex_destroy(&handle->volume.fatCacheLock);
+		pthread_mutex_destroy(&handle->volume.dentryLock);
+		free(handle->path);
+		free(handle);
+		return NULL;
+	}
+	readVolumeHeaders();
+	volume = previous;
+
+	return handle;
+}
+
+/**
+ * fat32Validate
+ *
+ * Validates a volume and loads its FAT, see libfat32.h
+ * @param fat32Volume* handle - volume from fat32Open
+ * @returns const char* - NULL if the volume can be read, otherwise what failed
+ */
+const char *fat32Validate(fat32Volume *handle)
+{
+	struct Volume *previous = volume;
+	const char *error;
+
+	if (handle->validated)
+	{
+		return NULL;
+	}
+
+	volume = &handle->volume;
+	error = validateVolume();
+	volume = previous;
+
+	handle->validated = error == NULL;
+	return error;
+}
+
+/**
+ * fat32Close
+ *
+ * Frees everything a volume holds and closes its image, see libfat32.h
+ * @param fat32Volume* handle - volume to close
+ * @returns void - NA
+ */
+void fat32Close(fat32Volume *handle)
+{
+	struct Volume *previous = volume;
+
+	volume = &handle->volume;
+	closeVolume();
+	volume = previous;
+
+	pthread_mutex_destroy(&handle->volume.fatCacheLock);
+	pthread_mutex_destroy(&handle->volume.dentryLock);
+	free(handle->path);
+	free(handle);
+}
+
+/**
+ * fat32Stat
+ *
+ * Looks up a path one part at a time, reading each directory on the way like fat32ReadDir does, see libfat32.h
+ * @param fat32Volume* handle - validated volume
+ * @param const char* path - parts separated by /
+ * @param fat32Entry* entry - filled in when the path is found
+ * @returns bool - true if the path was found
+ */
+bool fat32Stat(fat32Volume *handle, const char *path, fat32Entry *entry)
+{
+	struct fat32Dir dir = {0};
+	const char *part = path + strspn(path, "/");
+	bool found = true;
+
+	if (!handle->validated)
+	{
+		return false;
+	}
+
+	// the root has no directory entry of its own
+	memset(entry, 0, sizeof(fat32Entry));
+	strcpy(entry->name, "/");
+	strcpy(entry->shortName, "/");
+	entry->attributes = ATTR_DIRECTORY;
+	entry->isDirectory = true;
+	entry->firstCluster = handle->volume.bootSector.BPB_RootClus & MASK_FIRST_HEX;
+
+	dir.handle = handle;
+	while (*part != '\0' && found)
+	{
+		size_t partLength = strcspn(part, "/");
+		char name[FAT32_NAME_SIZE];
+
+		if (!entry->isDirectory || partLength >= sizeof(name))
+		{
+			return false;
+		}
+		memcpy(name, part, partLength);
+		name[partLength] = '\0';
+
+		openFat32Dir(&dir, entry->firstCluster);
+		found = false;
+		while (!found && fat32ReadDir(&dir, entry))
+		{
+			found = strcasecmp(entry->name, name) == 0 || strcasecmp(entry->shortName, name) == 0;
+		}
+		freeDirCluster(&dir.iterator.dir);
+
+		part += partLength;
+		part += strspn(part, "/");
+	}
+
+	return found;
+}
+
+/**
+ * fat32OpenDir
+ *
+ * Starts reading a directory, see libfat32.h
+ * @param fat32Volume* handle - validated volume
+ * @param const char* path - path to the directory
+ * @returns fat32Dir* - the directory, NULL if the path is not a directory
+ */
+fat32Dir *fat32OpenDir(fat32Volume *handle, const char *path)
+{
+	struct fat32Dir *dir;
+	fat32Entry entry;
+
+	if (!fat32Stat(handle, path, &entry) || !entry.isDirectory)
+	{
+		return NULL;
+	}
+
+	dir = calloc(1, sizeof(struct fat32Dir));
+	dir->handle = handle;
+	openFat32Dir(dir, entry.firstCluster);
+
+	return dir;
+}
+
+/**
+ * openFat32Dir
+ *
+ * Points a directory handle's iterator at the first cluster of a directory
+ * @param struct fat32Dir* dir - directory handle, its cluster buffer is kept
+ * @param uint32_t clusterNum - first cluster of the directory
+ * @returns void - NA
+ */
+void openFat32Dir(struct fat32Dir *dir, uint32_t clusterNum)
+{
+	struct Volume *previous = volume;
+
+	volume = &dir->handle->volume;
+	openDirIterator(&dir->iterator, clusterNum, clusterNum != (volume->bootSector.BPB_RootClus & MASK_FIRST_HEX));
+	volume = previous;
+}
+
+/**
+ * fat32ReadDir
+ *
+ * Reads the next visible entry of a directory, see libfat32.h
+ * @param fat32Dir* dir - directory from fat32OpenDir
+ * @param fat32Entry* entry - filled in with the next entry
+ * @returns bool - false once there are no more entries
+ */
+bool fat32ReadDir(fat32Dir *dir, fat32Entry *entry)
+{
+	struct Volume *previous = volume;
+	struct DecodedEntry decoded;
+	struct TextBuffer shortName = {0};
+	const struct DirInfo *info;
+
+	volume = &dir->handle->volume;
+	if (nextDirEntry(&dir->iterator, &decoded) == ENTRY_END)
+	{
+		volume = previous;
+		return false;
+	}
+	volume = previous;
+
+	info = decoded.info;
+	appendShortName(&shortName, &decoded);
+	appendBytes(&shortName, "", 1);
+
+	memset(entry, 0, sizeof(fat32Entry));
+	snprintf(entry->shortName, sizeof(entry->shortName), "%s", shortName.data);
+	if (decoded.longName != NULL)
+	{
+		entry->name[decodeLongName(&decoded, entry->name)] = '\0';
+	}
+	else
+	{
+		strcpy(entry->name, entry->shortName);
+	}
+	entry->attributes = info->dir_attr;
+	entry->isDirectory = (info->dir_attr & ATTR_DIRECTORY) == ATTR_DIRECTORY;
+	entry->size = entry->isDirectory ? 0 : info->dir_file_size;
+	entry->firstCluster = decoded.firstCluster;
+	entry->created = fatTimeToEpoch(info->dir_crt_date, info->dir_crt_time);
+	entry->modified = fatTimeToEpoch(info->dir_wrt_date, info->dir_wrt_time);
+	entry->accessed = fatTimeToEpoch(info->dir_last_access_time, 0);
+
+	free(shortName.data);
+	return true;
+}
+
+/**
+ * fat32CloseDir
+ *
+ * Stops reading a directory, see libfat32.h
+ * @param fat32Dir* dir - directory to close
+ * @returns void - NA
+ */
+void fat32CloseDir(fat32Dir *dir)
+{
+	freeDirCluster(&dir->iterator.dir);
+	free(dir);
+}
+
+/**
+ * fat32OpenFile
+ *
+ * Opens a file and builds its extents, see libfat32.h
+ * @param fat32Volume* handle - validated volume
+ * @param const char* path - path to the file
+ * @returns fat32File* - the file, NULL if the path is not a file
+ */
+fat32File *fat32OpenFile(fat32Volume *handle, const char *path)
+{
+	struct Volume *previous = volume;
+	struct fat32File *file;
+	fat32Entry entry;
+
+	if (!fat32Stat(handle, path, &entry) || entry.isDirectory)
+	{
+		return NULL;
+	}
+
+	file = calloc(1, sizeof(struct fat32File));
+	file->handle = handle;
+
+	volume = &handle->volume;
+	buildExtents(entry.firstCluster, entry.size, &file->list);
+	volume = previous;
+
+	// the extent ends are built lazily, doing it now means readers never race to build them
+	findExtent(&file->list, 0);
+
+	return file;
+}
+
+/**
+ * fat32Read
+ *
+ * Copies a range of a file out of the extents it covers, see libfat32.h
+ * @param fat32File* file - file from fat32OpenFile
+ * @param void* buffer - where to put the bytes
+ * @param size_t length - most bytes to read
+ * @param uint64_t offset - first byte of the file to read
+ * @returns ssize_t - bytes read, 0 at or past the end of the file, -1 if the image could not be read
+ */
+ssize_t fat32Read(fat32File *file, void *buffer, size_t length, uint64_t offset)
+{
+	struct Volume *previous = volume;
+	struct ExtentList slice = {0};
+	ssize_t total = 0;
+	ssize_t result;
+
+	sliceExtents(&file->list, offset, length, &slice);
+
+	volume = &file->handle->volume;
+	for (size_t i = 0; i < slice.count; i++)
+	{
+		// readImage zero fills whatever the image could not give, so only count what really came from it and stop there
+		result = readImage((char *)buffer + total, slice.extents[i].length, slice.extents[i].offset);
+		total += result;
+		if ((uint64_t)result < slice.extents[i].length)
+		{
+			break;
+		}
+	}
+	volume = previous;
+
+	// bytes were asked for inside the file but none came back, which is not the end of the file
+	if (total == 0 && slice.count > 0)
+	{
+		total = -1;
+	}
+
+	freeExtents(&slice);
+	return total;
+}
+
+/**
+ * fat32CloseFile
+ *
+ * Closes a file, see libfat32.h
+ * @param fat32File* file - file to close
+ * @returns void - NA
+ */
+void fat32CloseFile(fat32File *file)
+{
+	freeExtents(&file->list);
+	free(file);
+}
+
+/**
+ * parseOptions
+ *
+ * Pulls every argument starting with -- out of argv and stores it in options, leaving the positional arguments in order
+ * @param int argc - number of parameters
+ * @param char* argv - command line arguments, compacted in place
+ * @returns int - number of positional arguments left in argv
+ */
+int parseOptions(int argc, char *argv[])
+{
+	int positional = 0;
+
+	for (int i = 0; i < argc; i++)
+	{
+		// the program name and anything that is not an option stays where it is
+		if (i == 0 || strncmp(argv[i], "--", 2) != 0)
+		{
+			argv[positional++] = argv[i];
+		}
+		else if (strncmp(argv[i], "--fat-cache=", 12) == 0)
+		{
+			options.fatCacheLimitKB = strtol(argv[i] + 12, NULL, 10);
+		}
+		else if (strncmp(argv[i], "--threads=", 10) == 0)
+		{
+			options.threads = atoi(argv[i] + 10);
+			if (options.threads < 1)
+			{
+				options.threads = 1;
+			}
+		}
+		else if (strncmp(argv[i], "--readers=", 10) == 0)
+		{
+			options.readers = (atoi(argv[i] + 10) < 1) ? 1 : atoi(argv[i] + 10);
+		}
+		else if (strncmp(argv[i], "--writers=", 10) == 0)
+		{
+			options.writers = (atoi(argv[i] + 10) < 1) ? 1 : atoi(argv[i] + 10);
+		}
+		else if (strncmp(argv[i], "--io-depth=", 11) == 0)
+		{
+			options.ioDepth = (atoi(argv[i] + 11) < 1) ? 1 : atoi(argv[i] + 11);
+		}
+		else if (strcmp(argv[i], "--format=text") == 0)
+		{
+			options.listFormat = LIST_FORMAT_TEXT;
+		}
+		else if (strcmp(argv[i], "--format=ndjson") == 0)
+		{
+			options.listFormat = LIST_FORMAT_NDJSON;
+		}
+		else if (strcmp(argv[i], "--format=binary") == 0)
+		{
+			options.listFormat = LIST_FORMAT_BINARY;
+		}
+		else if (strcmp(argv[i], "--scan") == 0)
+		{
+			options.scanFat = true;
+		}
+		else if (strncmp(argv[i], "--name=", 7) == 0)
+		{
+			findFilter.name = argv[i] + 7;
+		}
+		else if (strncmp(argv[i], "--path=", 7) == 0)
+		{
+			// each part of the glob is matched against one level, so * never reaches across a /
+			for (char *part = strtok(argv[i] + 7, "/"); part != NULL; part = strtok(NULL, "/"))
+			{
+				findFilter.pathParts = realloc(findFilter.pathParts, (findFilter.pathPartCount + 1) * sizeof(char *));
+				findFilter.pathParts[findFilter.pathPartCount++] = part;
+			}
+		}
+		else if (strncmp(argv[i], "--min-size=", 11) == 0)
+		{
+			findFilter.minSize = strtoul(argv[i] + 11, NULL, 10);
+		}
+		else if (strncmp(argv[i], "--max-size=", 11) == 0)
+		{
+			findFilter.maxSize = strtoul(argv[i] + 11, NULL, 10);
+		}
+		else if (strncmp(argv[i], "--modified-after=", 17) == 0 || strncmp(argv[i], "--modified-before=", 18) == 0)
+		{
+			bool after = argv[i][11] == 'a';
+
+			if (!parseFatDate(argv[i] + (after ? 17 : 18), after ? &findFilter.modifiedAfter : &findFilter.modifiedBefore))
+			{
+				printf("Bad date in %s, exiting program.", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strncmp(argv[i], "--attr=", 7) == 0 || strncmp(argv[i], "--no-attr=", 10) == 0)
+		{
+			bool set = argv[i][2] == 'a';
+
+			if (!parseAttributes(argv[i] + (set ? 7 : 10), set ? &findFilter.attributesSet : &findFilter.attributesClear))
+			{
+				printf("Bad attributes in %s, exiting program.", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if (strcmp(argv[i], "--type=f") == 0)
+		{
+			findFilter.type = ENTRY_FILE;
+		}
+		else if (strcmp(argv[i], "--type=d") == 0)
+		{
+			findFilter.type = ENTRY_DIRECTORY;
+		}
+		else if (strcmp(argv[i], "--direct") == 0)
+		{
+			options.direct = true;
+		}
+		else if (strcmp(argv[i], "--prefetch=none") == 0)
+		{
+			options.prefetch = false;
+		}
+		else if (strncmp(argv[i], "--offset=", 9) == 0)
+		{
+			options.rangeOffset = strtoull(argv[i] + 9, NULL, 10);
+		}
+		else if (strncmp(argv[i], "--length=", 9) == 0)
+		{
+			options.rangeLength = strtoull(argv[i] + 9, NULL, 10);
+		}
+		else if (strcmp(argv[i], "--stats") == 0)
+		{
+			options.stats = true;
+		}
+		else if (strncmp(argv[i], "--stats=", 8) == 0)
+		{
+			options.statsPath = argv[i] + 8;
+		}
+		else if (strcmp(argv[i], "--index=none") == 0)
+		{
+			options.useIndex = false;
+		}
+		else if (strncmp(argv[i], "--index=", 8) == 0)
+		{
+			options.indexPath = argv[i] + 8;
+		}
+		else if (strcmp(argv[i], "--hash=sha256") == 0)
+		{
+			options.hash = HASH_SHA256;
+		}
+		else if (strcmp(argv[i], "--hash=xxh64") == 0)
+		{
+			options.hash = HASH_XXH64;
+		}
+		else if (strncmp(argv[i], "--hash=", 7) == 0)
+		{
+			printf("Unknown hash algorithm in %s, exiting program.", argv[i]);
+			exit(EXIT_FAILURE);
+		}
+		else if (strcmp(argv[i], "--io=auto") == 0)
+		{
+			options.backend = BACKEND_AUTO;
+		}
+		else if (strcmp(argv[i], "--io=pread") == 0)
+		{
+			options.backend = BACKEND_PREAD;
+		}
+		else if (strcmp(argv[i], "--io=mmap") == 0)
+		{
+			options.backend = BACKEND_MMAP;
+		}
+		else if (strcmp(argv[i], "--io=uring") == 0)
+		{
+			options.backend = BACKEND_URING;
+		}
+		else
+		{
+			printf("Unknown option %s, exiting program.", argv[i]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	argv[positional] = NULL;
+	return positional;
+}
+
+/**
+ * startPhase
+ *
+ * Charges the time since the last phase change to the phase the main thread was in and moves it on to the next one
+ * @param enum StatsPhase phase - phase starting now, PHASE_COUNT when the run is over
+ * @returns void - NA
+ */
+void startPhase(enum StatsPhase phase)
+{
+	uint64_t now = nowNanoseconds();
+
+	if (currentPhaseStart != 0 && currentPhase < PHASE_COUNT)
+	{
+		phaseNanoseconds[currentPhase] += now - currentPhaseStart;
+	}
+
+	currentPhase = phase;
+	currentPhaseStart = now;
+}
+
+/**
+ * mergeThreadStats
+ *
+ * Adds the calling thread's counters to totalStats and clears them, so calling it twice never counts anything twice. Every worker thread calls this just before it returns.
+ * @returns void - NA
+ */
+void mergeThreadStats(void)
+{
+	pthread_mutex_lock(&statsLock);
+
+	totalStats.readCalls += threadStats.readCalls;
+	totalStats.seekCalls += threadStats.seekCalls;
+	totalStats.bytesRead += threadStats.bytesRead;
+	totalStats.mappedBytes += threadStats.mappedBytes;
+	totalStats.fatLookups += threadStats.fatLookups;
+	totalStats.fatCacheHits += threadStats.fatCacheHits;
+	totalStats.dirClusters += threadStats.dirClusters;
+	totalStats.longNameEntries += threadStats.longNameEntries;
+	totalStats.prefetchHints += threadStats.prefetchHints;
+
+	pthread_mutex_unlock(&statsLock);
+
+	memset(&threadStats, 0, sizeof(threadStats));
+}
+
+/**
+ * reportStats
+ *
+ * Registered with atexit for --stats. Prints the merged counters and phase times to stderr, so they never mix with a listing or a streamed file on stdout, or writes them to the --stats file as JSON.
+ * @returns void - NA
+ */
+void reportStats(void)
+{
+	const char *phaseNames[PHASE_COUNT] = {"validate", "traverse", "copy"};
+	double hitRate;
+	FILE *out;
+
+	startPhase(PHASE_COUNT);
+	mergeThreadStats();
+
+	hitRate = (totalStats.fatLookups > 0) ? (100.0 * totalStats.fatCacheHits) / totalStats.fatLookups : 100.0;
+
+	if (options.statsPath == NULL)
+	{
+		fprintf(stderr, "\nRead calls %" PRIu64 "\n", totalStats.readCalls);
+		fprintf(stderr, "Seek calls %" PRIu64 "\n", totalStats.seekCalls);
+		fprintf(stderr, "Bytes read %" PRIu64 "\n", totalStats.bytesRead);
+		fprintf(stderr, "Bytes mapped %" PRIu64 "\n", totalStats.mappedBytes);
+		fprintf(stderr, "FAT lookups %" PRIu64 "\n", totalStats.fatLookups);
+		fprintf(stderr, "FAT cache hits %" PRIu64 " (%.1f%%)\n", totalStats.fatCacheHits, hitRate);
+		fprintf(stderr, "Directory clusters %" PRIu64 "\n", totalStats.dirClusters);
+		fprintf(stderr, "Long name entries %" PRIu64 "\n", totalStats.longNameEntries);
+		fprintf(stderr, "Prefetch hints %" PRIu64 "\n", totalStats.prefetchHints);
+		for (int i = 0; i < PHASE_COUNT; i++)
+		{
+			fprintf(stderr, "Time in %s %.3f ms\n", phaseNames[i], phaseNanoseconds[i] / 1e6);
+		}
+		return;
+	}
+
+	out = fopen(options.statsPath, "w");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Could not write stats to %s.\n", options.statsPath);
+		return;
+	}
+
+	fprintf(out, "{\"read_calls\":%" PRIu64 ",\"seek_calls\":%" PRIu64 ",\"bytes_read\":%" PRIu64 ",\"bytes_mapped\":%" PRIu64, totalStats.readCalls, totalStats.seekCalls, totalStats.bytesRead, totalStats.mappedBytes);
+	fprintf(out, ",\"fat_lookups\":%" PRIu64 ",\"fat_cache_hits\":%" PRIu64 ",\"dir_clusters\":%" PRIu64 ",\"long_name_entries\":%" PRIu64, totalStats.fatLookups, totalStats.fatCacheHits, totalStats.dirClusters, totalStats.longNameEntries);
+	fprintf(out, ",\"prefetch_hints\":%" PRIu64, totalStats.prefetchHints);
+	fprintf(out, ",\"threads\":%d,\"fat_cache_kb\":%ld", options.threads, options.fatCacheLimitKB);
+	for (int i = 0; i < PHASE_COUNT; i++)
+	{
+		fprintf(out, ",\"%s_ms\":%.3f", phaseNames[i], phaseNanoseconds[i] / 1e6);
+	}
+	fprintf(out, "}\n");
+
+	fclose(out);
+}
+
+/**
+ * nowNanoseconds
+ *
+ * Reads the monotonic clock
+ * @returns uint64_t - nanoseconds since some fixed point in the past
+ */
+uint64_t nowNanoseconds(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+/**
+ * printInfo
+ *
+ * Prints information regarding the FAT32 volume found in boot and info sector, with --scan the free space comes from the FAT itself
+ * @returns void - NA
+ */
+void printInfo(void)
+{
+	uint32_t freeClusters = volume->infoSector.free_count;
+	long freeSpace;
+	long totalSpace;
+	long totalUsableSpace;
+	long clusterSizeBytes;
+	char *driveName;
+	char *OEMName;
+
+	// drive name
+	driveName = malloc((BS_VolLab_LENGTH + 1) * sizeof(char));
+	memcpy(driveName, volume->bootSector.BS_VolLab, 11);
+	driveName[BS_VolLab_LENGTH] = '\0';
+
+	// OEM name
 	OEMName = malloc((BS_OEMName_LENGTH + 1) * sizeof(char));
-	memcpy(OEMName, bootSector.BS_OEMName, 8);
+	memcpy(OEMName, volume->bootSector.BS_OEMName, 8);
 	OEMName[BS_OEMName_LENGTH] = '\0';
 
-	// free space
-	freeSpace = (infoSector.free_count * bootSector.BPB_BytesPerSec * bootSector.BPB_SecPerClus) / BYTES_PER_KB;
+	// FSInfo is only a hint and is often stale or 0xFFFFFFFF, so count for ourselves when asked
+	if (options.scanFat)
+	{
+		freeClusters = countFreeClusters();
+	}
+
+	// free space
+	freeSpace = ((uint64_t)freeClusters * volume->bootSector.BPB_BytesPerSec * volume->bootSector.BPB_SecPerClus) / BYTES_PER_KB;
+
+	// total space
+	totalSpace = (volume->bootSector.BPB_TotSec32 * volume->bootSector.BPB_BytesPerSec) / BYTES_PER_KB;
+
+	// total usable space
+	totalUsableSpace = ((volume->bootSector.BPB_TotSec32 - volume->bootSector.BPB_RsvdSecCnt - (volume->bootSector.BPB_FATSz32 * volume->bootSector.BPB_NumFATs)) * volume->bootSector.BPB_BytesPerSec) / BYTES_PER_KB;
+
+	// cluster size in bytes
+	clusterSizeBytes = volume->bootSector.BPB_BytesPerSec * volume->bootSector.BPB_SecPerClus;
+
+	// a batch gets the same numbers as one line of JSON
+	if (volume->batchName != NULL)
+	{
+		struct TextBuffer line = {0};
+
+		appendText(&line, "{\"image\":\"%s\",\"drive_name\":\"", volume->batchName);
+		appendJsonString(&line, driveName, strlen(driveName));
+		appendString(&line, "\",\"oem_name\":\"");
+		appendJsonString(&line, OEMName, strlen(OEMName));
+		appendText(&line, "\",\"free_kb\":%ld,\"total_kb\":%ld,\"usable_kb\":%ld,\"sectors_per_cluster\":%u,\"cluster_bytes\":%ld",
+				   freeSpace, totalSpace, totalUsableSpace, volume->bootSector.BPB_SecPerClus, clusterSizeBytes);
+		if (options.scanFat)
+		{
+			appendText(&line, ",\"free_clusters\":%u,\"used_clusters\":%u,\"fsinfo_free_count\":%u", freeClusters, dataClusterCount() - freeClusters,
+					   volume->infoSector.free_count);
+		}
+		appendString(&line, "}\n");
+
+		fwrite(line.data, 1, line.length, volume->out);
+		free(line.data);
+		free(driveName);
+		free(OEMName);
+		return;
+	}
+
+	printf("Drive name: %s\n", driveName);
+	printf("OEM name: %s\n", OEMName);
+	printf("Free space is %ld KB\n", freeSpace);
+	printf("Total space is %ld KB\n", totalSpace);
+	printf("Total usable space %ld KB\n", totalUsableSpace);
+	printf("Cluster size in sectors %i\n", volume->bootSector.BPB_SecPerClus);
+	printf("Cluster size is %ld bytes\n", clusterSizeBytes);
+
+	if (options.scanFat)
+	{
+		printf("Free clusters %u\n", freeClusters);
+		printf("Used clusters %u\n", dataClusterCount() - freeClusters);
+		if (volume->infoSector.free_count != freeClusters)
+		{
+			printf("FSInfo free count %u does not match the FAT\n", volume->infoSector.free_count);
+		}
+	}
+
+	free(driveName);
+	free(OEMName);
+}
+
+/**
+ * countFreeClusters
+ *
+ * Counts the free clusters of the volume straight from the FAT instead of trusting FSInfo, splitting the FAT into one range per --threads worker
+ * @returns uint32_t - number of data clusters whose FAT entry is 0
+ */
+uint32_t countFreeClusters(void)
+{
+	int threadCount;
+	struct FatScan *scans = splitFatScan(&threadCount);
+	uint64_t freeCount = 0;
+
+	runFatScan(scans, threadCount, scanFatRange);
+
+	for (int i = 0; i < threadCount; i++)
+	{
+		freeCount += scans[i].freeCount;
+	}
+
+	free(scans);
+	return freeCount;
+}
+
+/**
+ * splitFatScan
+ *
+ * Splits the FAT entries of the data clusters into one range per --threads worker, with at least a page per range so tiny volumes do not pay for threads
+ * @param int* threadCount - filled in with the number of ranges
+ * @returns struct FatScan* - the ranges, the caller frees them
+ */
+struct FatScan *splitFatScan(int *threadCount)
+{
+	uint32_t endEntry = dataClusterCount() + 2; // data clusters are numbered from 2
+	uint32_t perThread;
+	struct FatScan *scans;
+
+	// a FAT can be shorter than the cluster count says, anything past its end has no entry to look at
+	if (endEntry > volume->fatCacheEntryCount)
+	{
+		endEntry = volume->fatCacheEntryCount;
+	}
+
+	*threadCount = volume->threads;
+	if ((uint64_t)*threadCount * volume->fatCacheEntriesPerPage > endEntry)
+	{
+		*threadCount = (endEntry + volume->fatCacheEntriesPerPage - 1) / volume->fatCacheEntriesPerPage;
+		*threadCount = (*threadCount < 1) ? 1 : *threadCount;
+	}
+	perThread = (endEntry - 2 + *threadCount - 1) / *threadCount;
+
+	scans = calloc(*threadCount, sizeof(struct FatScan));
+	for (int i = 0; i < *threadCount; i++)
+	{
+		scans[i].firstEntry = 2 + ((uint64_t)i * perThread < endEntry - 2 ? i * perThread : endEntry - 2);
+		scans[i].endEntry = (scans[i].firstEntry + (uint64_t)perThread < endEntry) ? scans[i].firstEntry + perThread : endEntry;
+	}
+
+	return scans;
+}
+
+/**
+ * runFatScan
+ *
+ * Runs a thread body over every range of a split FAT scan, the main thread takes the first range itself
+ * @param struct FatScan* scans - ranges from splitFatScan
+ * @param int threadCount - number of ranges
+ * @param void* (*body)(void*) - thread body, gets one struct FatScan
+ * @returns void - NA
+ */
+void runFatScan(struct FatScan *scans, int threadCount, void *(*body)(void *))
+{
+	pthread_t *threads = malloc(threadCount * sizeof(pthread_t));
+
+	for (int i = 1; i < threadCount; i++)
+	{
+		pthread_create(&threads[i], NULL, body, &scans[i]);
+	}
+	body(&scans[0]);
+
+	for (int i = 1; i < threadCount; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+}
+
+/**
+ * scanFatRange
+ *
+ * Thread body for countFreeClusters, counts the zero entries in one range of the FAT page by page
+ * @param void* arg - the struct FatScan to fill in
+ * @returns void* - NULL
+ */
+void *scanFatRange(void *arg)
+{
+	struct FatScan *scan = arg;
+	uint32_t *scratch = NULL; // only used when the FAT is paged in on demand
+	uint32_t entry = scan->firstEntry;
+
+	while (entry < scan->endEntry)
+	{
+		uint32_t pageNum = entry / volume->fatCacheEntriesPerPage;
+		uint32_t pageStart = pageNum * volume->fatCacheEntriesPerPage;
+		uint32_t pageEnd = (pageStart + volume->fatCacheEntriesPerPage < scan->endEntry) ? pageStart + volume->fatCacheEntriesPerPage : scan->endEntry;
+		const uint32_t *page = peekFatPage(pageNum, &scratch);
+
+		scan->freeCount += countZeroEntries(page + (entry - pageStart), pageEnd - entry);
+		entry = pageEnd;
+	}
+
+	free(scratch);
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * dataClusterCount
+ *
+ * Works out how many clusters the data region holds
+ * @returns uint32_t - number of data clusters
+ */
+uint32_t dataClusterCount(void)
+{
+	if (volume->bootSector.BPB_SecPerClus == 0 || volume->bootSector.BPB_TotSec32 <= volume->dataSectorLocationInSectors)
+	{
+		return 0;
+	}
+
+	return (volume->bootSector.BPB_TotSec32 - volume->dataSectorLocationInSectors) / volume->bootSector.BPB_SecPerClus;
+}
+
+/**
+ * countZeroEntries
+ *
+ * Counts the FAT entries that are 0 once the reserved top 4 bits are masked off, using the widest vector unit the CPU has
+ * @param const uint32_t* entries - FAT entries to look at
+ * @param size_t count - number of entries
+ * @returns size_t - number of free entries
+ */
+size_t countZeroEntries(const uint32_t *entries, size_t count)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+	{
+		return countZeroEntriesAvx2(entries, count);
+	}
+#elif defined(__aarch64__)
+	return countZeroEntriesNeon(entries, count);
+#endif
+
+	return countZeroEntriesScalar(entries, count);
+}
+
+/**
+ * countZeroEntriesScalar
+ *
+ * Counts free FAT entries one at a time, used for the tail of the vector kernels and on CPUs without them
+ * @param const uint32_t* entries - FAT entries to look at
+ * @param size_t count - number of entries
+ * @returns size_t - number of free entries
+ */
+size_t countZeroEntriesScalar(const uint32_t *entries, size_t count)
+{
+	size_t zeros = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		zeros += (entries[i] & MASK_FIRST_HEX) == 0;
+	}
+
+	return zeros;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * countZeroEntriesAvx2
+ *
+ * Counts free FAT entries 8 at a time, every lane of the accumulator counts the zeros it has seen by subtracting the all ones compare result
+ * @param const uint32_t* entries - FAT entries to look at
+ * @param size_t count - number of entries
+ * @returns size_t - number of free entries
+ */
+__attribute__((target("avx2"))) size_t countZeroEntriesAvx2(const uint32_t *entries, size_t count)
+{
+	const __m256i mask = _mm256_set1_epi32(MASK_FIRST_HEX);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i counts = _mm256_setzero_si256();
+	uint32_t lanes[8];
+	size_t zeros = 0;
+	size_t i = 0;
+
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i values = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(entries + i)), mask);
+		counts = _mm256_sub_epi32(counts, _mm256_cmpeq_epi32(values, zero));
+	}
+
+	_mm256_storeu_si256((__m256i *)lanes, counts);
+	for (int lane = 0; lane < 8; lane++)
+	{
+		zeros += lanes[lane];
+	}
+
+	return zeros + countZeroEntriesScalar(entries + i, count - i);
+}
+#endif
+
+#if defined(__aarch64__)
+/**
+ * countZeroEntriesNeon
+ *
+ * Counts free FAT entries 4 at a time, every lane of the accumulator counts the zeros it has seen by subtracting the all ones compare result
+ * @param const uint32_t* entries - FAT entries to look at
+ * @param size_t count - number of entries
+ * @returns size_t - number of free entries
+ */
+size_t countZeroEntriesNeon(const uint32_t *entries, size_t count)
+{
+	const uint32x4_t mask = vdupq_n_u32(MASK_FIRST_HEX);
+	const uint32x4_t zero = vdupq_n_u32(0);
+	uint32x4_t counts = vdupq_n_u32(0);
+	size_t i = 0;
+
+	for (; i + 4 <= count; i += 4)
+	{
+		uint32x4_t values = vandq_u32(vld1q_u32(entries + i), mask);
+		counts = vsubq_u32(counts, vceqq_u32(values, zero));
+	}
+
+	return vaddvq_u32(counts) + countZeroEntriesScalar(entries + i, count - i);
+}
+#endif
+
+/**
+ * checkVolume
+ *
+ * Looks for cross-linked clusters, loops, chains running into bad, free or invalid clusters, sizes that do not match their chain, and orphaned chains. Every chain is walked once against a shared ownership bitmap, so the whole check is linear in the size of the volume. Directories are walked on the main thread, file chains and the FAT passes run on --threads workers.
+ * @returns size_t - number of problems found
+ */
+size_t checkVolume(void)
+{
+	struct CheckFile *files = NULL;
+	size_t fileCount = 0;
+	size_t fileCapacity = 0;
+	size_t directoryCount = 0;
+	size_t problems = 0;
+	size_t bitmapWords;
+	uint64_t orphanClusters = 0;
+	uint64_t orphanChains = 0;
+	struct CheckClusters clusters = {0}; // clusters of the directory being read
+	struct FatScan *scans;
+	struct CheckRun run = {0};
+	pthread_t *threads;
+	int threadCount;
+
+	volume->checkEndCluster = dataClusterCount() + 2;
+	if (volume->checkEndCluster > volume->fatCacheEntryCount)
+	{
+		volume->checkEndCluster = volume->fatCacheEntryCount;
+	}
+	bitmapWords = (volume->checkEndCluster + 63) / 64;
+	volume->checkOwned = calloc(bitmapWords, sizeof(uint64_t));
+	volume->checkPointedTo = calloc(bitmapWords, sizeof(uint64_t));
+
+	// the root is the first directory to read, every directory found is added behind it so the list doubles as the queue
+	files = malloc(64 * sizeof(struct CheckFile));
+	fileCapacity = 64;
+	memset(&files[0], 0, sizeof(struct CheckFile));
+	files[0].path = strdup("/");
+	files[0].firstCluster = volume->bootSector.BPB_RootClus & MASK_FIRST_HEX;
+	files[0].isDirectory = true;
+	fileCount = 1;
+
+	for (size_t next = 0; next < fileCount; next++)
+	{
+		if (!files[next].isDirectory)
+		{
+			continue;
+		}
+
+		directoryCount++;
+		clusters.count = 0;
+		walkCheckChain(&files[next], &clusters);
+
+		for (size_t i = 0; i < clusters.count; i++)
+		{
+			struct DirCluster dir = {0};
+			bool endOfDirectory = false;
+
+			loadDirCluster(&dir, clusters.clusters[i]);
+
+			for (int j = 0; j < volume->entriesPerCluster && !endOfDirectory; j++)
+			{
+				const struct DirInfo *currentDir = (const struct DirInfo *)(dir.entries + (j * sizeof(struct DirInfo)));
+				struct CheckFile *found;
+				struct DecodedEntry decoded;
+				const char *parentPath = files[next].path;
+
+				if ((uint8_t)currentDir->dir_name[0] == 0x00)
+				{
+					endOfDirectory = true;
+					continue;
+				}
+
+				// hidden and system entries own clusters too, so only deleted entries, long names, labels and dot entries are left out
+				if ((uint8_t)currentDir->dir_name[0] == 0xE5 || currentDir->dir_name[0] == '.' ||
+					(currentDir->dir_attr & (ATTR_LONG_NAME_MASK)) == (ATTR_LONG_NAME) || (currentDir->dir_attr & ATTR_VOLUME_ID) == ATTR_VOLUME_ID)
+				{
+					continue;
+				}
+
+				if (fileCount == fileCapacity)
+				{
+					fileCapacity *= 2;
+					files = realloc(files, fileCapacity * sizeof(struct CheckFile));
+					parentPath = files[next].path;
+				}
+
+				decodeShortName(currentDir, &decoded);
+
+				found = &files[fileCount++];
+				memset(found, 0, sizeof(struct CheckFile));
+				found->firstCluster = decoded.firstCluster;
+				found->size = currentDir->dir_file_size;
+				found->isDirectory = (currentDir->dir_attr & ATTR_DIRECTORY) == ATTR_DIRECTORY;
+
+				// paths are short names like list prints them, the root's own / is left off
+				found->path = malloc(strlen(parentPath) + 16);
+				sprintf(found->path, "%s%s%s%s%s", (next == 0) ? "" : parentPath, decoded.givenName, (decoded.nameExtension[0] != '\0') ? "." : "",
+						decoded.nameExtension, found->isDirectory ? "/" : "");
+			}
+
+			freeDirCluster(&dir);
+		}
+	}
+
+	// walk every file's chain in parallel, each worker pulls the next file off a shared cursor
+	run.files = files;
+	run.fileCount = fileCount;
+	threads = malloc(volume->threads * sizeof(pthread_t));
+	for (int i = 1; i < volume->threads; i++)
+	{
+		pthread_create(&threads[i], NULL, checkWorker, &run);
+	}
+	checkWorker(&run);
+	for (int i = 1; i < volume->threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+
+	// two passes over the FAT, first mark every cluster something points at, then count in use clusters nobody owns
+	scans = splitFatScan(&threadCount);
+	runFatScan(scans, threadCount, markPointedTo);
+	runFatScan(scans, threadCount, countOrphans);
+	for (int i = 0; i < threadCount; i++)
+	{
+		orphanClusters += scans[i].orphanClusters;
+		orphanChains += scans[i].orphanChains;
+	}
+	free(scans);
+
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		if (files[i].problem != CHECK_OK)
+		{
+			printCheckProblem(&files[i]);
+			problems++;
+		}
+		free(files[i].path);
+	}
+
+	if (orphanClusters > 0)
+	{
+		problems++;
+	}
+
+	// a batch ends each image with one summary line instead of the two sentences
+	if (volume->batchName != NULL)
+	{
+		fprintf(volume->out, "{\"image\":\"%s\",\"files\":%zu,\"directories\":%zu,\"orphaned_clusters\":%" PRIu64 ",\"orphaned_chains\":%" PRIu64 ",\"problems\":%zu}\n",
+				volume->batchName, fileCount - directoryCount, directoryCount, orphanClusters, orphanChains, problems);
+	}
+	else
+	{
+		if (orphanClusters > 0)
+		{
+			printf("%" PRIu64 " orphaned clusters in %" PRIu64 " chains\n", orphanClusters, orphanChains);
+		}
+
+		printf("Checked %zu files and %zu directories, %zu problems found.\n", fileCount - directoryCount, directoryCount, problems);
+	}
+
+	free(files);
+	free(clusters.clusters);
+	free(volume->checkOwned);
+	free(volume->checkPointedTo);
+	volume->checkOwned = NULL;
+	volume->checkPointedTo = NULL;
+
+	return problems;
+}
+
+/**
+ * checkWorker
+ *
+ * Thread body for checkVolume, walks the chains of files until every file has been taken
+ * @param void* arg - the struct CheckRun
+ * @returns void* - NULL
+ */
+void *checkWorker(void *arg)
+{
+	struct CheckRun *run = arg;
+	size_t next;
+
+	while ((next = __atomic_fetch_add(&run->nextFile, 1, __ATOMIC_RELAXED)) < run->fileCount)
+	{
+		if (!run->files[next].isDirectory)
+		{
+			walkCheckChain(&run->files[next], NULL);
+		}
+	}
+
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * walkCheckChain
+ *
+ * Follows one chain, claiming every cluster in the ownership bitmap and stopping at the first problem. A cluster that is already claimed means a loop when it is earlier in this chain and a cross-link otherwise, so no chain is ever followed twice.
+ * @param struct CheckFile* file - file or directory to check, its problem and cluster count are filled in
+ * @param struct CheckClusters* clusters - filled in with the clusters of the chain, NULL if they are not needed
+ * @returns void - NA
+ */
+void walkCheckChain(struct CheckFile *file, struct CheckClusters *clusters)
+{
+	uint32_t clusterNum = file->firstCluster;
+	uint32_t previous = 0;
+	uint64_t expected = ((uint64_t)file->size + volume->bytesPerCluster - 1) / volume->bytesPerCluster;
+	uint32_t next;
+
+	// an empty file has no chain
+	if (clusterNum == 0 && !file->isDirectory)
+	{
+		if (file->size > 0)
+		{
+			file->problem = CHECK_SIZE_MISMATCH;
+		}
+		return;
+	}
+
+	while (true)
+	{
+		if (clusterNum < 2 || clusterNum >= volume->checkEndCluster)
+		{
+			file->problem = CHECK_INVALID_CLUSTER;
+			file->problemCluster = clusterNum;
+			return;
+		}
+
+		if (claimCluster(clusterNum))
+		{
+			file->problem = chainVisits(file->firstCluster, file->chainClusters, clusterNum) ? CHECK_LOOP : CHECK_CROSS_LINKED;
+			file->problemCluster = clusterNum;
+			return;
+		}
+
+		file->chainClusters++;
+		if (clusters != NULL)
+		{
+			if (clusters->count == clusters->capacity)
+			{
+				clusters->capacity = (clusters->capacity == 0) ? 16 : clusters->capacity * 2;
+				clusters->clusters = realloc(clusters->clusters, clusters->capacity * sizeof(uint32_t));
+			}
+			clusters->clusters[clusters->count++] = clusterNum;
+		}
+
+		previous = clusterNum;
+		next = getNextFatValue(clusterNum) & MASK_FIRST_HEX;
+
+		if (next >= END_OF_CLUSTER_CHAIN)
+		{
+			break;
+		}
+		if (next == BAD_CLUSTER || next == 0)
+		{
+			file->problem = (next == 0) ? CHECK_FREE_CLUSTER : CHECK_BAD_CLUSTER;
+			file->problemCluster = previous;
+			return;
+		}
+
+		clusterNum = next;
+	}
+
+	if (!file->isDirectory && file->chainClusters != expected)
+	{
+		file->problem = CHECK_SIZE_MISMATCH;
+	}
+}
+
+/**
+ * claimCluster
+ *
+ * Marks a cluster as owned in the check bitmap, safe to call from several threads at once
+ * @param uint32_t clusterNum - cluster to claim, below checkEndCluster
+ * @returns bool - true if the cluster was already owned
+ */
+bool claimCluster(uint32_t clusterNum)
+{
+	uint64_t bit = 1ULL << (clusterNum % 64);
+
+	return (__atomic_fetch_or(&volume->checkOwned[clusterNum / 64], bit, __ATOMIC_RELAXED) & bit) != 0;
+}
+
+/**
+ * chainVisits
+ *
+ * Checks whether a cluster is one of the first clusters of a chain, only called once a chain runs into a claimed cluster
+ * @param uint32_t firstCluster - first cluster of the chain
+ * @param uint64_t length - number of clusters of the chain to look at, all of them already claimed by this chain
+ * @param uint32_t clusterNum - cluster to look for
+ * @returns bool - true if the chain reaches clusterNum within length clusters
+ */
+bool chainVisits(uint32_t firstCluster, uint64_t length, uint32_t clusterNum)
+{
+	for (uint64_t i = 0; i < length; i++)
+	{
+		if (firstCluster == clusterNum)
+		{
+			return true;
+		}
+		firstCluster = getNextFatValue(firstCluster) & MASK_FIRST_HEX;
+	}
+
+	return false;
+}
+
+/**
+ * markPointedTo
+ *
+ * FAT pass for checkVolume, marks every cluster that an in use cluster points at
+ * @param void* arg - the struct FatScan range to look at
+ * @returns void* - NULL
+ */
+void *markPointedTo(void *arg)
+{
+	struct FatScan *scan = arg;
+	uint32_t *scratch = NULL;
+
+	for (uint32_t entry = scan->firstEntry; entry < scan->endEntry; entry++)
+	{
+		const uint32_t *page = peekFatPage(entry / volume->fatCacheEntriesPerPage, &scratch);
+		uint32_t pageEnd = (entry / volume->fatCacheEntriesPerPage + 1) * volume->fatCacheEntriesPerPage;
+
+		// stay on this page until it runs out so every entry does not pay for a lookup
+		for (; entry < scan->endEntry && entry < pageEnd; entry++)
+		{
+			uint32_t next = page[entry % volume->fatCacheEntriesPerPage] & MASK_FIRST_HEX;
+
+			if (next >= 2 && next < volume->checkEndCluster)
+			{
+				__atomic_fetch_or(&volume->checkPointedTo[next / 64], 1ULL << (next % 64), __ATOMIC_RELAXED);
+			}
+		}
+		entry--;
+	}
+
+	free(scratch);
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * countOrphans
+ *
+ * FAT pass for checkVolume, counts clusters that are in use but owned by nothing, and the ones among them nothing points at, which start an orphaned chain
+ * @param void* arg - the struct FatScan range to look at
+ * @returns void* - NULL
+ */
+void *countOrphans(void *arg)
+{
+	struct FatScan *scan = arg;
+	uint32_t *scratch = NULL;
+
+	for (uint32_t entry = scan->firstEntry; entry < scan->endEntry; entry++)
+	{
+		const uint32_t *page = peekFatPage(entry / volume->fatCacheEntriesPerPage, &scratch);
+		uint32_t pageEnd = (entry / volume->fatCacheEntriesPerPage + 1) * volume->fatCacheEntriesPerPage;
+
+		for (; entry < scan->endEntry && entry < pageEnd; entry++)
+		{
+			uint32_t value = page[entry % volume->fatCacheEntriesPerPage] & MASK_FIRST_HEX;
+			uint64_t bit = 1ULL << (entry % 64);
+
+			if (value == 0 || value == BAD_CLUSTER || (volume->checkOwned[entry / 64] & bit) != 0)
+			{
+				continue;
+			}
+
+			scan->orphanClusters++;
+			if ((volume->checkPointedTo[entry / 64] & bit) == 0)
+			{
+				scan->orphanChains++;
+			}
+		}
+		entry--;
+	}
+
+	free(scratch);
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * printCheckProblem
+ *
+ * Prints what is wrong with a file or directory
+ * @param const struct CheckFile* file - file with a problem
+ * @returns void - NA
+ */
+void printCheckProblem(const struct CheckFile *file)
+{
+	static const char *problemNames[] = {"ok", "cross_linked", "loop", "bad_cluster", "free_cluster", "invalid_cluster", "size_mismatch"};
+
+	// a batch gets one JSON line per problem, the kind is named rather than described
+	if (volume->batchName != NULL)
+	{
+		struct TextBuffer line = {0};
+
+		appendText(&line, "{\"image\":\"%s\",\"path\":\"", volume->batchName);
+		appendJsonString(&line, file->path, strlen(file->path));
+		appendText(&line, "\",\"problem\":\"%s\",\"cluster\":%u", problemNames[file->problem], file->problemCluster);
+		if (file->problem == CHECK_SIZE_MISMATCH)
+		{
+			appendText(&line, ",\"size\":%u,\"chain_clusters\":%" PRIu64, file->size, file->chainClusters);
+		}
+		appendString(&line, "}\n");
+
+		fwrite(line.data, 1, line.length, volume->out);
+		free(line.data);
+		return;
+	}
+
+	switch (file->problem)
+	{
+	case CHECK_CROSS_LINKED:
+		printf("%s: cluster %u is cross-linked with another chain\n", file->path, file->problemCluster);
+		break;
+	case CHECK_LOOP:
+		printf("%s: cluster chain loops back to cluster %u\n", file->path, file->problemCluster);
+		break;
+	case CHECK_BAD_CLUSTER:
+		printf("%s: cluster chain runs into a bad cluster after cluster %u\n", file->path, file->problemCluster);
+		break;
+	case CHECK_FREE_CLUSTER:
+		printf("%s: cluster chain runs into a free cluster after cluster %u\n", file->path, file->problemCluster);
+		break;
+	case CHECK_INVALID_CLUSTER:
+		printf("%s: cluster chain points at invalid cluster %u\n", file->path, file->problemCluster);
+		break;
+	case CHECK_SIZE_MISMATCH:
+		printf("%s: size is %u bytes but the chain has %" PRIu64 " clusters\n", file->path, file->size, file->chainClusters);
+		break;
+	}
+}
+
+/**
+ * listDirectory
+ *
+ * Prints out all files and directories under a task's directory (including long names) into the task's output. Walks with an explicit stack of directory iterators instead of recursing, so following a long cluster chain costs nothing and descending costs one iterator per level. Subdirectories are handed to listSubdirectory, which either pushes them onto the walk or makes them a task of their own.
+ * @param struct ListTask* task - task holding the directory's first cluster and depth
+ * @param struct DirWalk* walk - empty walk owned by the calling thread, its iterators and buffers are reused from task to task
+ * @returns void - NA
+ */
+void listDirectory(struct ListTask *task, struct DirWalk *walk)
+{
+	struct DirIterator *iterator;
+	struct DecodedEntry decoded; // the current entry, names decoded into fixed buffers
+	int depth;
+	int kind;
+
+	// paths of the entries start with the path of the task's directory
+	walk->path.length = 0;
+	appendString(&walk->path, (task->path != NULL) ? task->path : "");
+
+	// dot and dotdot are only in subdirectories, the root does not have them
+	pushDirWalk(walk, task->clusterNum, task->depth != 0);
+
+	while (walk->depth > 0)
+	{
+		iterator = &walk->frames[walk->depth - 1];
+		depth = task->depth + walk->depth - 1;
+		walk->path.length = iterator->pathLength;
+		kind = nextDirEntry(iterator, &decoded);
+
+		if (kind == ENTRY_END)
+		{
+			// finished this directory, carry on with its parent
+			walk->depth--;
+			continue;
+		}
+
+		appendListEntry(&task->out, &walk->path, &decoded, kind, depth);
+
+		if (kind == ENTRY_DIRECTORY)
+		{
+			// read sub directory, the iterator pointer is stale after this since the walk may grow
+			listSubdirectory(task, walk, &decoded, depth + 1);
+		}
+	}
+}
+
+/**
+ * appendListEntry
+ *
+ * Prints one file or directory in the format list was asked for
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct TextBuffer* path - path of the directory holding the entry, ending in / unless it is the root
+ * @param const struct DecodedEntry* decoded - entry to print
+ * @param int kind - ENTRY_DIRECTORY or ENTRY_FILE
+ * @param int depth - depth of the entry
+ * @returns void - NA
+ */
+void appendListEntry(struct TextBuffer *buffer, const struct TextBuffer *path, const struct DecodedEntry *decoded, int kind, int depth)
+{
+	if (options.listFormat == LIST_FORMAT_NDJSON)
+	{
+		appendJsonEntry(buffer, path, decoded);
+	}
+	else if (options.listFormat == LIST_FORMAT_BINARY)
+	{
+		appendBinaryEntry(buffer, path, decoded);
+	}
+	else
+	{
+		appendTextEntry(buffer, decoded, kind, depth);
+	}
+}
+
+/**
+ * appendTextEntry
+ *
+ * Prints one file or directory the way list shows it to people, long name first when there is one and indented with dashes
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct DecodedEntry* decoded - entry to print
+ * @param int kind - ENTRY_DIRECTORY or ENTRY_FILE
+ * @param int depth - number of dashes
+ * @returns void - NA
+ */
+void appendTextEntry(struct TextBuffer *buffer, const struct DecodedEntry *decoded, int kind, int depth)
+{
+	// print a set number of dashes depending on the depth
+	appendDashes(buffer, depth);
+
+	if (kind == ENTRY_DIRECTORY)
+	{
+		// print long name then short name if there is a long name whose checksum matches
+		if (decoded->longName != NULL)
+		{
+			appendString(buffer, "Long Name Directory: ");
+			appendLongName(buffer, decoded);
+			appendBytes(buffer, "\n", 1);
+
+			appendDashes(buffer, depth);
+			appendString(buffer, "Short Name Directory: ");
+		}
+		// if no long name then just print short name
+		else
+		{
+			appendString(buffer, "Directory: ");
+		}
+
+		appendString(buffer, decoded->givenName);
+		appendBytes(buffer, "\n", 1);
+		return;
+	}
+
+	if (decoded->longName != NULL)
+	{
+		appendString(buffer, "Long Name File: ");
+		appendLongName(buffer, decoded);
+		appendBytes(buffer, "\n", 1);
+
+		appendDashes(buffer, depth);
+	}
+
+	appendString(buffer, "Short Name File: ");
+	appendShortName(buffer, decoded);
+	appendBytes(buffer, "\n", 1);
+}
+
+/**
+ * appendShortName
+ *
+ * Prints the short name of an entry as NAME.EXT, or just NAME when the extension is blank
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct DecodedEntry* decoded - entry to print
+ * @returns void - NA
+ */
+void appendShortName(struct TextBuffer *buffer, const struct DecodedEntry *decoded)
+{
+	appendString(buffer, decoded->givenName);
+
+	// avoid printing . if the extension is only whitespace
+	if (decoded->nameExtension[0] != '\0')
+	{
+		appendBytes(buffer, ".", 1);
+		appendString(buffer, decoded->nameExtension);
+	}
+}
+
+/**
+ * appendJsonEntry
+ *
+ * Prints one file or directory as a line of JSON for list --format=ndjson
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct TextBuffer* path - path of the directory holding the entry, ending in / unless it is the root
+ * @param const struct DecodedEntry* decoded - entry to print
+ * @returns void - NA
+ */
+void appendJsonEntry(struct TextBuffer *buffer, const struct TextBuffer *path, const struct DecodedEntry *decoded)
+{
+	const struct DirInfo *info = decoded->info;
+	struct TextBuffer name = {0};
+	char longName[LONG_NAME_MAX_ENTRIES * LONG_NAME_CHARS_PER_ENTRY * 3];
+	char stamp[32];
+
+	appendShortName(&name, decoded);
+
+	// batch lines say which image they came from, the name is already escaped
+	appendBytes(buffer, "{", 1);
+	if (volume->batchName != NULL)
+	{
+		appendText(buffer, "\"image\":\"%s\",", volume->batchName);
+	}
+
+	appendString(buffer, "\"path\":\"");
+	appendJsonString(buffer, path->data, path->length);
+	appendJsonString(buffer, name.data, name.length);
+	appendString(buffer, "\",\"short_name\":\"");
+	appendJsonString(buffer, name.data, name.length);
+	appendString(buffer, "\",\"long_name\":");
+	if (decoded->longName != NULL)
+	{
+		appendBytes(buffer, "\"", 1);
+		appendJsonString(buffer, longName, decodeLongName(decoded, longName));
+		appendBytes(buffer, "\"", 1);
+	}
+	else
+	{
+		appendString(buffer, "null");
+	}
+
+	appendText(buffer, ",\"type\":\"%s\",\"attributes\":%u,\"size\":%u,\"first_cluster\":%u",
+			   ((info->dir_attr & ATTR_DIRECTORY) == ATTR_DIRECTORY) ? "directory" : "file", info->dir_attr, info->dir_file_size, decoded->firstCluster);
+
+	formatFatTimestamp(stamp, sizeof(stamp), info->dir_crt_date, info->dir_crt_time, info->dir_crt_time_tenth);
+	appendText(buffer, ",\"created\":\"%s\"", stamp);
+	formatFatTimestamp(stamp, sizeof(stamp), info->dir_wrt_date, info->dir_wrt_time, 0);
+	appendText(buffer, ",\"modified\":\"%s\"", stamp);
+	formatFatTimestamp(stamp, sizeof(stamp), info->dir_last_access_time, 0, 0);
+	appendText(buffer, ",\"accessed\":\"%.10s\"}\n", stamp);
+
+	free(name.data);
+}
+
+/**
+ * appendJsonString
+ *
+ * Copies bytes into a buffer escaped for use inside a JSON string, UTF-8 passes through untouched
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const char* data - bytes to escape
+ * @param size_t length - number of bytes
+ * @returns void - NA
+ */
+void appendJsonString(struct TextBuffer *buffer, const char *data, size_t length)
+{
+	// the worst case is every byte becoming a 6 byte \u escape
+	char *out = reserveText(buffer, length * 6);
+	size_t written = 0;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned char c = (unsigned char)data[i];
+
+		if (c == '"' || c == '\\')
+		{
+			out[written++] = '\\';
+			out[written++] = (char)c;
+		}
+		else if (c < 0x20)
+		{
+			written += snprintf(out + written, 7, "\\u%04x", c);
+		}
+		else
+		{
+			out[written++] = (char)c;
+		}
+	}
+
+	buffer->length += written;
+}
+
+/**
+ * formatFatTimestamp
+ *
+ * Turns a FAT date and time into an ISO 8601 string, date bits are 7 year (from 1980), 4 month, 5 day and time bits are 5 hour, 6 minute, 5 two-second
+ * @param char* out - where to write
+ * @param size_t size - size of out
+ * @param uint16_t date - FAT date
+ * @param uint16_t time - FAT time
+ * @param uint8_t tenths - extra hundredths of a second, 0 to 199, from the creation time
+ * @returns void - NA
+ */
+void formatFatTimestamp(char *out, size_t size, uint16_t date, uint16_t time, uint8_t tenths)
+{
+	int seconds = ((time & 0x1F) * 2) + (tenths / 100);
+
+	snprintf(out, size, "%04d-%02d-%02dT%02d:%02d:%02d.%02d", 1980 + (date >> 9), (date >> 5) & 0x0F, date & 0x1F,
+			 time >> 11, (time >> 5) & 0x3F, seconds, tenths % 100);
+}
+
+/**
+ * appendBinaryEntry
+ *
+ * Writes one file or directory as a length prefixed record for list --format=binary, the layout is in the README
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct TextBuffer* path - path of the directory holding the entry, ending in / unless it is the root
+ * @param const struct DecodedEntry* decoded - entry to write
+ * @returns void - NA
+ */
+void appendBinaryEntry(struct TextBuffer *buffer, const struct TextBuffer *path, const struct DecodedEntry *decoded)
+{
+	const struct DirInfo *info = decoded->info;
+	struct TextBuffer name = {0};
+	char longName[LONG_NAME_MAX_ENTRIES * LONG_NAME_CHARS_PER_ENTRY * 3];
+	size_t longNameLength = 0;
+	size_t pathLength;
+	size_t recordLength;
+	uint8_t *out;
+
+	appendShortName(&name, decoded);
+	pathLength = path->length + name.length;
+
+	if (decoded->longName != NULL)
+	{
+		longNameLength = decodeLongName(decoded, longName);
+	}
+
+	// fixed 20 bytes, then the path, the short name and the long name each behind their own length
+	recordLength = 20 + 4 + pathLength + 1 + name.length + 2 + longNameLength;
+	out = (uint8_t *)reserveText(buffer, 4 + recordLength);
+
+	putLittleEndian(out, recordLength, 4);
+	out[4] = info->dir_attr;
+	out[5] = info->dir_crt_time_tenth;
+	putLittleEndian(out + 6, info->dir_crt_time, 2);
+	putLittleEndian(out + 8, info->dir_crt_date, 2);
+	putLittleEndian(out + 10, info->dir_last_access_time, 2);
+	putLittleEndian(out + 12, info->dir_wrt_time, 2);
+	putLittleEndian(out + 14, info->dir_wrt_date, 2);
+	putLittleEndian(out + 16, decoded->firstCluster, 4);
+	putLittleEndian(out + 20, info->dir_file_size, 4);
+	out += 4 + 20;
+
+	putLittleEndian(out, pathLength, 4);
+	if (path->length > 0)
+	{
+		memcpy(out + 4, path->data, path->length);
+	}
+	memcpy(out + 4 + path->length, name.data, name.length);
+	out += 4 + pathLength;
+
+	out[0] = (uint8_t)name.length;
+	memcpy(out + 1, name.data, name.length);
+	out += 1 + name.length;
+
+	putLittleEndian(out, longNameLength, 2);
+	memcpy(out + 2, longName, longNameLength);
+
+	buffer->length += 4 + recordLength;
+	free(name.data);
+}
+
+/**
+ * putLittleEndian
+ *
+ * Stores an unsigned value as little endian bytes
+ * @param uint8_t* out - where to store
+ * @param uint64_t value - value to store
+ * @param int bytes - number of bytes to use
+ * @returns void - NA
+ */
+void putLittleEndian(uint8_t *out, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+	{
+		out[i] = (uint8_t)(value >> (i * BITS_PER_BYTE));
+	}
+}
+
+/**
+ * getLittleEndian
+ *
+ * Loads an unsigned value stored as little endian bytes
+ * @param const uint8_t* in - where the value is stored
+ * @param int bytes - number of bytes it uses
+ * @returns uint64_t - the value
+ */
+uint64_t getLittleEndian(const uint8_t *in, int bytes)
+{
+	uint64_t value = 0;
+
+	for (int i = bytes - 1; i >= 0; i--)
+	{
+		value = (value << BITS_PER_BYTE) | in[i];
+	}
+
+	return value;
+}
+
+/**
+ * openDirIterator
+ *
+ * Points an iterator at the first entry of a directory, keeping whatever cluster buffer it already has
+ * @param struct DirIterator* iterator - iterator to reset
+ * @param uint32_t clusterNum - first cluster of the directory
+ * @param bool skipDots - whether the first two entries are dot and dotdot and should be skipped
+ * @returns void - NA
+ */
+void openDirIterator(struct DirIterator *iterator, uint32_t clusterNum, bool skipDots)
+{
+	memset(&iterator->longName, 0, sizeof(iterator->longName));
+	openChainWalk(&iterator->chain, clusterNum);
+	iterator->entryNum = 0;
+	iterator->skipDots = skipDots;
+	iterator->loaded = false;
+}
+
+/**
+ * nextDirEntry
+ *
+ * Decodes the next visible file or directory in a directory, loading the next cluster of the chain whenever the current one runs out
+ * @param struct DirIterator* iterator - iterator to advance
+ * @param struct DecodedEntry* decoded - filled in when a file or directory is returned, its pointers stay valid until the iterator moves again
+ * @returns int - ENTRY_DIRECTORY or ENTRY_FILE, or ENTRY_END once the directory has no more entries
+ */
+int nextDirEntry(struct DirIterator *iterator, struct DecodedEntry *decoded)
+{
+	const struct DirInfo *currentDir;
+	int kind;
+
+	while (iterator->chain.clusterNum < END_OF_CLUSTER_CHAIN)
+	{
+		if (!iterator->loaded)
+		{
+			loadDirCluster(&iterator->dir, iterator->chain.clusterNum);
+			iterator->loaded = true;
+			prefetchNextCluster(iterator->chain.clusterNum);
+		}
+
+		// loop through the rest of the entries in the cluster
+		while (iterator->entryNum < volume->entriesPerCluster)
+		{
+			currentDir = (const struct DirInfo *)(iterator->dir.entries + (iterator->entryNum * sizeof(struct DirInfo)));
+			iterator->entryNum++;
+
+			// check to see whether we are at the end, if so there is nothing else in the directory
+			if ((uint8_t)currentDir->dir_name[0] == 0x00)
+			{
+				iterator->chain.clusterNum = END_OF_CLUSTER_CHAIN;
+				return ENTRY_END;
+			}
+
+			// make sure we are not looking at dot or dotdot entries and file has not been deleted
+			if ((iterator->skipDots && iterator->entryNum <= 2) || (uint8_t)currentDir->dir_name[0] == 0xE5)
+			{
+				continue;
+			}
+
+			// find rules files out on the raw entry, so their names are never decoded, a skipped entry ends any long name in front of it
+			if (iterator->filter != NULL && filterSkipsFile(iterator->filter, currentDir))
+			{
+				iterator->longName.started = false;
+				continue;
+			}
+
+			kind = decodeEntry(currentDir, &iterator->longName, decoded);
+			if (kind != ENTRY_NONE)
+			{
+				return kind;
+			}
+		}
+
+		// dot entries only open the first cluster
+		iterator->skipDots = false;
+
+		// get next cluster number from fat, the walk stops on its own if the chain is broken
+		advanceChainWalk(&iterator->chain);
+		iterator->entryNum = 0;
+		iterator->loaded = false;
+	}
+
+	return ENTRY_END;
+}
+
+/**
+ * openChainWalk
+ *
+ * Starts following a cluster chain. Cluster 0 is an empty chain, anything else outside the data region breaks the walk straight away.
+ * @param struct ChainWalk* chain - walk to start
+ * @param uint32_t firstCluster - first cluster of the chain
+ * @returns void - NA
+ */
+void openChainWalk(struct ChainWalk *chain, uint32_t firstCluster)
+{
+	chain->firstCluster = firstCluster;
+	chain->clusterNum = firstCluster;
+	chain->checkpoint = firstCluster;
+	chain->steps = 0;
+	chain->nextCheckpoint = 1;
+	chain->broken = false;
+
+	if (firstCluster == 0)
+	{
+		chain->clusterNum = END_OF_CLUSTER_CHAIN;
+	}
+	else if (firstCluster < 2 || firstCluster >= dataClusterCount() + 2)
+	{
+		breakChainWalk(chain, "starts at invalid cluster", firstCluster);
+	}
+}
+
+/**
+ * advanceChainWalk
+ *
+ * Moves a chain walk on to the next cluster. Loops are caught with Brent's algorithm, which only compares against one saved cluster per step and moves it to the current cluster whenever the step count reaches the next power of 2, so a healthy chain costs one extra compare per cluster. No chain can be longer than the volume either, which caps the walk even if the check somehow missed.
+ * @param struct ChainWalk* chain - walk to advance
+ * @returns uint32_t - the new current cluster, END_OF_CLUSTER_CHAIN once the chain is done or broken
+ */
+uint32_t advanceChainWalk(struct ChainWalk *chain)
+{
+	uint32_t next;
+
+	if (chain->clusterNum >= END_OF_CLUSTER_CHAIN)
+	{
+		return chain->clusterNum;
+	}
+
+	next = getNextFatValue(chain->clusterNum) & MASK_FIRST_HEX;
+	chain->steps++;
+
+	if (next >= END_OF_CLUSTER_CHAIN)
+	{
+		chain->clusterNum = END_OF_CLUSTER_CHAIN;
+	}
+	else if (next == BAD_CLUSTER)
+	{
+		breakChainWalk(chain, "runs into a bad cluster after cluster", chain->clusterNum);
+	}
+	else if (next < 2 || next >= dataClusterCount() + 2)
+	{
+		breakChainWalk(chain, "points at invalid cluster", next);
+	}
+	else if (next == chain->checkpoint || chain->steps >= dataClusterCount())
+	{
+		breakChainWalk(chain, "loops back to cluster", next);
+	}
+	else
+	{
+		chain->clusterNum = next;
+		if (chain->steps == chain->nextCheckpoint)
+		{
+			chain->checkpoint = next;
+			chain->nextCheckpoint *= 2;
+		}
+	}
+
+	return chain->clusterNum;
+}
+
+/**
+ * breakChainWalk
+ *
+ * Stops a chain walk that can not go on and says why on stderr, which keeps the message out of listings and streamed files
+ * @param struct ChainWalk* chain - walk to stop
+ * @param const char* reason - what went wrong, followed by the cluster
+ * @param uint32_t clusterNum - cluster the problem was found at
+ * @returns void - NA
+ */
+void breakChainWalk(struct ChainWalk *chain, const char *reason, uint32_t clusterNum)
+{
+	fprintf(stderr, "Cluster chain starting at %u %s %u, stopping.\n", chain->firstCluster, reason, clusterNum);
+	chain->clusterNum = END_OF_CLUSTER_CHAIN;
+	chain->broken = true;
+}
+
+/**
+ * pushDirWalk
+ *
+ * Starts iterating a directory one level below the top of a walk, reusing an iterator and its buffer from an earlier push when there is one. The walk's path should already hold the directory's path.
+ * @param struct DirWalk* walk - walk to grow
+ * @param uint32_t clusterNum - first cluster of the directory
+ * @param bool skipDots - whether the directory starts with dot and dotdot
+ * @returns struct DirIterator* - iterator for the directory, only valid until the next push
+ */
+struct DirIterator *pushDirWalk(struct DirWalk *walk, uint32_t clusterNum, bool skipDots)
+{
+	struct DirIterator *iterator;
+
+	if (walk->depth == walk->capacity)
+	{
+		walk->capacity = (walk->capacity == 0) ? 16 : walk->capacity * 2;
+		walk->frames = realloc(walk->frames, walk->capacity * sizeof(struct DirIterator));
+		memset(walk->frames + walk->depth, 0, (walk->capacity - walk->depth) * sizeof(struct DirIterator));
+	}
+
+	iterator = &walk->frames[walk->depth++];
+	openDirIterator(iterator, clusterNum, skipDots);
+	iterator->pathLength = walk->path.length;
+	iterator->filter = walk->filter;
+
+	return iterator;
+}
+
+/**
+ * freeDirWalk
+ *
+ * Releases every iterator a walk has allocated along with their cluster buffers
+ * @param struct DirWalk* walk - walk to release
+ * @returns void - NA
+ */
+void freeDirWalk(struct DirWalk *walk)
+{
+	for (int i = 0; i < walk->capacity; i++)
+	{
+		freeDirCluster(&walk->frames[i].dir);
+	}
+
+	free(walk->frames);
+	free(walk->path.data);
+	walk->frames = NULL;
+	walk->path.data = NULL;
+	walk->depth = 0;
+	walk->capacity = 0;
+}
+
+/**
+ * decodeEntry
+ *
+ * Decodes one raw directory entry. Long name records are collected into longName, and a visible file or directory has its names decoded into fixed size buffers along with the long name collected before it, if its checksum matches. Nothing is allocated.
+ * @param const struct DirInfo* currentDir - raw entry, not deleted and not the end marker
+ * @param struct LongName* longName - long name assembly state carried from one entry to the next
+ * @param struct DecodedEntry* decoded - filled in when a file or directory is returned
+ * @returns int - ENTRY_DIRECTORY or ENTRY_FILE for visible entries, ENTRY_NONE for everything else
+ */
+int decodeEntry(const struct DirInfo *currentDir, struct LongName *longName, struct DecodedEntry *decoded)
+{
+	const struct LongNameDirInfo *currentLongDir;
+	bool visible = ((currentDir->dir_attr & (ATTR_LONG_NAME_MASK)) != (ATTR_LONG_NAME)) && ((currentDir->dir_attr & (ATTR_HIDDEN)) != (ATTR_HIDDEN)) && ((currentDir->dir_attr & (ATTR_SYSTEM)) != (ATTR_SYSTEM)) && ((currentDir->dir_attr & (ATTR_VOLUME_ID)) != (ATTR_VOLUME_ID));
+
+	if (visible)
+	{
+		decodeShortName(currentDir, decoded);
+
+		// only keep the long name if it belongs to this entry
+		decoded->longName = NULL;
+		decoded->longNameEntries = 0;
+		if (longName->started && longName->checkSum == ChkSum(decoded->entryName))
+		{
+			decoded->longName = longName->chars;
+			decoded->longNameEntries = longName->entries;
+		}
+		longName->started = false;
+
+		return ((currentDir->dir_attr & (ATTR_DIRECTORY)) == (ATTR_DIRECTORY)) ? ENTRY_DIRECTORY : ENTRY_FILE;
+	}
+
+	// anything that is not part of a long name orphans the one in progress
+	if ((currentDir->dir_attr & (ATTR_LONG_NAME_MASK)) != (ATTR_LONG_NAME))
+	{
+		longName->started = false;
+		return ENTRY_NONE;
+	}
+
+	// look at the same entry as a long name entry
+	currentLongDir = (const struct LongNameDirInfo *)currentDir;
+
+	// check to see if it is a first entry long name, which has to be flagged as the last entry
+	if (!longName->started)
+	{
+		if ((currentLongDir->LDIR_Ord & LAST_LONG_ENTRY) == (LAST_LONG_ENTRY) && currentLongDir->LDIR_Type == 0)
+		{
+			longName->started = true;
+			longName->entries = 0;
+			longName->checkSum = currentLongDir->LDIR_Chksum;
+			longName->previousOrder = currentLongDir->LDIR_Ord;
+			appendLongNameEntry(longName, currentLongDir);
+		}
+	}
+	// otherwise it is a second+ entry, verify new entry is valid and discard everything if not
+	else if (longName->checkSum == currentLongDir->LDIR_Chksum && currentLongDir->LDIR_Ord < longName->previousOrder && currentLongDir->LDIR_Type == 0 && longName->entries < LONG_NAME_MAX_ENTRIES)
+	{
+		longName->previousOrder = currentLongDir->LDIR_Ord;
+		appendLongNameEntry(longName, currentLongDir);
+	}
+	else
+	{
+		longName->started = false;
+	}
+
+	return ENTRY_NONE;
+}
+
+/**
+ * decodeShortName
+ *
+ * Fills in the short name parts and first cluster of a decoded entry, leaving its long name alone
+ * @param const struct DirInfo* currentDir - raw entry
+ * @param struct DecodedEntry* decoded - entry to fill in, info ends up pointing at currentDir
+ * @returns void - NA
+ */
+void decodeShortName(const struct DirInfo *currentDir, struct DecodedEntry *decoded)
+{
+	decoded->info = currentDir;
+
+	// read in the name
+	memcpy(decoded->entryName, currentDir->dir_name, 11);
+	decoded->entryName[11] = '\0';
+
+	// seperate name into extension and given name, getting rid of blanks
+	memcpy(decoded->givenName, currentDir->dir_name, 8);
+	decoded->givenName[8] = '\0';
+	removeTrailingSpace(decoded->givenName);
+
+	memcpy(decoded->nameExtension, &currentDir->dir_name[8], 3);
+	decoded->nameExtension[3] = '\0';
+	removeTrailingSpace(decoded->nameExtension);
+	if (decoded->nameExtension[0] == ' ')
+	{
+		decoded->nameExtension[0] = '\0';
+	}
+
+	// combine the bits
+	decoded->firstCluster = (((uint32_t)currentDir->dir_first_cluster_hi << 16) | currentDir->dir_first_cluster_lo) & MASK_FIRST_HEX;
+}
+
+/**
+ * appendLongNameEntry
+ *
+ * Adds the 13 characters of a long name record to the long name being assembled
+ * @param struct LongName* longName - long name being assembled
+ * @param const struct LongNameDirInfo* currentLongDir - record to add
+ * @returns void - NA
+ */
+void appendLongNameEntry(struct LongName *longName, const struct LongNameDirInfo *currentLongDir)
+{
+	uint16_t *chars = longName->chars + (longName->entries * LONG_NAME_CHARS_PER_ENTRY);
+
+	// read in first 5 characters, next 6 characters, then last 2 characters
+	memcpy(chars, currentLongDir->LDIR_Name1, 10);
+	memcpy(chars + 5, currentLongDir->LDIR_Name2, 12);
+	memcpy(chars + 11, currentLongDir->LDIR_Name3, 4);
+
+	// count this entry
+	longName->entries++;
+	threadStats.longNameEntries++;
+}
+
+/**
+ * appendDashes
+ *
+ * Prints a set number of dashes depending on the depth
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param int depth - number of dashes
+ * @returns void - NA
+ */
+void appendDashes(struct TextBuffer *buffer, int depth)
+{
+	if (depth > 0)
+	{
+		memset(reserveText(buffer, depth), '-', depth);
+		buffer->length += depth;
+	}
+}
+
+/**
+ * appendLongName
+ *
+ * Prints the long name of a decoded entry, converting its UTF-16 characters to UTF-8 straight into the buffer
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct DecodedEntry* decoded - entry with a long name
+ * @returns void - NA
+ */
+void appendLongName(struct TextBuffer *buffer, const struct DecodedEntry *decoded)
+{
+	// every UTF-16 unit turns into at most 3 bytes, a surrogate pair (2 units) into 4
+	char *out = reserveText(buffer, (size_t)decoded->longNameEntries * LONG_NAME_CHARS_PER_ENTRY * 3);
+
+	buffer->length += decodeLongName(decoded, out);
+}
+
+/**
+ * decodeLongName
+ *
+ * Converts the UTF-16 long name of a decoded entry to UTF-8
+ * @param const struct DecodedEntry* decoded - entry with a long name
+ * @param char* out - where to write, needs 3 bytes for every character in the long name records
+ * @returns size_t - number of bytes written, there is no terminator
+ */
+size_t decodeLongName(const struct DecodedEntry *decoded, char *out)
+{
+	uint32_t highSurrogate = 0;
+	size_t written = 0;
+
+	// loops through all long name characters in reverse order (for structs) and forward order (within structs)
+	for (int i = (decoded->longNameEntries - 1); i >= 0; i--)
+	{
+		for (int j = 0; j < LONG_NAME_CHARS_PER_ENTRY; j++)
+		{
+			uint16_t unicode = decoded->longName[(i * LONG_NAME_CHARS_PER_ENTRY) + j];
+
+			// verifies that we are not printing padding or null characters
+			if (unicode == 0x0000 || unicode == 0xFFFF)
+			{
+				continue;
+			}
+
+			// characters outside the basic plane come as a high surrogate followed by a low one, unpaired halves are dropped
+			if (unicode >= 0xD800 && unicode <= 0xDBFF)
+			{
+				highSurrogate = unicode;
+			}
+			else if (unicode >= 0xDC00 && unicode <= 0xDFFF)
+			{
+				if (highSurrogate != 0)
+				{
+					written += encodeUtf8(0x10000 + ((highSurrogate - 0xD800) << 10) + (unicode - 0xDC00), out + written);
+				}
+				highSurrogate = 0;
+			}
+			else
+			{
+				written += encodeUtf8(unicode, out + written);
+				highSurrogate = 0;
+			}
+		}
+	}
+
+	return written;
+}
+
+/**
+ * encodeUtf8
+ *
+ * Writes a unicode code point as UTF-8
+ * @param uint32_t codePoint - character to write, not a surrogate
+ * @param char* out - where to write, needs room for 4 bytes
+ * @returns size_t - number of bytes written
+ */
+size_t encodeUtf8(uint32_t codePoint, char *out)
+{
+	if (codePoint < 0x80)
+	{
+		out[0] = (char)codePoint;
+		return 1;
+	}
+
+	if (codePoint < 0x800)
+	{
+		out[0] = (char)(0xC0 | (codePoint >> 6));
+		out[1] = (char)(0x80 | (codePoint & 0x3F));
+		return 2;
+	}
+
+	if (codePoint < 0x10000)
+	{
+		out[0] = (char)(0xE0 | (codePoint >> 12));
+		out[1] = (char)(0x80 | ((codePoint >> 6) & 0x3F));
+		out[2] = (char)(0x80 | (codePoint & 0x3F));
+		return 3;
+	}
+
+	out[0] = (char)(0xF0 | (codePoint >> 18));
+	out[1] = (char)(0x80 | ((codePoint >> 12) & 0x3F));
+	out[2] = (char)(0x80 | ((codePoint >> 6) & 0x3F));
+	out[3] = (char)(0x80 | (codePoint & 0x3F));
+	return 4;
+}
+
+/**
+ * reserveText
+ *
+ * Makes sure a text buffer has room for more bytes, flushing it to its sink first once it gets large. The caller writes into the returned space and adds what it wrote to length.
+ * @param struct TextBuffer* buffer - buffer to grow
+ * @param size_t length - number of bytes that will be written
+ * @returns char* - where to write, at the end of the buffer
+ */
+char *reserveText(struct TextBuffer *buffer, size_t length)
+{
+	if (buffer->sink != NULL && buffer->length >= TEXT_FLUSH_SIZE)
+	{
+		flushText(buffer);
+	}
+
+	if (buffer->capacity - buffer->length < length)
+	{
+		if (buffer->capacity == 0)
+		{
+			buffer->capacity = 4096;
+		}
+		while (buffer->capacity - buffer->length < length)
+		{
+			buffer->capacity *= 2;
+		}
+		buffer->data = realloc(buffer->data, buffer->capacity);
+	}
+
+	return buffer->data + buffer->length;
+}
+
+/**
+ * appendBytes
+ *
+ * Copies raw bytes onto the end of a text buffer
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const char* data - bytes to add
+ * @param size_t length - number of bytes
+ * @returns void - NA
+ */
+void appendBytes(struct TextBuffer *buffer, const char *data, size_t length)
+{
+	if (length == 0)
+	{
+		return;
+	}
+
+	memcpy(reserveText(buffer, length), data, length);
+	buffer->length += length;
+}
+
+/**
+ * appendString
+ *
+ * Copies a string without its terminator onto the end of a text buffer
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const char* string - string to add
+ * @returns void - NA
+ */
+void appendString(struct TextBuffer *buffer, const char *string)
+{
+	appendBytes(buffer, string, strlen(string));
+}
+
+/**
+ * appendText
+ *
+ * Formats text onto the end of a text buffer, writing the buffer to its sink once it gets large
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const char* format - printf style format
+ * @returns void - NA
+ */
+void appendText(struct TextBuffer *buffer, const char *format, ...)
+{
+	va_list args;
+	int needed;
+
+	// make sure there is a reasonable amount of room before trying
+	if (buffer->capacity - buffer->length < 256)
+	{
+		buffer->capacity = (buffer->capacity == 0) ? 4096 : buffer->capacity * 2;
+		buffer->data = realloc(buffer->data, buffer->capacity);
+	}
+
+	va_start(args, format);
+	needed = vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+	va_end(args);
+
+	// if it did not fit then grow to fit and format again
+	if (needed >= 0 && (size_t)needed >= buffer->capacity - buffer->length)
+	{
+		while ((size_t)needed >= buffer->capacity - buffer->length)
+		{
+			buffer->capacity *= 2;
+		}
+		buffer->data = realloc(buffer->data, buffer->capacity);
+
+		va_start(args, format);
+		vsnprintf(buffer->data + buffer->length, buffer->capacity - buffer->length, format, args);
+		va_end(args);
+	}
+
+	if (needed > 0)
+	{
+		buffer->length += needed;
+	}
+
+	if (buffer->sink != NULL && buffer->length >= TEXT_FLUSH_SIZE)
+	{
+		flushText(buffer);
+	}
+}
+
+/**
+ * flushText
+ *
+ * Writes everything in a text buffer to its sink and empties it
+ * @param struct TextBuffer* buffer - buffer to flush, nothing happens if it has no sink
+ * @returns void - NA
+ */
+void flushText(struct TextBuffer *buffer)
+{
+	if (buffer->sink != NULL && buffer->length > 0)
+	{
+		fwrite(buffer->data, 1, buffer->length, buffer->sink);
+		buffer->length = 0;
+	}
+}
+
+/**
+ * listVolume
+ *
+ * Prints the listing of every directory under the root, on the main thread or on a pool of work stealing threads when --threads is above 1
+ * @param uint32_t rootCluster - first cluster of the root directory
+ * @returns void - NA
+ */
+void listVolume(uint32_t rootCluster)
+{
+	struct ListTask *root;
+	struct DirWalk walk = {0};
+	pthread_t *threads;
+
+	// binary listings start with a magic number so readers can tell the stream apart from text
+	if (options.listFormat == LIST_FORMAT_BINARY)
+	{
+		fwrite(LIST_BINARY_MAGIC, 1, 8, volume->out);
+	}
+
+	// an up to date index already has every entry in order, so there is nothing to walk
+	if (volume->volumeIndex.header != NULL)
+	{
+		listIndex();
+		return;
+	}
+
+	// on a single thread everything is written straight through to the output as it is found
+	if (volume->threads <= 1)
+	{
+		root = newListTask(rootCluster, 0, NULL);
+		root->out.sink = volume->out;
+		listDirectory(root, &walk);
+		flushText(&root->out);
+		freeDirWalk(&walk);
+		free(root->out.data);
+		free(root);
+		return;
+	}
+
+	listPool = calloc(1, sizeof(struct ListPool));
+	pthread_mutex_init(&listPool->lock, NULL);
+	pthread_cond_init(&listPool->workReady, NULL);
+	pthread_cond_init(&listPool->taskDone, NULL);
+	listPool->workerCount = volume->threads;
+	listPool->deques = calloc(volume->threads, sizeof(struct ListDeque));
+	for (int i = 0; i < volume->threads; i++)
+	{
+		pthread_mutex_init(&listPool->deques[i].lock, NULL);
+	}
+
+	// seed the first worker with the root and start everyone
+	root = newListTask(rootCluster, 0, NULL);
+	listPool->pending = 1;
+	pushListTask(0, root);
+
+	threads = malloc(volume->threads * sizeof(pthread_t));
+	for (intptr_t i = 0; i < volume->threads; i++)
+	{
+		pthread_create(&threads[i], NULL, listWorker, (void *)i);
+	}
+
+	// print finished tasks in depth first order while the workers keep going
+	emitListTask(root, volume->out);
+
+	for (int i = 0; i < volume->threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	// only tear the deques down once nobody can be stealing from them
+	for (int i = 0; i < volume->threads; i++)
+	{
+		pthread_mutex_destroy(&listPool->deques[i].lock);
+		free(listPool->deques[i].tasks);
+	}
+
+	pthread_mutex_destroy(&listPool->lock);
+	pthread_cond_destroy(&listPool->workReady);
+	pthread_cond_destroy(&listPool->taskDone);
+	free(listPool->deques);
+	free(listPool);
+	listPool = NULL;
+	free(threads);
+}
+
+/**
+ * listSubdirectory
+ *
+ * Lists a subdirectory found while reading a directory, pushed onto the walk on the main thread, or as a new task that any worker can pick up in parallel mode
+ * @param struct ListTask* task - task of the directory the subdirectory was found in
+ * @param struct DirWalk* walk - walk the directory is being read with, its path is the path of the directory
+ * @param const struct DecodedEntry* decoded - the subdirectory's entry
+ * @param int depth - depth of the subdirectory's entries
+ * @returns void - NA
+ */
+void listSubdirectory(struct ListTask *task, struct DirWalk *walk, const struct DecodedEntry *decoded, int depth)
+{
+	struct ListTask *child;
+
+	// a subdirectory pointing back at one of the directories above it would be listed forever
+	if (loopsDirWalk(task, walk, decoded))
+	{
+		return;
+	}
+
+	// entries of the subdirectory sit under its name
+	appendString(&walk->path, decoded->givenName);
+	appendBytes(&walk->path, "/", 1);
+
+	if (listPool == NULL)
+	{
+		pushDirWalk(walk, decoded->firstCluster, depth != 0);
+		return;
+	}
+
+	// remember where the child's output belongs in ours
+	if (task->childCount == task->childCapacity)
+	{
+		task->childCapacity = (task->childCapacity == 0) ? 8 : task->childCapacity * 2;
+		task->children = realloc(task->children, task->childCapacity * sizeof(struct ListChild));
+	}
+
+	child = newListTask(decoded->firstCluster, depth, strndup(walk->path.data, walk->path.length));
+	child->parent = task;
+	task->children[task->childCount].position = task->out.length;
+	task->children[task->childCount].task = child;
+	task->childCount++;
+
+	pthread_mutex_lock(&listPool->lock);
+	listPool->pending++;
+	pthread_mutex_unlock(&listPool->lock);
+
+	pushListTask(listWorkerNum, child);
+}
+
+/**
+ * isAncestorDirectory
+ *
+ * Checks whether a directory is already being walked above the current one, either lower down the walk or in one of the tasks the current task came from
+ * @param const struct ListTask* task - task being run, NULL when there are no tasks
+ * @param const struct DirWalk* walk - walk the current directory is being read with
+ * @param uint32_t clusterNum - first cluster of the subdirectory
+ * @returns bool - true if the subdirectory is the current directory or one above it
+ */
+bool isAncestorDirectory(const struct ListTask *task, const struct DirWalk *walk, uint32_t clusterNum)
+{
+	for (int i = 0; i < walk->depth; i++)
+	{
+		if (walk->frames[i].chain.firstCluster == clusterNum)
+		{
+			return true;
+		}
+	}
+
+	for (; task != NULL; task = task->parent)
+	{
+		if (task->clusterNum == clusterNum)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * loopsDirWalk
+ *
+ * Checks whether a subdirectory points back at a directory being walked above it, and says so
+ * @param const struct ListTask* task - task being run, NULL when there are no tasks
+ * @param const struct DirWalk* walk - walk the subdirectory was found with, its path is the path of the current directory
+ * @param const struct DecodedEntry* decoded - the subdirectory's entry
+ * @returns bool - true if the subdirectory would be walked forever and has to be skipped
+ */
+bool loopsDirWalk(const struct ListTask *task, const struct DirWalk *walk, const struct DecodedEntry *decoded)
+{
+	if (!isAncestorDirectory(task, walk, decoded->firstCluster))
+	{
+		return false;
+	}
+
+	fprintf(stderr, "Directory %.*s%s points back at a directory above it, skipping.\n", (int)walk->path.length, walk->path.data, decoded->givenName);
+	return true;
+}
+
+/**
+ * descendDirWalk
+ *
+ * Moves the walk into a subdirectory, adding its name to the walk's path, unless it points back up the tree
+ * @param struct DirWalk* walk - walk the subdirectory was found with
+ * @param const struct DecodedEntry* decoded - the subdirectory's entry
+ * @returns bool - true if the walk is now in the subdirectory, false if it was skipped
+ */
+bool descendDirWalk(struct DirWalk *walk, const struct DecodedEntry *decoded)
+{
+	if (loopsDirWalk(NULL, walk, decoded))
+	{
+		return false;
+	}
+
+	appendString(&walk->path, decoded->givenName);
+	appendBytes(&walk->path, "/", 1);
+	pushDirWalk(walk, decoded->firstCluster, true);
+
+	return true;
+}
+
+/**
+ * newListTask
+ *
+ * Allocates an empty listing task
+ * @param uint32_t clusterNum - first cluster of the directory to list
+ * @param int depth - depth of the directory's entries
+ * @param char* path - heap allocated path of the directory ending in /, NULL for the root, owned by the task from now on
+ * @returns struct ListTask* - the new task
+ */
+struct ListTask *newListTask(uint32_t clusterNum, int depth, char *path)
+{
+	struct ListTask *task = calloc(1, sizeof(struct ListTask));
+
+	task->clusterNum = clusterNum;
+	task->depth = depth;
+	task->path = path;
+
+	return task;
+}
+
+/**
+ * pushListTask
+ *
+ * Puts a task on the bottom of a worker's deque and wakes an idle worker
+ * @param int workerNum - worker whose deque gets the task
+ * @param struct ListTask* task - task to queue
+ * @returns void - NA
+ */
+void pushListTask(int workerNum, struct ListTask *task)
+{
+	struct ListDeque *deque = &listPool->deques[workerNum];
+
+	// counted before it can be taken, so a thief can never bring queued below 0
+	pthread_mutex_lock(&listPool->lock);
+	listPool->queued++;
+	pthread_mutex_unlock(&listPool->lock);
+
+	pthread_mutex_lock(&deque->lock);
+
+	// slide everything back to the start before growing
+	if (deque->bottom == deque->capacity)
+	{
+		if (deque->top > 0)
+		{
+			memmove(deque->tasks, deque->tasks + deque->top, (deque->bottom - deque->top) * sizeof(struct ListTask *));
+			deque->bottom -= deque->top;
+			deque->top = 0;
+		}
+		else
+		{
+			deque->capacity = (deque->capacity == 0) ? 64 : deque->capacity * 2;
+			deque->tasks = realloc(deque->tasks, deque->capacity * sizeof(struct ListTask *));
+		}
+	}
+
+	deque->tasks[deque->bottom++] = task;
+
+	pthread_mutex_unlock(&deque->lock);
+
+	pthread_mutex_lock(&listPool->lock);
+	pthread_cond_signal(&listPool->workReady);
+	pthread_mutex_unlock(&listPool->lock);
+}
+
+/**
+ * takeListTask
+ *
+ * Pops the newest task off a worker's own deque, or steals the oldest task from another worker if its own is empty
+ * @param int workerNum - worker looking for work
+ * @returns struct ListTask* - task to run, NULL if every deque is empty
+ */
+struct ListTask *takeListTask(int workerNum)
+{
+	struct ListTask *task = NULL;
+
+	for (int i = 0; i < listPool->workerCount && task == NULL; i++)
+	{
+		struct ListDeque *deque = &listPool->deques[(workerNum + i) % listPool->workerCount];
+
+		pthread_mutex_lock(&deque->lock);
+		if (deque->top < deque->bottom)
+		{
+			// our own deque is used like a stack to stay depth first, other deques are stolen from the far end
+			task = (i == 0) ? deque->tasks[--deque->bottom] : deque->tasks[deque->top++];
+		}
+		if (deque->top == deque->bottom)
+		{
+			deque->top = 0;
+			deque->bottom = 0;
+		}
+		pthread_mutex_unlock(&deque->lock);
+	}
+
+	if (task != NULL)
+	{
+		pthread_mutex_lock(&listPool->lock);
+		listPool->queued--;
+		pthread_mutex_unlock(&listPool->lock);
+	}
+
+	return task;
+}
+
+/**
+ * listWorker
+ *
+ * Thread body for parallel listing, runs tasks until no task is queued or running
+ * @param void* arg - worker number
+ * @returns void* - NULL
+ */
+void *listWorker(void *arg)
+{
+	struct ListTask *task;
+	struct DirWalk walk = {0}; // reused for every task this worker runs
+
+	listWorkerNum = (int)(intptr_t)arg;
+
+	while (true)
+	{
+		task = takeListTask(listWorkerNum);
+
+		if (task != NULL)
+		{
+			listDirectory(task, &walk);
+
+			pthread_mutex_lock(&listPool->lock);
+			task->done = true;
+			listPool->pending--;
+			pthread_cond_broadcast(&listPool->taskDone);
+			if (listPool->pending == 0)
+			{
+				pthread_cond_broadcast(&listPool->workReady);
+			}
+			pthread_mutex_unlock(&listPool->lock);
+			continue;
+		}
+
+		// nothing to take, so wait until something is queued or everything is finished
+		pthread_mutex_lock(&listPool->lock);
+		while (listPool->queued == 0 && listPool->pending > 0)
+		{
+			pthread_cond_wait(&listPool->workReady, &listPool->lock);
+		}
+		if (listPool->pending == 0)
+		{
+			pthread_mutex_unlock(&listPool->lock);
+			break;
+		}
+		pthread_mutex_unlock(&listPool->lock);
+	}
+
+	freeDirWalk(&walk);
+
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * emitListTask
+ *
+ * Waits for a task to finish and writes its output to the sink with each subdirectory's output spliced in where it was found, freeing tasks as it goes
+ * @param struct ListTask* task - task to print
+ * @param FILE* sink - where to write
+ * @returns void - NA
+ */
+void emitListTask(struct ListTask *task, FILE *sink)
+{
+	size_t written = 0;
+
+	pthread_mutex_lock(&listPool->lock);
+	while (!task->done)
+	{
+		pthread_cond_wait(&listPool->taskDone, &listPool->lock);
+	}
+	pthread_mutex_unlock(&listPool->lock);
+
+	for (size_t i = 0; i < task->childCount; i++)
+	{
+		fwrite(task->out.data + written, 1, task->children[i].position - written, sink);
+		written = task->children[i].position;
+		emitListTask(task->children[i].task, sink);
+	}
+
+	fwrite(task->out.data + written, 1, task->out.length - written, sink);
+
+	free(task->out.data);
+	free(task->children);
+	free(task->path);
+	free(task);
+}
+
+/**
+ * findVolume
+ *
+ * Prints every entry under the root that matches the find filter. Files are ruled out on their raw entry before their names are decoded, and with --path a directory is only read when its path can still lead to a match.
+ * @param uint32_t rootCluster - first cluster of the root directory
+ * @returns size_t - number of entries printed
+ */
+size_t findVolume(uint32_t rootCluster)
+{
+	struct DirWalk walk = {0};
+	struct TextBuffer out = {0};
+	struct DirIterator *iterator;
+	struct DecodedEntry decoded;
+	size_t matches = 0;
+	int depth;
+	int kind;
+
+	out.sink = volume->out;
+	walk.filter = &findFilter;
+
+	if (options.listFormat == LIST_FORMAT_BINARY)
+	{
+		fwrite(LIST_BINARY_MAGIC, 1, 8, volume->out);
+	}
+
+	pushDirWalk(&walk, rootCluster, false);
+
+	while (walk.depth > 0)
+	{
+		iterator = &walk.frames[walk.depth - 1];
+		depth = walk.depth - 1;
+		walk.path.length = iterator->pathLength;
+		kind = nextDirEntry(iterator, &decoded);
+
+		if (kind == ENTRY_END)
+		{
+			walk.depth--;
+			continue;
+		}
+
+		// with --path every level has to match its part of the pattern, anything that does not is neither printed nor read
+		if (findFilter.pathPartCount > 0 && !nameMatches(&decoded, findFilter.pathParts[depth]))
+		{
+			continue;
+		}
+
+		if ((findFilter.pathPartCount == 0 || depth == findFilter.pathPartCount - 1) && entryMatches(&findFilter, decoded.info) &&
+			(findFilter.name == NULL || nameMatches(&decoded, findFilter.name)))
+		{
+			appendFindEntry(&out, &walk.path, &decoded, kind);
+			matches++;
+		}
+
+		// below the last part of --path nothing can match
+		if (kind == ENTRY_DIRECTORY && (findFilter.pathPartCount == 0 || depth < findFilter.pathPartCount - 1))
+		{
+			descendDirWalk(&walk, &decoded);
+		}
+	}
+
+	flushText(&out);
+	free(out.data);
+	freeDirWalk(&walk);
+
+	return matches;
+}
+
+/**
+ * appendFindEntry
+ *
+ * Prints an entry find matched, as its path for text and the same way list does for ndjson and binary
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct TextBuffer* path - path of the directory holding the entry, ending in / unless it is the root
+ * @param const struct DecodedEntry* decoded - entry to print
+ * @param int kind - ENTRY_FILE or ENTRY_DIRECTORY
+ * @returns void - NA
+ */
+void appendFindEntry(struct TextBuffer *buffer, const struct TextBuffer *path, const struct DecodedEntry *decoded, int kind)
+{
+	if (options.listFormat != LIST_FORMAT_TEXT)
+	{
+		appendListEntry(buffer, path, decoded, kind, 0);
+		return;
+	}
+
+	// the short name path is what get and cat take
+	appendBytes(buffer, path->data, path->length);
+	appendShortName(buffer, decoded);
+	appendString(buffer, (kind == ENTRY_DIRECTORY) ? "/\n" : "\n");
+}
+
+/**
+ * entryMatches
+ *
+ * Checks the parts of a filter that only need the raw directory entry, the type, attributes, size and modified date
+ * @param const struct FindFilter* filter - what to look for
+ * @param const struct DirInfo* info - the entry
+ * @returns bool - true if the entry passes
+ */
+bool entryMatches(const struct FindFilter *filter, const struct DirInfo *info)
+{
+	bool isDirectory = (info->dir_attr & ATTR_DIRECTORY) == ATTR_DIRECTORY;
+
+	if ((filter->type == ENTRY_FILE && isDirectory) || (filter->type == ENTRY_DIRECTORY && !isDirectory))
+	{
+		return false;
+	}
+
+	if ((info->dir_attr & filter->attributesSet) != filter->attributesSet || (info->dir_attr & filter->attributesClear) != 0)
+	{
+		return false;
+	}
+
+	if (info->dir_file_size < filter->minSize || info->dir_file_size > filter->maxSize)
+	{
+		return false;
+	}
+
+	return info->dir_wrt_date >= filter->modifiedAfter && info->dir_wrt_date < filter->modifiedBefore;
+}
+
+/**
+ * filterSkipsFile
+ *
+ * Lets nextDirEntry drop a file before it is decoded. Long name records, directories and entries decodeEntry hides are always kept, the long names have to be followed and directories may hold matches.
+ * @param const struct FindFilter* filter - what to look for
+ * @param const struct DirInfo* info - the entry
+ * @returns bool - true if the entry is a visible file the filter rules out
+ */
+bool filterSkipsFile(const struct FindFilter *filter, const struct DirInfo *info)
+{
+	if ((info->dir_attr & (ATTR_LONG_NAME_MASK)) == (ATTR_LONG_NAME) || (info->dir_attr & (ATTR_DIRECTORY | ATTR_HIDDEN | ATTR_SYSTEM | ATTR_VOLUME_ID)) != 0)
+	{
+		return false;
+	}
+
+	return !entryMatches(filter, info);
+}
+
+/**
+ * nameMatches
+ *
+ * Matches a glob against an entry's short name and its long name, without regard to case
+ * @param const struct DecodedEntry* decoded - the entry
+ * @param const char* pattern - fnmatch style glob
+ * @returns bool - true if either name matches
+ */
+bool nameMatches(const struct DecodedEntry *decoded, const char *pattern)
+{
+	char name[LONG_NAME_MAX_ENTRIES * LONG_NAME_CHARS_PER_ENTRY * 3 + 1];
+
+	snprintf(name, sizeof(name), "%s%s%s", decoded->givenName, (decoded->nameExtension[0] != '\0') ? "." : "", decoded->nameExtension);
+	if (fnmatch(pattern, name, FNM_CASEFOLD) == 0)
+	{
+		return true;
+	}
+
+	if (decoded->longName == NULL)
+	{
+		return false;
+	}
+
+	name[decodeLongName(decoded, name)] = '\0';
+	return fnmatch(pattern, name, FNM_CASEFOLD) == 0;
+}
+
+/**
+ * parseFatDate
+ *
+ * Turns YYYY-MM-DD into the date format of a directory entry
+ * @param const char* text - the date
+ * @param uint16_t* date - filled in with the FAT date
+ * @returns bool - true if the date could be read and is one FAT can hold
+ */
+bool parseFatDate(const char *text, uint16_t *date)
+{
+	int year;
+	int month;
+	int day;
+
+	if (sscanf(text, "%4d-%2d-%2d", &year, &month, &day) != 3 || year < 1980 || year > 2107 || month < 1 || month > 12 || day < 1 || day > 31)
+	{
+		return false;
+	}
+
+	*date = ((year - 1980) << 9) | (month << 5) | day;
+	return true;
+}
+
+/**
+ * parseAttributes
+ *
+ * Turns attribute letters into ATTR_ bits, r for read only, a for archive and d for directory
+ * @param const char* letters - the letters
+ * @param uint8_t* attributes - filled in with the bits
+ * @returns bool - true if every letter is known
+ */
+bool parseAttributes(const char *letters, uint8_t *attributes)
+{
+	*attributes = 0;
+
+	for (; *letters != '\0'; letters++)
+	{
+		switch (*letters)
+		{
+		case 'r':
+			*attributes |= ATTR_READ_ONLY;
+			break;
+		case 'a':
+			*attributes |= ATTR_ARCHIVE;
+			break;
+		case 'd':
+			*attributes |= ATTR_DIRECTORY;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * diffVolume
+ *
+ * Compares the image against a baseline and prints what was added, removed and modified since. The baseline is either another image or an index sidecar saved from one.
+ * @param const char* baselinePath - path of the baseline image or sidecar
+ * @param size_t* changes - filled in with the number of entries that differ
+ * @returns const char* - NULL once the diff is printed, otherwise why the baseline could not be read
+ */
+const char *diffVolume(const char *baselinePath, size_t *changes)
+{
+	struct Volume baseline = {.fd = -1, .threads = 1, .fatCacheLock = PTHREAD_MUTEX_INITIALIZER, .dentryLock = PTHREAD_MUTEX_INITIALIZER};
+	struct Volume *image = volume;
+	struct VolumeIndex index = {0};
+	const char *error = NULL;
+	bool isIndex;
+
+	// an image starts with a jump instruction, so the magic alone tells a sidecar apart
+	isIndex = mapIndex(baselinePath, &index) && memcmp(index.header->magic, INDEX_MAGIC, sizeof(index.header->magic)) == 0;
+
+	if (isIndex && !indexLayoutFits(&index))
+	{
+		error = "Baseline index is damaged";
+	}
+	else if (isIndex)
+	{
+		locateIndexSections(&index);
+		baseline.volumeIndex = index;
+		*changes = diffIndex(&baseline);
+	}
+	else
+	{
+		// the baseline is read through the same code as the image, so it gets a volume of its own
+		volume = &baseline;
+		error = openVolume(baselinePath);
+		volume = image;
+
+		if (error == NULL)
+		{
+			*changes = diffImages(&baseline);
+
+			volume = &baseline;
+			closeVolume();
+			volume = image;
+		}
+	}
+
+	if (index.map != NULL)
+	{
+		munmap((void *)index.map, index.size);
+	}
+
+	pthread_mutex_destroy(&baseline.fatCacheLock);
+	pthread_mutex_destroy(&baseline.dentryLock);
+
+	return error;
+}
+
+/**
+ * diffImages
+ *
+ * Walks the directories of two images side by side. FAT blocks are hashed first, and a directory whose chain only runs through unchanged
+ * blocks and whose clusters hold the same bytes in both images has its entries skipped, only its subdirectories are read further.
+ * @param struct Volume* baseline - open baseline image, the current volume is the image
+ * @returns size_t - number of entries added, removed or modified
+ */
+size_t diffImages(struct Volume *baseline)
+{
+	// an unchanged directory is only read for its subdirectories, so files are skipped before their names are decoded
+	static const struct FindFilter directoriesOnly = {NULL, NULL, 0, 0, UINT32_MAX, 0, UINT16_MAX, 0, 0, ENTRY_DIRECTORY};
+	struct DiffState state = {0};
+	struct DiffDirectory pending;
+	size_t firstChild;
+	size_t changes;
+
+	state.image.volume = volume;
+	state.baseline.volume = baseline;
+	state.out.sink = volume->out;
+
+	hashFatBlocks(&state);
+
+	state.pendingCapacity = 16;
+	state.pending = malloc(state.pendingCapacity * sizeof(struct DiffDirectory));
+	state.pending[0].cluster = volume->bootSector.BPB_RootClus & MASK_FIRST_HEX;
+	state.pending[0].baselineCluster = baseline->bootSector.BPB_RootClus & MASK_FIRST_HEX;
+	state.pending[0].depth = 0;
+	state.pending[0].path = strdup("");
+	state.pendingCount = 1;
+
+	while (state.pendingCount > 0)
+	{
+		pending = state.pending[--state.pendingCount];
+
+		// the walk is depth first, so the lineage above this depth is still the path down to it
+		if (pending.depth >= state.lineageCapacity)
+		{
+			state.lineageCapacity = (pending.depth + 1) * 2;
+			state.image.lineage = realloc(state.image.lineage, state.lineageCapacity * sizeof(uint32_t));
+			state.baseline.lineage = realloc(state.baseline.lineage, state.lineageCapacity * sizeof(uint32_t));
+		}
+		state.image.lineage[pending.depth] = pending.cluster;
+		state.baseline.lineage[pending.depth] = pending.baselineCluster;
+		state.directories++;
+		firstChild = state.pendingCount;
+
+		if (directoryClustersMatch(&state, &pending))
+		{
+			collectDiffEntries(&state.image, pending.cluster, pending.depth > 0, &directoriesOnly);
+			for (size_t i = 0; i < state.image.entryCount; i++)
+			{
+				if ((state.image.entries[i].info.dir_attr & ATTR_DIRECTORY) == ATTR_DIRECTORY)
+				{
+					pushDiffDirectory(&state, &pending, &state.image.entries[i], &state.image.entries[i]);
+				}
+			}
+		}
+		else
+		{
+			compareDiffDirectory(&state, &pending);
+		}
+
+		// subdirectories were pushed in name order, flipping them makes them come off the stack in name order too
+		for (size_t i = firstChild, j = state.pendingCount; i + 1 < j; i++, j--)
+		{
+			struct DiffDirectory swap = state.pending[i];
+
+			state.pending[i] = state.pending[j - 1];
+			state.pending[j - 1] = swap;
+		}
+
+		free(pending.path);
+	}
+
+	appendDiffSummary(&state);
+	changes = state.added + state.removed + state.modified;
+	freeDiffState(&state);
+
+	return changes;
+}
+
+/**
+ * diffIndex
+ *
+ * Walks the directories of the image and looks every entry up in a baseline index, whatever the index has that the walk did not find was removed.
+ * The index keeps no directory clusters to compare against, so every directory of the image is read.
+ * @param struct Volume* baseline - volume holding only the mapped baseline index, the current volume is the image
+ * @returns size_t - number of entries added, removed or modified
+ */
+size_t diffIndex(struct Volume *baseline)
+{
+	const struct VolumeIndex *index = &baseline->volumeIndex;
+	const struct IndexEntry *indexed;
+	struct DiffState state = {0};
+	struct DirWalk walk = {0};
+	struct DirIterator *iterator;
+	struct DecodedEntry decoded;
+	struct DiffEntry entry;
+	struct DiffEntry baselineEntry;
+	struct TextBuffer key = {0};
+	bool *seen;
+	size_t changes;
+	int kind;
+
+	state.image.volume = volume;
+	state.baseline.volume = baseline;
+	state.out.sink = volume->out;
+	seen = calloc(index->header->entryCount + 1, sizeof(bool));
+
+	// the index only keeps one checksum of the whole FAT, so to a diff the FAT is a single block
+	state.blockCount = 1;
+	state.changedBlockCount = (index->header->fatChecksum != checksumFat());
+
+	pushDirWalk(&walk, volume->bootSector.BPB_RootClus & MASK_FIRST_HEX, false);
+	state.directories++;
+
+	while (walk.depth > 0)
+	{
+		iterator = &walk.frames[walk.depth - 1];
+		walk.path.length = iterator->pathLength;
+		kind = nextDirEntry(iterator, &decoded);
+
+		if (kind == ENTRY_END)
+		{
+			walk.depth--;
+			continue;
+		}
+
+		// the same key writeIndex stores, directory keys never have a . so a file and a directory can not be mistaken for each other
+		key.length = 0;
+		appendBytes(&key, walk.path.data, walk.path.length);
+		if (kind == ENTRY_DIRECTORY)
+		{
+			appendString(&key, decoded.givenName);
+		}
+		else
+		{
+			appendText(&key, "%s.%.3s", decoded.givenName, &decoded.info->dir_name[8]);
+		}
+		appendBytes(&key, "", 1);
+
+		volume = baseline;
+		indexed = findIndexEntry(key.data);
+		volume = state.image.volume;
+
+		entry.info = *decoded.info;
+		entry.firstCluster = decoded.firstCluster;
+
+		if (indexed == NULL)
+		{
+			appendDiffChange(&state, walk.path.data, walk.path.length, &entry, NULL);
+		}
+		else
+		{
+			seen[indexed - index->entries] = true;
+			baselineEntry.info = indexed->entry;
+			baselineEntry.firstCluster = indexed->firstCluster;
+
+			if (diffEntriesDiffer(&entry, &baselineEntry))
+			{
+				appendDiffChange(&state, walk.path.data, walk.path.length, &entry, &baselineEntry);
+			}
+		}
+
+		if (kind == ENTRY_DIRECTORY)
+		{
+			if (!descendDirWalk(&walk, &decoded))
+			{
+				continue;
+			}
+			state.directories++;
+		}
+	}
+
+	// whatever the walk did not come across is gone, reported in the order the index lists it
+	for (uint64_t i = 0; i < index->header->entryCount; i++)
+	{
+		if (!seen[i])
+		{
+			baselineEntry.info = index->entries[i].entry;
+			baselineEntry.firstCluster = index->entries[i].firstCluster;
+			appendDiffChange(&state, index->pool + index->entries[i].dirPath, index->entries[i].dirPathLength, NULL, &baselineEntry);
+		}
+	}
+
+	state.directoriesCompared = state.directories;
+	appendDiffSummary(&state);
+	changes = state.added + state.removed + state.modified;
+
+	free(key.data);
+	free(seen);
+	freeDirWalk(&walk);
+	freeDiffState(&state);
+
+	return changes;
+}
+
+/**
+ * hashFatBlocks
+ *
+ * Hashes every FAT cache page of both images and marks the ones that differ. When the two FATs are not laid out the same way every block is marked.
+ * @param struct DiffState* state - diff whose changedBlocks are filled in
+ * @returns void - NA
+ */
+void hashFatBlocks(struct DiffState *state)
+{
+	struct Volume *image = state->image.volume;
+	struct Volume *baseline = state->baseline.volume;
+	uint32_t *scratch = NULL;
+	uint32_t *baselineScratch = NULL;
+	uint32_t baselineClusters;
+	uint64_t hash;
+	bool comparable;
+
+	volume = baseline;
+	baselineClusters = dataClusterCount();
+	volume = image;
+
+	// blocks only line up when both FATs are cut into the same pages and cover the same clusters of the same size
+	comparable = baseline->bytesPerCluster == image->bytesPerCluster && baseline->fatCacheEntriesPerPage == image->fatCacheEntriesPerPage &&
+				 baseline->fatCacheEntryCount == image->fatCacheEntryCount && baselineClusters == dataClusterCount();
+
+	state->blockCount = image->fatCachePageCount;
+	state->changedBlocks = malloc(state->blockCount * sizeof(bool));
+
+	for (uint32_t i = 0; i < state->blockCount; i++)
+	{
+		state->changedBlocks[i] = true;
+
+		if (comparable)
+		{
+			hash = hashFatBlock(i, &scratch);
+
+			volume = baseline;
+			state->changedBlocks[i] = hashFatBlock(i, &baselineScratch) != hash;
+			volume = image;
+		}
+
+		state->changedBlockCount += state->changedBlocks[i];
+	}
+
+	free(scratch);
+	free(baselineScratch);
+}
+
+/**
+ * hashFatBlock
+ *
+ * Hashes one FAT cache page of the current volume the same way checksumFat hashes the whole FAT
+ * @param uint32_t pageNum - page to hash
+ * @param uint32_t** scratch - buffer for pages that are not in memory, allocated on first use and kept for the next call
+ * @returns uint64_t - hash of the page's entries
+ */
+uint64_t hashFatBlock(uint32_t pageNum, uint32_t **scratch)
+{
+	const uint32_t *page = peekFatPage(pageNum, scratch);
+	uint32_t count = volume->fatCacheEntryCount - (pageNum * volume->fatCacheEntriesPerPage);
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	if (count > volume->fatCacheEntriesPerPage)
+	{
+		count = volume->fatCacheEntriesPerPage;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		hash = (hash ^ page[i]) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * directoryClustersMatch
+ *
+ * Checks whether a directory is the same in both images. Only the image's chain is followed, a FAT block that did not change sends the baseline's
+ * chain the same way, so the first step through a changed block gives up. Directories are rewritten in place, so the clusters are compared as well.
+ * @param struct DiffState* state - diff the directory belongs to
+ * @param const struct DiffDirectory* pending - directory to check
+ * @returns bool - true if the chain and every cluster on it are the same in both images
+ */
+bool directoryClustersMatch(struct DiffState *state, const struct DiffDirectory *pending)
+{
+	struct ChainWalk chain;
+	bool match = true;
+
+	if (pending->cluster == 0 || pending->cluster != pending->baselineCluster)
+	{
+		return false;
+	}
+
+	openChainWalk(&chain, pending->cluster);
+
+	while (match && chain.clusterNum < END_OF_CLUSTER_CHAIN)
+	{
+		if (state->changedBlocks[chain.clusterNum / volume->fatCacheEntriesPerPage])
+		{
+			return false;
+		}
+
+		loadDirCluster(&state->image.dir, chain.clusterNum);
+
+		volume = state->baseline.volume;
+		loadDirCluster(&state->baseline.dir, chain.clusterNum);
+		volume = state->image.volume;
+
+		match = memcmp(state->image.dir.entries, state->baseline.dir.entries, volume->bytesPerCluster) == 0;
+		advanceChainWalk(&chain);
+	}
+
+	return match && !chain.broken;
+}
+
+/**
+ * compareDiffDirectory
+ *
+ * Reads a directory on both sides, prints the entries that differ and pushes the subdirectories to read next
+ * @param struct DiffState* state - diff the directory belongs to
+ * @param const struct DiffDirectory* pending - directory to compare
+ * @returns void - NA
+ */
+void compareDiffDirectory(struct DiffState *state, const struct DiffDirectory *pending)
+{
+	const struct DiffEntry *entry;
+	const struct DiffEntry *baselineEntry;
+	size_t pathLength = strlen(pending->path);
+	size_t i = 0;
+	size_t j = 0;
+	int order;
+
+	state->directoriesCompared++;
+	collectDiffEntries(&state->image, pending->cluster, pending->depth > 0, NULL);
+	collectDiffEntries(&state->baseline, pending->baselineCluster, pending->depth > 0, NULL);
+
+	// both sides are sorted by short name, so one pass pairs them up
+	while (i < state->image.entryCount || j < state->baseline.entryCount)
+	{
+		entry = (i < state->image.entryCount) ? &state->image.entries[i] : NULL;
+		baselineEntry = (j < state->baseline.entryCount) ? &state->baseline.entries[j] : NULL;
+		order = (entry == NULL) ? 1 : (baselineEntry == NULL) ? -1 : compareDiffEntries(entry, baselineEntry);
+
+		// a file that became a directory or the other way round is a different entry under the same name
+		if (order == 0 && (entry->info.dir_attr & ATTR_DIRECTORY) != (baselineEntry->info.dir_attr & ATTR_DIRECTORY))
+		{
+			appendDiffChange(state, pending->path, pathLength, NULL, baselineEntry);
+			pushDiffDirectory(state, pending, NULL, baselineEntry);
+			appendDiffChange(state, pending->path, pathLength, entry, NULL);
+			pushDiffDirectory(state, pending, entry, NULL);
+			i++;
+			j++;
+		}
+		else if (order == 0)
+		{
+			if (diffEntriesDiffer(entry, baselineEntry))
+			{
+				appendDiffChange(state, pending->path, pathLength, entry, baselineEntry);
+			}
+			pushDiffDirectory(state, pending, entry, baselineEntry);
+			i++;
+			j++;
+		}
+		else if (order < 0)
+		{
+			appendDiffChange(state, pending->path, pathLength, entry, NULL);
+			pushDiffDirectory(state, pending, entry, NULL);
+			i++;
+		}
+		else
+		{
+			appendDiffChange(state, pending->path, pathLength, NULL, baselineEntry);
+			pushDiffDirectory(state, pending, NULL, baselineEntry);
+			j++;
+		}
+	}
+}
+
+/**
+ * collectDiffEntries
+ *
+ * Reads the visible entries of one side of a directory and sorts them by short name
+ * @param struct DiffSide* side - side to read, its entries are replaced
+ * @param uint32_t clusterNum - first cluster of the directory, 0 leaves the side empty
+ * @param bool skipDots - the first two entries are dot and dotdot
+ * @param const struct FindFilter* filter - files it rules out are left out, NULL to keep everything
+ * @returns void - NA
+ */
+void collectDiffEntries(struct DiffSide *side, uint32_t clusterNum, bool skipDots, const struct FindFilter *filter)
+{
+	struct Volume *previous = volume;
+	struct DecodedEntry decoded;
+
+	volume = side->volume;
+	side->entryCount = 0;
+	openDirIterator(&side->iterator, clusterNum, skipDots);
+	side->iterator.filter = filter;
+
+	while (nextDirEntry(&side->iterator, &decoded) != ENTRY_END)
+	{
+		if (side->entryCount == side->entryCapacity)
+		{
+			side->entryCapacity = (side->entryCapacity == 0) ? 64 : side->entryCapacity * 2;
+			side->entries = realloc(side->entries, side->entryCapacity * sizeof(struct DiffEntry));
+		}
+
+		side->entries[side->entryCount].info = *decoded.info;
+		side->entries[side->entryCount].firstCluster = decoded.firstCluster;
+		side->entryCount++;
+	}
+
+	volume = previous;
+	qsort(side->entries, side->entryCount, sizeof(struct DiffEntry), compareDiffEntries);
+}
+
+/**
+ * compareDiffEntries
+ *
+ * qsort comparator ordering diff entries by their raw short name, which is unique within a directory
+ * @param const void* a - first struct DiffEntry
+ * @param const void* b - second struct DiffEntry
+ * @returns int - negative, zero or positive like memcmp
+ */
+int compareDiffEntries(const void *a, const void *b)
+{
+	return memcmp(((const struct DiffEntry *)a)->info.dir_name, ((const struct DiffEntry *)b)->info.dir_name, sizeof(((const struct DiffEntry *)a)->info.dir_name));
+}
+
+/**
+ * pushDiffDirectory
+ *
+ * Queues a subdirectory to be read on whichever sides have it, files are ignored and so are directories that point back above themselves
+ * @param struct DiffState* state - diff to queue on
+ * @param const struct DiffDirectory* parent - directory holding the entry
+ * @param const struct DiffEntry* entry - the entry in the image, NULL if only the baseline has it
+ * @param const struct DiffEntry* baselineEntry - the entry in the baseline, NULL if only the image has it
+ * @returns void - NA
+ */
+void pushDiffDirectory(struct DiffState *state, const struct DiffDirectory *parent, const struct DiffEntry *entry, const struct DiffEntry *baselineEntry)
+{
+	const struct DiffEntry *named = (entry != NULL) ? entry : baselineEntry;
+	uint32_t cluster = (entry != NULL) ? entry->firstCluster : 0;
+	uint32_t baselineCluster = (baselineEntry != NULL) ? baselineEntry->firstCluster : 0;
+	struct TextBuffer path = {0};
+	struct DecodedEntry decoded;
+
+	if ((named->info.dir_attr & ATTR_DIRECTORY) != ATTR_DIRECTORY)
+	{
+		return;
+	}
+
+	decodeShortName(&named->info, &decoded);
+
+	for (int i = 0; i <= parent->depth; i++)
+	{
+		if ((cluster != 0 && state->image.lineage[i] == cluster) || (baselineCluster != 0 && state->baseline.lineage[i] == baselineCluster))
+		{
+			fprintf(stderr, "Directory %s%s points back at a directory above it, skipping.\n", parent->path, decoded.givenName);
+			return;
+		}
+	}
+
+	appendString(&path, parent->path);
+	appendString(&path, decoded.givenName);
+	appendBytes(&path, "/", 1);
+	appendBytes(&path, "", 1);
+
+	if (state->pendingCount == state->pendingCapacity)
+	{
+		state->pendingCapacity *= 2;
+		state->pending = realloc(state->pending, state->pendingCapacity * sizeof(struct DiffDirectory));
+	}
+
+	state->pending[state->pendingCount].cluster = cluster;
+	state->pending[state->pendingCount].baselineCluster = baselineCluster;
+	state->pending[state->pendingCount].depth = parent->depth + 1;
+	state->pending[state->pendingCount].path = path.data;
+	state->pendingCount++;
+}
+
+/**
+ * diffEntriesDiffer
+ *
+ * Compares the parts of two directory entries a change to the file would touch, the access date moves on every read so it is left out
+ * @param const struct DiffEntry* entry - entry in the image
+ * @param const struct DiffEntry* baselineEntry - entry with the same name in the baseline
+ * @returns bool - true if the attributes, size, first cluster or a timestamp differ
+ */
+bool diffEntriesDiffer(const struct DiffEntry *entry, const struct DiffEntry *baselineEntry)
+{
+	const struct DirInfo *info = &entry->info;
+	const struct DirInfo *baselineInfo = &baselineEntry->info;
+
+	return info->dir_attr != baselineInfo->dir_attr || info->dir_file_size != baselineInfo->dir_file_size || entry->firstCluster != baselineEntry->firstCluster ||
+		   info->dir_crt_date != baselineInfo->dir_crt_date || info->dir_crt_time != baselineInfo->dir_crt_time ||
+		   info->dir_crt_time_tenth != baselineInfo->dir_crt_time_tenth || info->dir_wrt_date != baselineInfo->dir_wrt_date || info->dir_wrt_time != baselineInfo->dir_wrt_time;
+}
+
+/**
+ * appendDiffChange
+ *
+ * Prints one added, removed or modified entry, by its short name path for text and as a line of JSON for ndjson
+ * @param struct DiffState* state - diff printing the change, its counts are updated
+ * @param const char* path - path of the directory holding the entry, ending in / unless it is the root
+ * @param size_t pathLength - bytes in path
+ * @param const struct DiffEntry* entry - the entry in the image, NULL if it was removed
+ * @param const struct DiffEntry* baselineEntry - the entry in the baseline, NULL if it was added
+ * @returns void - NA
+ */
+void appendDiffChange(struct DiffState *state, const char *path, size_t pathLength, const struct DiffEntry *entry, const struct DiffEntry *baselineEntry)
+{
+	const struct DiffEntry *named = (entry != NULL) ? entry : baselineEntry;
+	bool isDirectory = (named->info.dir_attr & ATTR_DIRECTORY) == ATTR_DIRECTORY;
+	struct TextBuffer *buffer = &state->out;
+	struct TextBuffer name = {0};
+	struct DecodedEntry decoded;
+	const char *change;
+
+	if (baselineEntry == NULL)
+	{
+		change = "added";
+		state->added++;
+	}
+	else if (entry == NULL)
+	{
+		change = "removed";
+		state->removed++;
+	}
+	else
+	{
+		change = "modified";
+		state->modified++;
+	}
+
+	decodeShortName(&named->info, &decoded);
+	appendShortName(&name, &decoded);
+
+	if (options.listFormat == LIST_FORMAT_NDJSON)
+	{
+		appendText(buffer, "{\"change\":\"%s\",\"path\":\"", change);
+		appendJsonString(buffer, path, pathLength);
+		appendJsonString(buffer, name.data, name.length);
+		appendText(buffer, "\",\"type\":\"%s\",", isDirectory ? "directory" : "file");
+		appendDiffFields(buffer, named);
+
+		if (entry != NULL && baselineEntry != NULL)
+		{
+			appendString(buffer, ",\"baseline\":{");
+			appendDiffFields(buffer, baselineEntry);
+			appendBytes(buffer, "}", 1);
+		}
+
+		appendString(buffer, "}\n");
+	}
+	else
+	{
+		// the short name path is what get and cat take
+		appendText(buffer, "%c%s: ", toupper((unsigned char)change[0]), change + 1);
+		appendBytes(buffer, path, pathLength);
+		appendBytes(buffer, name.data, name.length);
+		if (isDirectory)
+		{
+			appendBytes(buffer, "/", 1);
+		}
+
+		if (entry != NULL && baselineEntry != NULL)
+		{
+			appendDiffDetails(buffer, entry, baselineEntry);
+		}
+
+		appendBytes(buffer, "\n", 1);
+	}
+
+	free(name.data);
+}
+
+/**
+ * appendDiffDetails
+ *
+ * Prints the fields of a modified entry that changed, baseline value first, in brackets after its path
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct DiffEntry* entry - entry in the image
+ * @param const struct DiffEntry* baselineEntry - entry with the same name in the baseline
+ * @returns void - NA
+ */
+void appendDiffDetails(struct TextBuffer *buffer, const struct DiffEntry *entry, const struct DiffEntry *baselineEntry)
+{
+	const struct DirInfo *info = &entry->info;
+	const struct DirInfo *baselineInfo = &baselineEntry->info;
+	const char *separator = " (";
+	char stamp[32];
+	char baselineStamp[32];
+
+	if (info->dir_attr != baselineInfo->dir_attr)
+	{
+		appendText(buffer, "%sattributes 0x%02X -> 0x%02X", separator, baselineInfo->dir_attr, info->dir_attr);
+		separator = ", ";
+	}
+
+	if (info->dir_file_size != baselineInfo->dir_file_size)
+	{
+		appendText(buffer, "%ssize %u -> %u", separator, baselineInfo->dir_file_size, info->dir_file_size);
+		separator = ", ";
+	}
+
+	if (entry->firstCluster != baselineEntry->firstCluster)
+	{
+		appendText(buffer, "%sfirst cluster %u -> %u", separator, baselineEntry->firstCluster, entry->firstCluster);
+		separator = ", ";
+	}
+
+	formatFatTimestamp(stamp, sizeof(stamp), info->dir_crt_date, info->dir_crt_time, info->dir_crt_time_tenth);
+	formatFatTimestamp(baselineStamp, sizeof(baselineStamp), baselineInfo->dir_crt_date, baselineInfo->dir_crt_time, baselineInfo->dir_crt_time_tenth);
+	if (strcmp(stamp, baselineStamp) != 0)
+	{
+		appendText(buffer, "%screated %s -> %s", separator, baselineStamp, stamp);
+		separator = ", ";
+	}
+
+	formatFatTimestamp(stamp, sizeof(stamp), info->dir_wrt_date, info->dir_wrt_time, 0);
+	formatFatTimestamp(baselineStamp, sizeof(baselineStamp), baselineInfo->dir_wrt_date, baselineInfo->dir_wrt_time, 0);
+	if (strcmp(stamp, baselineStamp) != 0)
+	{
+		appendText(buffer, "%smodified %s -> %s", separator, baselineStamp, stamp);
+		separator = ", ";
+	}
+
+	if (separator[0] == ',')
+	{
+		appendBytes(buffer, ")", 1);
+	}
+}
+
+/**
+ * appendDiffFields
+ *
+ * Prints the compared fields of one entry as JSON members, without the braces around them
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct DiffEntry* entry - entry to print
+ * @returns void - NA
+ */
+void appendDiffFields(struct TextBuffer *buffer, const struct DiffEntry *entry)
+{
+	char stamp[32];
+
+	appendText(buffer, "\"attributes\":%u,\"size\":%u,\"first_cluster\":%u", entry->info.dir_attr, entry->info.dir_file_size, entry->firstCluster);
+
+	formatFatTimestamp(stamp, sizeof(stamp), entry->info.dir_crt_date, entry->info.dir_crt_time, entry->info.dir_crt_time_tenth);
+	appendText(buffer, ",\"created\":\"%s\"", stamp);
+	formatFatTimestamp(stamp, sizeof(stamp), entry->info.dir_wrt_date, entry->info.dir_wrt_time, 0);
+	appendText(buffer, ",\"modified\":\"%s\"", stamp);
+}
+
+/**
+ * appendDiffSummary
+ *
+ * Prints the counts of a finished diff and how much of the two images it had to read, then flushes everything out
+ * @param struct DiffState* state - finished diff
+ * @returns void - NA
+ */
+void appendDiffSummary(struct DiffState *state)
+{
+	if (options.listFormat == LIST_FORMAT_NDJSON)
+	{
+		appendText(&state->out, "{\"added\":%zu,\"removed\":%zu,\"modified\":%zu,\"fat_blocks\":%u,\"fat_blocks_changed\":%u,\"directories\":%zu,\"directories_compared\":%zu}\n",
+				   state->added, state->removed, state->modified, state->blockCount, state->changedBlockCount, state->directories, state->directoriesCompared);
+	}
+	else
+	{
+		appendText(&state->out, "%zu added, %zu removed, %zu modified. %u of %u FAT blocks changed, %zu of %zu directories compared entry by entry.\n",
+				   state->added, state->removed, state->modified, state->changedBlockCount, state->blockCount, state->directoriesCompared, state->directories);
+	}
+
+	flushText(&state->out);
+}
+
+/**
+ * freeDiffState
+ *
+ * Frees everything a diff allocated
+ * @param struct DiffState* state - diff to free
+ * @returns void - NA
+ */
+void freeDiffState(struct DiffState *state)
+{
+	struct DiffSide *sides[2] = {&state->image, &state->baseline};
+
+	for (int i = 0; i < 2; i++)
+	{
+		freeDirCluster(&sides[i]->iterator.dir);
+		freeDirCluster(&sides[i]->dir);
+		free(sides[i]->entries);
+		free(sides[i]->lineage);
+	}
+
+	for (size_t i = 0; i < state->pendingCount; i++)
+	{
+		free(state->pending[i].path);
+	}
+
+	free(state->pending);
+	free(state->changedBlocks);
+	free(state->out.data);
+}
+
+/**
+ * removeTrailingSpace
+ *
+ * Takes a string and removes all whitespaces at the end of it, then returns the same string.
+ * @param char* string - string to remove whitespaces from
+ * @returns char* - string with whitespaces removed
+ */
+char *removeTrailingSpace(char *string)
+{
+	char *end;
+
+	// this variable now points to
+	end = string + strlen(string) - 1;
+
+	while (end > string && isspace((unsigned char)*end))
+		end--;
+
+	end[1] = '\0';
+
+	return string;
+}
+
+/**
+ * getNextFatValue
+ *
+ * Takes a FAT cluster number and returns the next fat cluster number in the chain, loading the FAT page holding it if it is not cached yet
+ * @param uint32_t currentCluster - current FAT cluster number
+ * @returns uint32_t - next FAT cluster number in chain
+ */
+uint32_t getNextFatValue(uint32_t currentCluster)
+{
+	uint32_t pageNum;
+	uint32_t *page;
+	uint32_t newCluster;
+
+	// anything past the end of the FAT has no next cluster
+	if (currentCluster >= volume->fatCacheEntryCount)
+	{
+		return EOC;
+	}
+
+	pageNum = currentCluster / volume->fatCacheEntriesPerPage;
+	threadStats.fatLookups++;
+
+	// with the whole FAT resident nothing ever changes, so there is nothing to lock
+	if (volume->fatCacheMaxPages == volume->fatCachePageCount)
+	{
+		threadStats.fatCacheHits++;
+		return volume->fatCachePages[pageNum][currentCluster % volume->fatCacheEntriesPerPage];
+	}
+
+	// otherwise another thread could evict the page while we look at it
+	pthread_mutex_lock(&volume->fatCacheLock);
+
+	page = volume->fatCachePages[pageNum];
+	if (page == NULL)
+	{
+		page = loadFatCachePage(pageNum);
+	}
+	else
+	{
+		threadStats.fatCacheHits++;
+	}
+	newCluster = page[currentCluster % volume->fatCacheEntriesPerPage];
+
+	pthread_mutex_unlock(&volume->fatCacheLock);
+
+	return newCluster;
+}
+
+/**
+ * initFatCache
+ *
+ * Sets up the FAT cache, loading the whole FAT at once if it fits under the memory limit, otherwise pages are loaded on demand
+ * @returns void - NA
+ */
+void initFatCache(void)
+{
+	uint64_t fatBytes = (uint64_t)volume->bootSector.BPB_FATSz32 * volume->bootSector.BPB_BytesPerSec;
+	uint64_t pageBytes;
+
+	volume->fatCacheEntriesPerPage = (FAT_CACHE_PAGE_SECTORS * volume->bootSector.BPB_BytesPerSec) / (SIZE_OF_FAT_ENTRY / BITS_PER_BYTE);
+	volume->fatCacheEntryCount = fatBytes / (SIZE_OF_FAT_ENTRY / BITS_PER_BYTE);
+	volume->fatCachePageCount = (volume->fatCacheEntryCount + volume->fatCacheEntriesPerPage - 1) / volume->fatCacheEntriesPerPage;
+	pageBytes = (uint64_t)volume->fatCacheEntriesPerPage * (SIZE_OF_FAT_ENTRY / BITS_PER_BYTE);
+
+	// work out how many pages we are allowed to hold, always at least one so lookups can make progress
+	if (options.fatCacheLimitKB <= 0 || (uint64_t)options.fatCacheLimitKB * BYTES_PER_KB >= fatBytes)
+	{
+		volume->fatCacheMaxPages = volume->fatCachePageCount;
+	}
+	else
+	{
+		volume->fatCacheMaxPages = ((uint64_t)options.fatCacheLimitKB * BYTES_PER_KB) / pageBytes;
+		if (volume->fatCacheMaxPages == 0)
+		{
+			volume->fatCacheMaxPages = 1;
+		}
+	}
+
+	volume->fatCachePages = calloc(volume->fatCachePageCount, sizeof(uint32_t *));
+	volume->fatCacheLoadedPages = 0;
+	volume->fatCacheClockHand = 0;
+
+	// if the image is mapped the FAT is already in memory, so the pages just point into the map
+	volume->fatCacheMapped = mapImage(volume->fatSectorStart, fatBytes) != NULL;
+
+	// a mapped or demand paged FAT is read a page at a time, so ask for as much of it as may be held before the first lookup
+	if (volume->fatCacheMapped || volume->fatCacheMaxPages < volume->fatCachePageCount)
+	{
+		prefetchImage(volume->fatSectorStart, volume->fatCacheMapped ? fatBytes : (uint64_t)volume->fatCacheMaxPages * pageBytes);
+	}
+
+	if (volume->fatCacheMapped)
+	{
+		for (uint32_t i = 0; i < volume->fatCachePageCount; i++)
+		{
+			volume->fatCachePages[i] = (uint32_t *)(volume->imageMap + volume->fatSectorStart + ((off_t)i * pageBytes));
+		}
+		volume->fatCacheLoadedPages = volume->fatCachePageCount;
+	}
+	// if everything fits then pull the whole FAT in now so chain walks never touch the disk
+	else if (volume->fatCacheMaxPages == volume->fatCachePageCount)
+	{
+		struct ImageRead *reads = calloc(volume->fatCachePageCount, sizeof(struct ImageRead));
+
+		// every page is read in one batch so io_uring can have them all in flight at once
+		for (uint32_t i = 0; i < volume->fatCachePageCount; i++)
+		{
+			volume->fatCachePages[i] = malloc(pageBytes);
+			reads[i].buffer = volume->fatCachePages[i];
+			reads[i].length = pageBytes;
+			reads[i].offset = volume->fatSectorStart + ((off_t)i * pageBytes);
+		}
+
+		readImageBatch(reads, volume->fatCachePageCount);
+		volume->fatCacheLoadedPages = volume->fatCachePageCount;
+
+		free(reads);
+	}
+}
+
+/**
+ * loadFatCachePage
+ *
+ * Reads one page of the FAT into memory, evicting another page first if the cache is at its memory limit
+ * @param uint32_t pageNum - index of the page to load
+ * @returns uint32_t* - the loaded page
+ */
+uint32_t *loadFatCachePage(uint32_t pageNum)
+{
+	size_t pageBytes = volume->fatCacheEntriesPerPage * (SIZE_OF_FAT_ENTRY / BITS_PER_BYTE);
+	uint32_t *page = NULL;
+
+	// if we are full then sweep the clock hand around until we find a loaded page to reuse
+	if (volume->fatCacheLoadedPages >= volume->fatCacheMaxPages)
+	{
+		while (volume->fatCachePages[volume->fatCacheClockHand] == NULL)
+		{
+			volume->fatCacheClockHand = (volume->fatCacheClockHand + 1) % volume->fatCachePageCount;
+		}
+
+		page = volume->fatCachePages[volume->fatCacheClockHand];
+		volume->fatCachePages[volume->fatCacheClockHand] = NULL;
+		volume->fatCacheClockHand = (volume->fatCacheClockHand + 1) % volume->fatCachePageCount;
+		volume->fatCacheLoadedPages--;
+	}
+	else
+	{
+		page = malloc(pageBytes);
+	}
+
+	// the last page can run past the end of the FAT, so clear it before reading
+	memset(page, 0, pageBytes);
+	readImage(page, pageBytes, volume->fatSectorStart + ((off_t)pageNum * pageBytes));
+
+	volume->fatCachePages[pageNum] = page;
+	volume->fatCacheLoadedPages++;
+
+	return page;
+}
+
+/**
+ * peekFatPage
+ *
+ * Gives a whole page of the FAT for a scan over every entry. When the whole FAT is held the cached page is returned, otherwise the page is read into the caller's scratch buffer so demand paging is left alone. Safe to call from several threads with their own scratch buffers.
+ * @param uint32_t pageNum - index of the page
+ * @param uint32_t** scratch - buffer owned by the caller, allocated on first use, the caller frees it
+ * @returns const uint32_t* - the page, the part past the end of the FAT is not meaningful
+ */
+const uint32_t *peekFatPage(uint32_t pageNum, uint32_t **scratch)
+{
+	size_t pageBytes = volume->fatCacheEntriesPerPage * (SIZE_OF_FAT_ENTRY / BITS_PER_BYTE);
+
+	if (volume->fatCacheMapped || volume->fatCacheMaxPages == volume->fatCachePageCount)
+	{
+		return volume->fatCachePages[pageNum];
+	}
+
+	if (*scratch == NULL)
+	{
+		*scratch = malloc(pageBytes);
+	}
+	readImage(*scratch, pageBytes, volume->fatSectorStart + ((off_t)pageNum * pageBytes));
+
+	return *scratch;
+}
+
+/**
+ * freeFatCache
+ *
+ * Releases all memory held by the FAT cache
+ * @returns void - NA
+ */
+void freeFatCache(void)
+{
+	if (volume->fatCachePages == NULL)
+	{
+		return;
+	}
+
+	// mapped pages belong to the image map and are released with it
+	for (uint32_t i = 0; i < volume->fatCachePageCount && !volume->fatCacheMapped; i++)
+	{
+		free(volume->fatCachePages[i]);
+	}
+
+	free(volume->fatCachePages);
+	volume->fatCachePages = NULL;
+	volume->fatCacheLoadedPages = 0;
+}
+
+/**
+ * openImage
+ *
+ * Opens the image and picks the backend used to read it, mapping it into memory when the options allow and the kernel lets us
+ * @param const char* path - path to the image file
+ * @returns bool - true if the image was opened
+ */
+bool openImage(const char *path)
+{
+	struct stat imageStat;
+	void *map;
+	char *probe;
+
+	volume->directFd = -1;
+	volume->fd = open(path, O_RDONLY);
+	if (volume->fd < 0)
+	{
+		return false;
+	}
+
+	// file bytes bypass the page cache if the filesystem under the image allows it, everything else still goes through fd
+	if (options.direct)
+	{
+		volume->directFd = open(path, O_RDONLY | O_DIRECT);
+		probe = allocCopyBuffer();
+
+		// some filesystems take O_DIRECT at open and only refuse the reads, so find out now rather than in the middle of a copy
+		if (volume->directFd >= 0 && pread(volume->directFd, probe, DIRECT_ALIGN, 0) < 0)
+		{
+			close(volume->directFd);
+			volume->directFd = -1;
+		}
+		free(probe);
+	}
+
+	volume->imageMap = NULL;
+	volume->imageSize = 0;
+
+	if (fstat(volume->fd, &imageStat) == 0 && S_ISREG(imageStat.st_mode))
+	{
+		volume->imageSize = imageStat.st_size;
+	}
+
+	// uring never maps, it reads through per thread rings set up on first use
+	if (options.backend == BACKEND_URING)
+	{
+		pthread_once(&uringKeyOnce, createUringKey);
+		volume->uringEnabled = uringKeyCreated;
+		return true;
+	}
+
+	// auto only maps regular files, block devices and pipes keep using pread
+	if (options.backend == BACKEND_PREAD || (options.backend == BACKEND_AUTO && volume->imageSize == 0))
+	{
+		return true;
+	}
+
+	// forced mmap still needs a size, so ask block devices how big they are
+	if (volume->imageSize == 0)
+	{
+		volume->imageSize = lseek(volume->fd, 0, SEEK_END);
+		threadStats.seekCalls++;
+		if (volume->imageSize <= 0)
+		{
+			volume->imageSize = 0;
+			return true;
+		}
+	}
+
+	map = mmap(NULL, volume->imageSize, PROT_READ, MAP_SHARED, volume->fd, 0);
+
+	// if mapping fails we quietly fall back to pread
+	if (map != MAP_FAILED)
+	{
+		volume->imageMap = map;
+	}
+
+	return true;
+}
+
+/**
+ * createUringKey
+ *
+ * Creates the key holding each thread's io_uring ring, run once for the whole process
+ * @returns void - NA
+ */
+void createUringKey(void)
+{
+	uringKeyCreated = pthread_key_create(&uringRingKey, freeUringRing) == 0;
+}
+
+/**
+ * closeImage
+ *
+ * Unmaps and closes the image along with its index
+ * @returns void - NA
+ */
+void closeImage(void)
+{
+	closeIndex();
+
+	if (volume->imageMap != NULL)
+	{
+		munmap((void *)volume->imageMap, volume->imageSize);
+		volume->imageMap = NULL;
+	}
+
+	// other threads' rings went away when they exited, the main thread's has to be freed here
+	if (volume->uringEnabled && volume == &mainVolume)
+	{
+		freeUringRing(pthread_getspecific(uringRingKey));
+		pthread_setspecific(uringRingKey, NULL);
+	}
+	volume->uringEnabled = false;
+
+	if (volume->directFd >= 0)
+	{
+		close(volume->directFd);
+		volume->directFd = -1;
+	}
+	close(volume->fd);
+}
+
+/**
+ * readImage
+ *
+ * Copies bytes from the image into a buffer, from the map if there is one, through io_uring if it is in use, otherwise with pread. Anything past the end of the image reads as zeros.
+ * @param void* buffer - where to put the bytes
+ * @param size_t length - number of bytes to read
+ * @param off_t offset - byte offset in the image to read from
+ * @returns ssize_t - number of bytes that came from the image
+ */
+ssize_t readImage(void *buffer, size_t length, off_t offset)
+{
+	size_t bytesRead = 0;
+	struct ImageRead read = {buffer, length, offset, 0};
+
+	if (volume->imageMap != NULL)
+	{
+		if (offset < volume->imageSize)
+		{
+			bytesRead = (offset + (off_t)length <= volume->imageSize) ? length : (size_t)(volume->imageSize - offset);
+			memcpy(buffer, volume->imageMap + offset, bytesRead);
+		}
+		threadStats.mappedBytes += bytesRead;
+		memset((char *)buffer + bytesRead, 0, length - bytesRead);
+		return bytesRead;
+	}
+
+	if (volume->uringEnabled)
+	{
+		readImageBatch(&read, 1);
+		return read.bytesRead;
+	}
+
+	return readImagePread(buffer, length, offset);
+}
+
+/**
+ * readImagePread
+ *
+ * Reads bytes from the image with pread, zero filling anything past the end of the image
+ * @param void* buffer - where to put the bytes
+ * @param size_t length - number of bytes to read
+ * @param off_t offset - byte offset in the image to read from
+ * @returns ssize_t - number of bytes that came from the image
+ */
+ssize_t readImagePread(void *buffer, size_t length, off_t offset)
+{
+	size_t bytesRead = 0;
+	ssize_t result;
+
+	// pread can come back short, so keep going until we have everything or hit the end
+	while (bytesRead < length)
+	{
+		result = pread(volume->fd, (char *)buffer + bytesRead, length - bytesRead, offset + bytesRead);
+		threadStats.readCalls++;
+		if (result <= 0)
+		{
+			break;
+		}
+		bytesRead += result;
+		threadStats.bytesRead += result;
+	}
+
+	memset((char *)buffer + bytesRead, 0, length - bytesRead);
+	return bytesRead;
+}
+
+/**
+ * readImageBatch
+ *
+ * Reads several ranges of the image at once. With io_uring all of them are submitted together, up to the ring size in flight, and reaped as they complete. Otherwise they are read one after another.
+ * @param struct ImageRead* reads - reads to do, bytesRead is filled in for each
+ * @param size_t count - number of reads
+ * @returns void - NA
+ */
+void readImageBatch(struct ImageRead *reads, size_t count)
+{
+	struct UringRing *ring = (volume->imageMap == NULL && volume->uringEnabled) ? getUringRing() : NULL;
+	size_t submitted = 0;
+	size_t completed = 0;
+	unsigned inFlight = 0;
+	unsigned toSubmit;
+	unsigned head;
+	unsigned tail;
+	long result;
+
+	if (ring == NULL)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			reads[i].bytesRead = (volume->imageMap != NULL) ? readImage(reads[i].buffer, reads[i].length, reads[i].offset) : readImagePread(reads[i].buffer, reads[i].length, reads[i].offset);
+		}
+		return;
+	}
+
+	while (completed < count)
+	{
+		// fill the submission queue with as many reads as the ring has room for
+		toSubmit = 0;
+		tail = *ring->sqTail;
+		while (submitted < count && inFlight < ring->entries)
+		{
+			unsigned index = tail & *ring->sqMask;
+			struct io_uring_sqe *sqe = &ring->sqes[index];
+
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = volume->fd;
+			sqe->off = reads[submitted].offset;
+			sqe->addr = (uintptr_t)reads[submitted].buffer;
+			sqe->len = reads[submitted].length;
+			sqe->user_data = submitted;
+			ring->sqArray[index] = index;
+
+			tail++;
+			submitted++;
+			inFlight++;
+			toSubmit++;
+		}
+		__atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+
+		// one syscall submits everything new and waits for at least one completion
+		result = syscall(__NR_io_uring_enter, ring->ringFd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		threadStats.readCalls++;
+		if (result < 0 && errno != EINTR)
+		{
+			// the ring is no use to us, so redo the whole batch with pread
+			for (size_t i = 0; i < count; i++)
+			{
+				reads[i].bytesRead = readImagePread(reads[i].buffer, reads[i].length, reads[i].offset);
+			}
+			volume->uringEnabled = false;
+			return;
+		}
+
+		// reap whatever has completed
+		head = *ring->cqHead;
+		tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+		while (head != tail)
+		{
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+			struct ImageRead *read = &reads[cqe->user_data];
+			size_t done = (cqe->res > 0) ? (size_t)cqe->res : 0;
+
+			// short reads and errors, including kernels without IORING_OP_READ, get finished off with pread
+			read->bytesRead = done;
+			threadStats.bytesRead += done;
+			if (done < read->length)
+			{
+				read->bytesRead += readImagePread((char *)read->buffer + done, read->length - done, read->offset + done);
+			}
+
+			head++;
+			completed++;
+			inFlight--;
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * getUringRing
+ *
+ * Gets the calling thread's io_uring ring, setting it up on first use
+ * @returns struct UringRing* - the ring, NULL if the kernel would not give us one
+ */
+struct UringRing *getUringRing(void)
+{
+	struct UringRing *ring = pthread_getspecific(uringRingKey);
+
+	if (ring == NULL)
+	{
+		ring = setupUringRing();
+		if (ring == NULL)
+		{
+			// no io_uring on this system, so everyone falls back to pread
+			volume->uringEnabled = false;
+			return NULL;
+		}
+		pthread_setspecific(uringRingKey, ring);
+	}
+
+	return ring;
+}
+
+/**
+ * setupUringRing
+ *
+ * Creates an io_uring instance and maps its submission queue, completion queue and submission entries
+ * @returns struct UringRing* - the new ring, NULL if anything failed
+ */
+struct UringRing *setupUringRing(void)
+{
+	struct io_uring_params params;
+	struct UringRing *ring;
+	uint8_t *sqRing;
+	uint8_t *cqRing;
+
+	memset(&params, 0, sizeof(params));
+
+	ring = calloc(1, sizeof(struct UringRing));
+	ring->ringFd = syscall(__NR_io_uring_setup, URING_QUEUE_DEPTH, &params);
+	if (ring->ringFd < 0)
+	{
+		free(ring);
+		return NULL;
+	}
+
+	ring->entries = params.sq_entries;
+	ring->sqRingSize = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+	ring->cqRingSize = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQ_RING);
+	ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_CQ_RING);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQES);
+
+	if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		ring->sqRing = (ring->sqRing == MAP_FAILED) ? NULL : ring->sqRing;
+		ring->cqRing = (ring->cqRing == MAP_FAILED) ? NULL : ring->cqRing;
+		ring->sqes = (ring->sqes == MAP_FAILED) ? NULL : ring->sqes;
+		freeUringRing(ring);
+		return NULL;
+	}
+
+	sqRing = ring->sqRing;
+	cqRing = ring->cqRing;
+
+	ring->sqHead = (unsigned *)(sqRing + params.sq_off.head);
+	ring->sqTail = (unsigned *)(sqRing + params.sq_off.tail);
+	ring->sqMask = (unsigned *)(sqRing + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned *)(sqRing + params.sq_off.array);
+	ring->cqHead = (unsigned *)(cqRing + params.cq_off.head);
+	ring->cqTail = (unsigned *)(cqRing + params.cq_off.tail);
+	ring->cqMask = (unsigned *)(cqRing + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cqRing + params.cq_off.cqes);
+
+	return ring;
+}
+
+/**
+ * freeUringRing
+ *
+ * Unmaps and closes an io_uring instance, also used as the thread exit destructor
+ * @param void* ring - the struct UringRing to free, may be NULL
+ * @returns void - NA
+ */
+void freeUringRing(void *ring)
+{
+	struct UringRing *uring = ring;
+
+	if (uring == NULL)
+	{
+		return;
+	}
+
+	if (uring->sqRing != NULL)
+	{
+		munmap(uring->sqRing, uring->sqRingSize);
+	}
+	if (uring->cqRing != NULL)
+	{
+		munmap(uring->cqRing, uring->cqRingSize);
+	}
+	if (uring->sqes != NULL)
+	{
+		munmap(uring->sqes, uring->sqesSize);
+	}
+
+	close(uring->ringFd);
+	free(uring);
+}
+
+/**
+ * mapImage
+ *
+ * Gives a pointer straight into the image map so callers can read in place
+ * @param off_t offset - byte offset in the image
+ * @param size_t length - number of bytes the caller will look at
+ * @returns const void* - pointer to the bytes, or NULL if the image is not mapped or the range runs past the end
+ */
+const void *mapImage(off_t offset, size_t length)
+{
+	if (volume->imageMap == NULL || offset < 0 || offset + (off_t)length > volume->imageSize)
+	{
+		return NULL;
+	}
+
+	return volume->imageMap + offset;
+}
+
+/**
+ * prefetchImage
+ *
+ * Tells the kernel a range of the image is about to be read so it can start reading it in the background, through madvise when the range is mapped and posix_fadvise otherwise
+ * @param off_t offset - byte offset of the range in the image
+ * @param uint64_t length - number of bytes in the range
+ * @returns void - NA
+ */
+void prefetchImage(off_t offset, uint64_t length)
+{
+	off_t pageStart;
+
+	if (!options.prefetch || length == 0 || offset < 0)
+	{
+		return;
+	}
+
+	threadStats.prefetchHints++;
+
+	// madvise wants a page aligned start, and the range has to stay inside the map
+	if (volume->imageMap != NULL)
+	{
+		if (offset >= volume->imageSize)
+		{
+			return;
+		}
+		length = (offset + (off_t)length <= volume->imageSize) ? length : (uint64_t)(volume->imageSize - offset);
+		pageStart = offset & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+		madvise((void *)(volume->imageMap + pageStart), length + (offset - pageStart), MADV_WILLNEED);
+		return;
+	}
+
+	posix_fadvise(volume->fd, offset, length, POSIX_FADV_WILLNEED);
+}
+
+/**
+ * prefetchNextCluster
+ *
+ * Asks for the cluster after this one in its chain while this one is decoded, unless it is the next cluster on disk that readahead already covers
+ * @param uint32_t clusterNum - cluster being read
+ * @returns void - NA
+ */
+void prefetchNextCluster(uint32_t clusterNum)
+{
+	uint32_t nextCluster;
+
+	if (!options.prefetch)
+	{
+		return;
+	}
+
+	nextCluster = getNextFatValue(clusterNum) & MASK_FIRST_HEX;
+	if (nextCluster >= 2 && nextCluster < END_OF_CLUSTER_CHAIN && nextCluster != clusterNum + 1)
+	{
+		prefetchImage(clusterOffset(nextCluster), volume->bytesPerCluster);
+	}
+}
+
+/**
+ * prefetchExtents
+ *
+ * Asks for the extents of a file from first on, up to PREFETCH_WINDOW bytes of them, joining extents with small gaps between them into one range
+ * @param const struct ExtentList* list - extents of the file
+ * @param size_t first - first extent to ask for
+ * @returns size_t - first extent that was not asked for
+ */
+size_t prefetchExtents(const struct ExtentList *list, size_t first)
+{
+	off_t rangeStart = list->extents[first].offset;
+	off_t rangeEnd = rangeStart;
+	uint64_t asked = 0;
+	size_t next;
+
+	for (next = first; next < list->count && asked < PREFETCH_WINDOW; next++)
+	{
+		const struct Extent *extent = &list->extents[next];
+
+		if (extent->offset < rangeEnd || extent->offset - rangeEnd > PREFETCH_GAP)
+		{
+			prefetchImage(rangeStart, rangeEnd - rangeStart);
+			rangeStart = extent->offset;
+		}
+		rangeEnd = extent->offset + extent->length;
+		asked += extent->length;
+	}
+
+	prefetchImage(rangeStart, rangeEnd - rangeStart);
+	return next;
+}
+
+/**
+ * allocCopyBuffer
+ *
+ * Allocates a buffer for COPY_BUFFER_SIZE bytes of a file, aligned and padded so readImageDirect can use it
+ * @returns char* - the buffer, the caller frees it
+ */
+char *allocCopyBuffer(void)
+{
+	void *buffer = NULL;
+
+	if (posix_memalign(&buffer, DIRECT_ALIGN, COPY_BUFFER_SIZE + (2 * DIRECT_ALIGN)) != 0)
+	{
+		return NULL;
+	}
+
+	return buffer;
+}
+
+/**
+ * readFileBytes
+ *
+ * Reads bytes of a file being copied out, around the page cache with --direct and through readImage otherwise
+ * @param char* buffer - buffer from allocCopyBuffer
+ * @param size_t length - number of bytes to read, at most COPY_BUFFER_SIZE
+ * @param off_t offset - byte offset in the image to read from
+ * @returns const char* - where the bytes start, inside buffer
+ */
+const char *readFileBytes(char *buffer, size_t length, off_t offset)
+{
+	if (volume->directFd >= 0)
+	{
+		return readImageDirect(buffer, length, offset);
+	}
+
+	readImage(buffer, length, offset);
+	return buffer;
+}
+
+/**
+ * readImageDirect
+ *
+ * Reads bytes with O_DIRECT, widening the read to DIRECT_ALIGN boundaries on both sides. Anything past the end of the image reads as zeros.
+ * @param char* buffer - buffer from allocCopyBuffer
+ * @param size_t length - number of bytes to read, at most COPY_BUFFER_SIZE
+ * @param off_t offset - byte offset in the image to read from
+ * @returns const char* - where the bytes start, inside buffer
+ */
+const char *readImageDirect(char *buffer, size_t length, off_t offset)
+{
+	off_t start = offset & ~(off_t)(DIRECT_ALIGN - 1);
+	size_t span = (((offset + length) + DIRECT_ALIGN - 1) & ~(off_t)(DIRECT_ALIGN - 1)) - start;
+	size_t bytesRead = 0;
+	ssize_t result;
+
+	while (bytesRead < span)
+	{
+		result = pread(volume->directFd, buffer + bytesRead, span - bytesRead, start + bytesRead);
+		threadStats.readCalls++;
+		if (result <= 0)
+		{
+			break;
+		}
+		bytesRead += result;
+		threadStats.bytesRead += result;
+	}
+
+	memset(buffer + bytesRead, 0, span - bytesRead);
+	return buffer + (offset - start);
+}
+
+/**
+ * loadDirCluster
+ *
+ * Makes a whole directory cluster available for decoding with a single read, or none at all when the image is mapped
+ * @param struct DirCluster* dir - cluster holder, its buffer is allocated on first use and reused after that
+ * @param uint32_t clusterNum - cluster number in the data region to load
+ * @returns bool - true if the entries came from the image map
+ */
+bool loadDirCluster(struct DirCluster *dir, uint32_t clusterNum)
+{
+	dir->clusterNum = clusterNum;
+	dir->entries = mapImage(clusterOffset(clusterNum), volume->bytesPerCluster);
+	threadStats.dirClusters++;
+
+	if (dir->entries != NULL)
+	{
+		threadStats.mappedBytes += volume->bytesPerCluster;
+		return true;
+	}
+
+	if (dir->buffer == NULL)
+	{
+		dir->buffer = malloc(volume->bytesPerCluster);
+	}
+
+	readImage(dir->buffer, volume->bytesPerCluster, clusterOffset(clusterNum));
+	dir->entries = dir->buffer;
+
+	return false;
+}
+
+/**
+ * freeDirCluster
+ *
+ * Releases the buffer held by a directory cluster holder
+ * @param struct DirCluster* dir - cluster holder to release
+ * @returns void - NA
+ */
+void freeDirCluster(struct DirCluster *dir)
+{
+	free(dir->buffer);
+	dir->buffer = NULL;
+	dir->entries = NULL;
+}
+
+/**
+ * clusterOffset
+ *
+ * Works out the byte offset in the image where a data cluster starts
+ * @param uint32_t clusterNum - cluster number in the data region
+ * @returns off_t - byte offset of the cluster
+ */
+off_t clusterOffset(uint32_t clusterNum)
+{
+	// clusterNum - 2 because the first 2 slots of the FAT table (slots 0 and 1) are occupied by something else and thus do not count
+	return (volume->dataSectorLocationInSectors * volume->bootSector.BPB_BytesPerSec) + ((off_t)(clusterNum - 2) * volume->bytesPerCluster);
+}
+
+/**
+ * fetchFile
+ *
+ * Takes a file path, finds the file through the index or the dentry cache, and copies it to the output directory
+ * @param const char* path - path to target file, made of short names separated by /
+ * @returns bool - true if the file was found and copied
+ */
+bool fetchFile(const char *path)
+{
+	struct DirInfo target;
+	struct ExtentList list = {0};
+	struct Hasher hasher;
+	struct TextBuffer manifest = {0};
+	char givenName[9];
+	char nameExtension[4];
+	bool copied;
+
+	if (!locateFile(path, &target, &list))
+	{
+		return false;
+	}
+
+	// seperate name into extension and given name
+	memcpy(givenName, target.dir_name, 8);
+	givenName[8] = '\0';
+	removeTrailingSpace(givenName);
+
+	memcpy(nameExtension, &target.dir_name[8], 3);
+	nameExtension[3] = '\0';
+
+	limitToRange(&list);
+	startPhase(PHASE_COPY);
+
+	// with --hash the manifest line comes out ahead of the copied message
+	manifest.sink = volume->out;
+	initHasher(&hasher, options.hash);
+	copied = copyFile(&list, givenName, nameExtension, (options.hash != HASH_NONE) ? &hasher : NULL);
+	if (copied && options.hash != HASH_NONE)
+	{
+		appendHashLine(&manifest, path, &hasher);
+		flushText(&manifest);
+		free(manifest.data);
+	}
+	freeExtents(&list);
+
+	return copied;
+}
+
+/**
+ * locateFile
+ *
+ * Finds a file and where it lives in the image. An up to date index answers straight from the sidecar, otherwise the path is resolved through the dentry cache and the extents are built from the FAT.
+ * @param const char* path - path to the file, made of short names separated by /
+ * @param struct DirInfo* entry - filled in with a copy of the file's directory entry
+ * @param struct ExtentList* list - empty list filled in with the file's extents, NULL if they are not needed
+ * @returns bool - true if the file was found, and when list is given, its extents cover the whole file
+ */
+bool locateFile(const char *path, struct DirInfo *entry, struct ExtentList *list)
+{
+	const struct IndexEntry *indexed;
+	const struct Dentry *found;
+	uint32_t startingCluster;
+	uint64_t covered;
+
+	if (volume->volumeIndex.header != NULL)
+	{
+		indexed = findIndexEntry(path);
+		if (indexed == NULL || (indexed->entry.dir_attr & ATTR_DIRECTORY) == ATTR_DIRECTORY)
+		{
+			return false;
+		}
+
+		*entry = indexed->entry;
+		if (list != NULL)
+		{
+			// copy the extents out so the list is freed the same way whichever way it was built
+			list->count = indexed->extentCount;
+			list->capacity = indexed->extentCount;
+			list->extents = malloc(list->count * sizeof(struct Extent));
+			memcpy(list->extents, volume->volumeIndex.extents + indexed->firstExtent, list->count * sizeof(struct Extent));
+
+			// the index keeps a chain that ended early as it was found
+			covered = 0;
+			for (size_t i = 0; i < list->count; i++)
+			{
+				covered += list->extents[i].length;
+			}
+			if (!chainCoversFile(path, covered, entry->dir_file_size))
+			{
+				freeExtents(list);
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// the cache can grow under another thread, so the entry is copied out before the lock is let go
+	pthread_mutex_lock(&volume->dentryLock);
+	found = resolvePath(path, false);
+	if (found != NULL)
+	{
+		*entry = found->entry;
+	}
+	pthread_mutex_unlock(&volume->dentryLock);
+
+	if (found == NULL)
+	{
+		return false;
+	}
+
+	if (list != NULL)
+	{
+		// combine the bits
+		startingCluster = (((uint32_t)entry->dir_first_cluster_hi << 16) | entry->dir_first_cluster_lo) & MASK_FIRST_HEX;
+		covered = buildExtents(startingCluster, entry->dir_file_size, list);
+		if (!chainCoversFile(path, covered, entry->dir_file_size))
+		{
+			freeExtents(list);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * limitToRange
+ *
+ * Cuts a file's extents down to the range picked with --offset and --length, leaving them alone when no range was picked
+ * @param struct ExtentList* list - extents of the whole file, replaced by the extents of the range
+ * @returns void - NA
+ */
+void limitToRange(struct ExtentList *list)
+{
+	struct ExtentList slice = {0};
+
+	if (options.rangeOffset == 0 && options.rangeLength == UINT64_MAX)
+	{
+		return;
+	}
+
+	sliceExtents(list, options.rangeOffset, options.rangeLength, &slice);
+	freeExtents(list);
+	*list = slice;
+}
+
+/**
+ * streamFile
+ *
+ * Finds a file and writes its contents straight to a file descriptor, such as stdout or a pipe, without staging it in the output directory. The copy goes through the same extents as get, so the kernel moves the bytes with sendfile where it can and at most one fixed size buffer is held otherwise.
+ * @param const char* path - path to the file, made of short names separated by /
+ * @param int outFd - descriptor to write the file to
+ * @returns bool - true if the file was found and fully written
+ */
+bool streamFile(const char *path, int outFd)
+{
+	struct DirInfo target;
+	struct ExtentList list = {0};
+	struct Hasher hasher;
+	struct TextBuffer manifest = {0};
+	bool success;
+
+	if (!locateFile(path, &target, &list))
+	{
+		return false;
+	}
+
+	limitToRange(&list);
+	startPhase(PHASE_COPY);
+
+	// stdout carries the file, so the manifest line goes to stderr
+	manifest.sink = stderr;
+	initHasher(&hasher, options.hash);
+	success = copyExtents(&list, outFd, (options.hash != HASH_NONE) ? &hasher : NULL);
+	if (success && options.hash != HASH_NONE)
+	{
+		appendHashLine(&manifest, path, &hasher);
+		flushText(&manifest);
+		free(manifest.data);
+	}
+	freeExtents(&list);
+
+	return success;
+}
+
+/**
+ * serveVolume
+ *
+ * Keeps the image open with its FAT cache, dentry cache and index warm and answers requests on a Unix socket until SIGINT or SIGTERM. Every client gets its own thread, so a slow client never holds up the others. The protocol is in the README.
+ * @param const char* socketPath - where to create the socket, anything already there is replaced
+ * @returns bool - false if the socket could not be set up
+ */
+bool serveVolume(const char *socketPath)
+{
+	struct sockaddr_un address = {0};
+	struct sigaction action = {0};
+	pthread_attr_t attributes;
+	pthread_t thread;
+	int listenFd;
+	int clientFd;
+
+	if (strlen(socketPath) >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	unlink(socketPath);
+	if (listenFd < 0 || bind(listenFd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, SERVE_BACKLOG) != 0)
+	{
+		if (listenFd >= 0)
+		{
+			close(listenFd);
+		}
+		return false;
+	}
+
+	// no SA_RESTART, so accept comes back with EINTR when we are told to stop
+	action.sa_handler = stopServing;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	pthread_attr_init(&attributes);
+	pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+	printf("Serving %s on %s.\n", volume->imageName, socketPath);
+	fflush(stdout);
+
+	while (!serveStopping)
+	{
+		clientFd = accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+		if (clientFd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			break;
+		}
+
+		if (pthread_create(&thread, &attributes, serveClient, (void *)(intptr_t)clientFd) != 0)
+		{
+			close(clientFd);
+		}
+	}
+
+	pthread_attr_destroy(&attributes);
+	close(listenFd);
+	unlink(socketPath);
+
+	return true;
+}
+
+/**
+ * stopServing
+ *
+ * Signal handler for SIGINT and SIGTERM while serving
+ * @param int signalNum - signal that arrived
+ * @returns void - NA
+ */
+void stopServing(int signalNum)
+{
+	(void)signalNum;
+	serveStopping = 1;
+}
+
+/**
+ * serveClient
+ *
+ * Thread body for one client connection, answers requests in order until the client hangs up or sends something that does not parse
+ * @param void* arg - the connected socket, cast to a pointer
+ * @returns void* - NULL
+ */
+void *serveClient(void *arg)
+{
+	int clientFd = (int)(intptr_t)arg;
+	uint8_t header[SERVE_REQUEST_SIZE];
+	char path[PATH_MAX];
+	struct TextBuffer reply = {0};
+	struct DirInfo entry;
+	uint32_t status;
+	size_t pathLength;
+	bool connected = true;
+
+	while (connected && receiveAll(clientFd, header, sizeof(header)))
+	{
+		pathLength = getLittleEndian(header + 2, 2);
+		if (pathLength >= sizeof(path) || !receiveAll(clientFd, path, pathLength))
+		{
+			break;
+		}
+		path[pathLength] = '\0';
+
+		reply.length = 0;
+		status = SERVE_OK;
+
+		if (header[0] == SERVE_OP_INFO)
+		{
+			appendServeInfo(&reply);
+		}
+		else if (header[0] == SERVE_OP_STAT)
+		{
+			// a path can name a file or a directory, files are tried first like get does
+			if (locateFile(path, &entry, NULL) || locateDirectory(path, &entry))
+			{
+				appendBytes(&reply, (const char *)&entry, sizeof(entry));
+			}
+			else
+			{
+				status = SERVE_NOT_FOUND;
+			}
+		}
+		else if (header[0] == SERVE_OP_READDIR)
+		{
+			status = appendServeDirectory(&reply, path);
+		}
+		else if (header[0] == SERVE_OP_READ)
+		{
+			// reads stream their payload straight to the socket instead of building a reply
+			connected = serveRead(clientFd, path, getLittleEndian(header + 8, 8), getLittleEndian(header + 4, 4));
+			continue;
+		}
+		else
+		{
+			status = SERVE_BAD_REQUEST;
+		}
+
+		connected = sendReplyHeader(clientFd, status, reply.length) && sendAll(clientFd, reply.data, reply.length);
+	}
+
+	free(reply.data);
+	close(clientFd);
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * appendServeInfo
+ *
+ * Writes the info reply, a fixed 47 byte little endian record of the volume's geometry and names
+ * @param struct TextBuffer* reply - buffer to add to
+ * @returns void - NA
+ */
+void appendServeInfo(struct TextBuffer *reply)
+{
+	uint8_t *out = (uint8_t *)reserveText(reply, SERVE_INFO_SIZE);
+
+	putLittleEndian(out, volume->bootSector.BPB_BytesPerSec, 2);
+	out[2] = volume->bootSector.BPB_SecPerClus;
+	out[3] = volume->bootSector.BPB_NumFATs;
+	putLittleEndian(out + 4, volume->bootSector.BPB_TotSec32, 4);
+	putLittleEndian(out + 8, volume->bootSector.BPB_FATSz32, 4);
+	putLittleEndian(out + 12, volume->bootSector.BPB_RootClus & MASK_FIRST_HEX, 4);
+	putLittleEndian(out + 16, volume->bootSector.BS_VolID, 4);
+	putLittleEndian(out + 20, volume->infoSector.free_count, 4);
+	putLittleEndian(out + 24, dataClusterCount(), 4);
+	memcpy(out + 28, volume->bootSector.BS_VolLab, BS_VolLab_LENGTH);
+	memcpy(out + 28 + BS_VolLab_LENGTH, volume->bootSector.BS_OEMName, BS_OEMName_LENGTH);
+
+	reply->length += SERVE_INFO_SIZE;
+}
+
+/**
+ * appendServeDirectory
+ *
+ * Writes the readdir reply, one record per visible entry of the directory in the same layout as list --format=binary without the file header
+ * @param struct TextBuffer* reply - buffer to add to
+ * @param const char* path - directory to read, empty or / for the root
+ * @returns uint32_t - SERVE_OK, or SERVE_NOT_FOUND if there is no such directory
+ */
+uint32_t appendServeDirectory(struct TextBuffer *reply, const char *path)
+{
+	struct DirIterator iterator = {0};
+	struct DecodedEntry decoded;
+	struct TextBuffer dirPath = {0};
+	struct DirInfo entry;
+	const char *component = path;
+	uint32_t clusterNum;
+	size_t length;
+
+	if (!locateDirectory(path, &entry))
+	{
+		return SERVE_NOT_FOUND;
+	}
+	clusterNum = (((uint32_t)entry.dir_first_cluster_hi << 16) | entry.dir_first_cluster_lo) & MASK_FIRST_HEX;
+
+	// records carry the path of the directory the way list writes it, every component followed by /
+	while (*component != '\0')
+	{
+		length = strcspn(component, "/");
+		if (length > 0)
+		{
+			appendBytes(&dirPath, component, length);
+			appendBytes(&dirPath, "/", 1);
+		}
+		component += length + (component[length] == '/');
+	}
+
+	openDirIterator(&iterator, clusterNum, clusterNum != (volume->bootSector.BPB_RootClus & MASK_FIRST_HEX));
+	while (nextDirEntry(&iterator, &decoded) != ENTRY_END)
+	{
+		appendBinaryEntry(reply, &dirPath, &decoded);
+	}
+
+	freeDirCluster(&iterator.dir);
+	free(dirPath.data);
+
+	return SERVE_OK;
+}
+
+/**
+ * serveRead
+ *
+ * Answers a read request, sending the header and then the bytes of the file straight out of the image map or through a buffer. Reads past the end of the file come back short, and no more than SERVE_MAX_READ bytes are sent at once.
+ * @param int clientFd - socket to answer on
+ * @param const char* path - file to read
+ * @param uint64_t offset - byte offset in the file to start at
+ * @param uint64_t length - number of bytes asked for
+ * @returns bool - true if the connection is still usable
+ */
+bool serveRead(int clientFd, const char *path, uint64_t offset, uint64_t length)
+{
+	struct DirInfo entry;
+	struct ExtentList list = {0};
+	struct ExtentList slice = {0};
+	char *buffer = NULL; // only allocated if the image is not mapped
+	bool connected;
+
+	if (!locateFile(path, &entry, &list))
+	{
+		return sendReplyHeader(clientFd, SERVE_NOT_FOUND, 0);
+	}
+
+	// clamp the range to the file and to what one reply may carry
+	offset = (offset < entry.dir_file_size) ? offset : entry.dir_file_size;
+	length = (length < entry.dir_file_size - offset) ? length : entry.dir_file_size - offset;
+	length = (length < SERVE_MAX_READ) ? length : SERVE_MAX_READ;
+	sliceExtents(&list, offset, length, &slice);
+
+	connected = sendReplyHeader(clientFd, SERVE_OK, length);
+
+	for (size_t i = 0; i < slice.count && connected; i++)
+	{
+		off_t imageOffset = slice.extents[i].offset;
+		uint64_t bytesLeft = slice.extents[i].length;
+
+		while (bytesLeft > 0 && connected)
+		{
+			size_t chunk = (bytesLeft < COPY_BUFFER_SIZE) ? bytesLeft : COPY_BUFFER_SIZE;
+			const void *bytes = mapImage(imageOffset, chunk);
+
+			if (bytes == NULL)
+			{
+				if (buffer == NULL)
+				{
+					buffer = malloc(COPY_BUFFER_SIZE);
+				}
+				readImage(buffer, chunk, imageOffset);
+				bytes = buffer;
+			}
+
+			connected = sendAll(clientFd, bytes, chunk);
+			imageOffset += chunk;
+			bytesLeft -= chunk;
+		}
+	}
+
+	// a file shorter than its size says leaves the reply short, so the connection can not be trusted after it
+	for (uint64_t i = 0; i < slice.count; i++)
+	{
+		length -= slice.extents[i].length;
+	}
+	connected = connected && length == 0;
+
+	free(buffer);
+	freeExtents(&slice);
+	freeExtents(&list);
+
+	return connected;
+}
+
+/**
+ * locateDirectory
+ *
+ * Finds a directory through the index or the dentry cache, the root is any path with no components in it
+ * @param const char* path - path to the directory, made of short names separated by /
+ * @param struct DirInfo* entry - filled in with a copy of the directory's entry, made up for the root
+ * @returns bool - true if the directory was found
+ */
+bool locateDirectory(const char *path, struct DirInfo *entry)
+{
+	const struct IndexEntry *indexed;
+	const struct Dentry *found;
+	uint32_t rootCluster = volume->bootSector.BPB_RootClus & MASK_FIRST_HEX;
+
+	if (path[strspn(path, "/")] == '\0')
+	{
+		memset(entry, 0, sizeof(struct DirInfo));
+		memset(entry->dir_name, ' ', sizeof(entry->dir_name));
+		entry->dir_name[0] = '/';
+		entry->dir_attr = ATTR_DIRECTORY;
+		entry->dir_first_cluster_hi = rootCluster >> 16;
+		entry->dir_first_cluster_lo = rootCluster & 0xFFFF;
+		return true;
+	}
+
+	if (volume->volumeIndex.header != NULL)
+	{
+		indexed = findIndexEntry(path);
+		if (indexed == NULL || (indexed->entry.dir_attr & ATTR_DIRECTORY) != ATTR_DIRECTORY)
+		{
+			return false;
+		}
+
+		*entry = indexed->entry;
+		return true;
+	}
+
+	pthread_mutex_lock(&volume->dentryLock);
+	found = resolvePath(path, true);
+	if (found != NULL)
+	{
+		*entry = found->entry;
+	}
+	pthread_mutex_unlock(&volume->dentryLock);
+
+	return found != NULL;
+}
+
+/**
+ * sendReplyHeader
+ *
+ * Sends the 12 byte header every reply starts with
+ * @param int clientFd - socket to send on
+ * @param uint32_t status - one of the SERVE_ statuses
+ * @param uint64_t payloadLength - number of bytes that follow the header
+ * @returns bool - true if the header was sent
+ */
+bool sendReplyHeader(int clientFd, uint32_t status, uint64_t payloadLength)
+{
+	uint8_t header[SERVE_REPLY_SIZE];
+
+	putLittleEndian(header, status, 4);
+	putLittleEndian(header + 4, payloadLength, 8);
+
+	return sendAll(clientFd, header, sizeof(header));
+}
+
+/**
+ * sendAll
+ *
+ * Sends every byte of a buffer, without raising SIGPIPE if the client has gone away
+ * @param int clientFd - socket to send on
+ * @param const void* data - bytes to send
+ * @param size_t length - number of bytes
+ * @returns bool - true if everything was sent
+ */
+bool sendAll(int clientFd, const void *data, size_t length)
+{
+	size_t sent = 0;
+	ssize_t result;
+
+	while (sent < length)
+	{
+		result = send(clientFd, (const char *)data + sent, length - sent, MSG_NOSIGNAL);
+		if (result < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (result <= 0)
+		{
+			return false;
+		}
+		sent += result;
+	}
+
+	return true;
+}
+
+/**
+ * receiveAll
+ *
+ * Reads exactly the number of bytes asked for from a socket
+ * @param int clientFd - socket to read from
+ * @param void* data - where to put the bytes
+ * @param size_t length - number of bytes
+ * @returns bool - false if the client hung up or the read failed first
+ */
+bool receiveAll(int clientFd, void *data, size_t length)
+{
+	size_t received = 0;
+	ssize_t result;
+
+	while (received < length)
+	{
+		result = recv(clientFd, (char *)data + received, length - received, 0);
+		if (result < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (result <= 0)
+		{
+			return false;
+		}
+		received += result;
+	}
+
+	return true;
+}
+
+/**
+ * mountVolume
+ *
+ * Mounts the image read only at a directory through the kernel's FUSE protocol, then answers the kernel on --threads workers until the mount goes away. The protocol is spoken directly on /dev/fuse, the same way io_uring is set up without liburing, so there is nothing extra to link. Node IDs are the byte offsets of the short directory entries, so a node can always be read back from the image and nothing has to be remembered per node.
+ * @param const char* path - directory to mount on
+ * @returns bool - false if the mount could not be set up
+ */
+bool mountVolume(const char *path)
+{
+	struct sigaction action = {0};
+	struct MountWorker *workers;
+	pthread_t *threads;
+	char mountOptions[128];
+
+	fuseFd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+	if (fuseFd < 0)
+	{
+		return false;
+	}
+
+	snprintf(mountOptions, sizeof(mountOptions), "fd=%d,rootmode=40000,user_id=%u,group_id=%u,allow_other,default_permissions", fuseFd, getuid(), getgid());
+	if (mount(volume->imageName, path, "fuse.fat32", MS_RDONLY | MS_NOSUID | MS_NODEV, mountOptions) != 0)
+	{
+		close(fuseFd);
+		return false;
+	}
+	mountPoint = path;
+
+	// no SA_RESTART, the handler detaches the mount and every worker's read then fails with ENODEV
+	action.sa_handler = stopMount;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	printf("Mounted %s on %s.\n", volume->imageName, path);
+	fflush(stdout);
+
+	workers = calloc(options.threads, sizeof(struct MountWorker));
+	threads = malloc(options.threads * sizeof(pthread_t));
+	for (int i = 1; i < options.threads; i++)
+	{
+		pthread_create(&threads[i], NULL, mountWorker, &workers[i]);
+	}
+	mountWorker(&workers[0]);
+
+	for (int i = 1; i < options.threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	free(threads);
+	free(workers);
+	close(fuseFd);
+
+	return true;
+}
+
+/**
+ * stopMount
+ *
+ * Signal handler for SIGINT and SIGTERM while mounted, detaches the mount so the workers see it go
+ * @param int signalNum - signal that arrived
+ * @returns void - NA
+ */
+void stopMount(int signalNum)
+{
+	(void)signalNum;
+	umount2(mountPoint, MNT_DETACH);
+}
+
+/**
+ * mountWorker
+ *
+ * Thread body for the mount, reads requests from the kernel and answers them until the mount goes away
+ * @param void* arg - the struct MountWorker to use
+ * @returns void* - NULL
+ */
+void *mountWorker(void *arg)
+{
+	struct MountWorker *worker = arg;
+	ssize_t length;
+
+	worker->request = malloc(MOUNT_REQUEST_SIZE);
+
+	for (;;)
+	{
+		length = read(fuseFd, worker->request, MOUNT_REQUEST_SIZE);
+		if (length < 0)
+		{
+			// interrupted requests and signals are not fatal, anything else means the mount is gone
+			if (errno == EINTR || errno == ENOENT || errno == EAGAIN)
+			{
+				continue;
+			}
+			break;
+		}
+
+		if ((size_t)length >= sizeof(struct fuse_in_header) && handleMountRequest(worker))
+		{
+			break;
+		}
+	}
+
+	free(worker->request);
+	free(worker->buffer);
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * handleMountRequest
+ *
+ * Answers one request from the kernel. Everything that would write is refused, the mount is read only anyway.
+ * @param struct MountWorker* worker - worker holding the request
+ * @returns bool - true if the kernel asked us to stop
+ */
+bool handleMountRequest(struct MountWorker *worker)
+{
+	const struct fuse_in_header *in = (const struct fuse_in_header *)worker->request;
+	const void *arg = worker->request + sizeof(struct fuse_in_header);
+	struct DirInfo entry;
+	uint32_t firstCluster;
+
+	if (in->opcode == FUSE_INIT)
+	{
+		const struct fuse_init_in *init = arg;
+		struct fuse_init_out out = {0};
+
+		out.major = FUSE_KERNEL_VERSION;
+		out.minor = FUSE_KERNEL_MINOR_VERSION;
+		out.max_readahead = init->max_readahead;
+		out.max_write = MOUNT_MAX_WRITE;
+		out.max_background = MOUNT_MAX_BACKGROUND;
+		out.congestion_threshold = MOUNT_MAX_BACKGROUND * 3 / 4;
+		out.time_gran = 1;
+
+		// large reads keep the page cache fed in 1 MB pieces instead of 128 KB ones
+		out.flags = init->flags & (FUSE_ASYNC_READ | FUSE_MAX_PAGES | FUSE_PARALLEL_DIROPS);
+		out.max_pages = MOUNT_MAX_READ / MOUNT_PAGE_SIZE;
+
+		if (init->major != FUSE_KERNEL_VERSION)
+		{
+			replyFuse(in->unique, -EPROTO, NULL, 0);
+			return true;
+		}
+		replyFuse(in->unique, 0, &out, (init->minor < 23) ? FUSE_COMPAT_22_INIT_OUT_SIZE : sizeof(out));
+	}
+	else if (in->opcode == FUSE_LOOKUP)
+	{
+		struct fuse_entry_out out = {0};
+
+		out.nodeid = lookupMountNode(in->nodeid, arg, &entry);
+		if (out.nodeid == 0)
+		{
+			replyFuse(in->unique, -ENOENT, NULL, 0);
+			return false;
+		}
+
+		// nothing in the image ever changes under us, so the kernel can hold on to names and attributes
+		out.entry_valid = MOUNT_CACHE_SECONDS;
+		out.attr_valid = MOUNT_CACHE_SECONDS;
+		fillFuseAttr(out.nodeid, &entry, &out.attr);
+		replyFuse(in->unique, 0, &out, sizeof(out));
+	}
+	else if (in->opcode == FUSE_GETATTR)
+	{
+		struct fuse_attr_out out = {0};
+
+		if (!loadMountNode(in->nodeid, &entry))
+		{
+			replyFuse(in->unique, -ENOENT, NULL, 0);
+			return false;
+		}
+
+		out.attr_valid = MOUNT_CACHE_SECONDS;
+		fillFuseAttr(in->nodeid, &entry, &out.attr);
+		replyFuse(in->unique, 0, &out, sizeof(out));
+	}
+	else if (in->opcode == FUSE_OPEN || in->opcode == FUSE_OPENDIR)
+	{
+		const struct fuse_open_in *open = arg;
+		struct fuse_open_out out = {0};
+		bool isDirectory = in->opcode == FUSE_OPENDIR;
+
+		if ((open->flags & O_ACCMODE) != O_RDONLY)
+		{
+			replyFuse(in->unique, -EROFS, NULL, 0);
+			return false;
+		}
+		if (!loadMountNode(in->nodeid, &entry) || ((entry.dir_attr & ATTR_DIRECTORY) == ATTR_DIRECTORY) != isDirectory)
+		{
+			replyFuse(in->unique, isDirectory ? -ENOTDIR : -EISDIR, NULL, 0);
+			return false;
+		}
+
+		firstCluster = (((uint32_t)entry.dir_first_cluster_hi << 16) | entry.dir_first_cluster_lo) & MASK_FIRST_HEX;
+		if (isDirectory)
+		{
+			// the whole listing is built once per open and handed out in pieces, the kernel keeps it cached after that
+			out.fh = (uintptr_t)readMountDirectory(in->nodeid, firstCluster);
+			out.open_flags = FOPEN_KEEP_CACHE | FOPEN_CACHE_DIR;
+		}
+		else
+		{
+			struct ExtentList *list = calloc(1, sizeof(struct ExtentList));
+
+			// the file's extents and their lookup table are built here so reads on several threads only ever look at them
+			buildExtents(firstCluster, entry.dir_file_size, list);
+			findExtent(list, 0);
+			out.fh = (uintptr_t)list;
+			out.open_flags = FOPEN_KEEP_CACHE;
+		}
+		replyFuse(in->unique, 0, &out, sizeof(out));
+	}
+	else if (in->opcode == FUSE_READ)
+	{
+		const struct fuse_read_in *read = arg;
+
+		replyMountRead(worker, in->unique, (struct ExtentList *)(uintptr_t)read->fh, read->offset, read->size);
+	}
+	else if (in->opcode == FUSE_READDIR)
+	{
+		const struct fuse_read_in *read = arg;
+		const struct TextBuffer *listing = (const struct TextBuffer *)(uintptr_t)read->fh;
+		size_t start = (read->offset < listing->length) ? read->offset : listing->length;
+		size_t end = start;
+
+		// only whole records go out, each one's off field is where the next one starts
+		while (end < listing->length)
+		{
+			const struct fuse_dirent *dirent = (const struct fuse_dirent *)(listing->data + end);
+			size_t recordLength = FUSE_DIRENT_SIZE(dirent);
+
+			if (end + recordLength - start > read->size)
+			{
+				break;
+			}
+			end += recordLength;
+		}
+		replyFuse(in->unique, 0, listing->data + start, end - start);
+	}
+	else if (in->opcode == FUSE_RELEASE)
+	{
+		const struct fuse_release_in *release = arg;
+		struct ExtentList *list = (struct ExtentList *)(uintptr_t)release->fh;
+
+		freeExtents(list);
+		free(list);
+		replyFuse(in->unique, 0, NULL, 0);
+	}
+	else if (in->opcode == FUSE_RELEASEDIR)
+	{
+		const struct fuse_release_in *release = arg;
+		struct TextBuffer *listing = (struct TextBuffer *)(uintptr_t)release->fh;
+
+		free(listing->data);
+		free(listing);
+		replyFuse(in->unique, 0, NULL, 0);
+	}
+	else if (in->opcode == FUSE_STATFS)
+	{
+		struct fuse_statfs_out out = {0};
+
+		out.st.blocks = dataClusterCount();
+		out.st.bfree = (volume->infoSector.free_count <= out.st.blocks) ? volume->infoSector.free_count : 0;
+		out.st.bavail = out.st.bfree;
+		out.st.bsize = volume->bytesPerCluster;
+		out.st.frsize = volume->bytesPerCluster;
+		out.st.namelen = MOUNT_NAME_MAX;
+		replyFuse(in->unique, 0, &out, sizeof(out));
+	}
+	else if (in->opcode == FUSE_FLUSH || in->opcode == FUSE_FSYNCDIR || in->opcode == FUSE_FSYNC)
+	{
+		replyFuse(in->unique, 0, NULL, 0);
+	}
+	else if (in->opcode == FUSE_DESTROY)
+	{
+		replyFuse(in->unique, 0, NULL, 0);
+		return true;
+	}
+	// these never get a reply
+	else if (in->opcode != FUSE_FORGET && in->opcode != FUSE_BATCH_FORGET && in->opcode != FUSE_INTERRUPT)
+	{
+		replyFuse(in->unique, -ENOSYS, NULL, 0);
+	}
+
+	return false;
+}
+
+/**
+ * loadMountNode
+ *
+ * Reads back the directory entry a node ID stands for, the root gets a made up entry pointing at the root cluster
+ * @param uint64_t nodeId - FUSE_ROOT_ID or the byte offset of a short directory entry in the image
+ * @param struct DirInfo* entry - filled in with the entry
+ * @returns bool - true if the node is one we could have handed out
+ */
+bool loadMountNode(uint64_t nodeId, struct DirInfo *entry)
+{
+	if (nodeId == FUSE_ROOT_ID)
+	{
+		return locateDirectory("", entry);
+	}
+
+	if (nodeId % sizeof(struct DirInfo) != 0 || (off_t)nodeId < clusterOffset(2))
+	{
+		return false;
+	}
+
+	return readImage(entry, sizeof(struct DirInfo), nodeId) == sizeof(struct DirInfo);
+}
+
+/**
+ * lookupMountNode
+ *
+ * Finds a name in a directory, matching the long name or the short name without regard to case like FAT does
+ * @param uint64_t parentId - node ID of the directory
+ * @param const char* name - name to find
+ * @param struct DirInfo* entry - filled in with the entry that matched
+ * @returns uint64_t - node ID of the entry, 0 if there is none
+ */
+uint64_t lookupMountNode(uint64_t parentId, const char *name, struct DirInfo *entry)
+{
+	struct DirIterator iterator = {0};
+	struct DecodedEntry decoded;
+	struct DirInfo parent;
+	char entryName[LONG_NAME_MAX_ENTRIES * LONG_NAME_CHARS_PER_ENTRY * 3 + 1];
+	uint32_t clusterNum;
+	uint64_t nodeId = 0;
+
+	if (!loadMountNode(parentId, &parent) || (parent.dir_attr & ATTR_DIRECTORY) != ATTR_DIRECTORY)
+	{
+		return 0;
+	}
+	clusterNum = (((uint32_t)parent.dir_first_cluster_hi << 16) | parent.dir_first_cluster_lo) & MASK_FIRST_HEX;
+
+	openDirIterator(&iterator, clusterNum, clusterNum != (volume->bootSector.BPB_RootClus & MASK_FIRST_HEX));
+	while (nodeId == 0 && nextDirEntry(&iterator, &decoded) != ENTRY_END)
+	{
+		struct TextBuffer shortName = {0};
+
+		appendShortName(&shortName, &decoded);
+		appendBytes(&shortName, "", 1);
+		entryName[(decoded.longName != NULL) ? decodeLongName(&decoded, entryName) : 0] = '\0';
+
+		if (strcasecmp(shortName.data, name) == 0 || (decoded.longName != NULL && strcasecmp(entryName, name) == 0))
+		{
+			*entry = *decoded.info;
+			nodeId = clusterOffset(iterator.dir.clusterNum) + ((const uint8_t *)decoded.info - iterator.dir.entries);
+		}
+		free(shortName.data);
+	}
+
+	freeDirCluster(&iterator.dir);
+	return nodeId;
+}
+
+/**
+ * fillFuseAttr
+ *
+ * Fills in the attributes the kernel shows for a node. Everything is read only, and FAT timestamps are taken as UTC since FAT does not record a time zone.
+ * @param uint64_t nodeId - node ID, used as the inode number
+ * @param const struct DirInfo* entry - the node's directory entry
+ * @param struct fuse_attr* attr - attributes to fill in
+ * @returns void - NA
+ */
+void fillFuseAttr(uint64_t nodeId, const struct DirInfo *entry, struct fuse_attr *attr)
+{
+	bool isDirectory = (entry->dir_attr & ATTR_DIRECTORY) == ATTR_DIRECTORY;
+
+	memset(attr, 0, sizeof(struct fuse_attr));
+	attr->ino = nodeId;
+	attr->size = isDirectory ? volume->bytesPerCluster : entry->dir_file_size;
+	attr->blocks = (attr->size + 511) / 512;
+	attr->mtime = fatTimeToEpoch(entry->dir_wrt_date, entry->dir_wrt_time);
+	attr->ctime = fatTimeToEpoch(entry->dir_crt_date, entry->dir_crt_time);
+	attr->atime = fatTimeToEpoch(entry->dir_last_access_time, 0);
+	attr->mode = isDirectory ? (S_IFDIR | 0555) : (S_IFREG | 0444);
+	attr->nlink = isDirectory ? 2 : 1;
+	attr->uid = getuid();
+	attr->gid = getgid();
+	attr->blksize = volume->bytesPerCluster;
+}
+
+/**
+ * fatTimeToEpoch
+ *
+ * Turns a FAT date and time into seconds since 1970
+ * @param uint16_t date - FAT date, 0 for none
+ * @param uint16_t time - FAT time
+ * @returns uint64_t - seconds since 1970, 0 if there is no date
+ */
+uint64_t fatTimeToEpoch(uint16_t date, uint16_t time)
+{
+	struct tm parts = {0};
+
+	if (date == 0)
+	{
+		return 0;
+	}
+
+	parts.tm_year = 80 + (date >> 9);
+	parts.tm_mon = ((date >> 5) & 0x0F) - 1;
+	parts.tm_mday = date & 0x1F;
+	parts.tm_hour = time >> 11;
+	parts.tm_min = (time >> 5) & 0x3F;
+	parts.tm_sec = (time & 0x1F) * 2;
+
+	return (uint64_t)timegm(&parts);
+}
+
+/**
+ * readMountDirectory
+ *
+ * Builds the kernel's listing of a directory as back to back fuse_dirent records, with . and .. first
+ * @param uint64_t nodeId - node ID of the directory
+ * @param uint32_t clusterNum - first cluster of the directory
+ * @returns struct TextBuffer* - the records, freed on release
+ */
+struct TextBuffer *readMountDirectory(uint64_t nodeId, uint32_t clusterNum)
+{
+	struct TextBuffer *listing = calloc(1, sizeof(struct TextBuffer));
+	struct DirIterator iterator = {0};
+	struct DecodedEntry decoded;
+	char entryName[LONG_NAME_MAX_ENTRIES * LONG_NAME_CHARS_PER_ENTRY * 3];
+	int kind;
+
+	appendMountDirent(listing, nodeId, ".", 1, DT_DIR);
+	appendMountDirent(listing, MOUNT_UNKNOWN_INO, "..", 2, DT_DIR);
+
+	openDirIterator(&iterator, clusterNum, clusterNum != (volume->bootSector.BPB_RootClus & MASK_FIRST_HEX));
+	while ((kind = nextDirEntry(&iterator, &decoded)) != ENTRY_END)
+	{
+		uint64_t entryId = clusterOffset(iterator.dir.clusterNum) + ((const uint8_t *)decoded.info - iterator.dir.entries);
+		struct TextBuffer shortName = {0};
+
+		if (decoded.longName != NULL)
+		{
+			appendMountDirent(listing, entryId, entryName, decodeLongName(&decoded, entryName), (kind == ENTRY_DIRECTORY) ? DT_DIR : DT_REG);
+		}
+		else
+		{
+			appendShortName(&shortName, &decoded);
+			appendMountDirent(listing, entryId, shortName.data, shortName.length, (kind == ENTRY_DIRECTORY) ? DT_DIR : DT_REG);
+			free(shortName.data);
+		}
+	}
+
+	freeDirCluster(&iterator.dir);
+	return listing;
+}
+
+/**
+ * appendMountDirent
+ *
+ * Adds one fuse_dirent record to a directory listing
+ * @param struct TextBuffer* listing - listing to add to
+ * @param uint64_t nodeId - inode number shown for the entry
+ * @param const char* name - name, not terminated
+ * @param size_t nameLength - bytes in the name
+ * @param uint32_t type - DT_DIR or DT_REG
+ * @returns void - NA
+ */
+void appendMountDirent(struct TextBuffer *listing, uint64_t nodeId, const char *name, size_t nameLength, uint32_t type)
+{
+	size_t recordLength = FUSE_DIRENT_ALIGN(FUSE_NAME_OFFSET + nameLength);
+	struct fuse_dirent *dirent = (struct fuse_dirent *)reserveText(listing, recordLength);
+
+	memset(dirent, 0, recordLength);
+	dirent->ino = nodeId;
+	dirent->off = listing->length + recordLength;
+	dirent->namelen = nameLength;
+	dirent->type = type;
+	memcpy(dirent->name, name, nameLength);
+
+	listing->length += recordLength;
+}
+
+/**
+ * replyMountRead
+ *
+ * Answers a read with one writev straight out of the image map, or through the worker's buffer when the image is not mapped. Reads past the end of the file come back short.
+ * @param struct MountWorker* worker - worker answering, its buffer is allocated on first use
+ * @param uint64_t unique - request being answered
+ * @param struct ExtentList* list - extents of the open file
+ * @param uint64_t offset - byte offset in the file
+ * @param uint32_t size - number of bytes asked for
+ * @returns void - NA
+ */
+void replyMountRead(struct MountWorker *worker, uint64_t unique, struct ExtentList *list, uint64_t offset, uint32_t size)
+{
+	struct ExtentList slice = {0};
+	struct fuse_out_header header = {0};
+	struct iovec parts[MOUNT_MAX_IOVECS];
+	int partCount = 1;
+	size_t length = 0;
+
+	sliceExtents(list, offset, (size < MOUNT_MAX_READ) ? size : MOUNT_MAX_READ, &slice);
+
+	// one iovec per extent when it can point into the map, otherwise everything is read into one buffer
+	for (size_t i = 0; i < slice.count; i++)
+	{
+		const void *bytes = mapImage(slice.extents[i].offset, slice.extents[i].length);
+
+		if (bytes != NULL && partCount < MOUNT_MAX_IOVECS - 1 && partCount == (int)i + 1)
+		{
+			threadStats.mappedBytes += slice.extents[i].length;
+			parts[partCount].iov_base = (void *)bytes;
+			parts[partCount].iov_len = slice.extents[i].length;
+			partCount++;
+		}
+		else
+		{
+			if (worker->buffer == NULL)
+			{
+				worker->buffer = malloc(MOUNT_MAX_READ);
+			}
+			readImage(worker->buffer + length, slice.extents[i].length, slice.extents[i].offset);
+		}
+		length += slice.extents[i].length;
+	}
+
+	// anything that went through the buffer goes in one piece after the mapped ones
+	if (partCount - 1 < (int)slice.count)
+	{
+		size_t mapped = 0;
+
+		for (int i = 1; i < partCount; i++)
+		{
+			mapped += parts[i].iov_len;
+		}
+		parts[partCount].iov_base = worker->buffer + mapped;
+		parts[partCount].iov_len = length - mapped;
+		partCount++;
+	}
+
+	header.len = sizeof(header) + length;
+	header.unique = unique;
+	parts[0].iov_base = &header;
+	parts[0].iov_len = sizeof(header);
+	writev(fuseFd, parts, partCount);
+
+	freeExtents(&slice);
+}
+
+/**
+ * replyFuse
+ *
+ * Sends the kernel a reply, the header and the payload go out in one writev
+ * @param uint64_t unique - request being answered
+ * @param int error - 0 or a negated errno
+ * @param const void* data - payload, NULL if there is none
+ * @param size_t length - bytes of payload
+ * @returns bool - true if the kernel took the reply
+ */
+bool replyFuse(uint64_t unique, int error, const void *data, size_t length)
+{
+	struct fuse_out_header header = {0};
+	struct iovec parts[2];
+
+	header.len = sizeof(header) + length;
+	header.error = error;
+	header.unique = unique;
+	parts[0].iov_base = &header;
+	parts[0].iov_len = sizeof(header);
+	parts[1].iov_base = (void *)data;
+	parts[1].iov_len = length;
+
+	return writev(fuseFd, parts, (length > 0) ? 2 : 1) == (ssize_t)header.len;
+}
+
+/**
+ * fetchBatch
+ *
+ * Copies every file listed in a manifest to the output directory in one run. All paths are resolved first through the index or the shared dentry cache, then the files are copied in order of starting cluster so the image is read roughly front to back.
+ * @param const char* manifestPath - file with one path per line, - for stdin
+ * @returns bool - true if every file was found and copied
+ */
+bool fetchBatch(const char *manifestPath)
+{
+	struct BatchFile *files = NULL;
+	size_t fileCount = 0;
+	size_t missing = 0;
+	size_t copied = 0;
+
+	if (!readBatchManifest(manifestPath, &files, &fileCount, &missing))
+	{
+		return false;
+	}
+
+	qsort(files, fileCount, sizeof(struct BatchFile), compareBatchFiles);
+
+	// readers and writers overlap the image reads with the output writes
+	startPhase(PHASE_COPY);
+	if (!copyPipelined(files, fileCount, &copied))
+	{
+		missing++;
+	}
+
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		free(files[i].path);
+	}
+
+	printf("%zu files copied into output folder.\n", copied);
+
+	free(files);
+	return missing == 0;
+}
+
+/**
+ * readBatchManifest
+ *
+ * Reads a manifest of paths and resolves every one through the index or the shared dentry cache, paths that cannot be found are reported and left out
+ * @param const char* manifestPath - file with one path per line, - for stdin
+ * @param struct BatchFile** files - set to the files found, in manifest order, each path is allocated
+ * @param size_t* fileCount - set to the number of files found
+ * @param size_t* missing - incremented for every path that could not be found
+ * @returns bool - false if the manifest could not be opened
+ */
+bool readBatchManifest(const char *manifestPath, struct BatchFile **files, size_t *fileCount, size_t *missing)
+{
+	FILE *manifest;
+	size_t fileCapacity = 0;
+	char *line = NULL;
+	size_t lineCapacity = 0;
+	ssize_t lineLength;
+	struct DirInfo found;
+
+	manifest = (strcmp(manifestPath, "-") == 0) ? stdin : fopen(manifestPath, "r");
+	if (manifest == NULL)
+	{
+		printf("Error, could not open manifest %s.\n", manifestPath);
+		return false;
+	}
+
+	// resolve every path up front
+	while ((lineLength = getline(&line, &lineCapacity, manifest)) != -1)
+	{
+		// strip the line ending, but keep any other trailing spaces since extensions are matched padded
+		while (lineLength > 0 && (line[lineLength - 1] == '\n' || line[lineLength - 1] == '\r'))
+		{
+			line[--lineLength] = '\0';
+		}
+
+		if (lineLength == 0)
+		{
+			continue;
+		}
+
+		if (!locateFile(line, &found, NULL))
+		{
+			printf("Error, could not find %s.\n", line);
+			(*missing)++;
+			continue;
+		}
+
+		if (*fileCount == fileCapacity)
+		{
+			fileCapacity = (fileCapacity == 0) ? 64 : fileCapacity * 2;
+			*files = realloc(*files, fileCapacity * sizeof(struct BatchFile));
+		}
+
+		(*files)[*fileCount].path = strdup(line);
+		(*files)[*fileCount].order = *fileCount;
+		(*files)[*fileCount].entry = found;
+		(*files)[*fileCount].startingCluster = (((uint32_t)found.dir_first_cluster_hi << 16) | found.dir_first_cluster_lo) & MASK_FIRST_HEX;
+		(*fileCount)++;
+	}
+
+	free(line);
+	if (manifest != stdin)
+	{
+		fclose(manifest);
+	}
+
+	return true;
+}
+
+/**
+ * compareBatchFiles
+ *
+ * qsort comparator ordering batch files by starting cluster
+ * @param const void* a - first struct BatchFile
+ * @param const void* b - second struct BatchFile
+ * @returns int - negative, 0 or positive like strcmp
+ */
+int compareBatchFiles(const void *a, const void *b)
+{
+	uint32_t first = ((const struct BatchFile *)a)->startingCluster;
+	uint32_t second = ((const struct BatchFile *)b)->startingCluster;
+
+	return (first > second) - (first < second);
+}
+
+/**
+ * copyPipelined
+ *
+ * Copies a batch of files to the output directory with a pool of reader threads filling a bounded set of buffers from the image and a pool of writer threads draining them to the output files, so reads and writes overlap
+ * @param const struct BatchFile* files - files to copy, in the order the image should be read, their order fields give the order results are printed in
+ * @param size_t fileCount - number of files
+ * @param size_t* copied - set to the number of files written, files dropped for sharing an output name are not counted
+ * @returns bool - true if every file that was not dropped was written
+ */
+bool copyPipelined(const struct BatchFile *files, size_t fileCount, size_t *copied)
+{
+	struct CopyPipeline pipeline = {0};
+	struct CopyChunk *chunks;
+	struct CopyJob **byDestination;
+	struct CopyJob **byOrder;
+	struct TextBuffer manifest = {0};
+	pthread_t *threads;
+	int threadCount = options.readers + options.writers;
+	bool success = true;
+	char givenName[9];
+	uint64_t covered;
+
+	pipeline.jobs = calloc(fileCount, sizeof(struct CopyJob));
+	pipeline.jobCount = fileCount;
+
+	// work out where every file lives and how many chunks it will take
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		struct CopyJob *job = &pipeline.jobs[i];
+
+		job->file = &files[i];
+		memcpy(givenName, files[i].entry.dir_name, 8);
+		givenName[8] = '\0';
+		removeTrailingSpace(givenName);
+		snprintf(job->destination, sizeof(job->destination), "output/%s.%.3s", givenName, &files[i].entry.dir_name[8]);
+
+		// a file whose chain ends early is never opened, a short copy would pass for the file
+		covered = buildExtents(files[i].startingCluster, files[i].entry.dir_file_size, &job->list);
+		job->failed = !chainCoversFile(files[i].path, covered, files[i].entry.dir_file_size);
+		for (size_t j = 0; j < job->list.count; j++)
+		{
+			job->chunksLeft += (job->list.extents[j].length + COPY_BUFFER_SIZE - 1) / COPY_BUFFER_SIZE;
+		}
+		job->outFd = -1;
+		initHasher(&job->hasher, options.hash);
+	}
+
+	// two files with the same short name land on the same output path, only the last one in the manifest would survive so only copy that one
+	byDestination = malloc(fileCount * sizeof(struct CopyJob *));
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		byDestination[i] = &pipeline.jobs[i];
+	}
+	qsort(byDestination, fileCount, sizeof(struct CopyJob *), compareCopyJobDestinations);
+	for (size_t i = 0; i < fileCount;)
+	{
+		size_t end = i + 1;
+
+		while (end < fileCount && strcmp(byDestination[end]->destination, byDestination[i]->destination) == 0)
+		{
+			end++;
+		}
+
+		for (; i + 1 < end; i++)
+		{
+			byDestination[i]->skip = true;
+			printf("Skipping %s, same output name as %s.\n", byDestination[i]->file->path, byDestination[end - 1]->file->path);
+		}
+		i = end;
+	}
+	free(byDestination);
+
+	// the buffer pool, io depth buffers of COPY_BUFFER_SIZE each
+	chunks = calloc(options.ioDepth, sizeof(struct CopyChunk));
+	for (int i = 0; i < options.ioDepth; i++)
+	{
+		chunks[i].buffer = allocCopyBuffer();
+		chunks[i].next = pipeline.freeChunks;
+		pipeline.freeChunks = &chunks[i];
+	}
+
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.chunkFree, NULL);
+	pthread_cond_init(&pipeline.chunkReady, NULL);
+	pipeline.readersRunning = options.readers;
+
+	threads = malloc(threadCount * sizeof(pthread_t));
+	for (int i = 0; i < threadCount; i++)
+	{
+		pthread_create(&threads[i], NULL, (i < options.readers) ? copyReader : copyWriter, &pipeline);
+	}
+	for (int i = 0; i < threadCount; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+
+	// the files were copied in cluster order, the digests come out in manifest order the way hash prints them
+	byOrder = malloc(fileCount * sizeof(struct CopyJob *));
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		byOrder[files[i].order] = &pipeline.jobs[i];
+	}
+
+	manifest.sink = volume->out;
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		if (byOrder[i]->failed)
+		{
+			printf("Error, could not copy %s.\n", byOrder[i]->destination);
+			success = false;
+		}
+		else if (!byOrder[i]->skip)
+		{
+			(*copied)++;
+			if (options.hash != HASH_NONE)
+			{
+				appendHashLine(&manifest, byOrder[i]->file->path, &byOrder[i]->hasher);
+			}
+		}
+		freeExtents(&byOrder[i]->list);
+	}
+	flushText(&manifest);
+	free(manifest.data);
+	free(byOrder);
+
+	for (int i = 0; i < options.ioDepth; i++)
+	{
+		free(chunks[i].buffer);
+	}
+
+	pthread_mutex_destroy(&pipeline.lock);
+	pthread_cond_destroy(&pipeline.chunkFree);
+	pthread_cond_destroy(&pipeline.chunkReady);
+	free(chunks);
+	free(threads);
+	free(pipeline.jobs);
+
+	return success;
+}
+
+/**
+ * compareCopyJobDestinations
+ *
+ * qsort comparator ordering copy job pointers by destination, and by position in the manifest for equal destinations
+ * @param const void* a - first struct CopyJob**
+ * @param const void* b - second struct CopyJob**
+ * @returns int - negative, 0 or positive like strcmp
+ */
+int compareCopyJobDestinations(const void *a, const void *b)
+{
+	const struct CopyJob *first = *(const struct CopyJob *const *)a;
+	const struct CopyJob *second = *(const struct CopyJob *const *)b;
+	int result = strcmp(first->destination, second->destination);
+
+	if (result == 0)
+	{
+		result = (first->file->order > second->file->order) - (first->file->order < second->file->order);
+	}
+
+	return result;
+}
+
+/**
+ * copyReader
+ *
+ * Reader thread body, hands out the next piece of the next extent, waits for a free buffer and reads the bytes into it
+ * @param void* arg - the struct CopyPipeline
+ * @returns void* - NULL
+ */
+void *copyReader(void *arg)
+{
+	struct CopyPipeline *pipeline = arg;
+	struct CopyChunk *chunk;
+	struct CopyJob *job = NULL; // always set before a chunk is taken, gcc -O2 cannot see that
+	const struct Extent *extent;
+	size_t length;
+
+	while (true)
+	{
+		pthread_mutex_lock(&pipeline->lock);
+
+		// wait for a buffer first, this is what bounds the io depth, and the cursor can only be trusted once we stop waiting
+		while (pipeline->freeChunks == NULL)
+		{
+			pthread_cond_wait(&pipeline->chunkFree, &pipeline->lock);
+		}
+
+		// move the cursor past skipped jobs and jobs that are fully handed out, opening files as we get to them
+		while (pipeline->nextJob < pipeline->jobCount)
+		{
+			job = &pipeline->jobs[pipeline->nextJob];
+
+			if (!job->skip && !job->failed && !job->opened)
+			{
+				job->outFd = open(job->destination, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+				job->opened = true;
+				job->failed = job->outFd < 0;
+			}
+
+			if (!job->skip && !job->failed && pipeline->nextExtent < job->list.count)
+			{
+				break;
+			}
+
+			// empty files have nothing for a writer to do, so close them here
+			if (job->outFd >= 0 && job->list.count == 0)
+			{
+				close(job->outFd);
+				job->outFd = -1;
+			}
+
+			pipeline->nextJob++;
+			pipeline->nextExtent = 0;
+			pipeline->extentDone = 0;
+			pipeline->fileDone = 0;
+		}
+
+		if (pipeline->nextJob == pipeline->jobCount)
+		{
+			// pass the wake up on to readers still waiting for a buffer, and the last reader out wakes the writers so they can finish
+			pipeline->readersRunning--;
+			pthread_cond_broadcast(&pipeline->chunkFree);
+			pthread_cond_broadcast(&pipeline->chunkReady);
+			pthread_mutex_unlock(&pipeline->lock);
+			break;
+		}
+
+		chunk = pipeline->freeChunks;
+		pipeline->freeChunks = chunk->next;
+
+		// take the next piece of the current extent
+		extent = &job->list.extents[pipeline->nextExtent];
+		length = (extent->length - pipeline->extentDone > COPY_BUFFER_SIZE) ? COPY_BUFFER_SIZE : extent->length - pipeline->extentDone;
+
+		chunk->job = job;
+		chunk->imageOffset = extent->offset + pipeline->extentDone;
+		chunk->fileOffset = pipeline->fileDone;
+		chunk->length = length;
+
+		pipeline->extentDone += length;
+		pipeline->fileDone += length;
+		if (pipeline->extentDone == extent->length)
+		{
+			pipeline->nextExtent++;
+			pipeline->extentDone = 0;
+		}
+
+		pthread_mutex_unlock(&pipeline->lock);
+
+		chunk->data = readFileBytes(chunk->buffer, chunk->length, chunk->imageOffset);
+
+		pthread_mutex_lock(&pipeline->lock);
+		chunk->next = NULL;
+		if (pipeline->readyTail == NULL)
+		{
+			pipeline->readyHead = chunk;
+		}
+		else
+		{
+			pipeline->readyTail->next = chunk;
+		}
+		pipeline->readyTail = chunk;
+		pthread_cond_signal(&pipeline->chunkReady);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
+
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * copyWriter
+ *
+ * Writer thread body, writes filled buffers to their output files and puts them back on the free list, closing each file after its last chunk
+ * @param void* arg - the struct CopyPipeline
+ * @returns void* - NULL
+ */
+void *copyWriter(void *arg)
+{
+	struct CopyPipeline *pipeline = arg;
+	struct CopyChunk *chunk;
+	struct CopyJob *job;
+	size_t written;
+	ssize_t result;
+	bool failed;
+	int closeFd;
+
+	while (true)
+	{
+		pthread_mutex_lock(&pipeline->lock);
+
+		while (pipeline->readyHead == NULL && pipeline->readersRunning > 0)
+		{
+			pthread_cond_wait(&pipeline->chunkReady, &pipeline->lock);
+		}
+
+		if (pipeline->readyHead == NULL)
+		{
+			pthread_mutex_unlock(&pipeline->lock);
+			break;
+		}
+
+		chunk = pipeline->readyHead;
+		pipeline->readyHead = chunk->next;
+		if (pipeline->readyHead == NULL)
+		{
+			pipeline->readyTail = NULL;
+		}
+
+		pthread_mutex_unlock(&pipeline->lock);
+
+		// chunks of one file can be written by different writers, so each writes at its own offset
+		job = chunk->job;
+		written = 0;
+		failed = false;
+		while (written < chunk->length)
+		{
+			result = pwrite(job->outFd, chunk->data + written, chunk->length - written, chunk->fileOffset + written);
+			if (result <= 0)
+			{
+				failed = true;
+				break;
+			}
+			written += result;
+		}
+
+		pthread_mutex_lock(&pipeline->lock);
+		if (options.hash != HASH_NONE)
+		{
+			hashCopyChunk(pipeline, chunk);
+		}
+		else
+		{
+			chunk->next = pipeline->freeChunks;
+			pipeline->freeChunks = chunk;
+			pthread_cond_signal(&pipeline->chunkFree);
+		}
+
+		job->failed = job->failed || failed;
+		job->chunksLeft--;
+		closeFd = -1;
+		if (job->chunksLeft == 0)
+		{
+			closeFd = job->outFd;
+			job->outFd = -1;
+		}
+		pthread_mutex_unlock(&pipeline->lock);
+
+		if (closeFd >= 0)
+		{
+			close(closeFd);
+		}
+	}
+
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * hashCopyChunk
+ *
+ * Feeds a written chunk to its file's digest, called with the pipeline lock held. Chunks are written in whatever order the reads finish, so one that is not next in the file waits in the job's hash queue, holding its buffer, until the chunks before it have been hashed. Every earlier chunk already holds a buffer of its own, so the wait always ends.
+ * @param struct CopyPipeline* pipeline - the pipeline, its lock is let go while bytes are hashed
+ * @param struct CopyChunk* chunk - chunk that has just been written
+ * @returns void - NA
+ */
+void hashCopyChunk(struct CopyPipeline *pipeline, struct CopyChunk *chunk)
+{
+	struct CopyJob *job = chunk->job;
+	struct CopyChunk **link = &job->hashQueue;
+	struct CopyChunk *next;
+
+	while (*link != NULL && (*link)->fileOffset < chunk->fileOffset)
+	{
+		link = &(*link)->next;
+	}
+	chunk->next = *link;
+	*link = chunk;
+
+	// only one writer feeds a file's digest at a time, it picks up whatever the others queue meanwhile
+	if (job->hashing)
+	{
+		return;
+	}
+	job->hashing = true;
+
+	while (job->hashQueue != NULL && (uint64_t)job->hashQueue->fileOffset == job->hashedBytes)
+	{
+		next = job->hashQueue;
+		job->hashQueue = next->next;
+
+		pthread_mutex_unlock(&pipeline->lock);
+		if (next->data != NULL)
+		{
+			updateHasher(&job->hasher, next->data, next->length);
+		}
+		pthread_mutex_lock(&pipeline->lock);
+
+		job->hashedBytes += next->length;
+		next->next = pipeline->freeChunks;
+		pipeline->freeChunks = next;
+		pthread_cond_signal(&pipeline->chunkFree);
+	}
+
+	job->hashing = false;
+}
+
+/**
+ * hashVolume
+ *
+ * Prints a digest of every file listed in a manifest, or of every file on the volume without one, in the same format as get --hash. Files are read in order of starting cluster by --threads workers and printed in the order they were listed.
+ * @param const char* manifestPath - file with one path per line, - for stdin, NULL for every file
+ * @returns bool - true if every file was found and its chain covered the whole file
+ */
+bool hashVolume(const char *manifestPath)
+{
+	struct BatchFile *files = NULL;
+	struct HashRun run = {0};
+	struct TextBuffer out = {0};
+	size_t fileCount = 0;
+	size_t missing = 0;
+	pthread_t *threads;
+
+	if (manifestPath == NULL)
+	{
+		fileCount = collectFiles(volume->bootSector.BPB_RootClus & MASK_FIRST_HEX, &files);
+	}
+	else if (!readBatchManifest(manifestPath, &files, &fileCount, &missing))
+	{
+		return false;
+	}
+
+	// the command is for hashing, so it hashes even without --hash
+	run.files = calloc(fileCount, sizeof(struct HashFile));
+	run.byCluster = malloc(fileCount * sizeof(struct HashFile *));
+	run.fileCount = fileCount;
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		run.files[i].file = files[i];
+		initHasher(&run.files[i].hasher, (options.hash == HASH_NONE) ? HASH_SHA256 : options.hash);
+		run.byCluster[i] = &run.files[i];
+	}
+	free(files);
+
+	// read the image roughly front to back like a batch, the output keeps the listed order
+	qsort(run.byCluster, fileCount, sizeof(struct HashFile *), compareHashFiles);
+
+	startPhase(PHASE_COPY);
+	threads = malloc(volume->threads * sizeof(pthread_t));
+	for (int i = 1; i < volume->threads; i++)
+	{
+		pthread_create(&threads[i], NULL, hashWorker, &run);
+	}
+	hashWorker(&run);
+	for (int i = 1; i < volume->threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+
+	out.sink = volume->out;
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		if (run.files[i].truncated)
+		{
+			missing++;
+		}
+		else
+		{
+			appendHashLine(&out, run.files[i].file.path, &run.files[i].hasher);
+		}
+		free(run.files[i].file.path);
+	}
+	flushText(&out);
+	free(out.data);
+
+	free(run.files);
+	free(run.byCluster);
+	return missing == 0;
+}
+
+/**
+ * collectFiles
+ *
+ * Lists every file under the root by its short name path, the way find prints them. An up to date index answers without reading any directory.
+ * @param uint32_t rootCluster - first cluster of the root directory
+ * @param struct BatchFile** files - set to the files in the order list prints them, each path is allocated
+ * @returns size_t - number of files
+ */
+size_t collectFiles(uint32_t rootCluster, struct BatchFile **files)
+{
+	struct DirWalk walk = {0};
+	struct DirIterator *iterator;
+	struct DecodedEntry decoded;
+	struct TextBuffer path = {0};
+	size_t fileCount = 0;
+	size_t fileCapacity = 0;
+	int kind;
+
+	if (volume->volumeIndex.header != NULL)
+	{
+		*files = malloc((volume->volumeIndex.header->entryCount + 1) * sizeof(struct BatchFile));
+
+		for (uint64_t i = 0; i < volume->volumeIndex.header->entryCount; i++)
+		{
+			const struct IndexEntry *indexed = &volume->volumeIndex.entries[i];
+
+			if (decodeIndexEntry(indexed, &decoded) != ENTRY_FILE)
+			{
+				continue;
+			}
+
+			path.length = 0;
+			appendBytes(&path, volume->volumeIndex.pool + indexed->dirPath, indexed->dirPathLength);
+			appendShortName(&path, &decoded);
+
+			(*files)[fileCount].path = strndup(path.data, path.length);
+			(*files)[fileCount].entry = indexed->entry;
+			(*files)[fileCount].startingCluster = indexed->firstCluster;
+			fileCount++;
+		}
+
+		free(path.data);
+		return fileCount;
+	}
+
+	pushDirWalk(&walk, rootCluster, false);
+
+	while (walk.depth > 0)
+	{
+		iterator = &walk.frames[walk.depth - 1];
+		walk.path.length = iterator->pathLength;
+		kind = nextDirEntry(iterator, &decoded);
+
+		if (kind == ENTRY_END)
+		{
+			walk.depth--;
+			continue;
+		}
+
+		if (kind == ENTRY_DIRECTORY)
+		{
+			descendDirWalk(&walk, &decoded);
+			continue;
+		}
+
+		if (fileCount == fileCapacity)
+		{
+			fileCapacity = (fileCapacity == 0) ? 64 : fileCapacity * 2;
+			*files = realloc(*files, fileCapacity * sizeof(struct BatchFile));
+		}
+
+		path.length = 0;
+		appendBytes(&path, walk.path.data, walk.path.length);
+		appendShortName(&path, &decoded);
+
+		(*files)[fileCount].path = strndup(path.data, path.length);
+		(*files)[fileCount].entry = *decoded.info;
+		(*files)[fileCount].startingCluster = decoded.firstCluster;
+		fileCount++;
+	}
+
+	free(path.data);
+	freeDirWalk(&walk);
+
+	return fileCount;
+}
+
+/**
+ * compareHashFiles
+ *
+ * qsort comparator ordering hash file pointers by starting cluster
+ * @param const void* a - first struct HashFile**
+ * @param const void* b - second struct HashFile**
+ * @returns int - negative, 0 or positive like strcmp
+ */
+int compareHashFiles(const void *a, const void *b)
+{
+	return compareBatchFiles(&(*(struct HashFile *const *)a)->file, &(*(struct HashFile *const *)b)->file);
+}
+
+/**
+ * hashWorker
+ *
+ * Thread body for hashVolume, follows the chain of each file it takes and feeds the bytes to the file's digest without writing them anywhere
+ * @param void* arg - the struct HashRun
+ * @returns void* - NULL
+ */
+void *hashWorker(void *arg)
+{
+	struct HashRun *run = arg;
+	struct ExtentList list = {0};
+	struct HashFile *file;
+	uint64_t covered;
+	size_t next;
+
+	while ((next = __atomic_fetch_add(&run->nextFile, 1, __ATOMIC_RELAXED)) < run->fileCount)
+	{
+		file = run->byCluster[next];
+
+		list.count = 0;
+		covered = buildExtents(file->file.startingCluster, file->file.entry.dir_file_size, &list);
+		file->truncated = !chainCoversFile(file->file.path, covered, file->file.entry.dir_file_size);
+		if (!file->truncated)
+		{
+			copyExtents(&list, -1, &file->hasher);
+		}
+	}
+
+	freeExtents(&list);
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * analyzeVolume
+ *
+ * Prints how fragmented every file is and how fragmented the volume is as a whole, to tell which images will extract slowly. Every file's chain is followed once through the FAT cache by --threads workers, and the free space is measured with a parallel pass over the FAT. Nothing but the FAT, and the directories when there is no index, is read.
+ * @returns void - NA
+ */
+void analyzeVolume(void)
+{
+	struct BatchFile *files = NULL;
+	struct AnalyzeRun run = {0};
+	struct TextBuffer out = {0};
+	struct FatScan *scans;
+	struct FatScan freeSpace = {0};
+	pthread_t *threads;
+	size_t fileCount;
+	int threadCount;
+	uint32_t carried = 0; // free entries running up to the end of the ranges merged so far
+
+	fileCount = collectFiles(volume->bootSector.BPB_RootClus & MASK_FIRST_HEX, &files);
+	run.files = calloc(fileCount + 1, sizeof(struct AnalyzeFile));
+	run.fileCount = fileCount;
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		run.files[i].file = files[i];
+	}
+	free(files);
+
+	// follow every chain in parallel, each worker pulls the next file off a shared cursor
+	pthread_mutex_init(&run.lock, NULL);
+	threads = malloc(volume->threads * sizeof(pthread_t));
+	for (int i = 1; i < volume->threads; i++)
+	{
+		pthread_create(&threads[i], NULL, analyzeWorker, &run);
+	}
+	analyzeWorker(&run);
+	for (int i = 1; i < volume->threads; i++)
+	{
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+	pthread_mutex_destroy(&run.lock);
+
+	// free runs are found per range and then stitched together where one range's tail meets the next one's head
+	scans = splitFatScan(&threadCount);
+	runFatScan(scans, threadCount, scanFreeRuns);
+	for (int i = 0; i < threadCount; i++)
+	{
+		uint32_t rangeSize = scans[i].endEntry - scans[i].firstEntry;
+		uint32_t joined = (scans[i].leadingFree > 0) ? carried + scans[i].leadingFree : 0;
+
+		freeSpace.freeCount += scans[i].freeCount;
+		freeSpace.freeRuns += scans[i].freeRuns - ((carried > 0 && scans[i].leadingFree > 0) ? 1 : 0);
+		freeSpace.longestFreeRun = (scans[i].longestFreeRun > freeSpace.longestFreeRun) ? scans[i].longestFreeRun : freeSpace.longestFreeRun;
+		freeSpace.longestFreeRun = (joined > freeSpace.longestFreeRun) ? joined : freeSpace.longestFreeRun;
+		carried = (rangeSize > 0 && scans[i].leadingFree == rangeSize) ? carried + rangeSize : scans[i].trailingFree;
+	}
+	free(scans);
+
+	out.sink = volume->out;
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		appendAnalyzeFile(&out, &run.files[i]);
+	}
+
+	// the order get-batch copies in, file is the first member so the batch comparator sorts these too
+	qsort(run.files, fileCount, sizeof(struct AnalyzeFile), compareBatchFiles);
+	appendAnalyzeSummary(&out, &run.totals, &freeSpace, countBatchSeeks(run.files, fileCount));
+	flushText(&out);
+	free(out.data);
+
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		free(run.files[i].file.path);
+	}
+	free(run.files);
+}
+
+/**
+ * analyzeWorker
+ *
+ * Thread body for analyzeVolume, follows the chain of each file it takes and merges what it counted into the run once every file has been taken
+ * @param void* arg - the struct AnalyzeRun
+ * @returns void* - NULL
+ */
+void *analyzeWorker(void *arg)
+{
+	struct AnalyzeRun *run = arg;
+	struct AnalyzeTotals totals = {0};
+	struct ExtentList list = {0};
+	size_t next;
+
+	while ((next = __atomic_fetch_add(&run->nextFile, 1, __ATOMIC_RELAXED)) < run->fileCount)
+	{
+		analyzeFile(&run->files[next], &list, &totals);
+	}
+	freeExtents(&list);
+
+	pthread_mutex_lock(&run->lock);
+	run->totals.files += totals.files;
+	run->totals.fragmentedFiles += totals.fragmentedFiles;
+	run->totals.clusters += totals.clusters;
+	run->totals.extents += totals.extents;
+	run->totals.backwardJumps += totals.backwardJumps;
+	for (int i = 0; i < ANALYZE_GAP_BUCKETS; i++)
+	{
+		run->totals.gaps[i] += totals.gaps[i];
+	}
+	pthread_mutex_unlock(&run->lock);
+
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * analyzeFile
+ *
+ * Builds one file's extents from the FAT and counts its runs and the gaps between them
+ * @param struct AnalyzeFile* file - file to look at, its counts are filled in
+ * @param struct ExtentList* list - scratch list reused between files
+ * @param struct AnalyzeTotals* totals - the worker's totals to add to
+ * @returns void - NA
+ */
+void analyzeFile(struct AnalyzeFile *file, struct ExtentList *list, struct AnalyzeTotals *totals)
+{
+	const struct Extent *extent;
+	uint64_t covered;
+	off_t gap;
+
+	list->count = 0;
+	covered = buildExtents(file->file.startingCluster, file->file.entry.dir_file_size, list);
+
+	file->extents = list->count;
+	file->clusters = (covered + volume->bytesPerCluster - 1) / volume->bytesPerCluster;
+	totals->files++;
+	totals->fragmentedFiles += (list->count > 1) ? 1 : 0;
+	totals->clusters += file->clusters;
+	totals->extents += list->count;
+
+	if (list->count == 0)
+	{
+		return;
+	}
+
+	// only the last extent can end part way through a cluster, so every gap is a whole number of clusters
+	for (size_t i = 1; i < list->count; i++)
+	{
+		gap = list->extents[i].offset - (list->extents[i - 1].offset + (off_t)list->extents[i - 1].length);
+
+		if (gap <= 0)
+		{
+			totals->backwardJumps++;
+		}
+		else
+		{
+			int bucket = 63 - __builtin_clzll((uint64_t)gap / volume->bytesPerCluster);
+
+			totals->gaps[(bucket < ANALYZE_GAP_BUCKETS) ? bucket : ANALYZE_GAP_BUCKETS - 1]++;
+		}
+	}
+
+	extent = &list->extents[list->count - 1];
+	file->firstOffset = list->extents[0].offset;
+	file->endOffset = extent->offset + ((extent->length + volume->bytesPerCluster - 1) / volume->bytesPerCluster) * volume->bytesPerCluster;
+}
+
+/**
+ * countBatchSeeks
+ *
+ * Counts the seeks get-batch would make copying every file, one to reach each extent unless it starts where the read before it ended
+ * @param const struct AnalyzeFile* files - files in the order of their starting cluster
+ * @param size_t fileCount - number of files
+ * @returns uint64_t - number of seeks
+ */
+uint64_t countBatchSeeks(const struct AnalyzeFile *files, size_t fileCount)
+{
+	uint64_t seeks = 0;
+	off_t position = -1; // where the last read ended, nowhere before the first
+
+	for (size_t i = 0; i < fileCount; i++)
+	{
+		if (files[i].extents == 0)
+		{
+			continue;
+		}
+
+		// within a file every extent after the first is somewhere else by definition
+		seeks += files[i].extents - 1 + ((files[i].firstOffset != position) ? 1 : 0);
+		position = files[i].endOffset;
+	}
+
+	return seeks;
+}
+
+/**
+ * scanFreeRuns
+ *
+ * FAT pass for analyzeVolume, finds the runs of free entries in one range of the FAT
+ * @param void* arg - the struct FatScan range to look at
+ * @returns void* - NULL
+ */
+void *scanFreeRuns(void *arg)
+{
+	struct FatScan *scan = arg;
+	uint32_t *scratch = NULL;
+	uint32_t run = 0; // free entries just before the one being looked at
+	bool leading = true;
+
+	for (uint32_t entry = scan->firstEntry; entry < scan->endEntry; entry++)
+	{
+		const uint32_t *page = peekFatPage(entry / volume->fatCacheEntriesPerPage, &scratch);
+		uint32_t pageEnd = (entry / volume->fatCacheEntriesPerPage + 1) * volume->fatCacheEntriesPerPage;
+
+		// stay on this page until it runs out so every entry does not pay for a lookup
+		for (; entry < scan->endEntry && entry < pageEnd; entry++)
+		{
+			if ((page[entry % volume->fatCacheEntriesPerPage] & MASK_FIRST_HEX) == 0)
+			{
+				scan->freeCount++;
+				scan->freeRuns += (run == 0) ? 1 : 0;
+				run++;
+				continue;
+			}
+
+			scan->leadingFree = leading ? run : scan->leadingFree;
+			scan->longestFreeRun = (run > scan->longestFreeRun) ? run : scan->longestFreeRun;
+			leading = false;
+			run = 0;
+		}
+		entry--;
+	}
+
+	scan->leadingFree = leading ? run : scan->leadingFree;
+	scan->longestFreeRun = (run > scan->longestFreeRun) ? run : scan->longestFreeRun;
+	scan->trailingFree = run;
+
+	free(scratch);
+	mergeThreadStats();
+	return NULL;
+}
+
+/**
+ * appendAnalyzeFile
+ *
+ * Prints one file's fragmentation, every file for ndjson and only files of more than one extent for text
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct AnalyzeFile* file - file to print
+ * @returns void - NA
+ */
+void appendAnalyzeFile(struct TextBuffer *buffer, const struct AnalyzeFile *file)
+{
+	double averageRun = (file->extents > 0) ? (double)file->clusters / file->extents : 0;
+
+	if (options.listFormat == LIST_FORMAT_NDJSON)
+	{
+		appendString(buffer, "{\"path\":\"");
+		appendJsonString(buffer, file->file.path, strlen(file->file.path));
+		appendText(buffer, "\",\"size\":%" PRIu32 ",\"clusters\":%" PRIu64 ",\"extents\":%" PRIu64 ",\"average_run\":%.2f}\n", file->file.entry.dir_file_size, file->clusters,
+				   file->extents, averageRun);
+	}
+	else if (file->extents > 1)
+	{
+		appendText(buffer, "%s: %" PRIu64 " extents, %" PRIu64 " clusters, average run %.1f clusters\n", file->file.path, file->extents, file->clusters, averageRun);
+	}
+}
+
+/**
+ * appendAnalyzeSummary
+ *
+ * Prints the volume wide counts after the files, as the last line for ndjson
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const struct AnalyzeTotals* totals - counts merged over every file
+ * @param const struct FatScan* freeSpace - free entries, runs and longest run over the whole FAT
+ * @param uint64_t batchSeeks - seeks copying every file in get-batch order would make
+ * @returns void - NA
+ */
+void appendAnalyzeSummary(struct TextBuffer *buffer, const struct AnalyzeTotals *totals, const struct FatScan *freeSpace, uint64_t batchSeeks)
+{
+	double averageRun = (totals->extents > 0) ? (double)totals->clusters / totals->extents : 0;
+	double fragmented = (totals->files > 0) ? 100.0 * totals->fragmentedFiles / totals->files : 0;
+
+	if (options.listFormat == LIST_FORMAT_NDJSON)
+	{
+		appendText(buffer, "{\"files\":%" PRIu64 ",\"fragmented_files\":%" PRIu64 ",\"clusters\":%" PRIu64 ",\"extents\":%" PRIu64 ",\"average_run\":%.2f,", totals->files,
+				   totals->fragmentedFiles, totals->clusters, totals->extents, averageRun);
+		appendText(buffer, "\"free_clusters\":%" PRIu64 ",\"free_runs\":%" PRIu64 ",\"largest_free_run\":%" PRIu32 ",\"gaps\":[", freeSpace->freeCount, freeSpace->freeRuns, freeSpace->longestFreeRun);
+		for (int i = 0; i < ANALYZE_GAP_BUCKETS; i++)
+		{
+			appendText(buffer, (i == 0) ? "%" PRIu64 : ",%" PRIu64, totals->gaps[i]);
+		}
+		appendText(buffer, "],\"backward_jumps\":%" PRIu64 ",\"seeks\":%" PRIu64 ",\"batch_seeks\":%" PRIu64 "}\n", totals->backwardJumps, totals->extents, batchSeeks);
+		return;
+	}
+
+	appendText(buffer, "%" PRIu64 " files, %" PRIu64 " fragmented (%.1f%%)\n", totals->files, totals->fragmentedFiles, fragmented);
+	appendText(buffer, "%" PRIu64 " clusters in %" PRIu64 " extents, average run %.1f clusters\n", totals->clusters, totals->extents, averageRun);
+	appendText(buffer, "%" PRIu64 " free clusters in %" PRIu64 " runs, largest free run %" PRIu32 " clusters (%" PRIu64 " bytes)\n", freeSpace->freeCount, freeSpace->freeRuns,
+			   freeSpace->longestFreeRun, (uint64_t)freeSpace->longestFreeRun * volume->bytesPerCluster);
+
+	appendString(buffer, "Gaps between extents:\n");
+	for (int i = 0; i < ANALYZE_GAP_BUCKETS; i++)
+	{
+		if (totals->gaps[i] == 0)
+		{
+			continue;
+		}
+
+		if (i == 0)
+		{
+			appendText(buffer, "  1 cluster: %" PRIu64 "\n", totals->gaps[i]);
+		}
+		else if (i == ANALYZE_GAP_BUCKETS - 1)
+		{
+			appendText(buffer, "  %" PRIu64 "+ clusters: %" PRIu64 "\n", (uint64_t)1 << i, totals->gaps[i]);
+		}
+		else
+		{
+			appendText(buffer, "  %" PRIu64 "-%" PRIu64 " clusters: %" PRIu64 "\n", (uint64_t)1 << i, ((uint64_t)2 << i) - 1, totals->gaps[i]);
+		}
+	}
+	if (totals->backwardJumps > 0)
+	{
+		appendText(buffer, "  backward: %" PRIu64 "\n", totals->backwardJumps);
+	}
+
+	appendText(buffer, "Estimated seeks: %" PRIu64 " with get of every file, %" PRIu64 " with get-batch of every file\n", totals->extents, batchSeeks);
+}
+
+/**
+ * resolvePath
+ *
+ * Walks a path one component at a time from the root, every component but the last must be a directory
+ * @param const char* path - path to the file or directory, made of short names separated by /
+ * @param bool isDirectory - whether the last component is a directory or a file
+ * @returns const struct Dentry* - cached entry for the last component, NULL if it could not be found
+ */
+const struct Dentry *resolvePath(const char *path, bool isDirectory)
+{
+	char *pathCopy = strdup(path); // strtok_r writes into the path so work on a copy
+	char *savePtr;
+	char *token;
+	char *nextToken;
+	uint32_t clusterNum = volume->bootSector.BPB_RootClus & MASK_FIRST_HEX;
+	const struct Dentry *found = NULL;
+
+	token = strtok_r(pathCopy, "/", &savePtr);
+
+	while (token != NULL)
+	{
+		nextToken = strtok_r(NULL, "/", &savePtr);
+
+		// directories are matched without their extension, the file is matched as NAME.EXT
+		found = lookupDentry(clusterNum, token, nextToken != NULL || isDirectory);
+		if (found == NULL)
+		{
+			break;
+		}
+
+		// combine the bits
+		clusterNum = ((uint32_t)found->entry.dir_first_cluster_hi << 16) | found->entry.dir_first_cluster_lo;
+		clusterNum = clusterNum & MASK_FIRST_HEX;
+
+		token = nextToken;
+	}
+
+	free(pathCopy);
+	return found;
+}
+
+/**
+ * lookupDentry
+ *
+ * Finds a name in a directory, scanning the directory into the dentry cache the first time it is searched so a miss never rescans it
+ * @param uint32_t parentCluster - first cluster of the directory to search
+ * @param const char* name - short name to find, NAME for directories and NAME.EXT for files
+ * @param bool isDirectory - whether we are looking for a directory or a file
+ * @returns const struct Dentry* - matching entry, NULL if there is none
+ */
+const struct Dentry *lookupDentry(uint32_t parentCluster, const char *name, bool isDirectory)
+{
+	uint8_t kind = isDirectory ? DENTRY_DIRECTORY : DENTRY_FILE;
+	struct Dentry *found;
+
+	// anything longer than a short name can not be in the cache
+	if (strlen(name) >= sizeof(found->name))
+	{
+		return NULL;
+	}
+
+	found = findDentry(parentCluster, name, kind);
+
+	if (found == NULL && findDentry(parentCluster, "", DENTRY_SCANNED) == NULL)
+	{
+		scanDirectoryIntoCache(parentCluster);
+		found = findDentry(parentCluster, name, kind);
+	}
+
+	return found;
+}
+
+/**
+ * scanDirectoryIntoCache
+ *
+ * Reads every cluster of a directory and adds each visible file and directory to the dentry cache, then marks the directory as scanned
+ * @param uint32_t parentCluster - first cluster of the directory
+ * @returns void - NA
+ */
+void scanDirectoryIntoCache(uint32_t parentCluster)
+{
+	struct DirCluster dir = {0}; // whole cluster of entries, buffer reused for every cluster in the chain
+	const struct DirInfo *currentDir;
+	struct LongName longName = {0};
+	struct DecodedEntry decoded;
+	struct ChainWalk chain;
+	char fullName[13];
+	bool endOfDirectory = false;
+	int kind;
+
+	openChainWalk(&chain, parentCluster);
+
+	while (!endOfDirectory && chain.clusterNum < END_OF_CLUSTER_CHAIN)
+	{
+		loadDirCluster(&dir, chain.clusterNum);
+
+		// loop through all entries in the cluster
+		for (int i = 0; i < volume->entriesPerCluster; i++)
+		{
+			currentDir = (const struct DirInfo *)(dir.entries + (i * sizeof(struct DirInfo)));
+
+			// check to see whether we are at the end
+			if ((uint8_t)currentDir->dir_name[0] == 0x00)
+			{
+				endOfDirectory = true;
+				break;
+			}
+
+			// skip deleted entries
+			if ((uint8_t)currentDir->dir_name[0] == 0xE5)
+			{
+				continue;
+			}
+
+			kind = decodeEntry(currentDir, &longName, &decoded);
+
+			if (kind == ENTRY_DIRECTORY)
+			{
+				insertDentry(parentCluster, decoded.givenName, DENTRY_DIRECTORY, currentDir);
+			}
+			else if (kind == ENTRY_FILE)
+			{
+				// assemble full name, the extension keeps its padding just like when get compares it
+				snprintf(fullName, sizeof(fullName), "%s.%.3s", decoded.givenName, &currentDir->dir_name[8]);
+				insertDentry(parentCluster, fullName, DENTRY_FILE, currentDir);
+			}
+		}
+
+		// get next cluster number from fat
+		advanceChainWalk(&chain);
+	}
+
+	freeDirCluster(&dir);
+
+	insertDentry(parentCluster, "", DENTRY_SCANNED, NULL);
+}
+
+/**
+ * hashDentryKey
+ *
+ * FNV-1a hash of a dentry cache key
+ * @param uint32_t parentCluster - first cluster of the directory
+ * @param const char* name - entry name
+ * @param uint8_t kind - kind of entry
+ * @returns uint64_t - hash of the key
+ */
+uint64_t hashDentryKey(uint32_t parentCluster, const char *name, uint8_t kind)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (int i = 0; i < 4; i++)
+	{
+		hash = (hash ^ ((parentCluster >> (i * 8)) & 0xFF)) * 0x100000001b3ULL;
+	}
+
+	hash = (hash ^ kind) * 0x100000001b3ULL;
+
+	for (; *name != '\0'; name++)
+	{
+		hash = (hash ^ (uint8_t)*name) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * findDentry
+ *
+ * Looks a key up in the dentry cache
+ * @param uint32_t parentCluster - first cluster of the directory
+ * @param const char* name - entry name
+ * @param uint8_t kind - kind of entry
+ * @returns struct Dentry* - matching slot, NULL if the key is not cached
+ */
+struct Dentry *findDentry(uint32_t parentCluster, const char *name, uint8_t kind)
+{
+	size_t slot;
+
+	if (volume->dentryCache.capacity == 0)
+	{
+		return NULL;
+	}
+
+	// linear probing until we hit the key or an empty slot
+	slot = hashDentryKey(parentCluster, name, kind) & (volume->dentryCache.capacity - 1);
+	while (volume->dentryCache.slots[slot].kind != DENTRY_EMPTY)
+	{
+		struct Dentry *dentry = &volume->dentryCache.slots[slot];
+
+		if (dentry->kind == kind && dentry->parentCluster == parentCluster && strcmp(dentry->name, name) == 0)
+		{
+			return dentry;
+		}
+
+		slot = (slot + 1) & (volume->dentryCache.capacity - 1);
+	}
+
+	return NULL;
+}
+
+/**
+ * insertDentry
+ *
+ * Adds a key to the dentry cache, growing it when it gets over 70% full. If the key is already there the first entry seen wins, just like a linear scan would.
+ * @param uint32_t parentCluster - first cluster of the directory
+ * @param const char* name - entry name, shorter than 13 characters
+ * @param uint8_t kind - kind of entry
+ * @param const struct DirInfo* entry - directory entry to copy, NULL for DENTRY_SCANNED markers
+ * @returns void - NA
+ */
+void insertDentry(uint32_t parentCluster, const char *name, uint8_t kind, const struct DirInfo *entry)
+{
+	size_t slot;
+
+	if (findDentry(parentCluster, name, kind) != NULL)
+	{
+		return;
+	}
+
+	// rehash everything into a table twice the size
+	if ((volume->dentryCache.count + 1) * 10 > volume->dentryCache.capacity * 7)
+	{
+		struct DentryCache old = volume->dentryCache;
+
+		volume->dentryCache.capacity = (old.capacity == 0) ? 256 : old.capacity * 2;
+		volume->dentryCache.slots = calloc(volume->dentryCache.capacity, sizeof(struct Dentry));
+		volume->dentryCache.count = 0;
+
+		for (size_t i = 0; i < old.capacity; i++)
+		{
+			if (old.slots[i].kind != DENTRY_EMPTY)
+			{
+				slot = hashDentryKey(old.slots[i].parentCluster, old.slots[i].name, old.slots[i].kind) & (volume->dentryCache.capacity - 1);
+				while (volume->dentryCache.slots[slot].kind != DENTRY_EMPTY)
+				{
+					slot = (slot + 1) & (volume->dentryCache.capacity - 1);
+				}
+				volume->dentryCache.slots[slot] = old.slots[i];
+				volume->dentryCache.count++;
+			}
+		}
+
+		free(old.slots);
+	}
+
+	slot = hashDentryKey(parentCluster, name, kind) & (volume->dentryCache.capacity - 1);
+	while (volume->dentryCache.slots[slot].kind != DENTRY_EMPTY)
+	{
+		slot = (slot + 1) & (volume->dentryCache.capacity - 1);
+	}
+
+	volume->dentryCache.slots[slot].parentCluster = parentCluster;
+	volume->dentryCache.slots[slot].kind = kind;
+	strcpy(volume->dentryCache.slots[slot].name, name);
+	if (entry != NULL)
+	{
+		volume->dentryCache.slots[slot].entry = *entry;
+	}
+	volume->dentryCache.count++;
+}
+
+/**
+ * freeDentryCache
+ *
+ * Releases all memory held by the dentry cache
+ * @returns void - NA
+ */
+void freeDentryCache(void)
+{
+	free(volume->dentryCache.slots);
+	volume->dentryCache.slots = NULL;
+	volume->dentryCache.capacity = 0;
+	volume->dentryCache.count = 0;
+}
+
+/**
+ * writeIndex
+ *
+ * Walks every directory once and writes a sidecar holding each visible entry in listing order with its path, long name and the extents of every file. The sidecar is keyed by the volume id and a checksum of the FAT, so later runs can map it and skip the walk.
+ * @param const char* path - where to write the sidecar
+ * @returns bool - true if the sidecar was written
+ */
+bool writeIndex(const char *path)
+{
+	struct IndexHeader header = {0};
+	struct DirWalk walk = {0};
+	struct DirIterator *iterator;
+	struct DecodedEntry decoded;
+	struct IndexEntry *entries = NULL;
+	struct IndexEntry *indexed;
+	struct ExtentList extents = {0};	 // extents of every file, back to back
+	struct ExtentList fileExtents = {0}; // extents of one file, built on their own so they never merge with the previous file's
+	struct TextBuffer pool = {0};
+	uint64_t *levelPaths = NULL; // pool offset of the path of the directory at each level of the walk
+	uint32_t *slots;
+	size_t entryCount = 0;
+	size_t entryCapacity = 0;
+	int levelCapacity = 16;
+	int kind;
+	char tempPath[PATH_MAX];
+	static const char padding[8] = {0};
+	FILE *sidecar;
+	bool success;
+
+	levelPaths = malloc(levelCapacity * sizeof(uint64_t));
+	levelPaths[0] = 0;
+	pushDirWalk(&walk, volume->bootSector.BPB_RootClus & MASK_FIRST_HEX, false);
+
+	while (walk.depth > 0)
+	{
+		iterator = &walk.frames[walk.depth - 1];
+		walk.path.length = iterator->pathLength;
+		kind = nextDirEntry(iterator, &decoded);
+
+		if (kind == ENTRY_END)
+		{
+			walk.depth--;
+			continue;
+		}
+
+		if (entryCount == entryCapacity)
+		{
+			entryCapacity = (entryCapacity == 0) ? 1024 : entryCapacity * 2;
+			entries = realloc(entries, entryCapacity * sizeof(struct IndexEntry));
+		}
+
+		indexed = &entries[entryCount++];
+		memset(indexed, 0, sizeof(struct IndexEntry));
+		indexed->entry = *decoded.info;
+		indexed->firstCluster = decoded.firstCluster;
+		indexed->depth = walk.depth - 1;
+		indexed->dirPath = levelPaths[walk.depth - 1];
+		indexed->dirPathLength = walk.path.length;
+
+		// the key is matched the same way the dentry cache matches names
+		indexed->key = pool.length;
+		appendBytes(&pool, walk.path.data, walk.path.length);
+		if (kind == ENTRY_DIRECTORY)
+		{
+			appendString(&pool, decoded.givenName);
+		}
+		else
+		{
+			appendText(&pool, "%s.%.3s", decoded.givenName, &decoded.info->dir_name[8]);
+		}
+		indexed->keyLength = pool.length - indexed->key;
+
+		// long names are kept as raw UTF-16 so they print exactly like a walk would print them
+		if (decoded.longName != NULL)
+		{
+			appendBytes(&pool, padding, pool.length & 1);
+			indexed->longName = pool.length;
+			indexed->longNameEntries = decoded.longNameEntries;
+			appendBytes(&pool, (const char *)decoded.longName, (size_t)decoded.longNameEntries * LONG_NAME_CHARS_PER_ENTRY * sizeof(uint16_t));
+		}
+
+		if (kind == ENTRY_FILE)
+		{
+			fileExtents.count = 0;
+			buildExtents(decoded.firstCluster, decoded.info->dir_file_size, &fileExtents);
+
+			if (extents.capacity - extents.count < fileExtents.count)
+			{
+				while (extents.capacity - extents.count < fileExtents.count)
+				{
+					extents.capacity = (extents.capacity == 0) ? 1024 : extents.capacity * 2;
+				}
+				extents.extents = realloc(extents.extents, extents.capacity * sizeof(struct Extent));
+			}
+
+			indexed->firstExtent = extents.count;
+			indexed->extentCount = fileExtents.count;
+			if (fileExtents.count > 0)
+			{
+				memcpy(extents.extents + extents.count, fileExtents.extents, fileExtents.count * sizeof(struct Extent));
+			}
+			extents.count += fileExtents.count;
+			continue;
+		}
+
+		// a subdirectory pointing back up the tree is kept as an entry but never walked into
+		if (!descendDirWalk(&walk, &decoded))
+		{
+			continue;
+		}
+
+		// the path of the subdirectory goes in the pool once and is shared by all of its entries
+		if (walk.depth - 1 == levelCapacity)
+		{
+			levelCapacity *= 2;
+			levelPaths = realloc(levelPaths, levelCapacity * sizeof(uint64_t));
+		}
+		levelPaths[walk.depth - 1] = pool.length;
+		appendBytes(&pool, walk.path.data, walk.path.length);
+	}
+
+	freeDirWalk(&walk);
+	freeExtents(&fileExtents);
+	free(levelPaths);
+
+	// hash table from lookup key to entry, kept at most half full so probes stay short
+	header.slotCount = 16;
+	while (header.slotCount < entryCount * 2)
+	{
+		header.slotCount *= 2;
+	}
+	slots = calloc(header.slotCount, sizeof(uint32_t));
+
+	for (size_t i = 0; i < entryCount; i++)
+	{
+		const char *key = pool.data + entries[i].key;
+		size_t slot = hashBytes(key, entries[i].keyLength) & (header.slotCount - 1);
+		bool duplicate = false;
+
+		while (slots[slot] != 0 && !duplicate)
+		{
+			const struct IndexEntry *other = &entries[slots[slot] - 1];
+
+			// the first entry with a name wins, just like in the dentry cache
+			duplicate = other->keyLength == entries[i].keyLength && memcmp(pool.data + other->key, key, other->keyLength) == 0;
+			slot = (slot + 1) & (header.slotCount - 1);
+		}
+
+		if (!duplicate)
+		{
+			slots[slot] = i + 1;
+		}
+	}
+
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.volumeId = volume->bootSector.BS_VolID;
+	header.bytesPerCluster = volume->bytesPerCluster;
+	header.fatChecksum = checksumFat();
+	header.entryCount = entryCount;
+	header.extentCount = extents.count;
+	header.poolSize = pool.length;
+	header.entriesOffset = sizeof(struct IndexHeader);
+	header.extentsOffset = header.entriesOffset + entryCount * sizeof(struct IndexEntry);
+	header.slotsOffset = header.extentsOffset + extents.count * sizeof(struct Extent);
+	header.poolOffset = (header.slotsOffset + header.slotCount * sizeof(uint32_t) + 7) & ~(uint64_t)7;
+	header.bodyChecksum = checksumIndexBody(&header, entries, extents.extents, slots, pool.data);
+
+	// write next to the old sidecar and swap it in, so a reader never maps half an index
+	snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+	sidecar = fopen(tempPath, "wb");
+	if (sidecar == NULL)
+	{
+		free(entries);
+		free(slots);
+		freeExtents(&extents);
+		free(pool.data);
+		return false;
+	}
+
+	fwrite(&header, sizeof(header), 1, sidecar);
+	fwrite(entries, sizeof(struct IndexEntry), entryCount, sidecar);
+	fwrite(extents.extents, sizeof(struct Extent), extents.count, sidecar);
+	fwrite(slots, sizeof(uint32_t), header.slotCount, sidecar);
+	fwrite(padding, 1, header.poolOffset - (header.slotsOffset + header.slotCount * sizeof(uint32_t)), sidecar);
+	fwrite(pool.data, 1, pool.length, sidecar);
+
+	success = !ferror(sidecar);
+	success = (fclose(sidecar) == 0) && success;
+	success = success && rename(tempPath, path) == 0;
+	if (!success)
+	{
+		unlink(tempPath);
+	}
+
+	free(entries);
+	free(slots);
+	freeExtents(&extents);
+	free(pool.data);
+
+	return success;
+}
+
+/**
+ * openIndex
+ *
+ * Maps an index sidecar if it was built from this image, otherwise leaves volumeIndex empty so list and get walk the directories as usual
+ * @param const char* path - path of the sidecar
+ * @returns bool - true if the index is up to date and mapped
+ */
+bool openIndex(const char *path)
+{
+	struct VolumeIndex index = {0};
+
+	if (!mapIndex(path, &index))
+	{
+		return false;
+	}
+
+	if (!checkIndex(&index))
+	{
+		// stdout might be carrying a listing or a file, so the note goes to stderr
+		fprintf(stderr, "Index %s is out of date or damaged, reading the directories instead.\n", path);
+		munmap((void *)index.map, index.size);
+		return false;
+	}
+
+	locateIndexSections(&index);
+	volume->volumeIndex = index;
+
+	return true;
+}
+
+/**
+ * mapIndex
+ *
+ * Maps a sidecar read only without looking at anything past its size
+ * @param const char* path - path of the sidecar
+ * @param struct VolumeIndex* index - map, size and header are filled in
+ * @returns bool - true if the file is mapped and big enough for a header
+ */
+bool mapIndex(const char *path, struct VolumeIndex *index)
+{
+	struct stat indexStat;
+	int indexFd;
+	void *map;
+
+	indexFd = open(path, O_RDONLY);
+	if (indexFd < 0)
+	{
+		return false;
+	}
+
+	if (fstat(indexFd, &indexStat) != 0 || (size_t)indexStat.st_size < sizeof(struct IndexHeader))
+	{
+		close(indexFd);
+		return false;
+	}
+
+	map = mmap(NULL, indexStat.st_size, PROT_READ, MAP_SHARED, indexFd, 0);
+	close(indexFd);
+	if (map == MAP_FAILED)
+	{
+		return false;
+	}
+
+	index->map = map;
+	index->size = indexStat.st_size;
+	index->header = map;
+
+	return true;
+}
+
+/**
+ * locateIndexSections
+ *
+ * Points the section pointers of a checked sidecar at their place in the map
+ * @param struct VolumeIndex* index - sidecar whose layout has been checked
+ * @returns void - NA
+ */
+void locateIndexSections(struct VolumeIndex *index)
+{
+	index->entries = (const struct IndexEntry *)(index->map + index->header->entriesOffset);
+	index->extents = (const struct Extent *)(index->map + index->header->extentsOffset);
+	index->slots = (const uint32_t *)(index->map + index->header->slotsOffset);
+	index->pool = (const char *)(index->map + index->header->poolOffset);
+}
+
+/**
+ * checkIndex
+ *
+ * Makes sure a mapped sidecar belongs to this image, is not damaged and that nothing in it points outside the file or the image
+ * @param const struct VolumeIndex* index - sidecar with map, size and header set
+ * @returns bool - true if the index can be used
+ */
+bool checkIndex(const struct VolumeIndex *index)
+{
+	const struct IndexHeader *header = index->header;
 
-	// total space
-	totalSpace = (bootSector.BPB_TotSec32 * bootSector.BPB_BytesPerSec) / BYTES_PER_KB;
+	// cheap checks first, the FAT checksum reads the whole FAT
+	if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0 || header->volumeId != volume->bootSector.BS_VolID || header->bytesPerCluster != volume->bytesPerCluster)
+	{
+		return false;
+	}
 
-	// total usable space
-	totalUsableSpace = ((bootSector.BPB_TotSec32 - bootSector.BPB_RsvdSecCnt - (bootSector.BPB_FATSz32 * bootSector.BPB_NumFATs)) * bootSector.BPB_BytesPerSec) / BYTES_PER_KB;
+	return indexLayoutFits(index) && indexExtentsFit(index) && header->fatChecksum == checksumFat();
+}
 
-	// cluster size in bytes
-	clusterSizeBytes = bootSector.BPB_BytesPerSec * bootSector.BPB_SecPerClus;
+/**
+ * indexLayoutFits
+ *
+ * Makes sure every section, path and extent a mapped sidecar points at lies inside the file, that the depths follow the listing order and that the body matches its checksum
+ * @param const struct VolumeIndex* index - sidecar with map, size and header set
+ * @returns bool - true if nothing points outside the file and the body is intact
+ */
+bool indexLayoutFits(const struct VolumeIndex *index)
+{
+	const struct IndexHeader *header = index->header;
+	const struct IndexEntry *entries;
+	const uint32_t *slots;
 
-	printf("Drive name: %s\n", driveName);
-	printf("OEM name: %s\n", OEMName);
-	printf("Free space is %ld KB\n", freeSpace);
-	printf("Total space is %ld KB\n", totalSpace);
-	printf("Total usable space %ld KB\n", totalUsableSpace);
-	printf("Cluster size in sectors %i\n", bootSector.BPB_SecPerClus);
-	printf("Cluster size is %ld bytes\n", clusterSizeBytes);
+	if (header->slotCount == 0 || (header->slotCount & (header->slotCount - 1)) != 0 || header->entryCount >= UINT32_MAX ||
+		!indexSectionFits(header->entriesOffset, header->entryCount, sizeof(struct IndexEntry), index->size) ||
+		!indexSectionFits(header->extentsOffset, header->extentCount, sizeof(struct Extent), index->size) ||
+		!indexSectionFits(header->slotsOffset, header->slotCount, sizeof(uint32_t), index->size) ||
+		!indexSectionFits(header->poolOffset, header->poolSize, 1, index->size) ||
+		(header->entriesOffset | header->extentsOffset | header->slotsOffset | header->poolOffset) % 8 != 0)
+	{
+		return false;
+	}
 
-	free(driveName);
-	free(OEMName);
+	entries = (const struct IndexEntry *)(index->map + header->entriesOffset);
+	for (uint64_t i = 0; i < header->entryCount; i++)
+	{
+		if (entries[i].dirPath > header->poolSize || entries[i].dirPathLength > header->poolSize - entries[i].dirPath ||
+			entries[i].key > header->poolSize || entries[i].keyLength > header->poolSize - entries[i].key ||
+			entries[i].longNameEntries > LONG_NAME_MAX_ENTRIES || (entries[i].longName & 1) != 0 || entries[i].longName > header->poolSize ||
+			(uint64_t)entries[i].longNameEntries * LONG_NAME_CHARS_PER_ENTRY * sizeof(uint16_t) > header->poolSize - entries[i].longName ||
+			entries[i].firstExtent > header->extentCount || entries[i].extentCount > header->extentCount - entries[i].firstExtent)
+		{
+			return false;
+		}
+
+		// entries are in listing order, so an entry is at most one level below the one before it, the first entry of a directory
+		if (entries[i].depth > ((i == 0) ? 0 : entries[i - 1].depth + 1))
+		{
+			return false;
+		}
+	}
+
+	slots = (const uint32_t *)(index->map + header->slotsOffset);
+	for (uint64_t i = 0; i < header->slotCount; i++)
+	{
+		if (slots[i] > header->entryCount)
+		{
+			return false;
+		}
+	}
+
+	return header->bodyChecksum == checksumIndexBody(header, entries, (const struct Extent *)(index->map + header->extentsOffset), slots,
+													 (const char *)(index->map + header->poolOffset));
+}
+
+/**
+ * indexExtentsFit
+ *
+ * Makes sure every file's extents in a sidecar whose layout fits start on a cluster in the data region, end inside the image and cover no more than the file
+ * @param const struct VolumeIndex* index - sidecar with map, size and header set
+ * @returns bool - true if every extent can be read from this image
+ */
+bool indexExtentsFit(const struct VolumeIndex *index)
+{
+	const struct IndexHeader *header = index->header;
+	const struct IndexEntry *entries = (const struct IndexEntry *)(index->map + header->entriesOffset);
+	const struct Extent *extents = (const struct Extent *)(index->map + header->extentsOffset);
+	off_t dataStart = clusterOffset(2);
+	off_t dataEnd = clusterOffset(dataClusterCount() + 2);
+
+	if (volume->imageSize > 0 && volume->imageSize < dataEnd)
+	{
+		dataEnd = volume->imageSize;
+	}
+
+	for (uint64_t i = 0; i < header->entryCount; i++)
+	{
+		uint64_t covered = 0;
+
+		for (uint32_t j = 0; j < entries[i].extentCount; j++)
+		{
+			const struct Extent *extent = &extents[entries[i].firstExtent + j];
+
+			if (extent->offset < dataStart || extent->offset > dataEnd || (extent->offset - dataStart) % volume->bytesPerCluster != 0 ||
+				extent->length > (uint64_t)(dataEnd - extent->offset))
+			{
+				return false;
+			}
+
+			// only the last extent can end part way through a cluster
+			if (j + 1 < entries[i].extentCount && extent->length % volume->bytesPerCluster != 0)
+			{
+				return false;
+			}
+			covered += extent->length;
+		}
+
+		// a chain that ended early covers less than the file, but never more
+		if (covered > entries[i].entry.dir_file_size)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * checksumIndexBody
+ *
+ * Hashes the sections of a sidecar after its header, the padding in front of the pool is left out
+ * @param const struct IndexHeader* header - header giving the size of every section
+ * @param const struct IndexEntry* entries - entry section
+ * @param const struct Extent* extents - extent section
+ * @param const uint32_t* slots - hash table section
+ * @param const char* pool - pool section
+ * @returns uint64_t - checksum of the body
+ */
+uint64_t checksumIndexBody(const struct IndexHeader *header, const struct IndexEntry *entries, const struct Extent *extents, const uint32_t *slots, const char *pool)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	hash = checksumIndexBytes(hash, entries, header->entryCount * sizeof(struct IndexEntry));
+	hash = checksumIndexBytes(hash, extents, header->extentCount * sizeof(struct Extent));
+	hash = checksumIndexBytes(hash, slots, header->slotCount * sizeof(uint32_t));
+	return checksumIndexBytes(hash, pool, header->poolSize);
+}
+
+/**
+ * checksumIndexBytes
+ *
+ * Adds a run of bytes to an FNV-1a hash 8 bytes at a time, the index can be far too large to hash byte by byte
+ * @param uint64_t hash - hash so far
+ * @param const void* data - bytes to add, NULL when length is 0
+ * @param size_t length - number of bytes
+ * @returns uint64_t - the updated hash
+ */
+uint64_t checksumIndexBytes(uint64_t hash, const void *data, size_t length)
+{
+	const uint8_t *bytes = data;
+	size_t i = 0;
+	uint64_t word;
+
+	for (; i + 8 <= length; i += 8)
+	{
+		memcpy(&word, bytes + i, sizeof(word));
+		hash = (hash ^ word) * 0x100000001b3ULL;
+	}
+	for (; i < length; i++)
+	{
+		hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * indexSectionFits
+ *
+ * Checks that a section of a sidecar lies inside the file without overflowing
+ * @param uint64_t offset - byte offset of the section
+ * @param uint64_t count - number of items in the section
+ * @param size_t itemSize - size of one item
+ * @param size_t fileSize - size of the sidecar
+ * @returns bool - true if the section fits
+ */
+bool indexSectionFits(uint64_t offset, uint64_t count, size_t itemSize, size_t fileSize)
+{
+	return offset <= fileSize && count <= (fileSize - offset) / itemSize;
+}
+
+/**
+ * closeIndex
+ *
+ * Unmaps the index sidecar if one is mapped
+ * @returns void - NA
+ */
+void closeIndex(void)
+{
+	if (volume->volumeIndex.map != NULL)
+	{
+		munmap((void *)volume->volumeIndex.map, volume->volumeIndex.size);
+	}
+
+	memset(&volume->volumeIndex, 0, sizeof(volume->volumeIndex));
+}
+
+/**
+ * listIndex
+ *
+ * Prints every entry of the index in the format list was asked for, producing the same output a walk of the directories would
+ * @returns void - NA
+ */
+void listIndex(void)
+{
+	struct TextBuffer out = {0};
+	struct TextBuffer path = {0};
+	struct DecodedEntry decoded;
+	int kind;
+
+	out.sink = volume->out;
+
+	for (uint64_t i = 0; i < volume->volumeIndex.header->entryCount; i++)
+	{
+		const struct IndexEntry *indexed = &volume->volumeIndex.entries[i];
+
+		kind = decodeIndexEntry(indexed, &decoded);
+
+		// the appenders only read the path, so it can point straight into the pool
+		path.data = (char *)volume->volumeIndex.pool + indexed->dirPath;
+		path.length = indexed->dirPathLength;
+
+		appendListEntry(&out, &path, &decoded, kind, indexed->depth);
+	}
+
+	flushText(&out);
+	free(out.data);
+}
+
+/**
+ * decodeIndexEntry
+ *
+ * Turns an index entry back into the decoded entry a directory walk would have produced
+ * @param const struct IndexEntry* indexed - entry in the mapped index
+ * @param struct DecodedEntry* decoded - filled in, its pointers point into the index
+ * @returns int - ENTRY_DIRECTORY or ENTRY_FILE
+ */
+int decodeIndexEntry(const struct IndexEntry *indexed, struct DecodedEntry *decoded)
+{
+	decodeShortName(&indexed->entry, decoded);
+
+	decoded->longName = (indexed->longNameEntries > 0) ? (const uint16_t *)(volume->volumeIndex.pool + indexed->longName) : NULL;
+	decoded->longNameEntries = indexed->longNameEntries;
+
+	return ((indexed->entry.dir_attr & ATTR_DIRECTORY) == ATTR_DIRECTORY) ? ENTRY_DIRECTORY : ENTRY_FILE;
+}
+
+/**
+ * findIndexEntry
+ *
+ * Looks a path up in the index's hash table, empty components are dropped so it matches the way resolvePath splits paths
+ * @param const char* path - path made of short names separated by /
+ * @returns const struct IndexEntry* - matching entry, NULL if there is none
+ */
+const struct IndexEntry *findIndexEntry(const char *path)
+{
+	struct TextBuffer key = {0};
+	const struct IndexEntry *found = NULL;
+	const char *component = path;
+	size_t length;
+	size_t slot;
+
+	// rebuild the path with exactly one / between components
+	while (*component != '\0')
+	{
+		length = strcspn(component, "/");
+		if (length > 0)
+		{
+			if (key.length > 0)
+			{
+				appendBytes(&key, "/", 1);
+			}
+			appendBytes(&key, component, length);
+		}
+		component += length + (component[length] == '/');
+	}
+
+	slot = hashBytes(key.data, key.length) & (volume->volumeIndex.header->slotCount - 1);
+	while (key.length > 0 && volume->volumeIndex.slots[slot] != 0)
+	{
+		const struct IndexEntry *indexed = &volume->volumeIndex.entries[volume->volumeIndex.slots[slot] - 1];
+
+		if (indexed->keyLength == key.length && memcmp(volume->volumeIndex.pool + indexed->key, key.data, key.length) == 0)
+		{
+			found = indexed;
+			break;
+		}
+
+		slot = (slot + 1) & (volume->volumeIndex.header->slotCount - 1);
+	}
+
+	free(key.data);
+	return found;
+}
+
+/**
+ * checksumFat
+ *
+ * FNV-1a hash of every entry in the first FAT
+ * @returns uint64_t - checksum of the FAT
+ */
+uint64_t checksumFat(void)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	uint32_t *scratch = NULL;
+
+	for (uint32_t i = 0; i < volume->fatCachePageCount; i++)
+	{
+		const uint32_t *page = peekFatPage(i, &scratch);
+		uint32_t count = volume->fatCacheEntryCount - (i * volume->fatCacheEntriesPerPage);
+
+		if (count > volume->fatCacheEntriesPerPage)
+		{
+			count = volume->fatCacheEntriesPerPage;
+		}
+
+		// a whole entry at a time, the FAT is far too large to hash byte by byte
+		for (uint32_t j = 0; j < count; j++)
+		{
+			hash = (hash ^ page[j]) * 0x100000001b3ULL;
+		}
+	}
+
+	free(scratch);
+	return hash;
+}
+
+/**
+ * hashBytes
+ *
+ * FNV-1a hash of a run of bytes
+ * @param const char* data - bytes to hash
+ * @param size_t length - number of bytes
+ * @returns uint64_t - hash of the bytes
+ */
+uint64_t hashBytes(const char *data, size_t length)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * initHasher
+ *
+ * Starts a digest with nothing fed to it yet
+ * @param struct Hasher* hasher - hasher to set up
+ * @param enum HashAlgorithm algorithm - HASH_SHA256 or HASH_XXH64
+ * @returns void - NA
+ */
+void initHasher(struct Hasher *hasher, enum HashAlgorithm algorithm)
+{
+	static const uint32_t sha256Start[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+	pthread_once(&hashKernelsOnce, pickHashKernels);
+
+	memset(hasher, 0, sizeof(struct Hasher));
+	hasher->algorithm = algorithm;
+	memcpy(hasher->sha256, sha256Start, sizeof(sha256Start));
+
+	// the seed is 0, so the lanes start from the primes alone
+	hasher->xxh64[0] = XXH64_PRIME_1 + XXH64_PRIME_2;
+	hasher->xxh64[1] = XXH64_PRIME_2;
+	hasher->xxh64[2] = 0;
+	hasher->xxh64[3] = -XXH64_PRIME_1;
+}
+
+/**
+ * updateHasher
+ *
+ * Feeds the next bytes of the data to a digest, whole blocks are hashed straight from data without being copied
+ * @param struct Hasher* hasher - digest to feed
+ * @param const void* data - next bytes
+ * @param size_t length - number of bytes
+ * @returns void - NA
+ */
+void updateHasher(struct Hasher *hasher, const void *data, size_t length)
+{
+	const uint8_t *bytes = data;
+	size_t blockSize = (hasher->algorithm == HASH_SHA256) ? 64 : 32;
+	size_t take;
+
+	hasher->length += length;
+
+	// finish off a block left over from the last call
+	if (hasher->pendingLength > 0)
+	{
+		take = blockSize - hasher->pendingLength;
+		if (take > length)
+		{
+			take = length;
+		}
+
+		memcpy(hasher->pending + hasher->pendingLength, bytes, take);
+		hasher->pendingLength += take;
+		bytes += take;
+		length -= take;
+
+		if (hasher->pendingLength < blockSize)
+		{
+			return;
+		}
+
+		hashBlocks(hasher, hasher->pending, 1);
+		hasher->pendingLength = 0;
+	}
+
+	hashBlocks(hasher, bytes, length / blockSize);
+	bytes += length - (length % blockSize);
+
+	memcpy(hasher->pending, bytes, length % blockSize);
+	hasher->pendingLength = length % blockSize;
+}
+
+/**
+ * hashBlocks
+ *
+ * Runs whole blocks through the kernel of a digest's algorithm
+ * @param struct Hasher* hasher - digest to update
+ * @param const uint8_t* data - first block
+ * @param size_t blockCount - number of 64 byte SHA-256 blocks or 32 byte xxHash64 stripes
+ * @returns void - NA
+ */
+void hashBlocks(struct Hasher *hasher, const uint8_t *data, size_t blockCount)
+{
+	if (blockCount == 0)
+	{
+		return;
+	}
+
+	if (hasher->algorithm == HASH_SHA256)
+	{
+		sha256Blocks(hasher->sha256, data, blockCount);
+	}
+	else
+	{
+		xxh64Stripes(hasher->xxh64, data, blockCount);
+	}
+}
+
+/**
+ * finishHasher
+ *
+ * Pads out a copy of a digest and writes the result in hex, the hasher itself is left as it was
+ * @param const struct Hasher* hasher - digest of everything fed so far
+ * @param char* hex - HASH_HEX_SIZE bytes for the digest, SHA-256 in byte order and xxHash64 as one big endian number like xxhsum prints it
+ * @returns void - NA
+ */
+void finishHasher(const struct Hasher *hasher, char *hex)
+{
+	struct Hasher done = *hasher;
+	uint64_t hash;
+	size_t i = 0;
+
+	if (done.algorithm == HASH_SHA256)
+	{
+		// a 1 bit, zeros up to 8 bytes short of a block, then the length in bits
+		done.pending[done.pendingLength++] = 0x80;
+		if (done.pendingLength > 56)
+		{
+			memset(done.pending + done.pendingLength, 0, 64 - done.pendingLength);
+			sha256Blocks(done.sha256, done.pending, 1);
+			done.pendingLength = 0;
+		}
+		memset(done.pending + done.pendingLength, 0, 56 - done.pendingLength);
+		for (int byte = 0; byte < 8; byte++)
+		{
+			done.pending[56 + byte] = (uint8_t)((done.length * 8) >> (56 - (byte * 8)));
+		}
+		sha256Blocks(done.sha256, done.pending, 1);
+
+		for (int word = 0; word < 8; word++)
+		{
+			snprintf(hex + (word * 8), 9, "%08" PRIx32, done.sha256[word]);
+		}
+		return;
+	}
+
+	if (done.length >= 32)
+	{
+		hash = rotateLeft64(done.xxh64[0], 1) + rotateLeft64(done.xxh64[1], 7) + rotateLeft64(done.xxh64[2], 12) + rotateLeft64(done.xxh64[3], 18);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			hash = ((hash ^ xxh64Round(0, done.xxh64[lane])) * XXH64_PRIME_1) + XXH64_PRIME_4;
+		}
+	}
+	else
+	{
+		hash = XXH64_PRIME_5;
+	}
+	hash += done.length;
+
+	// the tail that did not fill a stripe, 8 bytes, then 4, then one at a time
+	for (; i + 8 <= done.pendingLength; i += 8)
+	{
+		uint64_t word;
+
+		memcpy(&word, done.pending + i, 8);
+		hash = (rotateLeft64(hash ^ xxh64Round(0, word), 27) * XXH64_PRIME_1) + XXH64_PRIME_4;
+	}
+	if (i + 4 <= done.pendingLength)
+	{
+		uint32_t word;
+
+		memcpy(&word, done.pending + i, 4);
+		hash = (rotateLeft64(hash ^ (word * XXH64_PRIME_1), 23) * XXH64_PRIME_2) + XXH64_PRIME_3;
+		i += 4;
+	}
+	for (; i < done.pendingLength; i++)
+	{
+		hash = rotateLeft64(hash ^ (done.pending[i] * XXH64_PRIME_5), 11) * XXH64_PRIME_1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= XXH64_PRIME_2;
+	hash ^= hash >> 29;
+	hash *= XXH64_PRIME_3;
+	hash ^= hash >> 32;
+
+	snprintf(hex, HASH_HEX_SIZE, "%016" PRIx64, hash);
 }
 
 /**
- * readCluster
+ * pickHashKernels
  *
- * Reads a given cluster and prints out all files and directories inside it (including long names), if it encounters a subdirectory it recursively calls itself
- * @param uint32_t clusterNum - The cluster number in data region to read from
- * @param int depth - What level of directory we are at (starts at 0), used for printings dashes and for excluding . and .. entries
+ * Chooses the fastest SHA-256 kernel the CPU runs, called once through hashKernelsOnce
  * @returns void - NA
  */
-void readCluster(uint32_t clusterNum, int depth)
+void pickHashKernels(void)
 {
-	unsigned char *entryName; // name of the directory that we will print
-	char *givenName;		  // non extension part of name
-	char *nameExtension;	  // extension part of name
-	uint32_t newCluster;
-	struct DirInfo currentDir;
+	sha256Blocks = sha256BlocksScalar;
 
-	// variables related to long names
-	struct LongNameDirInfo currentLongDir;
-	bool longNameStarted = false;	// boolean that stores whether this is first long name in chain
-	uint16_t *totalLongName = NULL; // memory that will hold long name
-	int charsAdded;					// number of chars added to long name memory so far
-	int numLongNameEntries;			// number of long name entries read in so far
-	unsigned char checkSum;			// verification checksum variable
-	uint8_t previousNameOrder;		// verify ordering
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
 
-	// allocate space
-	entryName = malloc(12 * sizeof(char));
-	givenName = malloc(9 * sizeof(char));
-	nameExtension = malloc(4 * sizeof(char));
-
-	// loop through all entries in the cluster
-	for (int i = 0; i < entriesPerCluster; i++)
+	// the SHA extensions are bit 29 of ebx in leaf 7, the kernel also uses SSE4.1 which every CPU with them has
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & (1U << 29)) != 0)
 	{
-		// lseek to the beginning of the next entry
-		// clusterNum - 2 because the first 2 slots of the FAT table (slots 0 and 1) are occupied by something else and thus do not count
-		lseek(fd, (dataSectorLocationInSectors * bootSector.BPB_BytesPerSec) + ((clusterNum - 2) * bytesPerCluster) + (i * sizeof(struct DirInfo)), SEEK_SET);
-
-		// read in the next entry
-		read(fd, &currentDir, sizeof(struct DirInfo));
+		sha256Blocks = sha256BlocksShaNi;
+	}
+#endif
+}
 
-		// read in the name
-		memcpy(entryName, currentDir.dir_name, 11);
-		entryName[11] = '\0';
+/**
+ * sha256BlocksScalar
+ *
+ * Runs 64 byte blocks through the SHA-256 compression function one round at a time, used on CPUs without SHA instructions
+ * @param uint32_t* state - the 8 chaining words
+ * @param const uint8_t* data - first block
+ * @param size_t blockCount - number of blocks
+ * @returns void - NA
+ */
+void sha256BlocksScalar(uint32_t *state, const uint8_t *data, size_t blockCount)
+{
+	uint32_t w[64];
+	uint32_t v[8];
 
-		// check to see whether we are at the end
-		if ((uint8_t)entryName[0] == 0x00)
+	for (; blockCount > 0; blockCount--, data += 64)
+	{
+		for (int i = 0; i < 16; i++)
 		{
-			// if it is then there is nothing else for us to read so we just end the loop
-			break;
+			w[i] = ((uint32_t)data[i * 4] << 24) | ((uint32_t)data[(i * 4) + 1] << 16) | ((uint32_t)data[(i * 4) + 2] << 8) | data[(i * 4) + 3];
 		}
-		// make sure we are not looking at dot or dotdot entries and file has not been deleted
-		else if ((i > 1 || depth == 0) && (uint8_t)entryName[0] != 0xE5)
+		for (int i = 16; i < 64; i++)
 		{
-			// seperate name into extension and given name
-			memcpy(givenName, &entryName[0], 8);
-			givenName[8] = '\0';
+			uint32_t s0 = rotateRight32(w[i - 15], 7) ^ rotateRight32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			uint32_t s1 = rotateRight32(w[i - 2], 17) ^ rotateRight32(w[i - 2], 19) ^ (w[i - 2] >> 10);
 
-			memcpy(nameExtension, &entryName[8], 3);
-			nameExtension[3] = '\0';
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
 
-			// get rid of blanks from normal name
-			givenName = removeTrailingSpace(givenName);
+		memcpy(v, state, sizeof(v));
+		for (int i = 0; i < 64; i++)
+		{
+			uint32_t s1 = rotateRight32(v[4], 6) ^ rotateRight32(v[4], 11) ^ rotateRight32(v[4], 25);
+			uint32_t choose = (v[4] & v[5]) ^ (~v[4] & v[6]);
+			uint32_t t1 = v[7] + s1 + choose + sha256Constants[i] + w[i];
+			uint32_t s0 = rotateRight32(v[0], 2) ^ rotateRight32(v[0], 13) ^ rotateRight32(v[0], 22);
+			uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
 
-			// check to see if it is a directory
-			if (((currentDir.dir_attr & (ATTR_LONG_NAME_MASK)) != (ATTR_LONG_NAME)) && ((currentDir.dir_attr & (ATTR_DIRECTORY)) == (ATTR_DIRECTORY)) && ((currentDir.dir_attr & (ATTR_HIDDEN)) != (ATTR_HIDDEN)) && ((currentDir.dir_attr & (ATTR_SYSTEM)) != (ATTR_SYSTEM)) && ((currentDir.dir_attr & (ATTR_VOLUME_ID)) != (ATTR_VOLUME_ID)))
-			{
+			memmove(v + 1, v, 7 * sizeof(uint32_t));
+			v[4] += t1;
+			v[0] = t1 + s0 + majority;
+		}
 
-				// print a set number of dashes depending on the depth
-				for (int j = 0; j < depth; j++)
-				{
-					printf("-");
-				}
+		for (int i = 0; i < 8; i++)
+		{
+			state[i] += v[i];
+		}
+	}
+}
 
-				// check to see if it is long name and check sum matches then print long name
-				if (longNameStarted && checkSum == ChkSum(entryName))
-				{
-					// print long name
-
-					// some obscure code I found online for printing unicode
-					setlocale(LC_ALL, "");
-					printf("Long Name Directory: ");
-
-					// loops through all long name characters in reverse order (for structs) and forward order (within structs)
-					for (int i = (numLongNameEntries - 1); i >= 0; i--)
-					{
-						for (int j = 0; j < 13; j++)
-						{
-							// verifies that we are not printing padding or null characters
-							int unicodeIndex = (i * 13) + j;
-							if (totalLongName[unicodeIndex] != 0x0000 && totalLongName[unicodeIndex] != 0xFFFF)
-							{
-								printf("%lc", (wint_t)totalLongName[unicodeIndex]);
-							}
-						}
-					}
-					printf("\n");
-
-					// print short name
-
-					// print a set number of dashes depending on the depth
-					for (int j = 0; j < depth; j++)
-					{
-						printf("-");
-					}
-
-					printf("Short Name Directory: %s\n", givenName);
-
-					// free all resources
-					longNameStarted = false;
-					free(totalLongName);
-					totalLongName = NULL;
-				}
-				// otherwise if it just says long name started then free resources and print normal name
-				else if (longNameStarted)
-				{
-					printf("Directory: %s\n", givenName);
-					// free all resources
-					longNameStarted = false;
-					free(totalLongName);
-					totalLongName = NULL;
-				}
-				// if no long name then just print short name
-				else
-				{
-					printf("Directory: %s\n", givenName);
-				}
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * sha256BlocksShaNi
+ *
+ * Runs 64 byte blocks through SHA-256 with the SHA extensions, each sha256rnds2 does 2 rounds and sha256msg1/msg2 expand the message 4 words at a time
+ * @param uint32_t* state - the 8 chaining words
+ * @param const uint8_t* data - first block
+ * @param size_t blockCount - number of blocks
+ * @returns void - NA
+ */
+__attribute__((target("sha,sse4.1"))) void sha256BlocksShaNi(uint32_t *state, const uint8_t *data, size_t blockCount)
+{
+	const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i abef;
+	__m128i cdgh;
+	__m128i savedAbef;
+	__m128i savedCdgh;
+	__m128i words[4]; // the last 16 message words, 4 to a register
+	__m128i message;
+	__m128i swap;
 
-				// make a new variable storing location of new directory
-				uint32_t newDirectoryCluster = 0;
+	// the instructions want the state as ABEF and CDGH rather than ABCD and EFGH
+	swap = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+	abef = _mm_alignr_epi8(swap, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, swap, 0xF0);
 
-				// combine the bits
-				newDirectoryCluster = ((uint32_t)currentDir.dir_first_cluster_hi << 16) | currentDir.dir_first_cluster_lo;
-				newDirectoryCluster = newDirectoryCluster & MASK_FIRST_HEX;
+	for (; blockCount > 0; blockCount--, data += 64)
+	{
+		savedAbef = abef;
+		savedCdgh = cdgh;
 
-				// read sub directory
-				readCluster(newDirectoryCluster, depth + 1);
-			}
-			// check to see if it is a visible file and not a long name entry
-			else if (((currentDir.dir_attr & (ATTR_LONG_NAME_MASK)) != (ATTR_LONG_NAME)) && ((currentDir.dir_attr & (ATTR_DIRECTORY)) != (ATTR_DIRECTORY)) && ((currentDir.dir_attr & (ATTR_HIDDEN)) != (ATTR_HIDDEN)) && ((currentDir.dir_attr & (ATTR_SYSTEM)) != (ATTR_SYSTEM)) && ((currentDir.dir_attr & (ATTR_VOLUME_ID)) != (ATTR_VOLUME_ID)))
+		for (int i = 0; i < 16; i++)
+		{
+			if (i < 4)
 			{
-				// print a set number of dashes depending on the depth
-				for (int j = 0; j < depth; j++)
-				{
-					printf("-");
-				}
-
-				// get rid of white space
-				nameExtension = removeTrailingSpace(nameExtension);
-
-				// check to see if it is long name then print name
-				if (longNameStarted && checkSum == ChkSum(entryName))
-				{
-					// print long name
-
-					// obscure code for printing unicode
-					setlocale(LC_ALL, "");
-					printf("Long Name File: ");
-
-					// loops through all long name characters in reverse order (for structs) and forward order (within structs)
-					for (int i = (numLongNameEntries - 1); i >= 0; i--)
-					{
-						for (int j = 0; j < 13; j++)
-						{
-							// verifies that we are not printing padding or null characters
-							int unicodeIndex = (i * 13) + j;
-							if (totalLongName[unicodeIndex] != 0x0000 && totalLongName[unicodeIndex] != 0xFFFF)
-							{
-								printf("%lc", (wint_t)totalLongName[unicodeIndex]);
-							}
-						}
-					}
-					printf("\n");
-
-					// print a set number of dashes depending on the depth
-					for (int j = 0; j < depth; j++)
-					{
-						printf("-");
-					}
-
-					// avoid printing . if it is only whitespace
-					if (strlen(nameExtension) == 1 && nameExtension[0] == ' ')
-					{
-						printf("Short Name File: %s\n", givenName);
-					}
-					else
-					{
-						printf("Short Name File: %s.%s\n", givenName, nameExtension);
-					}
-
-					// free all resources
-					longNameStarted = false;
-					free(totalLongName);
-					totalLongName = NULL;
-				}
-				// otherwise if it just says long name started then free resources and print normal name
-				else if (longNameStarted)
-				{
-					// avoid printing . if it is only whitespace
-					if (strlen(nameExtension) == 1 && nameExtension[0] == ' ')
-					{
-						printf("Short Name File: %s\n", givenName);
-					}
-					else
-					{
-						printf("Short Name File: %s.%s\n", givenName, nameExtension);
-					}
-
-					// free all resources
-					longNameStarted = false;
-					free(totalLongName);
-					totalLongName = NULL;
-				}
-				// if no long name then just print short name
-				else
-				{
-					// avoid printing . if it is only whitespace
-					if (strlen(nameExtension) == 1 && nameExtension[0] == ' ')
-					{
-						printf("Short Name File: %s\n", givenName);
-					}
-					else
-					{
-						printf("Short Name File: %s.%s\n", givenName, nameExtension);
-					}
-				}
+				words[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + (i * 16))), byteSwap);
 			}
-			// check to see if it is a first entry long name
-			else if (((currentDir.dir_attr & (ATTR_LONG_NAME_MASK)) == (ATTR_LONG_NAME)) && !longNameStarted)
+			else
 			{
-				// read the long name into a new struct for long names
-				lseek(fd, (dataSectorLocationInSectors * bootSector.BPB_BytesPerSec) + ((clusterNum - 2) * bytesPerCluster) + (i * sizeof(struct LongNameDirInfo)), SEEK_SET);
-				read(fd, &currentLongDir, sizeof(struct LongNameDirInfo));
-
-				// verify that it is the last entry, otherwise don't do anything
-				if ((currentLongDir.LDIR_Ord & LAST_LONG_ENTRY) == (LAST_LONG_ENTRY) && currentLongDir.LDIR_Type == 0)
-				{
-					// indicate that we started reading a long name
-					longNameStarted = true;
-					// allocate enough memory to store the entire long name
-					totalLongName = malloc(260 * sizeof(uint16_t));
-					// record how many chars we have written in so far
-					charsAdded = 0;
-					// count first entry
-					numLongNameEntries = 1;
-
-					// read in first 5 characters
-					memcpy(totalLongName + (charsAdded), currentLongDir.LDIR_Name1, 10);
-					charsAdded += 5;
-
-					// read in next 6 characters
-					memcpy(totalLongName + (charsAdded), currentLongDir.LDIR_Name2, 12);
-					charsAdded += 6;
-
-					// read in last 2 characters
-					memcpy(totalLongName + (charsAdded), currentLongDir.LDIR_Name3, 4);
-					charsAdded += 2;
-
-					// store verification info
-					checkSum = currentLongDir.LDIR_Chksum;
-					previousNameOrder = currentLongDir.LDIR_Ord;
-				}
+				// W[t] from W[t-16] and W[t-15], then W[t-7], then W[t-2]
+				message = _mm_sha256msg1_epu32(words[i & 3], words[(i + 1) & 3]);
+				message = _mm_add_epi32(message, _mm_alignr_epi8(words[(i + 3) & 3], words[(i + 2) & 3], 4));
+				words[i & 3] = _mm_sha256msg2_epu32(message, words[(i + 3) & 3]);
 			}
-			// check to see if it is a second+ entry long name
-			else if (((currentDir.dir_attr & (ATTR_LONG_NAME_MASK)) == (ATTR_LONG_NAME)) && longNameStarted)
-			{
-				// read the long name into a new struct for long names
-				lseek(fd, (dataSectorLocationInSectors * bootSector.BPB_BytesPerSec) + ((clusterNum - 2) * bytesPerCluster) + (i * sizeof(struct LongNameDirInfo)), SEEK_SET);
-				read(fd, &currentLongDir, sizeof(struct LongNameDirInfo));
 
-				// verify new entry is valid
-				if (checkSum == currentLongDir.LDIR_Chksum && currentLongDir.LDIR_Ord < previousNameOrder && currentLongDir.LDIR_Type == 0)
-				{
-					// update info
-					previousNameOrder = currentLongDir.LDIR_Ord;
+			message = _mm_add_epi32(words[i & 3], _mm_loadu_si128((const __m128i *)&sha256Constants[i * 4]));
+			cdgh = _mm_sha256rnds2_epu32(cdgh, abef, message);
+			abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(message, 0x0E));
+		}
 
-					// count this entry
-					numLongNameEntries++;
+		abef = _mm_add_epi32(abef, savedAbef);
+		cdgh = _mm_add_epi32(cdgh, savedCdgh);
+	}
 
-					// add more to the array
-					// read in first 5 characters
-					memcpy(totalLongName + (charsAdded), currentLongDir.LDIR_Name1, 10);
-					charsAdded += 5;
+	swap = _mm_shuffle_epi32(abef, 0x1B);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+	_mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(swap, cdgh, 0xF0));
+	_mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(cdgh, swap, 8));
+}
+#endif
 
-					// read in next 6 characters
-					memcpy(totalLongName + (charsAdded), currentLongDir.LDIR_Name2, 12);
-					charsAdded += 6;
+/**
+ * xxh64Stripes
+ *
+ * Runs 32 byte stripes through the 4 xxHash64 lanes, the lanes do not depend on each other so the CPU overlaps their multiplies
+ * @param uint64_t* lanes - the 4 lane accumulators
+ * @param const uint8_t* data - first stripe
+ * @param size_t stripeCount - number of stripes
+ * @returns void - NA
+ */
+void xxh64Stripes(uint64_t *lanes, const uint8_t *data, size_t stripeCount)
+{
+	uint64_t words[4];
 
-					// read in last 2 characters
-					memcpy(totalLongName + (charsAdded), currentLongDir.LDIR_Name3, 4);
-					charsAdded += 2;
-				}
-				// otherwise discard all of it
-				else
-				{
-					longNameStarted = false;
-					free(totalLongName);
-					totalLongName = NULL;
-				}
-			}
-			// otherwise we just have an orphan and we deallocate all memory
-			else if (longNameStarted)
-			{
-				longNameStarted = false;
-				free(totalLongName);
-				totalLongName = NULL;
-			}
+	for (; stripeCount > 0; stripeCount--, data += 32)
+	{
+		memcpy(words, data, sizeof(words));
+		for (int lane = 0; lane < 4; lane++)
+		{
+			lanes[lane] = xxh64Round(lanes[lane], words[lane]);
 		}
 	}
+}
+
+/**
+ * xxh64Round
+ *
+ * Mixes one 8 byte word into an xxHash64 accumulator
+ * @param uint64_t accumulator - lane or hash so far
+ * @param uint64_t input - little endian word
+ * @returns uint64_t - the new accumulator
+ */
+uint64_t xxh64Round(uint64_t accumulator, uint64_t input)
+{
+	return rotateLeft64(accumulator + (input * XXH64_PRIME_2), 31) * XXH64_PRIME_1;
+}
+
+/**
+ * rotateLeft64
+ *
+ * Rotates a 64 bit value left, compilers turn this into a single instruction
+ * @param uint64_t value - value to rotate
+ * @param int bits - 1 to 63
+ * @returns uint64_t - rotated value
+ */
+uint64_t rotateLeft64(uint64_t value, int bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+/**
+ * rotateRight32
+ *
+ * Rotates a 32 bit value right, compilers turn this into a single instruction
+ * @param uint32_t value - value to rotate
+ * @param int bits - 1 to 31
+ * @returns uint32_t - rotated value
+ */
+uint32_t rotateRight32(uint32_t value, int bits)
+{
+	return (value >> bits) | (value << (32 - bits));
+}
+
+/**
+ * appendHashLine
+ *
+ * Prints one line of a hash manifest, the digest, size and path for text and a JSON object for ndjson
+ * @param struct TextBuffer* buffer - buffer to add to
+ * @param const char* path - path of the file in the image
+ * @param const struct Hasher* hasher - digest of every byte of the file that was read
+ * @returns void - NA
+ */
+void appendHashLine(struct TextBuffer *buffer, const char *path, const struct Hasher *hasher)
+{
+	static const char *algorithmNames[] = {"none", "sha256", "xxh64"};
+	char hex[HASH_HEX_SIZE];
+
+	finishHasher(hasher, hex);
+
+	if (options.listFormat == LIST_FORMAT_NDJSON)
+	{
+		appendString(buffer, "{\"path\":\"");
+		appendJsonString(buffer, path, strlen(path));
+		appendText(buffer, "\",\"size\":%" PRIu64 ",\"algorithm\":\"%s\",\"digest\":\"%s\"}\n", hasher->length, algorithmNames[hasher->algorithm], hex);
+	}
+	else
+	{
+		// the path goes last so names with spaces in them still split cleanly
+		appendText(buffer, "%s  %" PRIu64 "  %s\n", hex, hasher->length, path);
+	}
+}
+
+/**
+ * copyFile
+ *
+ * Takes where a file lives in the FAT32 image and then copies it to output directory
+ * @param const struct ExtentList* list - extents of the file we want to copy
+ * @param char* givenName - short name for file except extension
+ * @param char* nameExtension - extension for file from short name
+ * @param struct Hasher* hasher - digest to feed the file's bytes as they are written, NULL for none
+ * @returns bool - true if the file was created and fully written
+ */
+bool copyFile(const struct ExtentList *list, char *givenName, char *nameExtension, struct Hasher *hasher)
+{
+	bool success;
+	int outFd;									   // new file descriptor
+	char *destination = malloc(sizeof(char) * 50); // allocate memory to store new file path
 
-	// get next cluster number from fat
-	newCluster = getNextFatValue(clusterNum);
-	// clear top 4 bits
-	newCluster = newCluster & MASK_FIRST_HEX;
+	// assemble destination path
+	strcpy(destination, "output/");
+	strcat(destination, givenName);
+	strcat(destination, ".");
+	strcat(destination, nameExtension);
 
-	// check to see if it references a valid cluster or End of Chain
-	if (newCluster < END_OF_CLUSTER_CHAIN)
+	// create file
+	outFd = open(destination, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (outFd < 0)
 	{
-		readCluster(newCluster, depth);
+		printf("Error, could not create %s.\n", destination);
+		free(destination);
+		return false;
 	}
 
-	// free all memory
-	free(entryName);
-	free(givenName);
-	free(nameExtension);
-	if (totalLongName != NULL)
+	// copy each run of consecutive clusters in one go
+	success = copyExtents(list, outFd, hasher);
+	if (!success)
 	{
-		free(totalLongName);
+		printf("Error, could not write %s.\n", destination);
 	}
+
+	close(outFd);
+
+	free(destination);
+	return success;
 }
 
 /**
- * removeTrailingSpace
+ * buildExtents
  *
- * Takes a string and removes all whitespaces at the end of it, then returns the same string.
- * @param char* string - string to remove whitespaces from
- * @returns char* - string with whitespaces removed
+ * Walks a file's cluster chain and merges runs of consecutive clusters into extents, stopping once the file size is covered or the chain ends
+ * @param uint32_t startingCluster - first cluster of the file
+ * @param uint64_t fileSize - number of bytes in the file
+ * @param struct ExtentList* list - list to append the extents to
+ * @returns uint64_t - number of bytes covered by the extents, less than fileSize if the chain ended early
  */
-char *removeTrailingSpace(char *string)
+uint64_t buildExtents(uint32_t startingCluster, uint64_t fileSize, struct ExtentList *list)
 {
-	char *end;
+	uint64_t bytesLeft = fileSize; // bytes not yet covered by an extent
+	uint64_t clusterBytes;		   // bytes of the file in the current cluster
+	struct Extent *last;
+	struct ChainWalk chain;
 
-	// this variable now points to
-	end = string + strlen(string) - 1;
+	openChainWalk(&chain, (fileSize == 0) ? 0 : startingCluster);
+	startingCluster = chain.clusterNum;
 
-	while (end > string && isspace((unsigned char)*end))
-		end--;
+	// loop until we reach file size, reach the end of the cluster chain, or something goes wrong with our cluster chain
+	while (bytesLeft != 0 && startingCluster < END_OF_CLUSTER_CHAIN)
+	{
+		clusterBytes = (bytesLeft >= (uint64_t)volume->bytesPerCluster) ? (uint64_t)volume->bytesPerCluster : bytesLeft;
+		last = (list->count > 0) ? &list->extents[list->count - 1] : NULL;
 
-	end[1] = '\0';
+		// if this cluster sits right after the last one we just grow the last extent
+		if (last != NULL && last->offset + (off_t)last->length == clusterOffset(startingCluster))
+		{
+			last->length += clusterBytes;
+		}
+		else
+		{
+			if (list->count == list->capacity)
+			{
+				list->capacity = (list->capacity == 0) ? 16 : list->capacity * 2;
+				list->extents = realloc(list->extents, list->capacity * sizeof(struct Extent));
+			}
 
-	return string;
+			list->extents[list->count].offset = clusterOffset(startingCluster);
+			list->extents[list->count].length = clusterBytes;
+			list->count++;
+		}
+
+		bytesLeft -= clusterBytes;
+
+		// get next cluster to copy from, only once more of the file is needed so the end of a healthy chain is never looked at
+		if (bytesLeft != 0)
+		{
+			startingCluster = advanceChainWalk(&chain);
+		}
+	}
+
+	return fileSize - bytesLeft;
 }
 
 /**
- * getNextFatValue
+ * chainCoversFile
  *
- * Takes a FAT cluster number and returns the next fat cluster number in the chain
- * @param uint32_t currentCluster - current FAT cluster number
- * @returns uint32_t - next FAT cluster number in chain
+ * Checks that the extents built for a file cover all of it, saying so on stderr when the chain ended first
+ * @param const char* path - path of the file, for the message
+ * @param uint64_t covered - number of bytes the extents cover
+ * @param uint64_t fileSize - number of bytes in the file
+ * @returns bool - true if the whole file is covered
  */
-uint32_t getNextFatValue(uint32_t currentCluster)
+bool chainCoversFile(const char *path, uint64_t covered, uint64_t fileSize)
 {
-	uint32_t newCluster;
-	lseek(fd, fatSectorStart + ((SIZE_OF_FAT_ENTRY / BITS_PER_BYTE) * currentCluster), SEEK_SET);
-	read(fd, &newCluster, SIZE_OF_FAT_ENTRY / BITS_PER_BYTE);
-	return newCluster;
+	if (covered >= fileSize)
+	{
+		return true;
+	}
+
+	fprintf(stderr, "Error, the cluster chain of %s holds only %" PRIu64 " of its %" PRIu64 " bytes.\n", path, covered, fileSize);
+	return false;
 }
 
 /**
- * fetchFile
+ * freeExtents
  *
- * Takes a file path and attempts to find the file in memory (then call function to copy it to output directory), recursively calling itself to search a new cluster. Returns true if successfully copied.
- * @param uint32_t currentCluster - current cluster being searched
- * @param char* target - path to target file
- * @param int numLeft - number of subdirectories left before finding the file in question
- * @returns NA
+ * Releases the memory held by an extent list
+ * @param struct ExtentList* list - list to release
+ * @returns void - NA
  */
-void fetchFile(uint32_t clusterNum, char *target, int numLeft)
+void freeExtents(struct ExtentList *list)
 {
-	char *entryName;	 // name of the directory that we will print
-	char *givenName;	 // short name except extension
-	char *nameExtension; // extension
-	char *fullName;		 // full name with . added before extension
-	struct DirInfo currentDir;
-	uint32_t newCluster;
-	bool foundTarget = false;
+	free(list->extents);
+	free(list->ends);
+	list->extents = NULL;
+	list->ends = NULL;
+	list->count = 0;
+	list->capacity = 0;
+}
+
+/**
+ * findExtent
+ *
+ * Finds the extent holding a byte of the file with a binary search over where each extent ends. The ends are worked out the first time the list is searched and kept, so every search after that is O(log n) in the number of extents.
+ * @param struct ExtentList* list - extents of the file, must not grow after the first search
+ * @param uint64_t fileOffset - byte offset in the file
+ * @returns size_t - index of the extent holding the byte, list->count if the offset is past the last extent
+ */
+size_t findExtent(struct ExtentList *list, uint64_t fileOffset)
+{
+	size_t low = 0;
+	size_t high = list->count;
 
-	// verify target not null
-	if (target == NULL)
+	if (list->ends == NULL && list->count > 0)
 	{
-		return;
+		list->ends = malloc(list->count * sizeof(uint64_t));
+		list->ends[0] = list->extents[0].length;
+		for (size_t i = 1; i < list->count; i++)
+		{
+			list->ends[i] = list->ends[i - 1] + list->extents[i].length;
+		}
 	}
 
-	// verify target not 0
-	if (strlen(target) == 0)
+	// first extent that ends after the offset
+	while (low < high)
 	{
-		return;
-	}
+		size_t middle = low + ((high - low) / 2);
 
-	// allocate space
-	entryName = malloc(12 * sizeof(char));
-	givenName = malloc(9 * sizeof(char));
-	nameExtension = malloc(4 * sizeof(char));
-	fullName = malloc(13 * sizeof(char));
+		if (list->ends[middle] <= fileOffset)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
 
-	// loop through all entries in the cluster
-	for (int i = 0; i < entriesPerCluster; i++)
-	{
-		// lseek to the beginning of the next entry
-		// clusterNum - 2 because the first 2 slots of the FAT table (slots 0 and 1) are occupied by something else and thus do not count
-		lseek(fd, (dataSectorLocationInSectors * bootSector.BPB_BytesPerSec) + ((clusterNum - 2) * bytesPerCluster) + (i * sizeof(struct DirInfo)), SEEK_SET);
+	return low;
+}
 
-		// read in the next entry
-		read(fd, &currentDir, sizeof(struct DirInfo));
+/**
+ * sliceExtents
+ *
+ * Builds the extents covering a byte range of a file, so a ranged read is copied with the same code as a whole file and nothing before the range is read. The range is cut short at the end of the file.
+ * @param struct ExtentList* list - extents of the whole file
+ * @param uint64_t offset - first byte of the range in the file
+ * @param uint64_t length - number of bytes in the range
+ * @param struct ExtentList* slice - empty list filled in with the range, freed with freeExtents
+ * @returns void - NA
+ */
+void sliceExtents(struct ExtentList *list, uint64_t offset, uint64_t length, struct ExtentList *slice)
+{
+	size_t first = findExtent(list, offset);
+	uint64_t extentStart;
+	uint64_t skip;
 
-		// read in the name
-		memcpy(entryName, currentDir.dir_name, 11);
-		entryName[11] = '\0';
+	for (size_t i = first; i < list->count && length > 0; i++)
+	{
+		extentStart = list->ends[i] - list->extents[i].length;
+		skip = (offset > extentStart) ? offset - extentStart : 0; // only the first extent starts part way in
 
-		// check to see whether we are at the end
-		if ((uint8_t)entryName[0] == 0x00)
+		if (slice->count == slice->capacity)
 		{
-			// if it is then there is nothing else for us to read so we just end the loop
-			break;
+			slice->capacity = (slice->capacity == 0) ? 4 : slice->capacity * 2;
+			slice->extents = realloc(slice->extents, slice->capacity * sizeof(struct Extent));
 		}
-		else if ((uint8_t)entryName[0] != 0xE5)
-		{
 
-			// seperate name into extension and given name
-			memcpy(givenName, &entryName[0], 8);
-			givenName[8] = '\0';
-
-			memcpy(nameExtension, &entryName[8], 3);
-			nameExtension[3] = '\0';
+		slice->extents[slice->count].offset = list->extents[i].offset + (off_t)skip;
+		slice->extents[slice->count].length = (list->extents[i].length - skip < length) ? list->extents[i].length - skip : length;
+		length -= slice->extents[slice->count].length;
+		slice->count++;
+	}
+}
 
-			// get rid of blanks from normal name
-			givenName = removeTrailingSpace(givenName);
+/**
+ * copyExtents
+ *
+ * Copies every extent to a file descriptor in order. The kernel does the copy with copy_file_range or sendfile when it can, otherwise the bytes are written out of the image map or through a large buffer.
+ * A hasher is fed the bytes while they are in memory for the write, so hashing keeps the copy in user space.
+ * @param const struct ExtentList* list - extents to copy
+ * @param int outFd - descriptor to write to, at its current position, -1 to only hash the bytes
+ * @param struct Hasher* hasher - digest to feed every byte written, NULL for none
+ * @returns bool - true if everything was written
+ */
+bool copyExtents(const struct ExtentList *list, int outFd, struct Hasher *hasher)
+{
+	char *buffer = NULL; // only allocated if we end up copying through user space
+	bool success = true;
+	bool direct = volume->directFd >= 0;
+	bool kernelCopy = !direct && hasher == NULL; // the kernel can only move bytes we do not need to see
+	size_t hinted = 1; // first extent the kernel has not been told about, the first one is read straight away
 
-			// check to see if it is a directory and that we are not looking for a file
-			if (numLeft != 0 && ((currentDir.dir_attr & (ATTR_LONG_NAME_MASK)) != (ATTR_LONG_NAME)) && ((currentDir.dir_attr & (ATTR_DIRECTORY)) == (ATTR_DIRECTORY)) && ((currentDir.dir_attr & (ATTR_HIDDEN)) != (ATTR_HIDDEN)) && ((currentDir.dir_attr & (ATTR_SYSTEM)) != (ATTR_SYSTEM)) && ((currentDir.dir_attr & (ATTR_VOLUME_ID)) != (ATTR_VOLUME_ID)))
-			{
-				// combine the bits
-				newCluster = ((uint32_t)currentDir.dir_first_cluster_hi << 16) | currentDir.dir_first_cluster_lo;
-				newCluster = newCluster & MASK_FIRST_HEX;
+	// with io_uring the reads are batched instead of letting the kernel copy, --direct reads have to stay ours
+	if (volume->uringEnabled && volume->directFd < 0)
+	{
+		return copyExtentsBatched(list, outFd, hasher);
+	}
 
-				// check to see whether we found what we were looking for
-				if (strcmp(target, givenName) == 0)
-				{
-					// if we did then we read the subdirectory and keep looking
+	for (size_t i = 0; i < list->count && success; i++)
+	{
+		off_t offset = list->extents[i].offset;
+		uint64_t bytesLeft = list->extents[i].length;
+		ssize_t result;
 
-					// first we get the next target to search for
-					target = strtok(NULL, "/");
+		// the next extents are somewhere else in the image, so readahead of this one will not have started on them
+		if (!direct && i + 1 >= hinted && hinted < list->count)
+		{
+			hinted = prefetchExtents(list, hinted);
+		}
 
-					// recursively call itself to try and find what it is looking for in next subdirectory
-					foundTarget = true;
-					fetchFile(newCluster, target, numLeft - 1);
-					break;
+		// let the kernel move the bytes between the files without them passing through us, it reads through the page cache so not with --direct
+		while (bytesLeft > 0 && copyFileRangeWorks && kernelCopy)
+		{
+			result = copy_file_range(volume->fd, &offset, outFd, NULL, bytesLeft, 0);
+			threadStats.readCalls++;
+			if (result <= 0)
+			{
+				// not supported for this pair of files, so stop trying it and fall through
+				if (result < 0 && errno != EINTR)
+				{
+					copyFileRangeWorks = false;
 				}
+				break;
 			}
-			// make sure not long name and we are looking for a file
-			else if (numLeft == 0 && ((currentDir.dir_attr & (ATTR_LONG_NAME_MASK)) != (ATTR_LONG_NAME)) && ((currentDir.dir_attr & (ATTR_DIRECTORY)) != (ATTR_DIRECTORY)) && ((currentDir.dir_attr & (ATTR_HIDDEN)) != (ATTR_HIDDEN)) && ((currentDir.dir_attr & (ATTR_SYSTEM)) != (ATTR_SYSTEM)) && ((currentDir.dir_attr & (ATTR_VOLUME_ID)) != (ATTR_VOLUME_ID)))
+			bytesLeft -= result;
+			threadStats.bytesRead += result;
+		}
+
+		while (bytesLeft > 0 && sendfileWorks && kernelCopy)
+		{
+			result = sendfile(outFd, volume->fd, &offset, bytesLeft);
+			threadStats.readCalls++;
+			if (result <= 0)
 			{
-				// combine the bits
-				newCluster = ((uint32_t)currentDir.dir_first_cluster_hi << 16) | currentDir.dir_first_cluster_lo;
-				newCluster = newCluster & MASK_FIRST_HEX;
+				if (result < 0 && errno != EINTR)
+				{
+					sendfileWorks = false;
+				}
+				break;
+			}
+			bytesLeft -= result;
+			threadStats.bytesRead += result;
+		}
 
-				// assemble full name
-				strcpy(fullName, "");
-				strcat(fullName, givenName);
-				strcat(fullName, ".");
-				strcat(fullName, nameExtension);
+		// otherwise write straight out of the map, or read through a buffer in large chunks
+		while (bytesLeft > 0)
+		{
+			size_t chunk = (bytesLeft > COPY_BUFFER_SIZE) ? COPY_BUFFER_SIZE : bytesLeft;
+			const void *bytes = direct ? NULL : mapImage(offset, chunk);
 
-				// check to see whether we found what we were looking for
-				if (strcmp(target, fullName) == 0)
+			if (bytes == NULL)
+			{
+				if (buffer == NULL)
 				{
-					// if so, then we are done and this is our file
-					foundFile = true;
-					foundTarget = true;
-					copyFile(&currentDir, newCluster, givenName, nameExtension);
-					break;
+					buffer = allocCopyBuffer();
 				}
+				bytes = readFileBytes(buffer, chunk, offset);
+			}
+			else
+			{
+				threadStats.mappedBytes += chunk;
 			}
-		}
-	}
 
-	// free memory
-	free(entryName);
-	free(givenName);
-	free(nameExtension);
-	free(fullName);
+			result = (outFd >= 0) ? write(outFd, bytes, chunk) : (ssize_t)chunk;
+			if (result <= 0)
+			{
+				success = false;
+				break;
+			}
 
-	// get next cluster number from fat
-	newCluster = getNextFatValue(clusterNum);
-	// clear top 4 bits
-	newCluster = newCluster & MASK_FIRST_HEX;
+			// only what was written, a short write comes round again for the rest
+			if (hasher != NULL)
+			{
+				updateHasher(hasher, bytes, result);
+			}
 
-	// check to see if it references a valid cluster or End of Chain
-	if (foundTarget != true && newCluster < END_OF_CLUSTER_CHAIN)
-	{
-		fetchFile(newCluster, target, numLeft);
+			offset += result;
+			bytesLeft -= result;
+		}
 	}
+
+	free(buffer);
+	return success;
 }
 
 /**
- * copyFile
+ * copyExtentsBatched
  *
- * Takes info about a file in FAT32 image and then copies it to output directory
- * @param struct DirInfo* targetDir - directory entry struct containing info about file we want to copy
- * @param uint32_t startingCluster - cluster to start copying the file bytes from
- * @param char* givenName - short name for file except extension
- * @param char* nameExtension - extension for file from short name
- * @returns void - NA
+ * Copies every extent to a file descriptor in order, reading up to --io-depth pieces of COPY_BUFFER_SIZE at once as one batch and then writing them out
+ * @param const struct ExtentList* list - extents to copy
+ * @param int outFd - descriptor to write to, at its current position, -1 to only hash the bytes
+ * @param struct Hasher* hasher - digest to feed every byte read, NULL for none
+ * @returns bool - true if everything was written
  */
-void copyFile(struct DirInfo *targetDir, uint32_t startingCluster, char *givenName, char *nameExtension)
+bool copyExtentsBatched(const struct ExtentList *list, int outFd, struct Hasher *hasher)
 {
-	uint32_t bytesLeft = targetDir->dir_file_size; // bytes left to copy from file
-	FILE *fptr;									   // new file pointer
-	int *clusterBytes = malloc(bytesPerCluster);   // allocate memory for copying
-	char *destination = malloc(sizeof(char) * 50); // allocate memory to store new file path
-
-	// assemble destination path
-	strcpy(destination, "output/");
-	strcat(destination, givenName);
-	strcat(destination, ".");
-	strcat(destination, nameExtension);
-
-	// create file
-	fptr = fopen(destination, "w");
+	struct ImageRead *reads = calloc(options.ioDepth, sizeof(struct ImageRead));
+	size_t extent = 0;	 // extent being split into pieces
+	uint64_t extentDone = 0; // bytes of that extent already in a batch
+	bool success = true;
+	int batchSize;
 
-	// loop until we reacj file size, reach the end of the cluster chain, or something goes wrong with our cluster chain
-	while (bytesLeft != 0 && startingCluster < EOC && startingCluster != 0)
+	for (int i = 0; i < options.ioDepth; i++)
 	{
-		// lseek to the beginning of where we start reading
-		// clusterNum - 2 because the first 2 slots of the FAT table (slots 0 and 1) are occupied by something else and thus do not count
-		lseek(fd, (dataSectorLocationInSectors * bootSector.BPB_BytesPerSec) + ((startingCluster - 2) * bytesPerCluster), SEEK_SET);
-		read(fd, clusterBytes, bytesPerCluster);
+		reads[i].buffer = malloc(COPY_BUFFER_SIZE);
+	}
 
-		// check to see if we need to copy entire cluster or only part of it
-		if (bytesLeft >= bytesPerCluster)
+	while (extent < list->count && success)
+	{
+		// fill a batch with the next pieces of the file
+		for (batchSize = 0; batchSize < options.ioDepth && extent < list->count; batchSize++)
 		{
-			fwrite(clusterBytes, 1, bytesPerCluster, fptr);
-			bytesLeft = bytesLeft - bytesPerCluster;
+			uint64_t left = list->extents[extent].length - extentDone;
 
-			// get next cluster to copy from
-			startingCluster = getNextFatValue(startingCluster);
-			startingCluster = startingCluster & MASK_FIRST_HEX;
+			reads[batchSize].length = (left > COPY_BUFFER_SIZE) ? COPY_BUFFER_SIZE : left;
+			reads[batchSize].offset = list->extents[extent].offset + extentDone;
+
+			extentDone += reads[batchSize].length;
+			if (extentDone == list->extents[extent].length)
+			{
+				extent++;
+				extentDone = 0;
+			}
 		}
-		else
+
+		readImageBatch(reads, batchSize);
+
+		for (int i = 0; i < batchSize && success; i++)
 		{
-			// copy part of cluster, no need to get fat entry since we are done and loop will end
-			fwrite(clusterBytes, 1, bytesLeft, fptr);
-			bytesLeft = 0;
+			size_t written = 0;
+			ssize_t result;
+
+			// the batch comes back in file order, so each piece can go straight into the digest
+			if (hasher != NULL)
+			{
+				updateHasher(hasher, reads[i].buffer, reads[i].length);
+			}
+
+			while (outFd >= 0 && written < reads[i].length)
+			{
+				result = write(outFd, (char *)reads[i].buffer + written, reads[i].length - written);
+				if (result <= 0)
+				{
+					success = false;
+					break;
+				}
+				written += result;
+			}
 		}
 	}
 
-	fclose(fptr);
+	for (int i = 0; i < options.ioDepth; i++)
+	{
+		free(reads[i].buffer);
+	}
+	free(reads);
 
-	free(clusterBytes);
-	free(destination);
+	return success;
 }
 
 //-----------------------------------------------------------------------------
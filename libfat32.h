@@ -0,0 +1,139 @@
+/**
+ * libfat32.h
+ *
+ * PURPOSE: Lets other programs read FAT32 images through a volume handle, built as libfat32.a and libfat32.so.
+ **/
+
+#ifndef LIBFAT32_H
+#define LIBFAT32_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define FAT32_API __attribute__((visibility("default")))
+
+#define FAT32_NAME_SIZE 781 // 20 long name records of 13 characters in UTF-8, plus the terminator
+
+// an open image, any number of threads can read through one handle at the same time
+typedef struct fat32Volume fat32Volume;
+
+// a directory being read, one thread at a time
+typedef struct fat32Dir fat32Dir;
+
+// an open file, any number of threads can read it at the same time
+typedef struct fat32File fat32File;
+
+// one file or directory
+typedef struct
+{
+	char name[FAT32_NAME_SIZE]; // long name when there is one, otherwise the short name
+	char shortName[13];			// NAME.EXT, or NAME for a directory
+	uint8_t attributes;			// ATTR_ bits as stored in the directory entry
+	bool isDirectory;
+	uint32_t size;		   // bytes in the file, 0 for directories
+	uint32_t firstCluster; // first cluster of the file or directory, 0 for an empty file
+	int64_t created;	   // seconds since the epoch, FAT does not record a time zone so these are read as UTC
+	int64_t modified;
+	int64_t accessed; // FAT only keeps the date, so this is midnight of that day
+} fat32Entry;
+
+/**
+ * fat32Open
+ *
+ * Opens an image and reads its boot sector and FSInfo, fat32Validate has to pass before anything can be read from it
+ * @param const char* path - path to the image file or block device
+ * @returns fat32Volume* - the volume, NULL if the image could not be opened
+ */
+FAT32_API fat32Volume *fat32Open(const char *path);
+
+/**
+ * fat32Validate
+ *
+ * Checks the boot sector, FSInfo and the first two FAT entries, and loads the FAT
+ * @param fat32Volume* handle - volume from fat32Open
+ * @returns const char* - NULL if the volume can be read, otherwise what failed
+ */
+FAT32_API const char *fat32Validate(fat32Volume *handle);
+
+/**
+ * fat32Close
+ *
+ * Closes a volume, every directory and file opened on it has to be closed first
+ * @param fat32Volume* handle - volume to close
+ * @returns void - NA
+ */
+FAT32_API void fat32Close(fat32Volume *handle);
+
+/**
+ * fat32Stat
+ *
+ * Looks up a path, each part matching either the long or the short name without regard to case
+ * @param fat32Volume* handle - validated volume
+ * @param const char* path - parts separated by /, "" or "/" is the root
+ * @param fat32Entry* entry - filled in when the path is found
+ * @returns bool - true if the path was found
+ */
+FAT32_API bool fat32Stat(fat32Volume *handle, const char *path, fat32Entry *entry);
+
+/**
+ * fat32OpenDir
+ *
+ * Starts reading a directory
+ * @param fat32Volume* handle - validated volume
+ * @param const char* path - path to the directory
+ * @returns fat32Dir* - the directory, NULL if the path is not a directory
+ */
+FAT32_API fat32Dir *fat32OpenDir(fat32Volume *handle, const char *path);
+
+/**
+ * fat32ReadDir
+ *
+ * Reads the next visible entry of a directory, dot entries, deleted entries and the volume label are skipped
+ * @param fat32Dir* dir - directory from fat32OpenDir
+ * @param fat32Entry* entry - filled in with the next entry
+ * @returns bool - false once there are no more entries
+ */
+FAT32_API bool fat32ReadDir(fat32Dir *dir, fat32Entry *entry);
+
+/**
+ * fat32CloseDir
+ *
+ * Stops reading a directory
+ * @param fat32Dir* dir - directory to close
+ * @returns void - NA
+ */
+FAT32_API void fat32CloseDir(fat32Dir *dir);
+
+/**
+ * fat32OpenFile
+ *
+ * Opens a file for reading, following its cluster chain once up front
+ * @param fat32Volume* handle - validated volume
+ * @param const char* path - path to the file
+ * @returns fat32File* - the file, NULL if the path is not a file
+ */
+FAT32_API fat32File *fat32OpenFile(fat32Volume *handle, const char *path);
+
+/**
+ * fat32Read
+ *
+ * Copies bytes of a file into a buffer like pread, without moving any file position
+ * @param fat32File* file - file from fat32OpenFile
+ * @param void* buffer - where to put the bytes
+ * @param size_t length - most bytes to read
+ * @param uint64_t offset - first byte of the file to read
+ * @returns ssize_t - bytes read, fewer than asked where the image ends early, 0 at or past the end of the file, -1 if the image could not be read
+ */
+FAT32_API ssize_t fat32Read(fat32File *file, void *buffer, size_t length, uint64_t offset);
+
+/**
+ * fat32CloseFile
+ *
+ * Closes a file
+ * @param fat32File* file - file to close
+ * @returns void - NA
+ */
+FAT32_API void fat32CloseFile(fat32File *file);
+
+#endif